@@ -34,12 +34,14 @@ static inline uint64_t pt_index(uint64_t virt) {
 }
 
 //get or create a table at an entry
+//the only huge entries ever walked through are 1GB HHDM pages, a mapping that
+//lands inside one (the framebuffer) splits it into 2MB pages first
 static EFI_STATUS get_or_create_table(
     EFI_BOOT_SERVICES *bs,
     page_entry_t *entry,
     page_entry_t **child
 ) {
-    if (*entry & PTE_PRESENT) {
+    if ((*entry & PTE_PRESENT) && !(*entry & PTE_HUGE)) {
         *child = (page_entry_t *)(*entry & PTE_ADDR_MASK);
         return EFI_SUCCESS;
     }
@@ -49,10 +51,53 @@ static EFI_STATUS get_or_create_table(
         return status;
     }
     
+    if (*entry & PTE_PRESENT) {
+        uint64_t base = *entry & PTE_ADDR_MASK & ~(PAGE_SIZE_1G - 1);
+        uint64_t flags = *entry & ~PTE_ADDR_MASK;
+        for (int i = 0; i < 512; i++) {
+            (*child)[i] = (base + (uint64_t)i * PAGE_SIZE_2M) | flags;
+        }
+    }
+    
     *entry = (uint64_t)*child | PTE_PRESENT | PTE_WRITABLE;
     return EFI_SUCCESS;
 }
 
+//CPUID 0x80000001 EDX bit 26: 1GB pages in the PDPT
+static int cpu_has_1gb_pages(void) {
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000000));
+    if (eax < 0x80000001) return 0;
+    __asm__ volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000001));
+    return (edx >> 26) & 1;
+}
+
+//RAM types are the only ones safe to cover with a write-back 1GB page
+static int is_ram_type(UINT32 type) {
+    return type == EfiLoaderCode || type == EfiLoaderData ||
+           type == EfiBootServicesCode || type == EfiBootServicesData ||
+           type == EfiConventionalMemory;
+}
+
+//map a 1GB region: virt -> phys, fails if part of it is already mapped finer
+static EFI_STATUS paging_map_1gb(
+    EFI_BOOT_SERVICES *bs,
+    page_tables_t *pt,
+    uint64_t virt,
+    uint64_t phys,
+    uint64_t flags
+) {
+    page_entry_t *pdpt;
+    EFI_STATUS status = get_or_create_table(bs, &pt->pml4[pml4_index(virt)], &pdpt);
+    if (EFI_ERROR(status)) return status;
+    
+    page_entry_t *entry = &pdpt[pdpt_index(virt)];
+    if ((*entry & PTE_PRESENT) && !(*entry & PTE_HUGE)) return EFI_UNSUPPORTED;
+    
+    *entry = (phys & ~(PAGE_SIZE_1G - 1)) | flags | PTE_HUGE | PTE_PRESENT;
+    return EFI_SUCCESS;
+}
+
 EFI_STATUS paging_init(EFI_BOOT_SERVICES *bs, page_tables_t *pt) {
     EFI_STATUS status;
     
@@ -174,6 +219,7 @@ EFI_STATUS paging_map_hhdm(
     EFI_STATUS status;
     UINTN entry_count = mmap_size / desc_size;
     uint8_t *ptr = (uint8_t *)mmap;
+    int use_1gb = cpu_has_1gb_pages();
     
     for (UINTN i = 0; i < entry_count; i++) {
         EFI_MEMORY_DESCRIPTOR *desc = (EFI_MEMORY_DESCRIPTOR *)ptr;
@@ -191,10 +237,21 @@ EFI_STATUS paging_map_hhdm(
         uint64_t map_start = start & ~(PAGE_SIZE_2M - 1);
         uint64_t map_end = (end + PAGE_SIZE_2M - 1) & ~(PAGE_SIZE_2M - 1);
         
-        for (uint64_t addr = map_start; addr < map_end; addr += PAGE_SIZE_2M) {
+        uint64_t addr = map_start;
+        while (addr < map_end) {
             uint64_t virt = HHDM_OFFSET + addr;
+            
+            //whole gigabytes of RAM take a single PDPT entry (fewer TLB misses on the HHDM)
+            if (use_1gb && is_ram_type(desc->Type) && !(addr & (PAGE_SIZE_1G - 1)) &&
+                addr >= start && end - addr >= PAGE_SIZE_1G &&
+                paging_map_1gb(bs, pt, virt, addr, PTE_WRITABLE) == EFI_SUCCESS) {
+                addr += PAGE_SIZE_1G;
+                continue;
+            }
+            
             status = paging_map_2mb(bs, pt, virt, addr, PTE_WRITABLE);
             if (EFI_ERROR(status)) return status;
+            addr += PAGE_SIZE_2M;
         }
         
         ptr += desc_size;
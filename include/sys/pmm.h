@@ -0,0 +1,14 @@
+#ifndef SYS_PMM_H
+#define SYS_PMM_H
+
+/*
+ *physical page allocator constants shared with userspace
+ *
+ *the kernel's pmm_stats_t and the libc copy read through OBJ_INFO_PMM_STATS
+ *size their per-order arrays from these so the layouts can't drift apart
+ */
+
+//largest buddy block is 2^PMM_MAX_ORDER pages (4MB)
+#define PMM_MAX_ORDER  10
+
+#endif
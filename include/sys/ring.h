@@ -0,0 +1,48 @@
+#ifndef SYS_RING_H
+#define SYS_RING_H
+
+/*
+ *shared memory ring channels
+ *
+ *a ring channel is a normal channel pair plus one VMO that both endpoints
+ *map. the VMO holds a page of control state followed by two single-producer
+ *single-consumer byte rings, dir[i] carrying records TO endpoint i
+ *
+ *records are a uint32 length followed by the payload padded to 4 bytes,
+ *copied in and out with wraparound. head/tail are free-running byte counts
+ *so head - tail is the fill level. the kernel is only entered to sleep or
+ *wake on the *_waiting words (futexes) and to flag a closed endpoint
+ *
+ *uses uint32 from the includer's types header (kernel or libc)
+ */
+
+#define RING_MAGIC          0x474E4952  //"RING"
+#define RING_MIN_SIZE       4096
+#define RING_DEFAULT_SIZE   65536
+#define RING_MAX_SIZE       (16 * 1024 * 1024)
+#define RING_CTRL_SIZE      4096        //control page before the data rings
+#define RING_RECORD_HDR     4
+
+//one direction, producer and consumer fields on separate cache lines
+typedef struct {
+    volatile uint32 head;               //bytes ever published by the producer
+    volatile uint32 consumer_waiting;   //1 while the consumer is (about to be) asleep
+    uint32 _pad0[14];
+    volatile uint32 tail;               //bytes ever consumed
+    volatile uint32 producer_waiting;   //1 while the producer waits for space
+    uint32 _pad1[14];
+} ring_dir_t;
+
+typedef struct {
+    uint32 magic;
+    uint32 ring_size;           //data bytes per direction, power of two
+    volatile uint32 closed;     //bit n set by the kernel once endpoint n closes
+    uint32 _reserved[13];
+    ring_dir_t dir[2];
+} ring_ctrl_t;
+
+//byte offset of dir[i]'s data within the VMO
+#define RING_DATA_OFFSET(ring_size, i)  (RING_CTRL_SIZE + (i) * (ring_size))
+#define RING_VMO_SIZE(ring_size)        (RING_CTRL_SIZE + 2 * (ring_size))
+
+#endif
@@ -11,6 +11,10 @@
 #define SYS_PROCESS_CREATE  50  //create suspended process, returns handle
 #define SYS_HANDLE_GRANT    51  //inject handle into child process
 #define SYS_PROCESS_START   52  //start initial thread in process
+#define SYS_THREAD_CREATE   90  //start another thread in the calling process
+#define SYS_THREAD_EXIT     91  //terminate the calling thread only
+#define SYS_THREAD_JOIN     92  //wait for a thread handle to exit
+#define SYS_THREAD_SET_TLS  93  //set the calling thread's TLS base (FS on amd64)
 
 //object/handle management
 #define SYS_GET_OBJ         5   //get object from namespace
@@ -25,6 +29,14 @@
 #define SYS_CHANNEL_TRY_RECV 44  //non-blocking channel receive
 #define SYS_CHANNEL_RECV_MSG 45  //receive with handles
 #define SYS_CHANNEL_TRY_RECV_MSG 46 //non-blocking recv_msg
+#define SYS_CHANNEL_CREATE_RING 94 //channel pair plus a shared SPSC ring VMO
+#define SYS_CHANNEL_RING_VMO 95 //get a handle to a ring channel's VMO
+#define SYS_CHANNEL_SEND_BATCH 96 //queue several messages in one call
+#define SYS_CHANNEL_RECV_BATCH 97 //dequeue several messages in one call
+#define SYS_CHANNEL_CALL    98  //send a request and wait for its reply
+#define SYS_CHANNEL_SEND_REPLY 101 //answer a channel_call with its txid
+#define SYS_FUTEX_WAIT      88  //sleep while a user word holds an expected value
+#define SYS_FUTEX_WAKE      89  //wake threads sleeping on a user word
 
 //memory: vmos
 #define SYS_VMO_CREATE      37
@@ -33,6 +45,8 @@
 #define SYS_VMO_MAP         40  //map vmo into address space
 #define SYS_VMO_UNMAP       41  //unmap from address space
 #define SYS_VMO_RESIZE      53  //resize a vmo
+#define SYS_VMO_CREATE_CHILD 99 //copy-on-write child of a vmo
+#define SYS_VMO_DECOMMIT    100 //give a range of committed pages back
 
 //filesystem, context, and process events
 #define SYS_STAT            43  //get file status by path
@@ -62,11 +76,15 @@
 //misc/system
 #define SYS_DEBUG_WRITE     3
 #define SYS_GET_TICKS       57  //get timer ticks since boot
+#define SYS_CLOCK_NS        102 //get monotonic nanoseconds since boot
+#define SYS_SLEEP           85  //block the calling thread for milliseconds
+#define SYS_NANOSLEEP       86  //block the calling thread for nanoseconds
 #define SYS_REBOOT          61  //reboot the system
 #define SYS_SHUTDOWN        62  //shutdown the system
 
 //object info
 #define SYS_OBJECT_GET_INFO 63
+#define SYS_OBJECT_WAIT_MANY 87 //block until any of N handles has a signal asserted
 
 //networking
 #define SYS_PING            64  //send ICMP ping and wait for reply
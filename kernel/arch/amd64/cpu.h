@@ -6,6 +6,9 @@
 //kernel stack for ring transitions (wraps TSS RSP0)
 void arch_set_kernel_stack(void *stack_top);
 
+//user thread pointer (wraps IA32_FS_BASE)
+void arch_set_tls_base(uintptr base);
+
 
 //MI interface implementations
 uint32 arch_cpu_index(void);
@@ -19,6 +22,17 @@ static inline void arch_idle(void) {
     __asm__ volatile ("sti; hlt");
 }
 
+//CPUs with a TLB shootdown waiting for them (see mmu.c)
+extern volatile uint64 arch_tlb_pending;
+void arch_tlb_service(void);
+
+//spin loop body: a CPU spinning with interrupts off still has to answer
+//shootdowns or the CPU holding what it waits for may be waiting on it
+static inline void arch_spin_relax(void) {
+    __asm__ volatile ("pause");
+    if (arch_tlb_pending) arch_tlb_service();
+}
+
 static inline void arch_pause(void) {
     __asm__ volatile ("pause");
 }
@@ -64,6 +78,14 @@ static inline void arch_irq_restore(irq_state_t flags) {
     __asm__ volatile ("push %0; popfq" :: "r"(flags) : "memory");
 }
 
+//true when maskable interrupts are enabled (RFLAGS.IF)
+static inline bool arch_irq_enabled(void) {
+    uint64 flags;
+    __asm__ volatile ("pushfq; pop %0" : "=r"(flags) :: "memory");
+    return (flags & (1 << 9)) != 0;
+}
+
 void arch_string_init(void);
+void arch_page_zero_nt(void *page);
 
 #endif
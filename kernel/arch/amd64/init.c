@@ -60,6 +60,9 @@ void arch_init(struct db_boot_info *boot_info) {
             } else if (strcmp(arg, "nox2apic") == 0) {
                 apic_set_force_x2apic_disabled(true);
                 printf("[amd64] x2APIC disabled via command line\n");
+            } else if (strcmp(arg, "notickless") == 0) {
+                apic_set_force_periodic_timer(true);
+                printf("[amd64] periodic timer forced via command line\n");
             } else if (strcmp(arg, "nointremap") == 0 || strcmp(arg, "noiommu") == 0) {
                 iommu_set_force_disable(true);
                 printf("[amd64] interrupt remapping disabled via command line\n");
@@ -76,6 +79,8 @@ void arch_init(struct db_boot_info *boot_info) {
     
     //initialize per-CPU data early
     percpu_init();
+    kheap_init_percpu();
+    pmm_init_percpu();
     
     proc_init();
     
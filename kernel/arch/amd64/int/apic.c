@@ -20,6 +20,13 @@ static uint64 apic_base_phys = 0;
 static volatile uint32 *apic_base_virt = NULL;
 bool x2apic_enabled = false;
 
+//timer state shared by all CPUs (every LAPIC runs off the same bus clock)
+static bool force_periodic_timer = false;
+static bool timer_oneshot = false;       //LAPIC timers are programmed per deadline
+static bool timer_tsc_deadline = false;  //one-shot uses IA32_TSC_DEADLINE instead of the count
+static uint64 apic_timer_hz = 0;         //LAPIC timer counts per second (divide by 16)
+static uint64 tsc_hz = 0;                //TSC ticks per second (0 if uncalibrated)
+
 void apic_write(uint32 reg, uint32 val) {
     if (x2apic_enabled) {
         wrmsr(MSR_X2APIC_BASE + (reg >> 4), val);
@@ -44,6 +51,16 @@ bool apic_is_supported(void) {
     return (edx & (1 << 9)) != 0;
 }
 
+//invariant TSC (CPUID 0x80000007 EDX bit 8) ticks at a constant rate through
+//P-state and C-state changes, without it TSC-deadline interrupts can drift or stall
+static bool apic_tsc_invariant(void) {
+    uint32 eax, ebx, ecx, edx;
+    arch_cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000007) return false;
+    arch_cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+    return (edx & (1 << 8)) != 0;
+}
+
 uint32 apic_get_id(void) {
     percpu_t *cpu = percpu_get();
     if (!apic_available && cpu) {
@@ -63,6 +80,10 @@ void apic_set_force_x2apic_disabled(bool force) {
     force_disable_x2apic = force;
 }
 
+void apic_set_force_periodic_timer(bool force) {
+    force_periodic_timer = force;
+}
+
 bool apic_init(void) {
     serial_write("[apic] Initializing...\n");
     
@@ -251,6 +272,7 @@ void apic_timer_init(uint32 hz) {
 
     //start APIC timer counting down from max
     apic_write(APIC_TIMER_ICR, 0xFFFFFFFF);
+    uint64 tsc_start = arch_rdtsc();
 
     //poll PIT until it wraps/hits 0
     uint8 lo, hi;
@@ -264,6 +286,36 @@ void apic_timer_init(uint32 hz) {
 
     //read APIC timer remaining count
     uint32 delta = 0xFFFFFFFF - apic_read(APIC_TIMER_CCR);
+    uint64 tsc_delta = arch_rdtsc() - tsc_start;
+
+    //the first (BSP) calibration decides the timer mode for every CPU
+    if (apic_timer_hz == 0) {
+        apic_timer_hz = (uint64)delta * 100;
+        tsc_hz = tsc_delta * 100;
+
+        uint32 eax, ebx, ecx, edx;
+        arch_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+        timer_oneshot = !force_periodic_timer && tsc_hz != 0 && apic_timer_hz != 0;
+        //a non-invariant TSC only measures the delta at arm time, the LAPIC
+        //count does the actual waiting
+        timer_tsc_deadline = timer_oneshot && (ecx & (1 << 24)) && apic_tsc_invariant();
+    }
+
+    if (timer_oneshot) {
+        //one-shot (or TSC-deadline) mode: the MI timer code arms the next
+        //deadline after every interrupt so idle CPUs can stop ticking
+        apic_write(APIC_TIMER_DCR, 0x03);
+        if (timer_tsc_deadline) {
+            apic_write(APIC_LVT_TIMER, APIC_TIMER_VECTOR | APIC_TIMER_TSC_DEADLINE);
+        } else {
+            apic_write(APIC_LVT_TIMER, APIC_TIMER_VECTOR);
+        }
+        apic_timer_arm(arch_rdtsc() + tsc_hz / hz);
+
+        printf("[apic] timer %s @ %u Hz tick (tsc %lu Hz)\n",
+               timer_tsc_deadline ? "tsc-deadline" : "one-shot", hz, tsc_hz);
+        return;
+    }
 
     //setup periodic timer
     //vector 32 is IRQ 0 handler in DeltaOS
@@ -273,3 +325,30 @@ void apic_timer_init(uint32 hz) {
 
     printf("[apic] timer periodic @ %u Hz (ticks per int: %u)\n", hz, (delta * 100) / hz);
 }
+
+bool apic_timer_is_oneshot(void) {
+    return apic_available && timer_oneshot;
+}
+
+uint64 apic_tsc_hz(void) {
+    return tsc_hz;
+}
+
+void apic_timer_arm(uint64 tsc_deadline) {
+    if (!timer_oneshot) return;
+
+    if (timer_tsc_deadline) {
+        //a deadline already in the past fires immediately
+        wrmsr(MSR_TSC_DEADLINE, tsc_deadline ? tsc_deadline : 1);
+        return;
+    }
+
+    //convert the remaining TSC delta to LAPIC timer counts
+    uint64 now = arch_rdtsc();
+    uint64 delta = tsc_deadline > now ? tsc_deadline - now : 0;
+    uint64 counts = (delta / tsc_hz) * apic_timer_hz +
+                    ((delta % tsc_hz) * apic_timer_hz) / tsc_hz;
+    if (counts == 0) counts = 1;
+    if (counts > 0xFFFFFFFF) counts = 0xFFFFFFFF;
+    apic_write(APIC_TIMER_ICR, (uint32)counts);
+}
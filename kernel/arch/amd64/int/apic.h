@@ -27,6 +27,7 @@
 
 //LVT timer bits
 #define APIC_TIMER_PERIODIC     (1 << 17)
+#define APIC_TIMER_TSC_DEADLINE (2 << 17)
 #define APIC_TIMER_MASKED       (1 << 16)
 
 //timer divide values
@@ -45,6 +46,7 @@
 #define APIC_BASE_X2APIC_ENABLE (1 << 10)
 
 #define MSR_X2APIC_BASE         0x800
+#define MSR_TSC_DEADLINE        0x6E0
 
 //default vectors
 #define APIC_SPURIOUS_VECTOR    0xFF
@@ -63,6 +65,10 @@ uint32 apic_read(uint32 reg);
 void apic_write(uint32 reg, uint32 val);
 void apic_init_ap(void);
 void apic_timer_init(uint32 hz);
+void apic_set_force_periodic_timer(bool force);
+bool apic_timer_is_oneshot(void);
+uint64 apic_tsc_hz(void);
+void apic_timer_arm(uint64 tsc_deadline);
 void apic_wait_icr_idle(void);
 void apic_send_ipi(uint32 apic_id, uint8 vector);
 void apic_send_init_ipi(uint32 apic_id);
@@ -7,6 +7,7 @@
 #include <mm/kheap.h>
 #include <arch/io.h>
 
+#define IA32_FS_BASE        0xC0000100
 #define IA32_GS_BASE        0xC0000101
 #define IA32_KERNEL_GS_BASE 0xC0000102
 
@@ -240,3 +241,11 @@ void arch_set_kernel_stack(void *stack_top) {
     percpu_set_kernel_stack(stack_top);
 }
 
+//set FS base for the thread about to run (userspace TLS pointer)
+void arch_set_tls_base(uintptr base) {
+    percpu_t *cpu = percpu_get();
+    if (cpu && cpu->tls_base == base) return;
+    wrmsr(IA32_FS_BASE, base);
+    if (cpu) cpu->tls_base = base;
+}
+
@@ -17,7 +17,9 @@
 #include <arch/smp.h>
 #include <arch/fpu.h>
 #include <mm/kheap.h>
+#include <mm/vmm.h>
 #include <proc/sched.h>
+#include <proc/ktimer.h>
 #include <proc/process.h>
 #include <proc/thread.h>
 #include <proc/event.h>
@@ -179,7 +181,13 @@ static void irq0_handler(int from_usermode) {
         pic_send_eoi(0);
     }
 
-    sched_tick(from_usermode);  //preemptive scheduling - only preempt if from usermode
+    //one-shot timers also fire for kernel timer deadlines between ticks
+    if (ktimer_run_expired()) {
+        sched_tick(from_usermode);  //preemptive scheduling - only preempt if from usermode
+    }
+
+    //arm the next tick, or the next deadline if this CPU is now idle
+    ktimer_reprogram();
 }
 
 void interrupt_handler(uint64 vector, uint64 error_code, uint64 rip, interrupt_frame_t *frame) {
@@ -188,9 +196,21 @@ void interrupt_handler(uint64 vector, uint64 error_code, uint64 rip, interrupt_f
             return;
         }
 
-        //check for safe-copy recovery
         if (vector == PAGE_FAULT_VECTOR) {
+            //demand paging: faults on user addresses are resolved against the
+            //process VMAs first, including kernel accesses during syscalls
+            uint32 access = 0;
+            if (error_code & 1) access |= VMM_FAULT_PRESENT;
+            if (error_code & 2) access |= VMM_FAULT_WRITE;
+            if (error_code & 4) access |= VMM_FAULT_USER;
+            if (error_code & 16) access |= VMM_FAULT_EXEC;
+            process_t *fp = process_current();
             percpu_t *cpu = percpu_get();
+            if (fp && !cpu->user_nofault && vmm_handle_fault(fp, arch_read_cr2(), access) == 0) {
+                return;
+            }
+
+            //check for safe-copy recovery
             if (cpu->recovery_rip != 0) {
                 frame->rip = cpu->recovery_rip;
                 cpu->recovery_rip = 0;
@@ -227,6 +247,12 @@ void interrupt_handler(uint64 vector, uint64 error_code, uint64 rip, interrupt_f
         //check if we were interrupted from usermode using CS.RPL (authoritative)
         int from_usermode = ((frame->cs & 3) == 3) ? 1 : 0;
 
+        if (vector == IPI_TLB_SHOOTDOWN) {
+            arch_tlb_service();
+            apic_send_eoi();
+            return;
+        }
+
         if (vector == IPI_RESCHEDULE) {
             if (apic_is_enabled() && ioapic_is_enabled()) {
                 apic_send_eoi();
@@ -1,5 +1,6 @@
 #include <arch/amd64/types.h>
 #include <arch/amd64/io.h>
+#include <arch/amd64/cpu.h>
 #include <arch/amd64/interrupts.h>
 #include <net/net.h>
 #include <lib/io.h>
@@ -9,8 +10,11 @@
 #define PIT_CH0   0x40
 #define PIT_BASE  1193182U
 
+#define NS_PER_SEC 1000000000ULL
+
 static volatile uint64 timer_ticks = 0;
 volatile uint32 timer_freq = 0;
+static uint64 tsc_base = 0;     //TSC value when the tick clock started
 #include <arch/percpu.h>
 
 void arch_timer_tick(void) {
@@ -21,10 +25,37 @@ void arch_timer_tick(void) {
     net_poll();
 }
 
+uint64 arch_timer_get_ns(void) {
+    uint64 hz = apic_tsc_hz();
+    if (hz && tsc_base) {
+        //split the division so the multiply cannot overflow
+        uint64 tsc = arch_rdtsc() - tsc_base;
+        return (tsc / hz) * NS_PER_SEC + ((tsc % hz) * NS_PER_SEC) / hz;
+    }
+    if (timer_freq == 0) return 0;
+    return timer_ticks * (NS_PER_SEC / timer_freq);
+}
+
 uint64 arch_timer_get_ticks(void) {
+    //one-shot CPUs skip ticks while idle so derive the count from the TSC
+    if (apic_timer_is_oneshot() && timer_freq) {
+        return arch_timer_get_ns() / (NS_PER_SEC / timer_freq);
+    }
     return timer_ticks;
 }
 
+bool arch_timer_is_tickless(void) {
+    return apic_timer_is_oneshot();
+}
+
+void arch_timer_program(uint64 deadline_ns) {
+    if (!apic_timer_is_oneshot()) return;
+
+    uint64 hz = apic_tsc_hz();
+    uint64 tsc = (deadline_ns / NS_PER_SEC) * hz + ((deadline_ns % NS_PER_SEC) * hz) / NS_PER_SEC;
+    apic_timer_arm(tsc_base + tsc);
+}
+
 void arch_timer_setfreq(uint32 hz) {
     if (hz == 0) return;
     timer_freq = hz;
@@ -45,6 +76,7 @@ void arch_timer_init(uint32 hz) {
     if (apic_is_enabled()) {
         timer_freq = hz;
         apic_timer_init(hz);
+        tsc_base = arch_rdtsc();
     } else {
         printf("[pit] initializing @ %u Hz...\n", hz);
         arch_timer_setfreq(hz);
@@ -1,10 +1,17 @@
 #include <arch/amd64/mmu.h>
+#include <arch/amd64/cpu.h>
+#include <arch/amd64/percpu.h>
+#include <arch/amd64/int/apic.h>
+#include <arch/smp.h>
 #include <mm/pmm.h>
 #include <mm/mm.h>
 #include <lib/string.h>
+#include <lib/spinlock.h>
 #include <lib/io.h>
 
 static pagemap_t kernel_pagemap;
+static bool mmu_pcid_enabled;
+static uint64 next_ctx_id = 1;
 
 static uintptr mmu_read_cr3(void) {
     uintptr cr3;
@@ -12,19 +19,170 @@ static uintptr mmu_read_cr3(void) {
     return cr3;
 }
 
+static uint64 mmu_read_cr4(void) {
+    uint64 cr4;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static void mmu_write_cr4(uint64 cr4) {
+    __asm__ volatile ("mov %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
+//the bootloader may hand the BSP over without WP, APs get it in the trampoline
+//copy-on-write relies on kernel writes to user pages faulting too
+static void mmu_init_cr0(void) {
+    uint64 cr0;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+    if (cr0 & AMD64_CR0_WP) return;
+    __asm__ volatile ("mov %0, %%cr0" :: "r"(cr0 | AMD64_CR0_WP) : "memory");
+}
+
 static bool mmu_is_current_pagemap(pagemap_t *map) {
-    return map && map->top_level == mmu_read_cr3();
+    return map && map->top_level == (mmu_read_cr3() & AMD64_PTE_ADDR_MASK);
 }
 
+//drops the non-global entries of the loaded PCID
 static void mmu_flush_current_tlb(void) {
     uintptr cr3 = mmu_read_cr3();
     __asm__ volatile ("mov %0, %%cr3" :: "r"(cr3) : "memory");
 }
 
+//kernel mappings are global so they survive CR3 loads and invlpg drops them
+//from every PCID, toggling PGE is the only way to flush all of them at once
+static void mmu_flush_all_tlb(void) {
+    uint64 cr4 = mmu_read_cr4();
+    mmu_write_cr4(cr4 & ~AMD64_CR4_PGE);
+    mmu_write_cr4(cr4);
+}
+
+/*
+ *TLB shootdown
+ *
+ *page table changes are collected in a mmu_tlb_batch_t and flushed in one
+ *round: the local CPU invalidates directly and every other CPU that has the
+ *pagemap loaded (every online CPU for the shared kernel half) gets an IPI.
+ *one request is in flight at a time, the initiator publishes it, sets the
+ *target bits in arch_tlb_pending and spins until all of them are cleared
+*/
+volatile uint64 arch_tlb_pending;
+static volatile uint64 tlb_online_cpus;
+static spinlock_t tlb_lock = SPINLOCK_INIT;
+static mmu_tlb_batch_t tlb_request;
+static bool tlb_request_kernel;
+
+static void mmu_tlb_apply(mmu_tlb_batch_t *batch, bool kernel) {
+    //a CPU that switched away from a user pagemap sees the new tlb_gen and
+    //flushes that PCID when it loads the pagemap again
+    if (!kernel && !mmu_is_current_pagemap(batch->map)) return;
+
+    if (batch->full) {
+        if (kernel) mmu_flush_all_tlb();
+        else mmu_flush_current_tlb();
+    } else {
+        for (uint32 i = 0; i < batch->count; i++) {
+            __asm__ volatile ("invlpg (%0)" :: "r"(batch->addrs[i]) : "memory");
+        }
+    }
+
+    //the loaded PCID is now current up to this flush
+    if (!kernel && mmu_pcid_enabled) {
+        percpu_t *cpu = percpu_get();
+        uint32 slot = cpu->pcid_slot;
+        if (cpu->pcid_ctx[slot] == batch->map->ctx_id && cpu->pcid_gen[slot] < batch->gen) {
+            cpu->pcid_gen[slot] = batch->gen;
+        }
+    }
+}
+
+void arch_tlb_service(void) {
+    uint64 bit = 1ULL << percpu_get()->cpu_index;
+    if (!(__atomic_load_n(&arch_tlb_pending, __ATOMIC_ACQUIRE) & bit)) return;
+
+    mmu_tlb_apply(&tlb_request, tlb_request_kernel);
+    __atomic_and_fetch(&arch_tlb_pending, ~bit, __ATOMIC_RELEASE);
+}
+
+void mmu_tlb_cpu_online(uint32 cpu_index) {
+    __atomic_or_fetch(&tlb_online_cpus, 1ULL << cpu_index, __ATOMIC_SEQ_CST);
+    //drop anything cached before we started receiving shootdowns
+    mmu_flush_all_tlb();
+}
+
+void mmu_tlb_batch_init(mmu_tlb_batch_t *batch, pagemap_t *map) {
+    batch->map = map;
+    batch->count = 0;
+    batch->full = false;
+    batch->gen = 0;
+    batch->ntables = 0;
+}
+
+static void mmu_tlb_batch_add(mmu_tlb_batch_t *batch, uintptr virt) {
+    if (batch->full) return;
+    if (batch->count == MMU_TLB_BATCH_MAX) {
+        batch->full = true;
+        return;
+    }
+    batch->addrs[batch->count++] = virt;
+}
+
+void mmu_tlb_batch_flush(mmu_tlb_batch_t *batch) {
+    if (!batch->full && batch->count == 0) return;
+    bool kernel = batch->map == &kernel_pagemap;
+
+    //interrupts stay off so a handler on this CPU cannot start a second round
+    irq_state_t flags = arch_irq_save();
+    //PCIDs of this pagemap that are not loaded anywhere go stale right here
+    if (!kernel) batch->gen = __atomic_add_fetch(&batch->map->tlb_gen, 1, __ATOMIC_SEQ_CST);
+    mmu_tlb_apply(batch, kernel);
+
+    //page table writes must be visible before we sample who uses the pagemap
+    arch_mb();
+    uint64 online = tlb_online_cpus;
+    if (online) {
+        uint64 targets = kernel ? online : (batch->map->active_cpus & online);
+        targets &= ~(1ULL << percpu_get()->cpu_index);
+
+        if (targets) {
+            spinlock_acquire(&tlb_lock);
+            tlb_request = *batch;
+            tlb_request_kernel = kernel;
+            __atomic_or_fetch(&arch_tlb_pending, targets, __ATOMIC_SEQ_CST);
+            for (uint32 cpu = 0; cpu < MAX_CPUS; cpu++) {
+                if (targets & (1ULL << cpu)) {
+                    apic_send_ipi(percpu_get_by_index(cpu)->apic_id, IPI_TLB_SHOOTDOWN);
+                }
+            }
+            while (__atomic_load_n(&arch_tlb_pending, __ATOMIC_ACQUIRE) & targets) {
+                arch_pause();
+            }
+            spinlock_release(&tlb_lock);
+        }
+    }
+    arch_irq_restore(flags);
+
+    batch->count = 0;
+    batch->full = false;
+
+    //no CPU can still be walking an unlinked table once the round is done
+    for (uint32 t = 0; t < batch->ntables; t++) {
+        pmm_free((void *)batch->tables[t], 1);
+    }
+    batch->ntables = 0;
+}
+
+//free a page table that was just unlinked once every CPU has dropped it
+//from its paging-structure caches
+static void mmu_tlb_batch_free_table(mmu_tlb_batch_t *batch, uintptr phys) {
+    batch->full = true;
+    if (batch->ntables == MMU_TLB_BATCH_TABLES) mmu_tlb_batch_flush(batch);
+    batch->tables[batch->ntables++] = phys;
+}
+
 pagemap_t *mmu_get_kernel_pagemap(void) {
     if (kernel_pagemap.top_level == 0) {
         //retrieve current PML4 from CR3 on first call
-        kernel_pagemap.top_level = mmu_read_cr3();
+        kernel_pagemap.top_level = mmu_read_cr3() & AMD64_PTE_ADDR_MASK;
     }
     return &kernel_pagemap;
 }
@@ -63,8 +221,72 @@ static void mmu_init_pat(void) {
     mmu_write_msr(MSR_IA32_PAT, pat);
 }
 
+//the bootloader maps whole gigabytes of RAM in the HHDM with 1GB entries
+//a finer mapping inside one first turns it into a PD of 2MB entries, which
+//keep the same flags (the PAT bit sits at bit 12 for both sizes)
+//those PDPs belong to the kernel half that every pagemap shares, so splits are
+//serialised by one lock of their own rather than by any single address space
+static spinlock_t split_lock = SPINLOCK_INIT;
+
+static int split_huge_pdp(mmu_tlb_batch_t *batch, uint64 *pdp, uint32 index, uintptr virt) {
+    uint64 entry = __atomic_load_n(&pdp[index], __ATOMIC_ACQUIRE);
+    if (!(entry & AMD64_PTE_PRESENT) || !(entry & AMD64_PTE_HUGE)) return 0;
+
+    void *pd_phys = pmm_alloc(1);
+    if (!pd_phys) return -1;
+
+    //someone else may have split it while we were allocating
+    spinlock_acquire(&split_lock);
+    entry = pdp[index];
+    if (!(entry & AMD64_PTE_PRESENT) || !(entry & AMD64_PTE_HUGE)) {
+        spinlock_release(&split_lock);
+        pmm_free(pd_phys, 1);
+        return 0;
+    }
+    uint64 *pd = (uint64 *)P2V(pd_phys);
+    uintptr base = entry & AMD64_PTE_ADDR_MASK & ~(uintptr)0x3FFFFFFF;
+    uint64 flags = entry & (~AMD64_PTE_ADDR_MASK | (1ULL << 12));
+    for (int i = 0; i < 512; i++) {
+        pd[i] = (base + (uintptr)i * 0x200000) | flags;
+    }
+    __atomic_store_n(&pdp[index], (uintptr)pd_phys | AMD64_PTE_PRESENT | AMD64_PTE_WRITE |
+                     (entry & AMD64_PTE_USER), __ATOMIC_RELEASE);
+    spinlock_release(&split_lock);
+
+    //the translations match but a CPU must not keep the 1GB entry cached next
+    //to the 2MB ones, every CPU drops it with the batch (or right away if the
+    //batch only reaches the CPUs of one user pagemap)
+    uintptr gb = virt & ~(uintptr)0x3FFFFFFF;
+    if (batch->map == &kernel_pagemap) {
+        mmu_tlb_batch_add(batch, gb);
+    } else {
+        mmu_tlb_batch_t kbatch;
+        mmu_tlb_batch_init(&kbatch, &kernel_pagemap);
+        mmu_tlb_batch_add(&kbatch, gb);
+        mmu_tlb_batch_flush(&kbatch);
+    }
+    return 0;
+}
+
+//global kernel pages everywhere, PCIDs if the boot CPU decided to use them
+//every CPU is assumed to support what the boot CPU does
+static void mmu_init_cr4(void) {
+    uint64 cr4 = mmu_read_cr4() | AMD64_CR4_PGE;
+    if (mmu_pcid_enabled) cr4 |= AMD64_CR4_PCIDE;
+    mmu_write_cr4(cr4);
+    mmu_flush_all_tlb();
+}
+
 void mmu_init(void) {
     mmu_init_pat();
+    mmu_init_cr0();
+
+    //PCIDE can only be turned on while CR3 names PCID 0
+    uint32 eax, ebx, ecx, edx;
+    arch_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    mmu_pcid_enabled = (ecx & (1 << 17)) && (mmu_read_cr3() & 0xFFF) == 0;
+    mmu_init_cr4();
+    printf("[mmu] PCID %s\n", mmu_pcid_enabled ? "enabled" : "unsupported");
     
     pagemap_t *map = mmu_get_kernel_pagemap();
     uint64 *pml4 = (uint64 *)P2V(map->top_level);
@@ -74,6 +296,10 @@ void mmu_init(void) {
     }
 }
 
+void mmu_init_ap(void) {
+    mmu_init_cr4();
+}
+
 static uint64 *get_next_level(uint64 *current_table, uint32 index, bool allocate, bool user) {
     uint64 entry = current_table[index];
     if (entry & AMD64_PTE_PRESENT) {
@@ -90,11 +316,10 @@ static uint64 *get_next_level(uint64 *current_table, uint32 index, bool allocate
     if (!allocate) return NULL;
 
     //allocate a new page for the next level table
-    void *next_table_phys = pmm_alloc(1);
+    void *next_table_phys = pmm_alloc_zeroed();
     if (!next_table_phys) return NULL;
 
     uint64 *next_table_virt = (uint64 *)P2V(next_table_phys);
-    memset(next_table_virt, 0, PAGE_SIZE);
 
     //set entry in current table to point to new table
     //we set all permissions here as actual permissions are enforced in the leaf PTE
@@ -149,130 +374,166 @@ void mmu_debug_walk(pagemap_t *map, uintptr virt, const char *label) {
 }
 
 void mmu_map_range(pagemap_t *map, uintptr virt, uintptr phys, size pages, uint64 flags) {
-    uint64 *pml4 = (uint64 *)P2V(map->top_level);
+    //only entries that were already present can be cached anywhere
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, map);
+    mmu_map_range_batch(&batch, virt, phys, pages, flags);
+    mmu_tlb_batch_flush(&batch);
+
+#ifdef MMU_DEBUG_VERIFY_MAPS
+    for (size v = 0; v < pages; v++) {
+        uintptr check_virt = virt + (v * PAGE_SIZE);
+        uintptr resolved = mmu_virt_to_phys(map, check_virt);
+        if (resolved == (uintptr)-1) {
+            printf("[mmu] VERIFY FAIL: page %zu at 0x%lx not mapped!\n", v, check_virt);
+        }
+    }
+#endif
+}
+
+void mmu_map_runs(pagemap_t *map, const mmu_run_t *runs, size count, uint64 flags) {
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, map);
+    for (size r = 0; r < count; r++) {
+        if (mmu_map_range_batch(&batch, runs[r].virt, runs[r].phys, runs[r].pages, flags) < 0) break;
+    }
+    mmu_tlb_batch_flush(&batch);
+}
+
+int mmu_map_range_batch(mmu_tlb_batch_t *batch, uintptr virt, uintptr phys, size pages, uint64 flags) {
+    uint64 *pml4 = (uint64 *)P2V(batch->map->top_level);
 
     uint64 pte_flags = AMD64_PTE_PRESENT;
     if (flags & MMU_FLAG_WRITE) pte_flags |= AMD64_PTE_WRITE;
     if (flags & MMU_FLAG_USER)  pte_flags |= AMD64_PTE_USER;
     if (flags & MMU_FLAG_NOCACHE) pte_flags |= (AMD64_PTE_PCD | AMD64_PTE_PWT);
     if (!(flags & MMU_FLAG_EXEC)) pte_flags |= AMD64_PTE_NX;
+    //the kernel half is shared by every pagemap so it never needs flushing on a switch
+    if (!(flags & MMU_FLAG_USER) && virt >= HHDM_OFFSET) pte_flags |= AMD64_PTE_GLOBAL;
 
     //check for write combining
     bool is_wc = (flags & MMU_FLAG_WC) != 0;
 
+    uint64 leaf_flags = pte_flags;
+    if (is_wc) {
+        //for 4KB pages, PAT bit is bit 7 (AMD64_PTE_PAT)
+        leaf_flags |= AMD64_PTE_PAT;
+        //make sure PCD/PWT are clear
+        leaf_flags &= ~(AMD64_PTE_PCD | AMD64_PTE_PWT);
+    }
+
+    uint64 huge_flags = pte_flags | AMD64_PTE_HUGE;
+    if (is_wc) {
+        //for huge pages (2MB), PAT bit is bit 12
+        huge_flags |= (1ULL << 12);
+        //make sure PCD/PWT are clear
+        huge_flags &= ~(AMD64_PTE_PCD | AMD64_PTE_PWT);
+    }
+
     bool user = (flags & MMU_FLAG_USER) != 0;
-    bool flush_tlb = mmu_is_current_pagemap(map) || map == mmu_get_kernel_pagemap();
     //printf("[mmu] map_range virt=0x%lx phys=0x%lx pages=%zu flags=0x%lx\n", virt, phys, pages, flags);
 
+    //the PD is looked up once per 1GB and each pass below fills up to a
+    //whole page table (or one 2MB entry) before walking again
+    uint64 *pd = NULL;
+    uintptr pd_key = (uintptr)-1;
+
     size i = 0;
     while (i < pages) {
         uintptr cur_virt = virt + (i * PAGE_SIZE);
         uintptr cur_phys = phys + (i * PAGE_SIZE);
 
-        uint64 *pdp = get_next_level(pml4, PML4_IDX(cur_virt), true, user);
-        if (!pdp) {
-            //if get_next_level failed it might be because the entry is a HUGE page
-            //we treat this as a fatal error for now but in kernel space we could overwrite
-            printf("[mmu] ERR: failed to traverse PML4 index %d for 0x%lx\n", PML4_IDX(cur_virt), cur_virt);
-            return;
-        }
+        if ((cur_virt >> 30) != pd_key) {
+            uint64 *pdp = get_next_level(pml4, PML4_IDX(cur_virt), true, user);
+            if (!pdp) {
+                //if get_next_level failed it might be because the entry is a HUGE page
+                //we treat this as a fatal error for now but in kernel space we could overwrite
+                printf("[mmu] ERR: failed to traverse PML4 index %d for 0x%lx\n", PML4_IDX(cur_virt), cur_virt);
+                return -1;
+            }
 
-        uint64 *pd = get_next_level(pdp, PDP_IDX(cur_virt), true, user);
-        if (!pd) {
-            printf("[mmu] ERR: failed to traverse PDP index %d for 0x%lx\n", PDP_IDX(cur_virt), cur_virt);
-            return;
+            if (split_huge_pdp(batch, pdp, PDP_IDX(cur_virt), cur_virt) < 0) return -1;
+            pd = get_next_level(pdp, PDP_IDX(cur_virt), true, user);
+            if (!pd) {
+                printf("[mmu] ERR: failed to traverse PDP index %d for 0x%lx\n", PDP_IDX(cur_virt), cur_virt);
+                return -1;
+            }
+            pd_key = cur_virt >> 30;
         }
 
         //try to map a 2MB huge page
-        bool mapped_huge = false;
         if (pages - i >= 512 && (cur_virt % 0x200000 == 0) && (cur_phys % 0x200000 == 0)) {
             //if 4K page table already covers this range, free it before overwriting
             uint64 old_pd_entry = pd[PD_IDX(cur_virt)];
             if ((old_pd_entry & AMD64_PTE_PRESENT) && !(old_pd_entry & AMD64_PTE_HUGE)) {
-                //existing 4K page table, free it
-                pmm_free((void *)(old_pd_entry & AMD64_PTE_ADDR_MASK), 1);
+                //existing 4K page table, other CPUs may walk it until the flush
+                mmu_tlb_batch_free_table(batch, old_pd_entry & AMD64_PTE_ADDR_MASK);
+            } else if (old_pd_entry & AMD64_PTE_PRESENT) {
+                mmu_tlb_batch_add(batch, cur_virt);
             }
 
             //overwrite with huge-page entry
-            uint64 huge_flags = pte_flags | AMD64_PTE_HUGE;
-            if (is_wc) {
-                //for huge pages (2MB), PAT bit is bit 12
-                huge_flags |= (1ULL << 12);
-                //make sure PCD/PWT are clear
-                huge_flags &= ~(AMD64_PTE_PCD | AMD64_PTE_PWT);
-            }
-
             pd[PD_IDX(cur_virt)] = (cur_phys & AMD64_PTE_ADDR_MASK) | huge_flags;
             i += 512;
-            mapped_huge = true;
+            continue;
         }
 
-        if (!mapped_huge) {
-            //if the PD entry is already a HUGE page we must split/overwrite it to map a 4KB page
-            if (pd[PD_IDX(cur_virt)] & AMD64_PTE_HUGE) {
-                uint64 old_entry = pd[PD_IDX(cur_virt)];
-                uintptr base_phys = old_entry & AMD64_PTE_ADDR_MASK;
-                uint64 flags = old_entry & ~AMD64_PTE_ADDR_MASK & ~AMD64_PTE_HUGE;
-
-                //allocate a new PT
-                void *pt_phys = pmm_alloc(1);
-                if (!pt_phys) {
-                    printf("[mmu] ERR: failed to allocate PT for split\n");
-                    return;
-                }
-                uint64 *pt_virt = (uint64 *)P2V(pt_phys);
-
-                //populate the new PT with 4KB entries
-                for (int j = 0; j < 512; j++) {
-                    pt_virt[j] = (base_phys + (j * 4096)) | flags;
-                }
-
-                //update the PD entry to point to the new PT
-                pd[PD_IDX(cur_virt)] = (uintptr)pt_phys | AMD64_PTE_PRESENT | AMD64_PTE_WRITE | (user ? AMD64_PTE_USER : 0);
-            }
-
-            uint64 *pt = get_next_level(pd, PD_IDX(cur_virt), true, user);
-            if (!pt) {
-                printf("[mmu] ERR: failed to allocate PT for virt 0x%lx\n", cur_virt);
-                return;
+        //if the PD entry is already a HUGE page we must split/overwrite it to map a 4KB page
+        if (pd[PD_IDX(cur_virt)] & AMD64_PTE_HUGE) {
+            uint64 old_entry = pd[PD_IDX(cur_virt)];
+            uintptr base_phys = old_entry & AMD64_PTE_ADDR_MASK;
+            uint64 old_flags = old_entry & ~AMD64_PTE_ADDR_MASK & ~AMD64_PTE_HUGE;
+
+            //allocate a new PT
+            void *pt_phys = pmm_alloc(1);
+            if (!pt_phys) {
+                printf("[mmu] ERR: failed to allocate PT for split\n");
+                return -1;
             }
+            uint64 *pt_virt = (uint64 *)P2V(pt_phys);
 
-            uint64 leaf_flags = pte_flags;
-            if (is_wc) {
-                //for 4KB pages, PAT bit is bit 7 (AMD64_PTE_PAT)
-                leaf_flags |= AMD64_PTE_PAT;
-                //make sure PCD/PWT are clear
-                leaf_flags &= ~(AMD64_PTE_PCD | AMD64_PTE_PWT);
+            //populate the new PT with 4KB entries
+            for (int j = 0; j < 512; j++) {
+                pt_virt[j] = (base_phys + (j * 4096)) | old_flags;
             }
 
-            pt[PT_IDX(cur_virt)] = (cur_phys & AMD64_PTE_ADDR_MASK) | leaf_flags;
-            i++;
+            //update the PD entry to point to the new PT
+            pd[PD_IDX(cur_virt)] = (uintptr)pt_phys | AMD64_PTE_PRESENT | AMD64_PTE_WRITE | (user ? AMD64_PTE_USER : 0);
         }
-    }
 
-    if (flush_tlb) {
-        mmu_flush_current_tlb();
-    }
+        uint64 *pt = get_next_level(pd, PD_IDX(cur_virt), true, user);
+        if (!pt) {
+            printf("[mmu] ERR: failed to allocate PT for virt 0x%lx\n", cur_virt);
+            return -1;
+        }
 
-#ifdef MMU_DEBUG_VERIFY_MAPS
-    for (size v = 0; v < pages; v++) {
-        uintptr check_virt = virt + (v * PAGE_SIZE);
-        uintptr resolved = mmu_virt_to_phys(map, check_virt);
-        if (resolved == (uintptr)-1) {
-            printf("[mmu] VERIFY FAIL: page %zu at 0x%lx not mapped!\n", v, check_virt);
+        //fill this page table up to its end or the end of the range
+        size n = 512 - PT_IDX(cur_virt);
+        if (n > pages - i) n = pages - i;
+        for (size j = 0; j < n; j++) {
+            uint64 *pte = &pt[PT_IDX(cur_virt) + j];
+            if (*pte & AMD64_PTE_PRESENT) mmu_tlb_batch_add(batch, cur_virt + j * PAGE_SIZE);
+            *pte = ((cur_phys + j * PAGE_SIZE) & AMD64_PTE_ADDR_MASK) | leaf_flags;
         }
+        i += n;
     }
-#endif
+    return 0;
 }
 
 void mmu_unmap_range(pagemap_t *map, uintptr virt, size pages) {
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, map);
+    mmu_unmap_range_batch(&batch, virt, pages);
+    mmu_tlb_batch_flush(&batch);
+}
+
+void mmu_unmap_range_batch(mmu_tlb_batch_t *batch, uintptr virt, size pages) {
     /*debug: log unmapping of kernel heap range
     if (virt >= KHEAP_VIRT_START && virt < KHEAP_VIRT_END) {
         // printf("[mmu] unmap virt=0x%lx pages=%zu\n", virt, pages);
     } */
 
-    uint64 *pml4 = (uint64 *)P2V(map->top_level);
-    bool flush_tlb = mmu_is_current_pagemap(map) || map == mmu_get_kernel_pagemap();
+    uint64 *pml4 = (uint64 *)P2V(batch->map->top_level);
 
     for (size i = 0; i < pages; ) {
         uintptr cur_virt = virt + (i * PAGE_SIZE);
@@ -280,11 +541,14 @@ void mmu_unmap_range(pagemap_t *map, uintptr virt, size pages) {
         uint64 *pdp = get_next_level(pml4, PML4_IDX(cur_virt), false, false);
         if (!pdp) { i++; continue; }
 
+        if (split_huge_pdp(batch, pdp, PDP_IDX(cur_virt), cur_virt) < 0) { i++; continue; }
         uint64 *pd = get_next_level(pdp, PDP_IDX(cur_virt), false, false);
         if (!pd) { i++; continue; }
 
         uint64 pd_entry = pd[PD_IDX(cur_virt)];
         if (pd_entry & AMD64_PTE_HUGE) {
+            //invlpg anywhere inside a huge page drops the whole translation
+            mmu_tlb_batch_add(batch, cur_virt);
             //only fast-path when unmapping a full 2MiB-aligned huge page
             if ((cur_virt & 0x1FFFFF) == 0 && i + 512 <= pages) {
                 pd[PD_IDX(cur_virt)] = 0;
@@ -307,16 +571,13 @@ void mmu_unmap_range(pagemap_t *map, uintptr virt, size pages) {
             }
         } else {
             uint64 *pt = get_next_level(pd, PD_IDX(cur_virt), false, false);
-            if (pt) {
+            if (pt && (pt[PT_IDX(cur_virt)] & AMD64_PTE_PRESENT)) {
                 pt[PT_IDX(cur_virt)] = 0;
+                mmu_tlb_batch_add(batch, cur_virt);
             }
             i++;
         }
     }
-
-    if (flush_tlb) {
-        mmu_flush_current_tlb();
-    }
 }
 
 uintptr mmu_virt_to_phys(pagemap_t *map, uintptr virt) {
@@ -349,8 +610,43 @@ uintptr mmu_virt_to_phys(pagemap_t *map, uintptr virt) {
     return (pt_entry & AMD64_PTE_ADDR_MASK) + (virt & 0xFFF);
 }
 
+//pick the PCID map runs under on this CPU and return the CR3 value to load
+//a slot is reused without flushing only if it still belongs to map and no
+//flush of map happened since, recycled or stale slots are flushed by the load
+static uint64 mmu_pcid_select(percpu_t *cpu, pagemap_t *map) {
+    //the kernel pagemap never changes its lower half so PCID 0 never goes stale
+    if (map == &kernel_pagemap) return map->top_level | AMD64_CR3_NOFLUSH;
+
+    uint64 gen = __atomic_load_n(&map->tlb_gen, __ATOMIC_SEQ_CST);
+    uint32 slot = 0;
+    while (slot < PCID_SLOTS && cpu->pcid_ctx[slot] != map->ctx_id) slot++;
+
+    bool fresh = slot < PCID_SLOTS && cpu->pcid_gen[slot] == gen;
+    if (slot == PCID_SLOTS) {
+        slot = cpu->pcid_next;
+        cpu->pcid_next = (slot + 1) % PCID_SLOTS;
+        cpu->pcid_ctx[slot] = map->ctx_id;
+    }
+    cpu->pcid_gen[slot] = gen;
+    cpu->pcid_slot = slot;
+
+    return map->top_level | (slot + 1) | (fresh ? AMD64_CR3_NOFLUSH : 0);
+}
+
 void mmu_switch(pagemap_t *map) {
-    __asm__ volatile ("mov %0, %%cr3" :: "r"(map->top_level) : "memory");
+    percpu_t *cpu = percpu_get();
+    pagemap_t *old = cpu->active_pagemap;
+    //every change to a loaded pagemap is shot down to us so staying on it is free
+    if (old == map) return;
+
+    //join the new pagemap before loading it so no shootdown can miss us, a
+    //flush that races with the load either bumps tlb_gen first or sees our bit
+    uint64 bit = 1ULL << cpu->cpu_index;
+    __atomic_or_fetch(&map->active_cpus, bit, __ATOMIC_SEQ_CST);
+    uint64 cr3 = mmu_pcid_enabled ? mmu_pcid_select(cpu, map) : map->top_level;
+    __asm__ volatile ("mov %0, %%cr3" :: "r"(cr3) : "memory");
+    if (old) __atomic_and_fetch(&old->active_cpus, ~bit, __ATOMIC_SEQ_CST);
+    cpu->active_pagemap = map;
 }
 
 uintptr mmu_kvtop(void *virt) {
@@ -368,14 +664,13 @@ pagemap_t *mmu_pagemap_create(void) {
     pagemap_t *map = (pagemap_t *)P2V(map_phys);
 
     //allocate PML4
-    void *pml4_phys = pmm_alloc(1);
+    void *pml4_phys = pmm_alloc_zeroed();
     if (!pml4_phys) {
         pmm_free(map_phys, 1);
         return NULL;
     }
 
     uint64 *pml4 = (uint64 *)P2V(pml4_phys);
-    memset(pml4, 0, PAGE_SIZE);
 
     //copy kernel upper-half entries (indices 256-511) from kernel pagemap
     pagemap_t *kernel_map = mmu_get_kernel_pagemap();
@@ -386,6 +681,9 @@ pagemap_t *mmu_pagemap_create(void) {
     }
 
     map->top_level = (uintptr)pml4_phys;
+    map->active_cpus = 0;
+    map->ctx_id = __atomic_fetch_add(&next_ctx_id, 1, __ATOMIC_RELAXED);
+    map->tlb_gen = 0;
     return map;
 }
 
@@ -413,6 +711,11 @@ static void free_page_table_level(uint64 *table, int level) {
 void mmu_pagemap_destroy(pagemap_t *map) {
     if (!map || !map->top_level) return;
 
+    //no CPU may still be walking these tables, step off them ourselves and
+    //wait for anyone else who is on the way out
+    if (percpu_get()->active_pagemap == map) mmu_switch(mmu_get_kernel_pagemap());
+    while (__atomic_load_n(&map->active_cpus, __ATOMIC_ACQUIRE)) arch_spin_relax();
+
     uint64 *pml4 = (uint64 *)P2V(map->top_level);
 
     //only free user-space entries (lower half indices 0-255)
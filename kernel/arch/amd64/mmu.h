@@ -29,16 +29,50 @@
 
 #define AMD64_PTE_ADDR_MASK 0x000FFFFFFFFFF000ULL
 
+//control register bits
+#define AMD64_CR0_WP        (1ULL << 16)  //supervisor writes honour read-only pages
+#define AMD64_CR3_NOFLUSH   (1ULL << 63)  //keep the TLB entries of the loaded PCID
+#define AMD64_CR4_PGE       (1ULL << 7)
+#define AMD64_CR4_PCIDE     (1ULL << 17)
+
 //amd64 virtual address space layout
 #define HHDM_OFFSET      0xFFFF800000000000ULL
 #define KHEAP_VIRT_START 0xFFFF900000000000ULL
 #define KHEAP_VIRT_END   0xFFFFA00000000000ULL
 #define ARCH_PMM_ZONE_MIN_ADDR 0x100000ULL
+#define ARCH_PMM_ZONE_DMA32_ADDR 0x100000000ULL   //end of 32-bit DMA reachable memory
 
 typedef struct pagemap {
     uintptr top_level; //physical address of PML4
+    volatile uint64 active_cpus; //bit per CPU that has this pagemap loaded
+    uint64 ctx_id;     //never reused, tags this pagemap in per-CPU PCID slots
+    volatile uint64 tlb_gen; //bumped by every user flush, stale PCIDs are flushed on load
 } pagemap_t;
 
+//most pages a TLB batch invalidates one by one before falling back to a full flush
+#define MMU_TLB_BATCH_MAX 32
+
+//page tables a batch can hold back until its flush before flushing early
+#define MMU_TLB_BATCH_TABLES 8
+
+//pending TLB invalidations for one pagemap, flushed on every CPU in one round
+typedef struct mmu_tlb_batch {
+    pagemap_t *map;
+    uint32 count;
+    bool full;
+    uint64 gen;        //tlb_gen of map once flushed
+    uintptr addrs[MMU_TLB_BATCH_MAX];
+    uint32 ntables;
+    uintptr tables[MMU_TLB_BATCH_TABLES]; //unlinked page tables, freed after the flush
+} mmu_tlb_batch_t;
+
+//a physically contiguous run of pages mapped at virt
+typedef struct mmu_run {
+    uintptr virt;
+    uintptr phys;
+    size pages;
+} mmu_run_t;
+
 //helpers to get indices
 #define PML4_IDX(v) (((v) >> 39) & 0x1FF)
 #define PDP_IDX(v)  (((v) >> 30) & 0x1FF)
@@ -47,10 +81,19 @@ typedef struct pagemap {
 
 //MI mmu interface
 void mmu_init(void);
+void mmu_init_ap(void);
 void mmu_map_range(pagemap_t *map, uintptr virt, uintptr phys, size pages, uint64 flags);
+void mmu_map_runs(pagemap_t *map, const mmu_run_t *runs, size count, uint64 flags);
 void mmu_unmap_range(pagemap_t *map, uintptr virt, size pages);
 uintptr mmu_virt_to_phys(pagemap_t *map, uintptr virt);
 void mmu_switch(pagemap_t *map);
+
+//batched invalidation
+void mmu_tlb_batch_init(mmu_tlb_batch_t *batch, pagemap_t *map);
+int mmu_map_range_batch(mmu_tlb_batch_t *batch, uintptr virt, uintptr phys, size pages, uint64 flags);
+void mmu_unmap_range_batch(mmu_tlb_batch_t *batch, uintptr virt, size pages);
+void mmu_tlb_batch_flush(mmu_tlb_batch_t *batch);
+void mmu_tlb_cpu_online(uint32 cpu_index);
 pagemap_t *mmu_get_kernel_pagemap(void);
 uint64 mmu_get_kernel_cr3(void);
 
@@ -54,8 +54,8 @@ void percpu_init(void) {
     bsp->started = 1;
     bsp->tick_count = 0;
     
-    bsp->run_queue_head = NULL;
-    bsp->run_queue_tail = NULL;
+    bsp->run_queue_bitmap = 0;
+    bsp->run_queue_count = 0;
     bsp->idle_thread = NULL;
     spinlock_irq_init(&bsp->sched_lock);
 
@@ -89,8 +89,8 @@ void percpu_init_ap(uint32 cpu_index, uint32 apic_id) {
     ap->started = 0;
     ap->tick_count = 0;
 
-    ap->run_queue_head = NULL;
-    ap->run_queue_tail = NULL;
+    ap->run_queue_bitmap = 0;
+    ap->run_queue_count = 0;
     ap->idle_thread = NULL;
     spinlock_irq_init(&ap->sched_lock);
 
@@ -9,6 +9,13 @@ struct thread;
 //maximum number of CPUs supported (matches ACPI arrays)
 #define MAX_CPUS 64
 
+//number of scheduler priority levels per run queue (0 = highest)
+#define SCHED_PRIO_LEVELS 8
+
+//PCIDs each CPU hands out to user pagemaps (slot n uses PCID n + 1,
+//PCID 0 belongs to the kernel pagemap)
+#define PCID_SLOTS 16
+
 /*
  *per-CPU data structure for AMD64
  * 
@@ -29,8 +36,9 @@ struct thread;
 #define PERCPU_TSS          48
 #define PERCPU_GDT          56
 #define PERCPU_IST_STACK    64
-#define PERCPU_RUN_Q_HEAD   72
-#define PERCPU_RUN_Q_TAIL   80
+#define PERCPU_RUN_Q_BITMAP 72
+#define PERCPU_RUN_Q_COUNT  76
+#define PERCPU_STEAL_COUNT  80
 #define PERCPU_IDLE         88
 #define PERCPU_CPU_INDEX    96
 #define PERCPU_APIC_ID      100
@@ -55,10 +63,11 @@ typedef struct percpu {
     struct gdt_entry *gdt;  //56: ...
     void *ist_stack;        //64: ...
 
-    //72-95: scheduler pointers
-    struct thread *run_queue_head; //72
-    struct thread *run_queue_tail; //80
-    struct thread *idle_thread;    //88
+    //72-95: scheduler state
+    uint32 run_queue_bitmap;        //72: bit n set while priority level n is non-empty
+    volatile uint32 run_queue_count;//76: threads queued on this CPU (excludes current)
+    uint64 steal_count;             //80: threads this CPU pulled from siblings
+    struct thread *idle_thread;     //88
 
     //96-111: counters and IDs
     uint32 cpu_index;       //96
@@ -72,6 +81,29 @@ typedef struct percpu {
     
     //136+: synchronisation
     spinlock_irq_t sched_lock;
+
+    //per-priority FIFO run queues (protected by sched_lock)
+    struct thread *run_queue_head[SCHED_PRIO_LEVELS];
+    struct thread *run_queue_tail[SCHED_PRIO_LEVELS];
+
+    //FS base currently loaded on this CPU (skips redundant MSR writes)
+    uint64 tls_base;
+
+    //pagemap currently loaded in CR3, its active_cpus has our bit set
+    struct pagemap *active_pagemap;
+
+    //PCID slots: the pagemap context each one was last used for and the
+    //flush generation its TLB entries are current with
+    uint64 pcid_ctx[PCID_SLOTS];
+    uint64 pcid_gen[PCID_SLOTS];
+    uint32 pcid_next;       //next slot to recycle
+    uint32 pcid_slot;       //slot of the loaded pagemap
+
+    //set while a safe copy must not be resolved by demand paging
+    volatile uint32 user_nofault;
+
+    //ticks since queued threads were last lifted back to their base priority
+    uint32 boost_ticks;
 } percpu_t;
 
 //get pointer to current CPU's per-CPU data
@@ -125,6 +125,8 @@ void smp_init(void) {
     percpu_t *bsp = percpu_get_by_index(0);
     if (bsp) bsp->apic_id = bsp_apic_id;
     
+    mmu_tlb_cpu_online(0);
+
     uint32 cpu_count = acpi_cpu_count;
     if (cpu_count <= 1) {
         printf("[smp] Single CPU system, SMP init complete\n");
@@ -192,6 +194,9 @@ void ap_entry(uint32 cpu_index) {
     
     //initialize this AP's GDT and TSS
     gdt_init_ap(cpu_index);
+
+    //global kernel pages and PCIDs like the BSP
+    mmu_init_ap();
     
     //enable SSE for this AP
     enable_sse();
@@ -210,6 +215,9 @@ void ap_entry(uint32 cpu_index) {
     apic_init_ap();
     apic_timer_init(1000);  //1000Hz (periodic scheduler tick)
     
+    //our APIC is up so shootdown IPIs can reach us from here on
+    mmu_tlb_cpu_online(cpu_index);
+
     //signal that we're online
     __sync_fetch_and_add(&ap_started_count, 1);
     
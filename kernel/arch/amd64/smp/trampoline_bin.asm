@@ -54,8 +54,9 @@ trampoline_32:
     lgdt [gdt64_ptr]
     
     ;enable paging - this activates long mode
+    ;WP makes kernel writes honour read-only user pages, copy-on-write relies on it
     mov eax, cr0
-    or eax, 1 << 31
+    or eax, (1 << 31) | (1 << 16)
     mov cr0, eax
     
     ;far jump to 64-bit long mode
@@ -151,3 +151,29 @@ void *memmove(void *dest, const void *src, size n) {
 
     return dest;
 }
+
+//clear one 4KB page with movnti so background zeroing does not evict
+//the working set, the sfence orders the stores before the page is handed out
+void arch_page_zero_nt(void *page) {
+    void *d = page;
+    __asm__ volatile (
+        "xor %%eax, %%eax\n\t"
+        "mov $64, %%ecx\n\t"     //64 bytes per iteration
+        "1:\n\t"
+        "movnti %%rax, 0(%0)\n\t"
+        "movnti %%rax, 8(%0)\n\t"
+        "movnti %%rax, 16(%0)\n\t"
+        "movnti %%rax, 24(%0)\n\t"
+        "movnti %%rax, 32(%0)\n\t"
+        "movnti %%rax, 40(%0)\n\t"
+        "movnti %%rax, 48(%0)\n\t"
+        "movnti %%rax, 56(%0)\n\t"
+        "add $64, %0\n\t"
+        "dec %%ecx\n\t"
+        "jnz 1b\n\t"
+        "sfence"
+        : "+r"(d) //outputs (modified)
+        : //inputs
+        : "rax", "rcx", "cc", "memory" //clobbers
+    );
+}
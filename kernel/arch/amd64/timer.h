@@ -8,5 +8,8 @@ void arch_timer_init(uint32 hz);
 void arch_timer_setfreq(uint32 hz);
 uint32 arch_timer_getfreq(void);
 uint64 arch_timer_get_ticks(void);
+uint64 arch_timer_get_ns(void);
+bool arch_timer_is_tickless(void);
+void arch_timer_program(uint64 deadline_ns);
 
 #endif
@@ -22,9 +22,12 @@
  * arch_halt() - halt CPU until next interrupt
  * arch_idle() - idle CPU (enable interrupts and halt)
  * arch_pause() - hint to CPU that we're in a spin loop
+ * arch_spin_relax() - lock spin loop body, also answers pending cross-CPU requests
  * arch_set_kernel_stack(void *stack_top) - set kernel stack for ring transitions
+ * arch_set_tls_base(uintptr base) - load the user thread pointer for the next thread
  * arch_cpu_index() - get the current CPU logical index/ID
  * arch_cpu_count() - get the number of online CPUs (if architecture supports SMP)
+ * arch_page_zero_nt(void *page) - clear one page without pulling it into the cache
  *
  * memory barriers:
  *
@@ -36,6 +39,7 @@
  *
  * irq_state_t arch_irq_save() - disable interrupts and return previous state
  * arch_irq_restore(irq_state_t) - restore interrupt state
+ * arch_irq_enabled() - true if interrupts are currently enabled
  *
  * optional (arch-specific):
  *
@@ -23,9 +23,15 @@
  *
  * mmu_init() - initialize MMU for current kernel
  * mmu_map_range(map, virt, phys, pages, flags) - map range of pages
+ * mmu_map_runs(map, runs, count, flags) - map several physical runs with one flush
+ * mmu_map_range_batch(batch, virt, phys, pages, flags) - map and defer the invalidation to batch
  * mmu_unmap_range(map, virt, pages) - unmap range of pages
+ * mmu_tlb_batch_init(batch, map) - start collecting invalidations for map
+ * mmu_unmap_range_batch(batch, virt, pages) - unmap and defer the invalidation to batch
+ * mmu_tlb_batch_flush(batch) - invalidate everything in batch on every CPU using map
+ * mmu_tlb_cpu_online(cpu) - start sending shootdowns to a CPU
  * mmu_virt_to_phys(map, virt) - translate virtual address to physical physical
- * mmu_switch(map) - switch to a different address space
+ * mmu_switch(map) - switch to a different address space, tracking which CPUs use it
  * mmu_get_kernel_pagemap() - get the kernel's initial pagemap
  * mmu_pagemap_create() - create a new address space (pagemap)
  * mmu_pagemap_destroy(map) - destroy an address space
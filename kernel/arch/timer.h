@@ -22,6 +22,9 @@
  * arch_timer_init(hz) - initialize timer at given frequency
  * arch_timer_setfreq(hz) - change timer frequency
  * arch_timer_get_ticks() - get monotonic tick count since boot
+ * arch_timer_get_ns() - get monotonic nanoseconds since boot
+ * arch_timer_is_tickless() - true if the timer is one-shot and must be re-armed per interrupt
+ * arch_timer_program(deadline_ns) - arm this CPU's one-shot timer (no-op for periodic timers)
  */
 
 #endif
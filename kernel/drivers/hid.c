@@ -478,14 +478,7 @@ static void push_to_channel(channel_endpoint_t *ep, void *data, uint32 len) {
         return;
     }
 
-    if (ch->queue_tail[peer_id])
-        ch->queue_tail[peer_id]->next = entry;
-    else
-        ch->queue[peer_id] = entry;
-    ch->queue_tail[peer_id] = entry;
-    ch->queue_len[peer_id]++;
-
-    thread_wake_one(&ch->waiters[peer_id]);
+    channel_push_locked(ch, peer_id, entry);
     spinlock_irq_release(&ch->lock, flags);
 }
 
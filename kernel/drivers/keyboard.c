@@ -164,14 +164,7 @@ static void kbd_push_event(uint8 keycode, uint8 pressed, uint32 codepoint) {
             kfree(ev);
             continue;
         }
-        if (ch->queue_tail[peer_id]) {
-            ch->queue_tail[peer_id]->next = entry;
-        } else {
-            ch->queue[peer_id] = entry;
-        }
-        ch->queue_tail[peer_id] = entry;
-        ch->queue_len[peer_id]++;
-        thread_wake_one(&ch->waiters[peer_id]);
+        channel_push_locked(ch, peer_id, entry);
         spinlock_irq_release(&ch->lock, flags);
     }
 }
@@ -117,16 +117,8 @@ static void mouse_push_event(int16 dx, int16 dy, uint8 buttons) {
         kfree(event);
         return;
     }
-    
-    if (ch->queue_tail[peer_id]) {
-        ch->queue_tail[peer_id]->next = entry;
-    } else {
-        ch->queue[peer_id] = entry;
-    }
-    ch->queue_tail[peer_id] = entry;
-    ch->queue_len[peer_id]++;
 
-    thread_wake_one(&ch->waiters[peer_id]);
+    channel_push_locked(ch, peer_id, entry);
     spinlock_irq_release(&ch->lock, flags);
 }
 
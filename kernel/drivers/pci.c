@@ -270,6 +270,7 @@ static void pci_channel_handler(channel_endpoint_t *ep, channel_msg_t *msg, void
             channel_msg_t reply = {
                 .data = &resp,
                 .data_len = sizeof(resp),
+                .txid = msg->txid,
                 .handles = NULL,
                 .handle_count = 0
             };
@@ -291,6 +292,7 @@ static void pci_channel_handler(channel_endpoint_t *ep, channel_msg_t *msg, void
             channel_msg_t reply = {
                 .data = &resp,
                 .data_len = sizeof(resp),
+                .txid = msg->txid,
                 .handles = NULL,
                 .handle_count = 0
             };
@@ -314,6 +316,7 @@ static void pci_channel_handler(channel_endpoint_t *ep, channel_msg_t *msg, void
             channel_msg_t reply = {
                 .data = &resp,
                 .data_len = sizeof(resp),
+                .txid = msg->txid,
                 .handles = NULL,
                 .handle_count = 0
             };
@@ -342,6 +345,7 @@ static void pci_channel_handler(channel_endpoint_t *ep, channel_msg_t *msg, void
             channel_msg_t reply = {
                 .data = &resp,
                 .data_len = sizeof(resp),
+                .txid = msg->txid,
                 .handles = NULL,
                 .handle_count = 0
             };
@@ -360,6 +364,7 @@ static void pci_channel_handler(channel_endpoint_t *ep, channel_msg_t *msg, void
                 channel_msg_t reply = {
                     .data = &resp,
                     .data_len = sizeof(resp),
+                    .txid = msg->txid,
                     .handles = NULL,
                     .handle_count = 0
                 };
@@ -0,0 +1,502 @@
+#include <fs/bcache.h>
+#include <fs/fs.h>
+#include <mm/kheap.h>
+#include <mm/pmm.h>
+#include <mm/mm.h>
+#include <proc/process.h>
+#include <proc/thread.h>
+#include <proc/sched.h>
+#include <proc/wait.h>
+#include <syscall/syscall.h>
+#include <lib/string.h>
+#include <lib/io.h>
+#include <lib/spinlock.h>
+
+/*
+ *block cache
+ *
+ *block devices are cached in BCACHE_BLOCK_SIZE buffers keyed by (device,
+ *block number) and found through a hash table. a buffer is owned by one
+ *thread at a time (BUSY) while it is copied or does I/O, everything else
+ *only happens under bcache_lock which is never held across device I/O
+ *
+ *the number of buffers grows with use up to a share of RAM, after that a
+ *CLOCK hand picks the victim: buffers used since it last passed get a
+ *second chance. writes only dirty a buffer, it reaches the device when it
+ *is evicted, on bcache_sync or when the flusher thread wakes up
+ */
+
+#define BCACHE_MAX_DEVS     16
+#define BCACHE_HASH_BITS    10
+#define BCACHE_HASH_SIZE    (1U << BCACHE_HASH_BITS)
+#define BCACHE_MIN_BUFS     64
+#define BCACHE_MAX_BUFS     8192        //32MB of blocks at most
+#define BCACHE_RAM_SHARE    32          //at most 1/32 of RAM
+
+#define BCACHE_DIRTY        (1 << 0)    //newer than the device
+#define BCACHE_BUSY         (1 << 1)    //owned by one thread, others wait
+#define BCACHE_REF          (1 << 2)    //used since the clock hand last passed
+#define BCACHE_WERR         (1 << 3)    //last write-back failed, not evicted until one succeeds
+
+typedef struct bcache_buf {
+    bcache_dev_t *dev;          //NULL while the buffer holds nothing
+    uint64 block;
+    uint8 *data;                //one page through the HHDM
+    uint32 len;                 //valid bytes, short for the last block of a device
+    uint32 flags;
+    struct bcache_buf *hnext;
+} bcache_buf_t;
+
+static spinlock_t bcache_lock = SPINLOCK_INIT;
+static bcache_dev_t bcache_devs[BCACHE_MAX_DEVS];
+static bcache_buf_t *bcache_hash[BCACHE_HASH_SIZE];
+static bcache_buf_t *bcache_bufs;
+static size bcache_capacity;
+static size bcache_used;        //buffers that have a page
+static size bcache_hand;
+static bool bcache_flusher_started;
+static bool bcache_write_through;   //no flusher thread, writes go straight out
+
+static inline uint32 bcache_hash_idx(bcache_dev_t *dev, uint64 block) {
+    uint64 key = ((uint64)(uintptr)dev >> 4) * 31 + block;
+    return (uint32)((key * 0x9E3779B97F4A7C15ULL) >> (64 - BCACHE_HASH_BITS));
+}
+
+static bcache_buf_t *bcache_lookup(bcache_dev_t *dev, uint64 block) {
+    bcache_buf_t *b = bcache_hash[bcache_hash_idx(dev, block)];
+    while (b && (b->dev != dev || b->block != block)) b = b->hnext;
+    return b;
+}
+
+static void bcache_hash_insert(bcache_buf_t *b) {
+    bcache_buf_t **head = &bcache_hash[bcache_hash_idx(b->dev, b->block)];
+    b->hnext = *head;
+    *head = b;
+}
+
+static void bcache_hash_remove(bcache_buf_t *b) {
+    bcache_buf_t **pp = &bcache_hash[bcache_hash_idx(b->dev, b->block)];
+    while (*pp && *pp != b) pp = &(*pp)->hnext;
+    if (*pp) *pp = b->hnext;
+    b->hnext = NULL;
+}
+
+//bytes of a block that lie on the device, 0 past its end
+static uint32 bcache_block_len(bcache_dev_t *dev, uint64 block) {
+    uint64 start = block * BCACHE_BLOCK_SIZE;
+    if (start >= dev->length) return 0;
+    uint64 left = dev->length - start;
+    return left < BCACHE_BLOCK_SIZE ? (uint32)left : BCACHE_BLOCK_SIZE;
+}
+
+//caller owns the buffer (BUSY), a short transfer counts as a failure
+static int bcache_buf_write(bcache_buf_t *b) {
+    ssize wr = object_write(b->dev->obj, b->data, b->len, b->block * BCACHE_BLOCK_SIZE);
+    return wr == (ssize)b->len ? 0 : -1;
+}
+
+static int bcache_buf_read(bcache_buf_t *b) {
+    ssize rd = object_read(b->dev->obj, b->data, b->len, b->block * BCACHE_BLOCK_SIZE);
+    return rd == (ssize)b->len ? 0 : -1;
+}
+
+//bcache_lock held, the buffer was owned (BUSY) for the write
+static void bcache_write_done(bcache_buf_t *b, int rc) {
+    b->flags &= ~BCACHE_BUSY;
+    if (rc == 0) b->flags &= ~(BCACHE_DIRTY | BCACHE_WERR);
+    else b->flags |= BCACHE_WERR;
+}
+
+//a buffer to load a new block into, bcache_lock held
+static bcache_buf_t *bcache_victim(void) {
+    if (bcache_used < bcache_capacity) {
+        void *page = pmm_alloc(1);
+        if (page) {
+            bcache_buf_t *b = &bcache_bufs[bcache_used++];
+            b->data = P2V(page);
+            return b;
+        }
+    }
+
+    //the first lap may only clear reference bits, the second then finds one
+    for (size i = 0; i < 2 * bcache_used; i++) {
+        bcache_buf_t *b = &bcache_bufs[bcache_hand];
+        bcache_hand = (bcache_hand + 1) % bcache_used;
+        //a block the device refused stays cached until a sync gets it out
+        if (b->flags & (BCACHE_BUSY | BCACHE_WERR)) continue;
+        if (b->flags & BCACHE_REF) {
+            b->flags &= ~BCACHE_REF;
+            continue;
+        }
+        return b;
+    }
+    return NULL;
+}
+
+//find or load a block and take ownership of it
+//fill is false when the caller overwrites the whole block, saving the read
+static bcache_buf_t *bcache_get(bcache_dev_t *dev, uint64 block, bool fill) {
+    uint32 len = bcache_block_len(dev, block);
+    if (!len) return NULL;
+
+    for (;;) {
+        spinlock_acquire(&bcache_lock);
+        bcache_buf_t *b = bcache_lookup(dev, block);
+        if (b) {
+            if (b->flags & BCACHE_BUSY) {
+                spinlock_release(&bcache_lock);
+                sched_yield();
+                continue;
+            }
+            b->flags |= BCACHE_BUSY | BCACHE_REF;
+            spinlock_release(&bcache_lock);
+            return b;
+        }
+
+        b = bcache_victim();
+        if (!b) {
+            spinlock_release(&bcache_lock);
+            return NULL;
+        }
+
+        if (b->flags & BCACHE_DIRTY) {
+            //the old contents go out first, the block we want may have been
+            //loaded by someone else meanwhile so look again afterwards
+            //if the write fails the victim is marked and the next pass picks another
+            b->flags |= BCACHE_BUSY;
+            spinlock_release(&bcache_lock);
+            int rc = bcache_buf_write(b);
+            spinlock_acquire(&bcache_lock);
+            bcache_write_done(b, rc);
+            spinlock_release(&bcache_lock);
+            if (rc < 0) printf("[bcache] ERR: write-back of block %llu failed\n", (uint64)b->block);
+            continue;
+        }
+
+        if (b->dev) bcache_hash_remove(b);
+        b->dev = dev;
+        b->block = block;
+        b->len = len;
+        b->flags = BCACHE_BUSY | BCACHE_REF;
+        bcache_hash_insert(b);
+        spinlock_release(&bcache_lock);
+
+        if (fill && bcache_buf_read(b) < 0) {
+            spinlock_acquire(&bcache_lock);
+            bcache_hash_remove(b);
+            b->dev = NULL;
+            b->flags = 0;
+            spinlock_release(&bcache_lock);
+            return NULL;
+        }
+        return b;
+    }
+}
+
+static void bcache_put(bcache_buf_t *b, bool dirty) {
+    spinlock_acquire(&bcache_lock);
+    if (dirty) b->flags |= BCACHE_DIRTY;
+    b->flags &= ~BCACHE_BUSY;
+    spinlock_release(&bcache_lock);
+}
+
+int bcache_read(bcache_dev_t *dev, uint64 offset, void *buf, size len) {
+    if (!dev || !buf) return -1;
+
+    uint8 *out = buf;
+    while (len) {
+        uint64 block = offset / BCACHE_BLOCK_SIZE;
+        uint32 off = (uint32)(offset % BCACHE_BLOCK_SIZE);
+        size n = BCACHE_BLOCK_SIZE - off;
+        if (n > len) n = len;
+
+        bcache_buf_t *b = bcache_get(dev, block, true);
+        if (!b) return -1;
+        if (off + n > b->len) {
+            bcache_put(b, false);
+            return -1;
+        }
+        memcpy(out, b->data + off, n);
+        bcache_put(b, false);
+
+        out += n;
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int bcache_write(bcache_dev_t *dev, uint64 offset, const void *buf, size len) {
+    if (!dev || !buf) return -1;
+
+    const uint8 *in = buf;
+    while (len) {
+        uint64 block = offset / BCACHE_BLOCK_SIZE;
+        uint32 off = (uint32)(offset % BCACHE_BLOCK_SIZE);
+        size n = BCACHE_BLOCK_SIZE - off;
+        if (n > len) n = len;
+
+        uint32 blen = bcache_block_len(dev, block);
+        if (off + n > blen) return -1;
+
+        bcache_buf_t *b = bcache_get(dev, block, off != 0 || n < blen);
+        if (!b) return -1;
+        memcpy(b->data + off, in, n);
+
+        if (bcache_write_through) {
+            int rc = bcache_buf_write(b);
+            spinlock_acquire(&bcache_lock);
+            b->flags |= BCACHE_DIRTY;
+            bcache_write_done(b, rc);
+            spinlock_release(&bcache_lock);
+            if (rc < 0) return -1;
+        } else {
+            bcache_put(b, true);
+        }
+
+        in += n;
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+//take ownership of a block if it is cached, NULL if it isn't
+static bcache_buf_t *bcache_claim_cached(bcache_dev_t *dev, uint64 block) {
+    for (;;) {
+        spinlock_acquire(&bcache_lock);
+        bcache_buf_t *b = bcache_lookup(dev, block);
+        if (b && (b->flags & BCACHE_BUSY)) {
+            spinlock_release(&bcache_lock);
+            sched_yield();
+            continue;
+        }
+        if (b) b->flags |= BCACHE_BUSY;
+        spinlock_release(&bcache_lock);
+        return b;
+    }
+}
+
+//the whole blocks of a transfer that can skip the cache, first and count are
+//in blocks and the short last block of a device never qualifies
+static bool bcache_direct_span(bcache_dev_t *dev, uint64 offset, size len, uint64 *first, uint64 *count) {
+    uint64 start = (offset + BCACHE_BLOCK_SIZE - 1) / BCACHE_BLOCK_SIZE;
+    uint64 end = offset + len;
+    if (end > dev->length) end = dev->length;
+    end /= BCACHE_BLOCK_SIZE;
+    if (end <= start) return false;
+    *first = start;
+    *count = end - start;
+    return true;
+}
+
+int bcache_read_direct(bcache_dev_t *dev, uint64 offset, void *buf, size len) {
+    if (!dev || !buf) return -1;
+    uint64 first, count;
+    if (!bcache_direct_span(dev, offset, len, &first, &count)) return bcache_read(dev, offset, buf, len);
+
+    uint8 *out = buf;
+    uint64 head = first * BCACHE_BLOCK_SIZE - offset;
+    if (head && bcache_read(dev, offset, out, head) < 0) return -1;
+
+    while (count) {
+        uint64 n = count < BCACHE_DIRECT_BLOCKS ? count : BCACHE_DIRECT_BLOCKS;
+
+        //dirty copies go out first so the device holds the latest data, clean
+        //ones already match it
+        for (uint64 i = 0; i < n; i++) {
+            bcache_buf_t *b = bcache_claim_cached(dev, first + i);
+            if (!b) continue;
+            int rc = (b->flags & BCACHE_DIRTY) ? bcache_buf_write(b) : 0;
+            spinlock_acquire(&bcache_lock);
+            if (b->flags & BCACHE_DIRTY) bcache_write_done(b, rc);
+            else b->flags &= ~BCACHE_BUSY;
+            spinlock_release(&bcache_lock);
+            if (rc < 0) return -1;
+        }
+
+        size bytes = (size)(n * BCACHE_BLOCK_SIZE);
+        uint8 *dst = out + (first * BCACHE_BLOCK_SIZE - offset);
+        if (object_read(dev->obj, dst, bytes, first * BCACHE_BLOCK_SIZE) != (ssize)bytes) return -1;
+        first += n;
+        count -= n;
+    }
+
+    uint64 done = first * BCACHE_BLOCK_SIZE - offset;
+    if (done < len && bcache_read(dev, offset + done, out + done, len - done) < 0) return -1;
+    return 0;
+}
+
+int bcache_write_direct(bcache_dev_t *dev, uint64 offset, const void *buf, size len) {
+    if (!dev || !buf) return -1;
+    uint64 first, count;
+    if (!bcache_direct_span(dev, offset, len, &first, &count)) return bcache_write(dev, offset, buf, len);
+
+    const uint8 *in = buf;
+    uint64 head = first * BCACHE_BLOCK_SIZE - offset;
+    if (head && bcache_write(dev, offset, in, head) < 0) return -1;
+
+    bcache_buf_t *owned[BCACHE_DIRECT_BLOCKS];
+    while (count) {
+        uint64 n = count < BCACHE_DIRECT_BLOCKS ? count : BCACHE_DIRECT_BLOCKS;
+        const uint8 *src = in + (first * BCACHE_BLOCK_SIZE - offset);
+
+        //cached copies are held across the transfer so the flusher can't
+        //write an older version over it
+        for (uint64 i = 0; i < n; i++) owned[i] = bcache_claim_cached(dev, first + i);
+
+        size bytes = (size)(n * BCACHE_BLOCK_SIZE);
+        int rc = object_write(dev->obj, src, bytes, first * BCACHE_BLOCK_SIZE) == (ssize)bytes ? 0 : -1;
+
+        //held copies now match the device, a block someone loaded during the
+        //transfer may hold either version so it takes ours and goes out again
+        for (uint64 i = 0; i < n; i++) {
+            bcache_buf_t *b = owned[i];
+            if (b) {
+                if (rc == 0) memcpy(b->data, src + i * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE);
+                spinlock_acquire(&bcache_lock);
+                b->flags &= ~BCACHE_BUSY;
+                if (rc == 0) b->flags &= ~(BCACHE_DIRTY | BCACHE_WERR);
+                spinlock_release(&bcache_lock);
+            } else if (rc == 0 && (b = bcache_claim_cached(dev, first + i))) {
+                memcpy(b->data, src + i * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE);
+                bcache_put(b, true);
+            }
+        }
+        if (rc < 0) return -1;
+        first += n;
+        count -= n;
+    }
+
+    uint64 done = first * BCACHE_BLOCK_SIZE - offset;
+    if (done < len && bcache_write(dev, offset + done, in + done, len - done) < 0) return -1;
+    return 0;
+}
+
+int bcache_sync(bcache_dev_t *dev) {
+    int rc = 0;
+
+    spinlock_acquire(&bcache_lock);
+    for (size i = 0; i < bcache_used; i++) {
+        bcache_buf_t *b = &bcache_bufs[i];
+        if (!(b->flags & BCACHE_DIRTY) || (b->flags & BCACHE_BUSY)) continue;
+        if (dev && b->dev != dev) continue;
+
+        b->flags |= BCACHE_BUSY;
+        spinlock_release(&bcache_lock);
+        int wr = bcache_buf_write(b);
+        spinlock_acquire(&bcache_lock);
+        bcache_write_done(b, wr);
+        if (wr < 0) rc = -1;
+    }
+    spinlock_release(&bcache_lock);
+    return rc;
+}
+
+static void bcache_flush_worker(void *arg) {
+    (void)arg;
+    for (;;) {
+        thread_sleep_ns(BCACHE_FLUSH_NS);
+        if (bcache_sync(NULL) < 0) printf("[bcache] ERR: write-back failed, blocks stay dirty\n");
+    }
+}
+
+static void bcache_start_flusher(void) {
+    process_t *kernel = process_get_kernel();
+    thread_t *thread = kernel ? thread_create(kernel, bcache_flush_worker, NULL) : NULL;
+    if (!thread) {
+        printf("[bcache] ERR: no flusher thread, writing through\n");
+        bcache_write_through = true;
+        return;
+    }
+    sched_add(thread);
+}
+
+//bcache_lock held
+static int bcache_setup(void) {
+    size cap = pmm_get_total_pages() / BCACHE_RAM_SHARE;
+    if (cap < BCACHE_MIN_BUFS) cap = BCACHE_MIN_BUFS;
+    if (cap > BCACHE_MAX_BUFS) cap = BCACHE_MAX_BUFS;
+
+    bcache_bufs = kzalloc(cap * sizeof(bcache_buf_t));
+    if (!bcache_bufs) return -1;
+    bcache_capacity = cap;
+    return 0;
+}
+
+bcache_dev_t *bcache_attach(object_t *obj) {
+    if (!obj) return NULL;
+
+    //the size bounds every block, a device that can't report it isn't cached
+    block_device_info_t info = {0};
+    uint64 length = 0;
+    if (object_get_info(obj, OBJ_INFO_BLOCK_DEVICE, &info, sizeof(info)) >= 0 &&
+        info.sector_size && info.sector_count) {
+        length = info.sector_count * info.sector_size;
+    } else if (obj->ops && obj->ops->stat) {
+        stat_t st;
+        if (obj->ops->stat(obj, &st) == 0) length = st.size;
+    }
+    if (length == 0) return NULL;
+
+    spinlock_acquire(&bcache_lock);
+    if (!bcache_bufs && bcache_setup() < 0) {
+        spinlock_release(&bcache_lock);
+        return NULL;
+    }
+
+    bcache_dev_t *dev = NULL;
+    bcache_dev_t *slot = NULL;
+    for (uint32 i = 0; i < BCACHE_MAX_DEVS; i++) {
+        if (bcache_devs[i].obj == obj) {
+            dev = &bcache_devs[i];
+            break;
+        }
+        if (!bcache_devs[i].obj && !slot) slot = &bcache_devs[i];
+    }
+    if (!dev && slot) {
+        dev = slot;
+        dev->obj = obj;
+        dev->length = length;
+        dev->refs = 0;
+        object_ref(obj);
+    }
+    if (dev) dev->refs++;
+
+    bool start = dev && !bcache_flusher_started;
+    if (start) bcache_flusher_started = true;
+    spinlock_release(&bcache_lock);
+
+    if (start) bcache_start_flusher();
+    return dev;
+}
+
+void bcache_detach(bcache_dev_t *dev) {
+    if (!dev) return;
+    if (bcache_sync(dev) < 0) printf("[bcache] ERR: dropping dirty blocks of a detached device\n");
+
+    spinlock_acquire(&bcache_lock);
+    if (--dev->refs > 0) {
+        spinlock_release(&bcache_lock);
+        return;
+    }
+    for (size i = 0; i < bcache_used; i++) {
+        bcache_buf_t *b = &bcache_bufs[i];
+        if (b->dev != dev) continue;
+        //a flusher write may still be in flight, let it finish first
+        while (b->flags & BCACHE_BUSY) {
+            spinlock_release(&bcache_lock);
+            sched_yield();
+            spinlock_acquire(&bcache_lock);
+        }
+        if (b->dev != dev) continue;
+        bcache_hash_remove(b);
+        b->dev = NULL;
+        b->flags = 0;
+    }
+    object_t *obj = dev->obj;
+    dev->obj = NULL;
+    spinlock_release(&bcache_lock);
+
+    object_deref(obj);
+}
@@ -0,0 +1,49 @@
+#ifndef FS_BCACHE_H
+#define FS_BCACHE_H
+
+#include <arch/types.h>
+#include <obj/object.h>
+
+//bytes cached per buffer, a whole number of sectors on every supported device
+#define BCACHE_BLOCK_SIZE   4096
+
+//write-back interval of the flusher thread
+#define BCACHE_FLUSH_NS     (5ULL * 1000000000ULL)
+
+//a block device as the cache sees it, shared by every user of the same object
+typedef struct bcache_dev {
+    object_t *obj;
+    uint64 length;          //bytes on the device
+    uint32 refs;
+} bcache_dev_t;
+
+//start caching a block device, returns NULL if the cache can't be set up
+//or the device can't report its size
+bcache_dev_t *bcache_attach(object_t *obj);
+
+//write back and drop everything cached for the device and release it
+void bcache_detach(bcache_dev_t *dev);
+
+//copy bytes at a device offset through the cache, 0 on success -1 on I/O error
+int bcache_read(bcache_dev_t *dev, uint64 offset, void *buf, size len);
+
+//update bytes at a device offset in the cache, they reach the device on
+//eviction, on bcache_sync or when the flusher thread runs
+int bcache_write(bcache_dev_t *dev, uint64 offset, const void *buf, size len);
+
+//longest transfer the direct paths hand to the device at once, in blocks,
+//block drivers bounce each one through a contiguous buffer of that size
+#define BCACHE_DIRECT_BLOCKS    32
+
+//like bcache_read and bcache_write but the whole blocks of the range move in
+//one device transfer per BCACHE_DIRECT_BLOCKS without being cached, for bulk
+//file data. cached copies of those blocks are kept coherent, the partial
+//blocks at either end still go through the cache
+int bcache_read_direct(bcache_dev_t *dev, uint64 offset, void *buf, size len);
+int bcache_write_direct(bcache_dev_t *dev, uint64 offset, const void *buf, size len);
+
+//write back dirty blocks of one device or of every device when dev is NULL
+//returns -1 if any write failed, those blocks stay dirty
+int bcache_sync(bcache_dev_t *dev);
+
+#endif
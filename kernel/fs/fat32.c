@@ -1,5 +1,6 @@
 #include <fs/fat32.h>
 #include <fs/mount.h>
+#include <fs/bcache.h>
 #include <drivers/blkdev.h>
 #include <mm/kheap.h>
 #include <mm/mm.h>
@@ -25,6 +26,15 @@
 #define FAT32_EOC_MIN       0x0FFFFFF8
 #define FAT32_EOC_MASK      0x0FFFFFFF
 
+#define FAT32_FSINFO_LEAD_SIG   0x41615252
+#define FAT32_FSINFO_STRUC_SIG  0x61417272
+#define FAT32_FSINFO_TRAIL_SIG  0xAA550000
+#define FAT32_FSINFO_UNKNOWN    0xFFFFFFFF
+
+//direct FAT reads at mount go out in pieces this size, each needs a bounce
+//buffer of the same size in the block driver
+#define FAT32_FAT_READ_CHUNK    (64 * 1024)
+
 typedef struct __attribute__((packed)) {
     uint8 jump[3];
     //boot sector oem string
@@ -85,8 +95,25 @@ typedef struct __attribute__((packed)) {
     uint16 name3[2];           //chars 12 to 13
 } fat32_lfn_dirent_t;
 
+typedef struct __attribute__((packed)) {
+    uint32 lead_sig;           //41615252
+    uint8 reserved[480];
+    uint32 struc_sig;          //61417272
+    uint32 free_count;         //last known free clusters, ffffffff if unknown
+    uint32 next_free;          //where to start looking, ffffffff if unknown
+    uint8 reserved2[12];
+    uint32 trail_sig;          //aa550000
+} fat32_fsinfo_t;
+
 typedef struct fat32_fs fat32_fs_t;
 
+//clusters that follow each other on disk, one entry of a file's extent map
+typedef struct {
+    uint32 index;              //position of the first cluster in the file
+    uint32 cluster;            //its cluster number
+    uint32 count;              //clusters in the run
+} fat32_extent_t;
+
 typedef struct fat32_node {
     fat32_fs_t *fs;
     uint32 first_cluster;      //first data cluster
@@ -96,10 +123,18 @@ typedef struct fat32_node {
     uint64 dir_entry_offset;   //short entry offset in parent
     bool is_dir;
     bool is_root;              //root has no dirent
+
+    //the chain as runs, built as far as it has been walked and only ever
+    //appended to since chains only grow while a node is open, fs->lock held
+    fat32_extent_t *extents;
+    uint32 extent_count;
+    uint32 extent_cap;
+    uint32 mapped;             //clusters covered by the extents
 } fat32_node_t;
 
 struct fat32_fs {
     object_t *source;          //backing block device
+    bcache_dev_t *cache;       //the same device through the block cache
     uint32 dev_sector_size;    //device sector size
     uint64 dev_sector_count;
 
@@ -118,6 +153,20 @@ struct fat32_fs {
     uint64 cluster_size;        //bytes per cluster
 
     uint32 next_free_cluster;   //roving allocation hint
+
+    //the first FAT copy lives in memory, all lookups and allocation use it
+    //changed sectors are marked and written to every copy in one go once the
+    //operation that changed them is done
+    uint32 *fat;                //entries 0 to fat_entries - 1
+    uint32 fat_entries;         //total_clusters + 2 unless the FAT is shorter
+    uint64 *free_map;           //bit set for every free cluster
+    uint32 free_count;
+    uint64 *fat_dirty;          //bit per FAT sector changed since the last flush
+    uint32 fat_dirty_count;
+    bool fsinfo_valid;          //the FSInfo sector is there and gets kept up to date
+    bool fsinfo_dirty;
+
+    void *zero_cluster;         //all zero cluster used to blank new ones, allocated on first use
     spinlock_t lock;
     fs_t *fs;
 };
@@ -284,18 +333,6 @@ static inline uint32 fat32_cluster_eoc(uint32 cluster) {
     return (cluster & FAT32_EOC_MASK) >= FAT32_EOC_MIN;
 }
 
-static inline uint64 align_down_u64(uint64 value, uint64 align) {
-    //round down to an alignment boundary
-    return value - (value % align);
-}
-
-static inline uint64 align_up_u64(uint64 value, uint64 align) {
-    //round up to an alignment boundary
-    uint64 mod = value % align;
-    if (!mod) return value;
-    return value + (align - mod);
-}
-
 static inline uint32 fat32_cluster_to_sector(fat32_fs_t *fs, uint32 cluster) {
     //cluster 2 is the first data cluster
     return (uint32)(fs->data_offset / fs->bytes_per_sector) +
@@ -307,86 +344,111 @@ static inline uint64 fat32_cluster_offset(fat32_fs_t *fs, uint32 cluster) {
     return fs->data_offset + (uint64)(cluster - 2) * fs->cluster_size;
 }
 
+//all device access goes through the block cache so FAT entries, directories
+//and recently used file data are served from memory
 static int fat32_dev_read_bytes(fat32_fs_t *fs, uint64 offset, void *buf, size len) {
-    if (!fs || !fs->source || !buf || len == 0) return -1;
-
-    //round reads to device sector size
-    uint64 dev_align = fs->dev_sector_size ? fs->dev_sector_size : 512;
-    uint64 aligned_start = align_down_u64(offset, dev_align);
-    uint64 aligned_end = align_up_u64(offset + len, dev_align);
-    size aligned_len = (size)(aligned_end - aligned_start);
-    size pages = (aligned_len + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (!fs || !fs->cache || !buf || len == 0) return -1;
+    return bcache_read(fs->cache, offset, buf, len);
+}
 
-    void *phys = pmm_alloc(pages);
-    if (!phys) return -1;
-    void *tmp = P2V(phys);
-    memset(tmp, 0, aligned_len);
+static int fat32_dev_write_bytes(fat32_fs_t *fs, uint64 offset, const void *buf, size len) {
+    if (!fs || !fs->cache || !buf || len == 0) return -1;
+    return bcache_write(fs->cache, offset, buf, len);
+}
 
-    ssize rd = object_read(fs->source, tmp, aligned_len, aligned_start);
-    if (rd < 0) {
-        pmm_free(phys, pages);
-        return -1;
-    }
+//file data skips the block cache for whole blocks, see bcache_read_direct
+static int fat32_dev_read_direct(fat32_fs_t *fs, uint64 offset, void *buf, size len) {
+    if (!fs || !fs->cache || !buf || len == 0) return -1;
+    return bcache_read_direct(fs->cache, offset, buf, len);
+}
 
-    memcpy(buf, (uint8 *)tmp + (offset - aligned_start), len);
-    pmm_free(phys, pages);
-    return 0;
+static int fat32_dev_write_direct(fat32_fs_t *fs, uint64 offset, const void *buf, size len) {
+    if (!fs || !fs->cache || !buf || len == 0) return -1;
+    return bcache_write_direct(fs->cache, offset, buf, len);
 }
 
-static int fat32_dev_write_bytes(fat32_fs_t *fs, uint64 offset, const void *buf, size len) {
-    if (!fs || !fs->source || !buf || len == 0) return -1;
+static uint32 fat32_fat_read_entry(fat32_fs_t *fs, uint32 cluster) {
+    if (cluster >= fs->fat_entries) return FAT32_EOC_MASK;
+    return fs->fat[cluster] & FAT32_EOC_MASK;
+}
 
-    //read modify write so bytes outside the request stay intact
-    uint64 dev_align = fs->dev_sector_size ? fs->dev_sector_size : 512;
-    uint64 aligned_start = align_down_u64(offset, dev_align);
-    uint64 aligned_end = align_up_u64(offset + len, dev_align);
-    size aligned_len = (size)(aligned_end - aligned_start);
-    size pages = (aligned_len + PAGE_SIZE - 1) / PAGE_SIZE;
+static inline bool fat32_cluster_is_free(fat32_fs_t *fs, uint32 cluster) {
+    return (fs->free_map[cluster / 64] >> (cluster % 64)) & 1;
+}
 
-    void *phys = pmm_alloc(pages);
-    if (!phys) return -1;
-    void *tmp = P2V(phys);
-    memset(tmp, 0, aligned_len);
+static inline void fat32_free_map_set(fat32_fs_t *fs, uint32 cluster, bool free) {
+    if (free) fs->free_map[cluster / 64] |= 1ULL << (cluster % 64);
+    else fs->free_map[cluster / 64] &= ~(1ULL << (cluster % 64));
+}
 
-    if (object_read(fs->source, tmp, aligned_len, aligned_start) < 0) {
-        pmm_free(phys, pages);
-        return -1;
-    }
+//only changes the in memory FAT, fat32_fat_flush_locked writes it out
+static int fat32_fat_write_entry_locked(fat32_fs_t *fs, uint32 cluster, uint32 value) {
+    if (cluster < 2 || cluster >= fs->fat_entries) return -1;
 
-    memcpy((uint8 *)tmp + (offset - aligned_start), buf, len);
+    //the top 4 bits are reserved and keep whatever the disk had
+    value &= FAT32_EOC_MASK;
+    uint32 old = fs->fat[cluster];
+    if ((old & FAT32_EOC_MASK) == value) return 0;
+    fs->fat[cluster] = (old & ~FAT32_EOC_MASK) | value;
 
-    if (object_write(fs->source, tmp, aligned_len, aligned_start) < 0) {
-        pmm_free(phys, pages);
-        return -1;
+    bool was_free = (old & FAT32_EOC_MASK) == 0;
+    if (was_free != (value == 0)) {
+        fat32_free_map_set(fs, cluster, value == 0);
+        if (value == 0) fs->free_count++;
+        else fs->free_count--;
+        fs->fsinfo_dirty = true;
     }
 
-    pmm_free(phys, pages);
+    uint32 sector = (uint32)(((uint64)cluster * 4) / fs->bytes_per_sector);
+    if (!(fs->fat_dirty[sector / 64] & (1ULL << (sector % 64)))) {
+        fs->fat_dirty[sector / 64] |= 1ULL << (sector % 64);
+        fs->fat_dirty_count++;
+    }
     return 0;
 }
 
-static uint32 fat32_fat_read_entry(fat32_fs_t *fs, uint32 cluster) {
-    uint32 entry = 0;
-    uint64 offset = fs->fat_offset + ((uint64)cluster * 4);
-    if (fat32_dev_read_bytes(fs, offset, &entry, sizeof(entry)) < 0) return FAT32_EOC_MASK;
-    return entry & FAT32_EOC_MASK;
+static int fat32_fsinfo_write_locked(fat32_fs_t *fs) {
+    uint64 offset = (uint64)fs->fsinfo_sector * fs->bytes_per_sector;
+    uint32 hint[2] = { fs->free_count, fs->next_free_cluster };
+    if (fat32_dev_write_bytes(fs, offset + __builtin_offsetof(fat32_fsinfo_t, free_count), hint, sizeof(hint)) < 0) return -1;
+    fs->fsinfo_dirty = false;
+    return 0;
 }
 
-static int fat32_fat_write_entry_locked(fat32_fs_t *fs, uint32 cluster, uint32 value) {
-    //write both fat copies
-    value &= FAT32_EOC_MASK;
-    for (uint32 copy = 0; copy < fs->fat_count; copy++) {
-        uint64 offset = fs->fat_offset + ((uint64)copy * fs->fat_size_sectors * fs->bytes_per_sector) + ((uint64)cluster * 4);
-        if (fat32_dev_write_bytes(fs, offset, &value, sizeof(value)) < 0) {
-            return -1;
+//write every changed FAT sector to all copies, runs of sectors go out together
+static int fat32_fat_flush_locked(fat32_fs_t *fs) {
+    int rc = 0;
+    uint32 words = (fs->fat_size_sectors + 63) / 64;
+    for (uint32 w = 0; w < words && fs->fat_dirty_count; w++) {
+        while (fs->fat_dirty[w]) {
+            uint32 first = w * 64 + (uint32)__builtin_ctzll(fs->fat_dirty[w]);
+            uint32 last = first;
+            while (last + 1 < fs->fat_size_sectors &&
+                   (fs->fat_dirty[(last + 1) / 64] & (1ULL << ((last + 1) % 64)))) {
+                last++;
+            }
+            for (uint32 sec = first; sec <= last; sec++) {
+                fs->fat_dirty[sec / 64] &= ~(1ULL << (sec % 64));
+            }
+            fs->fat_dirty_count -= last - first + 1;
+
+            uint64 start = (uint64)first * fs->bytes_per_sector;
+            uint64 len = (uint64)(last - first + 1) * fs->bytes_per_sector;
+            for (uint32 copy = 0; copy < fs->fat_count; copy++) {
+                uint64 offset = fs->fat_offset + (uint64)copy * fs->fat_size_sectors * fs->bytes_per_sector;
+                if (fat32_dev_write_bytes(fs, offset + start, (uint8 *)fs->fat + start, len) < 0) rc = -1;
+            }
         }
     }
-    return 0;
+    if (fs->fsinfo_valid && fs->fsinfo_dirty && fat32_fsinfo_write_locked(fs) < 0) rc = -1;
+    return rc;
 }
 
 static int fat32_fat_write_entry(fat32_fs_t *fs, uint32 cluster, uint32 value) {
     if (!fs) return -1;
     spinlock_acquire(&fs->lock);
     int rc = fat32_fat_write_entry_locked(fs, cluster, value);
+    if (fat32_fat_flush_locked(fs) < 0) rc = -1;
     spinlock_release(&fs->lock);
     return rc;
 }
@@ -396,72 +458,128 @@ static uint32 fat32_cluster_next(fat32_fs_t *fs, uint32 cluster) {
     return fat32_fat_read_entry(fs, cluster);
 }
 
+//fs->lock held
 static int fat32_cluster_zero(fat32_fs_t *fs, uint32 cluster) {
     //new clusters start blank so old data does not leak back out
-    void *zero = kzalloc(fs->cluster_size);
-    if (!zero) return -1;
-    int ret = fat32_dev_write_bytes(fs, fat32_cluster_offset(fs, cluster), zero, fs->cluster_size);
-    kfree(zero);
-    return ret;
+    //the source buffer is only ever read so one per filesystem is enough
+    if (!fs->zero_cluster) {
+        fs->zero_cluster = kzalloc(fs->cluster_size);
+        if (!fs->zero_cluster) return -1;
+    }
+    return fat32_dev_write_bytes(fs, fat32_cluster_offset(fs, cluster), fs->zero_cluster, fs->cluster_size);
 }
 
 static int fat32_cluster_read(fat32_fs_t *fs, uint32 cluster, void *buf) {
     return fat32_dev_read_bytes(fs, fat32_cluster_offset(fs, cluster), buf, fs->cluster_size);
 }
 
-static int fat32_cluster_write(fat32_fs_t *fs, uint32 cluster, const void *buf) {
-    return fat32_dev_write_bytes(fs, fat32_cluster_offset(fs, cluster), buf, fs->cluster_size);
+//add the next cluster of the chain to the map, fs->lock held
+static int fat32_extent_append_locked(fat32_node_t *node, uint32 cluster) {
+    fat32_extent_t *last = node->extent_count ? &node->extents[node->extent_count - 1] : NULL;
+    if (last && last->cluster + last->count == cluster) {
+        last->count++;
+        node->mapped++;
+        return 0;
+    }
+
+    if (node->extent_count == node->extent_cap) {
+        uint32 cap = node->extent_cap ? node->extent_cap * 2 : 4;
+        fat32_extent_t *grown = kmalloc(cap * sizeof(fat32_extent_t));
+        if (!grown) return -1;
+        if (node->extent_count) memcpy(grown, node->extents, node->extent_count * sizeof(fat32_extent_t));
+        kfree(node->extents);
+        node->extents = grown;
+        node->extent_cap = cap;
+    }
+    node->extents[node->extent_count++] = (fat32_extent_t){
+        .index = node->mapped, .cluster = cluster, .count = 1
+    };
+    node->mapped++;
+    return 0;
 }
 
-static uint32 fat32_chain_length(fat32_fs_t *fs, uint32 first_cluster, uint32 *last_cluster) {
-    if (first_cluster < 2) {
-        if (last_cluster) *last_cluster = 0;
-        return 0;
+//follow the chain past the mapped part until it covers wanted clusters or ends
+//fs->lock held
+static void fat32_extent_fill_locked(fat32_node_t *node, uint32 wanted) {
+    fat32_fs_t *fs = node->fs;
+    while (node->mapped < wanted) {
+        uint32 next;
+        if (!node->extent_count) {
+            next = node->first_cluster;
+        } else {
+            fat32_extent_t *last = &node->extents[node->extent_count - 1];
+            next = fat32_cluster_next(fs, last->cluster + last->count - 1);
+        }
+        if (next < 2 || fat32_cluster_eoc(next) || next >= fs->fat_entries) return;
+        //a looped chain would map forever
+        if (node->mapped >= fs->total_clusters) return;
+        if (fat32_extent_append_locked(node, next) < 0) return;
     }
+}
 
-    //count chain length and remember the tail
-    uint32 count = 0;
-    uint32 cluster = first_cluster;
-    uint32 last = cluster;
+//disk cluster at position index of the file and how many clusters from there
+//on are contiguous, -1 once the chain ends
+static int fat32_extent_lookup(fat32_node_t *node, uint32 index, uint32 *cluster_out, uint32 *run_out) {
+    fat32_fs_t *fs = node->fs;
+    spinlock_acquire(&fs->lock);
+    fat32_extent_fill_locked(node, index + 1);
+    if (index >= node->mapped) {
+        spinlock_release(&fs->lock);
+        return -1;
+    }
 
-    while (cluster >= 2 && cluster < FAT32_EOC_MIN) {
-        count++;
-        last = cluster;
-        uint32 next = fat32_cluster_next(fs, cluster);
-        if (next == cluster) break;
-        cluster = next;
-        if (count > fs->total_clusters + 1) break;
+    uint32 lo = 0;
+    uint32 hi = node->extent_count - 1;
+    while (lo < hi) {
+        uint32 mid = (lo + hi + 1) / 2;
+        if (node->extents[mid].index <= index) lo = mid;
+        else hi = mid - 1;
     }
+    fat32_extent_t *ext = &node->extents[lo];
+    *cluster_out = ext->cluster + (index - ext->index);
+    *run_out = ext->count - (index - ext->index);
+    spinlock_release(&fs->lock);
+    return 0;
+}
 
-    if (last_cluster) *last_cluster = last;
-    return count;
+//first free cluster at or after from, 0 if there is none
+static uint32 fat32_free_map_find(fat32_fs_t *fs, uint32 from, uint32 end) {
+    uint32 w = from / 64;
+    uint64 bits = fs->free_map[w] & (~0ULL << (from % 64));
+    for (;;) {
+        if (bits) {
+            uint32 cluster = w * 64 + (uint32)__builtin_ctzll(bits);
+            return cluster < end ? cluster : 0;
+        }
+        if (++w * 64 >= end) return 0;
+        bits = fs->free_map[w];
+    }
 }
 
 static uint32 fat32_alloc_cluster_locked(fat32_fs_t *fs) {
+    if (fs->free_count == 0) return 0;
+
     //start from the last hint and wrap once
-    uint32 start = fs->next_free_cluster < 2 ? 2 : fs->next_free_cluster;
-    for (uint32 pass = 0; pass < 2; pass++) {
-        uint32 begin = (pass == 0) ? start : 2;
-        uint32 end = (pass == 0) ? (fs->total_clusters + 2) : start;
-        for (uint32 cluster = begin; cluster < end; cluster++) {
-            if (fat32_fat_read_entry(fs, cluster) == 0) {
-                if (fat32_fat_write_entry_locked(fs, cluster, FAT32_EOC_MASK) < 0) return 0;
-                if (fat32_cluster_zero(fs, cluster) < 0) {
-                    fat32_fat_write_entry_locked(fs, cluster, 0);
-                    return 0;
-                }
-                fs->next_free_cluster = cluster + 1;
-                return cluster;
-            }
-        }
+    uint32 start = fs->next_free_cluster < 2 || fs->next_free_cluster >= fs->fat_entries ? 2 : fs->next_free_cluster;
+    uint32 cluster = fat32_free_map_find(fs, start, fs->fat_entries);
+    if (!cluster && start > 2) cluster = fat32_free_map_find(fs, 2, start);
+    if (!cluster) return 0;
+
+    if (fat32_fat_write_entry_locked(fs, cluster, FAT32_EOC_MASK) < 0) return 0;
+    if (fat32_cluster_zero(fs, cluster) < 0) {
+        fat32_fat_write_entry_locked(fs, cluster, 0);
+        return 0;
     }
-    return 0;
+    fs->next_free_cluster = cluster + 1;
+    fs->fsinfo_dirty = true;
+    return cluster;
 }
 
 static uint32 fat32_alloc_cluster(fat32_fs_t *fs) {
     if (!fs) return 0;
     spinlock_acquire(&fs->lock);
     uint32 cluster = fat32_alloc_cluster_locked(fs);
+    if (cluster && fat32_fat_flush_locked(fs) < 0) cluster = 0;
     spinlock_release(&fs->lock);
     return cluster;
 }
@@ -469,22 +587,34 @@ static uint32 fat32_alloc_cluster(fat32_fs_t *fs) {
 static int fat32_chain_ensure_locked(fat32_fs_t *fs, fat32_node_t *node, uint32 wanted_clusters) {
     if (!fs || !node || wanted_clusters == 0) return -1;
 
-    //grow the chain until it can hold the requested size
-    uint32 last = 0;
-    uint32 have = fat32_chain_length(fs, node->first_cluster, &last);
+    //grow the chain until it can hold the requested size, the extent map
+    //knows where it ends and takes every new cluster as it is linked
+    fat32_extent_fill_locked(node, UINT32_MAX);
+    uint32 have = node->mapped;
     if (have >= wanted_clusters) return 0;
 
+    //the map stops early if it runs out of memory, never link past a cluster that isn't the tail
+    uint32 last = 0;
+    if (node->extent_count) {
+        fat32_extent_t *tail = &node->extents[node->extent_count - 1];
+        last = tail->cluster + tail->count - 1;
+        uint32 next = fat32_cluster_next(fs, last);
+        if (next >= 2 && !fat32_cluster_eoc(next) && next < fs->fat_entries) return -1;
+    } else if (node->first_cluster >= 2) {
+        return -1;
+    }
+
     while (have < wanted_clusters) {
         uint32 cluster = fat32_alloc_cluster_locked(fs);
         if (!cluster) return -1;
 
         if (node->first_cluster < 2) {
             node->first_cluster = cluster;
-            last = cluster;
         } else {
             if (fat32_fat_write_entry_locked(fs, last, cluster) < 0) return -1;
-            last = cluster;
         }
+        last = cluster;
+        if (fat32_extent_append_locked(node, cluster) < 0) return -1;
         have++;
     }
 
@@ -496,6 +626,7 @@ static int fat32_chain_ensure(fat32_fs_t *fs, fat32_node_t *node, uint32 wanted_
     if (!fs) return -1;
     spinlock_acquire(&fs->lock);
     int rc = fat32_chain_ensure_locked(fs, node, wanted_clusters);
+    if (fat32_fat_flush_locked(fs) < 0) rc = -1;
     spinlock_release(&fs->lock);
     return rc;
 }
@@ -1030,44 +1161,30 @@ static ssize fat32_file_read(object_t *obj, void *buf, size len, size offset) {
     if (node->is_dir) return -1;
     if (node->first_cluster < 2 || offset >= node->size) return 0;
 
+    fat32_fs_t *fs = node->fs;
     size remaining = len;
     if (offset + remaining > node->size) remaining = node->size - offset;
 
-    size cluster_pages = (node->fs->cluster_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    void *phys = pmm_alloc(cluster_pages);
-    if (!phys) return -1;
-    void *tmp = P2V(phys);
-
+    //one device transfer per run of contiguous clusters, whole blocks bypass the cache
     size copied = 0;
     uint64 pos = offset;
     while (remaining > 0) {
-        //walk to the cluster that contains the current offset
-        uint32 cluster_index = (uint32)(pos / node->fs->cluster_size);
-        uint32 cluster_off = (uint32)(pos % node->fs->cluster_size);
-        uint32 cluster = node->first_cluster;
-
-        for (uint32 i = 0; i < cluster_index; i++) {
-            cluster = fat32_cluster_next(node->fs, cluster);
-            if (cluster < 2 || fat32_cluster_eoc(cluster)) {
-                pmm_free(phys, cluster_pages);
-                return (ssize)copied;
-            }
-        }
+        uint32 cluster_index = (uint32)(pos / fs->cluster_size);
+        uint32 cluster_off = (uint32)(pos % fs->cluster_size);
+        uint32 cluster, run;
+        if (fat32_extent_lookup(node, cluster_index, &cluster, &run) < 0) break;
 
-        if (fat32_cluster_read(node->fs, cluster, tmp) < 0) {
-            pmm_free(phys, cluster_pages);
+        uint64 chunk = (uint64)run * fs->cluster_size - cluster_off;
+        if (chunk > remaining) chunk = remaining;
+        if (fat32_dev_read_direct(fs, fat32_cluster_offset(fs, cluster) + cluster_off,
+                                  (uint8 *)buf + copied, (size)chunk) < 0) {
             return -1;
         }
-
-        size chunk = node->fs->cluster_size - cluster_off;
-        if (chunk > remaining) chunk = remaining;
-        memcpy((uint8 *)buf + copied, (uint8 *)tmp + cluster_off, chunk);
         copied += chunk;
         remaining -= chunk;
         pos += chunk;
     }
 
-    pmm_free(phys, cluster_pages);
     return (ssize)copied;
 }
 
@@ -1077,51 +1194,25 @@ static int fat32_file_write_range(fat32_node_t *node, size offset, const void *b
     size written = 0;
     uint64 pos = offset;
 
-    size cluster_pages = (fs->cluster_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    void *phys = pmm_alloc(cluster_pages);
-    if (!phys) return -1;
-    void *tmp = P2V(phys);
-
+    //the chain was extended by the caller, partial blocks at the ends of a
+    //run go through the block cache which merges them, the rest goes direct
     while (remaining > 0) {
-        //same cluster walk as read
         uint32 cluster_index = (uint32)(pos / fs->cluster_size);
         uint32 cluster_off = (uint32)(pos % fs->cluster_size);
-        uint32 cluster = node->first_cluster;
-
-        for (uint32 i = 0; i < cluster_index; i++) {
-            uint32 next = fat32_cluster_next(fs, cluster);
-            if (next < 2 || fat32_cluster_eoc(next)) {
-                //chain ended early, caller should have extended it
-                next = 0;
-            }
-            cluster = next ? next : cluster;
-            if (!next) break;
-        }
-
-        if (cluster < 2 || fat32_cluster_eoc(cluster)) {
-            pmm_free(phys, cluster_pages);
-            return -1;
-        }
-
-        if (fat32_cluster_read(fs, cluster, tmp) < 0) {
-            pmm_free(phys, cluster_pages);
-            return -1;
-        }
+        uint32 cluster, run;
+        if (fat32_extent_lookup(node, cluster_index, &cluster, &run) < 0) return -1;
 
-        size chunk = fs->cluster_size - cluster_off;
+        uint64 chunk = (uint64)run * fs->cluster_size - cluster_off;
         if (chunk > remaining) chunk = remaining;
-        memcpy((uint8 *)tmp + cluster_off, (const uint8 *)buf + written, chunk);
-        if (fat32_cluster_write(fs, cluster, tmp) < 0) {
-            pmm_free(phys, cluster_pages);
+        if (fat32_dev_write_direct(fs, fat32_cluster_offset(fs, cluster) + cluster_off,
+                                   (const uint8 *)buf + written, (size)chunk) < 0) {
             return -1;
         }
-
         written += chunk;
         remaining -= chunk;
         pos += chunk;
     }
 
-    pmm_free(phys, cluster_pages);
     return 0;
 }
 
@@ -1200,6 +1291,8 @@ static int fat32_dir_stat(object_t *obj, stat_t *st) {
 static int fat32_node_close(object_t *obj) {
     //node data is owned by the open object
     if (!obj || !obj->data) return 0;
+    fat32_node_t *node = (fat32_node_t *)obj->data;
+    kfree(node->extents);
     kfree(obj->data);
     obj->data = NULL;
     return 0;
@@ -1378,14 +1471,16 @@ static int fat32_free_chain(fat32_fs_t *fs, uint32 first_cluster) {
     while (cluster >= 2 && cluster < FAT32_EOC_MIN) {
         uint32 next = fat32_cluster_next(fs, cluster);
         if (fat32_fat_write_entry_locked(fs, cluster, 0) < 0) {
+            fat32_fat_flush_locked(fs);
             spinlock_release(&fs->lock);
             return -1;
         }
         if (next == cluster) break;
         cluster = next;
     }
+    int rc = fat32_fat_flush_locked(fs);
     spinlock_release(&fs->lock);
-    return 0;
+    return rc;
 }
 
 static int fat32_fs_stat_path(fat32_fs_t *fs, const char *path, stat_t *st) {
@@ -1529,8 +1624,7 @@ static int fat32_fs_create(fs_t *fs_obj, const char *path, uint32 type) {
         dotdot.first_cluster_hi = (uint16)((parent_cluster >> 16) & 0xFFFF);
         dotdot.first_cluster_lo = (uint16)(parent_cluster & 0xFFFF);
 
-        //zero the new dir cluster first
-        if (fat32_cluster_zero(fs, new_dir_cluster) < 0) return -1;
+        //fat32_alloc_cluster already blanked the new dir cluster
         if (fat32_dev_write_bytes(fs, fat32_cluster_offset(fs, new_dir_cluster), &dot, sizeof(dot)) < 0) return -1;
         if (fat32_dev_write_bytes(fs, fat32_cluster_offset(fs, new_dir_cluster) + sizeof(dot), &dotdot, sizeof(dotdot)) < 0) return -1;
         return 0;
@@ -1592,6 +1686,81 @@ static fs_ops_t fat32_ops = {
     .stat = fat32_fs_stat       //path stat
 };
 
+//the FAT is read once at mount and kept in memory, so it goes straight to the
+//device instead of filling the block cache with blocks nothing reads again
+//blocks already cached for the device are written back first so the device
+//holds the latest copy, later FAT updates go through the cache as usual
+static int fat32_fat_read_direct(fat32_fs_t *fs, uint64 fat_bytes) {
+    if (bcache_sync(fs->cache) < 0) return -1;
+    for (uint64 done = 0; done < fat_bytes; ) {
+        uint64 len = fat_bytes - done;
+        if (len > FAT32_FAT_READ_CHUNK) len = FAT32_FAT_READ_CHUNK;
+        if (object_read(fs->source, (uint8 *)fs->fat + done, len, fs->fat_offset + done) != (ssize)len) {
+            return -1;
+        }
+        done += len;
+    }
+    return 0;
+}
+
+static void fat32_fat_release(fat32_fs_t *fs) {
+    if (fs->fat) {
+        uint64 fat_bytes = (uint64)fs->fat_size_sectors * fs->bytes_per_sector;
+        kheap_free_scattered(fs->fat, (fat_bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    }
+    kfree(fs->free_map);
+    kfree(fs->fat_dirty);
+    fs->fat = NULL;
+    fs->free_map = NULL;
+    fs->fat_dirty = NULL;
+}
+
+//read the first FAT copy and the FSInfo hints, build the free cluster map
+static int fat32_fat_load(fat32_fs_t *fs) {
+    uint64 fat_bytes = (uint64)fs->fat_size_sectors * fs->bytes_per_sector;
+    uint64 entries = fat_bytes / 4;
+    if (entries > (uint64)fs->total_clusters + 2) entries = (uint64)fs->total_clusters + 2;
+    if (entries < 3) return -1;
+    fs->fat_entries = (uint32)entries;
+
+    //a large volume's FAT runs to megabytes, so it is backed page by page
+    fs->fat = kheap_alloc_scattered((fat_bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    fs->free_map = kzalloc(((entries + 63) / 64) * sizeof(uint64));
+    fs->fat_dirty = kzalloc(((fs->fat_size_sectors + 63) / 64) * sizeof(uint64));
+    if (!fs->fat || !fs->free_map || !fs->fat_dirty) {
+        fat32_fat_release(fs);
+        return -1;
+    }
+    if (fat32_fat_read_direct(fs, fat_bytes) < 0) {
+        fat32_fat_release(fs);
+        return -1;
+    }
+
+    fs->free_count = 0;
+    for (uint32 cluster = 2; cluster < fs->fat_entries; cluster++) {
+        if (fs->fat[cluster] & FAT32_EOC_MASK) continue;
+        fat32_free_map_set(fs, cluster, true);
+        fs->free_count++;
+    }
+
+    //FSInfo is only a hint: its allocation start is taken when it is in range
+    //and its free count is corrected from the scan if it went stale
+    fat32_fsinfo_t info;
+    uint64 offset = (uint64)fs->fsinfo_sector * fs->bytes_per_sector;
+    if (fs->fsinfo_sector >= 1 && fs->fsinfo_sector < fs->reserved_sectors &&
+        fs->bytes_per_sector >= sizeof(info) &&
+        fat32_dev_read_bytes(fs, offset, &info, sizeof(info)) == 0 &&
+        info.lead_sig == FAT32_FSINFO_LEAD_SIG && info.struc_sig == FAT32_FSINFO_STRUC_SIG &&
+        info.trail_sig == FAT32_FSINFO_TRAIL_SIG) {
+        fs->fsinfo_valid = true;
+        if (info.next_free != FAT32_FSINFO_UNKNOWN && info.next_free >= 2 && info.next_free < fs->fat_entries) {
+            fs->next_free_cluster = info.next_free;
+        }
+        fs->fsinfo_dirty = info.free_count != fs->free_count;
+    }
+    return 0;
+}
+
 intptr fat32_mount(object_t *source, const char *target) {
     if (!source || !target) return -1;
 
@@ -1689,11 +1858,31 @@ intptr fat32_mount(object_t *source, const char *target) {
         return -1;
     }
 
+    state->cache = bcache_attach(source);
+    if (!state->cache) {
+        object_deref(source);
+        kfree(fs);
+        kfree(state);
+        pmm_free(boot_phys, boot_pages);
+        return -1;
+    }
+
+    if (fat32_fat_load(state) < 0) {
+        bcache_detach(state->cache);
+        object_deref(source);
+        kfree(fs);
+        kfree(state);
+        pmm_free(boot_phys, boot_pages);
+        return -1;
+    }
+
     fs->name = "fat32";
     fs->ops = &fat32_ops;
     fs->data = state;
 
     if (fs_mount_register(target, fs) < 0) {
+        fat32_fat_release(state);
+        bcache_detach(state->cache);
         object_deref(source);
         kfree(fs);
         kfree(state);
@@ -1702,7 +1891,8 @@ intptr fat32_mount(object_t *source, const char *target) {
     }
 
     pmm_free(boot_phys, boot_pages);
-    printf("[fat32] mounted %s: %u bytes/sector, %u sectors/cluster, root cluster %u\n",
-           target, state->bytes_per_sector, state->sectors_per_cluster, state->root_cluster);
+    printf("[fat32] mounted %s: %u bytes/sector, %u sectors/cluster, root cluster %u, %u clusters free\n",
+           target, state->bytes_per_sector, state->sectors_per_cluster, state->root_cluster,
+           state->free_count);
     return 0;
 }
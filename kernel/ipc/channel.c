@@ -1,4 +1,8 @@
 #include <ipc/channel.h>
+#include <ipc/futex.h>
+#include <mm/vmo.h>
+#include <mm/mm.h>
+#include <sys/ring.h>
 #include <proc/process.h>
 #include <proc/event.h>
 #include <proc/bottom_half.h>
@@ -7,6 +11,119 @@
 #include <lib/io.h>
 #include <lib/spinlock.h>
 #include <drivers/serial.h>
+#include <errno.h>
+
+#define CHANNEL_SIGNALS (OBJECT_SIGNAL_READABLE | OBJECT_SIGNAL_WRITABLE | OBJECT_SIGNAL_PEER_CLOSED)
+
+//recompute both endpoints' signals from queue state, caller holds ch->lock
+static void channel_update_signals_locked(channel_t *ch) {
+    for (int id = 0; id < 2; id++) {
+        int peer_id = 1 - id;
+        uint32 set = 0;
+        if (ch->queue[id]) set |= OBJECT_SIGNAL_READABLE;
+        if (ch->closed[peer_id]) {
+            set |= OBJECT_SIGNAL_PEER_CLOSED;
+        } else if (ch->queue_len[peer_id] < CHANNEL_MSG_QUEUE_SIZE) {
+            set |= OBJECT_SIGNAL_WRITABLE;
+        }
+        object_signal(&ch->endpoints[id].obj, CHANNEL_SIGNALS & ~set, set);
+    }
+}
+
+//a thread parked in channel_call, lives on its own kernel stack
+typedef struct channel_caller {
+    uint32 txid;
+    channel_msg_entry_t *reply;     //set when the reply is handed over
+    wait_queue_t wq;
+    struct channel_caller *next;
+} channel_caller_t;
+
+//free a queue entry that never reached a receiver, dropping any transferred objects
+static void channel_entry_free(channel_msg_entry_t *entry) {
+    if (entry->data) kfree(entry->data);
+    for (uint32 i = 0; i < entry->object_count; i++) {
+        if (entry->objects[i]) object_deref(entry->objects[i]);
+    }
+    if (entry->objects) kfree(entry->objects);
+    if (entry->rights) kfree(entry->rights);
+    kfree(entry);
+}
+
+//what channel_enqueue_locked did with an entry
+typedef enum {
+    CHANNEL_ENQ_QUEUED,     //appended to the peer's queue
+    CHANNEL_ENQ_HANDED,     //given to a caller parked in channel_call
+    CHANNEL_ENQ_STALE,      //reply to a call that already gave up, caller frees it unlocked
+} channel_enq_t;
+
+static bool channel_caller_parked_locked(channel_t *ch, int id, uint32 txid) {
+    for (channel_caller_t *c = ch->callers[id]; c; c = c->next) {
+        if (c->txid == txid) return true;
+    }
+    return false;
+}
+
+//append entry to peer_id's queue and wake a receiver, caller holds ch->lock
+//handoff queues the receiver to run next here because the sender is about to block
+//a reply to a parked channel_call skips the queue and goes to that caller only.
+//a kernel txid with no caller on either end is a reply that arrived after its
+//call timed out, nobody will ever claim it so it is not queued
+static channel_enq_t channel_enqueue_locked(channel_t *ch, int peer_id, channel_msg_entry_t *entry, bool handoff) {
+    entry->next = NULL;
+    if (entry->txid) {
+        for (channel_caller_t **pp = &ch->callers[peer_id]; *pp; pp = &(*pp)->next) {
+            channel_caller_t *c = *pp;
+            if (c->txid != entry->txid) continue;
+            *pp = c->next;
+            c->reply = entry;
+            if (handoff) thread_wake_one_handoff(&c->wq);
+            else thread_wake_one(&c->wq);
+            return CHANNEL_ENQ_HANDED;
+        }
+        //the request itself still has its caller registered on the sending end
+        if ((entry->txid & CHANNEL_TXID_KERNEL) &&
+            !channel_caller_parked_locked(ch, 1 - peer_id, entry->txid)) {
+            return CHANNEL_ENQ_STALE;
+        }
+    }
+
+    if (ch->queue_tail[peer_id]) {
+        ch->queue_tail[peer_id]->next = entry;
+    } else {
+        ch->queue[peer_id] = entry;
+    }
+    ch->queue_tail[peer_id] = entry;
+    ch->queue_len[peer_id]++;
+
+    if (handoff) {
+        thread_wake_one_handoff(&ch->waiters[peer_id]);
+    } else {
+        thread_wake_one(&ch->waiters[peer_id]);
+    }
+    channel_update_signals_locked(ch);
+    return CHANNEL_ENQ_QUEUED;
+}
+
+void channel_push_locked(channel_t *ch, int peer_id, channel_msg_entry_t *entry) {
+    //driver events never carry a kernel txid so they are never stale
+    channel_enqueue_locked(ch, peer_id, entry, false);
+}
+
+//tell a ring user its peer is gone: flag the endpoint and kick every sleeper
+//clearing the waiting words makes a waiter racing with us see a changed futex
+static void channel_ring_mark_closed(vmo_t *vmo, int id) {
+    uintptr ctrl_phys = vmo_commit_page(vmo, 0);
+    if (!ctrl_phys) return;
+    ring_ctrl_t *ctrl = (ring_ctrl_t *)P2V(ctrl_phys);
+    __atomic_or_fetch(&ctrl->closed, 1u << id, __ATOMIC_SEQ_CST);
+    for (int d = 0; d < 2; d++) {
+        ring_dir_t *dir = &ctrl->dir[d];
+        __atomic_store_n(&dir->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&dir->producer_waiting, 0, __ATOMIC_SEQ_CST);
+        futex_wake_object(&vmo->obj, (uintptr)&dir->consumer_waiting - (uintptr)ctrl, UINT32_MAX);
+        futex_wake_object(&vmo->obj, (uintptr)&dir->producer_waiting - (uintptr)ctrl, UINT32_MAX);
+    }
+}
 
 static int channel_endpoint_close(object_t *obj) {
     channel_endpoint_t *ep = (channel_endpoint_t *)obj;
@@ -23,6 +140,9 @@ static int channel_endpoint_close(object_t *obj) {
     //wake any threads waiting on either end - their wait state is now invalid
     thread_wake_all(&ch->waiters[id]);
     thread_wake_all(&ch->waiters[1 - id]);
+    for (int i = 0; i < 2; i++) {
+        for (channel_caller_t *c = ch->callers[i]; c; c = c->next) thread_wake_one(&c->wq);
+    }
 
     //free any pending messages in our queue
     channel_msg_entry_t *msg = ch->queue[id];
@@ -42,12 +162,16 @@ static int channel_endpoint_close(object_t *obj) {
     ch->queue_tail[id] = NULL;
     ch->queue_len[id] = 0;
 
+    channel_update_signals_locked(ch);
     spinlock_irq_release(&ch->lock, flags);
 
+    if (ch->ring_vmo) channel_ring_mark_closed(ch->ring_vmo, id);
+
     //decrement the channel's own lifetime refcount; free only when both endpoints are gone
     //ch_refcount is decremented atomically outside the channel lock to avoid
     //holding the lock across kfree
     if (__atomic_sub_fetch(&ch->ch_refcount, 1, __ATOMIC_SEQ_CST) == 0) {
+        if (ch->ring_vmo) object_deref(&ch->ring_vmo->obj);
         kfree(ch);
     }
 
@@ -93,6 +217,7 @@ int channel_create(process_t *proc, handle_rights_t rights,
         wait_queue_init(&ch->waiters[i]);
     }
     spinlock_irq_init(&ch->lock);
+    channel_update_signals_locked(ch);
 
     //grant handles to process
     //process_grant_handle refs the object; deref the construction ref so handle close frees the endpoint
@@ -121,6 +246,65 @@ int channel_create(process_t *proc, handle_rights_t rights,
     return 0;
 }
 
+int channel_create_ring(process_t *proc, handle_rights_t rights, uint32 ring_size,
+                        int32 *out_endpoint0, int32 *out_endpoint1, int32 *out_vmo) {
+    if (!proc || !out_endpoint0 || !out_endpoint1 || !out_vmo) return -EINVAL;
+    if (ring_size < RING_MIN_SIZE || ring_size > RING_MAX_SIZE) return -EINVAL;
+    if (ring_size & (ring_size - 1)) return -EINVAL;
+
+    int32 vh = vmo_create(proc, RING_VMO_SIZE(ring_size), VMO_FLAG_NONE,
+                          HANDLE_RIGHTS_BASIC | HANDLE_RIGHTS_IO | HANDLE_RIGHT_MAP);
+    if (vh < 0) return -ENOMEM;
+    vmo_t *vmo = vmo_get(proc, vh);
+    if (!vmo) {
+        process_close_handle(proc, vh);
+        return -ENOMEM;
+    }
+
+    //fresh VMOs are zeroed so only the constants need filling in
+    //the control page is committed here and stays put, ring data pages are demand paged
+    uintptr ctrl_phys = vmo_commit_page(vmo, 0);
+    if (!ctrl_phys) {
+        process_close_handle(proc, vh);
+        return -ENOMEM;
+    }
+    ring_ctrl_t *ctrl = (ring_ctrl_t *)P2V(ctrl_phys);
+    ctrl->magic = RING_MAGIC;
+    ctrl->ring_size = ring_size;
+
+    int32 h0, h1;
+    if (channel_create(proc, rights, &h0, &h1) != 0) {
+        process_close_handle(proc, vh);
+        return -ENOMEM;
+    }
+
+    //no peer can exist yet so publishing the ring without the lock is fine
+    channel_endpoint_t *ep = channel_get_endpoint(proc, h0);
+    object_ref(&vmo->obj);
+    ep->channel->ring_vmo = vmo;
+
+    *out_endpoint0 = h0;
+    *out_endpoint1 = h1;
+    *out_vmo = vh;
+    return 0;
+}
+
+int channel_ring_get_vmo(process_t *proc, int32 endpoint_handle, int32 *out_vmo) {
+    if (!proc || !out_vmo) return -EINVAL;
+
+    channel_endpoint_t *ep = channel_get_endpoint(proc, endpoint_handle);
+    if (!ep) return -EBADF;
+    vmo_t *vmo = ep->channel->ring_vmo;
+    if (!vmo) return -EINVAL;
+
+    int32 vh = process_grant_handle(proc, &vmo->obj,
+                                    HANDLE_RIGHTS_BASIC | HANDLE_RIGHTS_IO | HANDLE_RIGHT_MAP);
+    if (vh < 0) return -ENOMEM;
+
+    *out_vmo = vh;
+    return ep->endpoint_id;
+}
+
 channel_endpoint_t *channel_get_endpoint(process_t *proc, int32 handle) {
     if (!proc) return NULL;
 
@@ -130,7 +314,7 @@ channel_endpoint_t *channel_get_endpoint(process_t *proc, int32 handle) {
     return (channel_endpoint_t *)obj;
 }
 
-int channel_send(process_t *proc, int32 endpoint_handle, channel_msg_t *msg) {
+static int channel_send_common(process_t *proc, int32 endpoint_handle, channel_msg_t *msg, bool handoff) {
     if (!proc || !msg) return -1;
     if (!process_handle_has_rights(proc, endpoint_handle, HANDLE_RIGHT_WRITE)) {
         return -8;
@@ -167,6 +351,7 @@ int channel_send(process_t *proc, int32 endpoint_handle, channel_msg_t *msg) {
 
     //record sender PID
     entry->sender_pid = proc->pid;
+    entry->txid = msg->txid;
 
     //transfer handles (MOVE semantics)
     if (msg->handle_count > 0 && msg->handles) {
@@ -250,22 +435,12 @@ int channel_send(process_t *proc, int32 endpoint_handle, channel_msg_t *msg) {
         return -3;  //queue full
     }
 
-    //enqueue message to peer's queue
-    entry->next = NULL;
-    if (ch->queue_tail[peer_id]) {
-        ch->queue_tail[peer_id]->next = entry;
-    } else {
-        ch->queue[peer_id] = entry;
-    }
-    ch->queue_tail[peer_id] = entry;
-    ch->queue_len[peer_id]++;
-
-    //wake any thread waiting for a message on this endpoint
-    thread_wake_one(&ch->waiters[peer_id]);
+    //enqueue message to peer's queue and wake any thread waiting on it
+    channel_enq_t enq = channel_enqueue_locked(ch, peer_id, entry, handoff);
 
     //if peer has a handler registered, call it immediately (synchronous dispatch)
     channel_endpoint_t *peer_ep = &ch->endpoints[peer_id];
-    if (peer_ep->handler) {
+    if (enq == CHANNEL_ENQ_QUEUED && peer_ep->handler) {
         //dequeue the message we just enqueued
         channel_msg_t handler_msg;
         memset(&handler_msg, 0, sizeof(handler_msg));
@@ -278,6 +453,7 @@ int channel_send(process_t *proc, int32 endpoint_handle, channel_msg_t *msg) {
             handler_msg.data = e->data;
             handler_msg.data_len = e->data_len;
             handler_msg.sender_pid = e->sender_pid;
+            handler_msg.txid = e->txid;
             handler_msg.handles = NULL;  //not used for kernel handlers
             handler_msg.handle_count = 0;
 
@@ -291,6 +467,7 @@ int channel_send(process_t *proc, int32 endpoint_handle, channel_msg_t *msg) {
             e->rights = NULL;
             kfree(e);
 
+            channel_update_signals_locked(ch);
             spinlock_irq_release(&ch->lock, flags);
 
             //send is committed - now safe to remove sender's handles (MOVE semantics)
@@ -307,6 +484,7 @@ int channel_send(process_t *proc, int32 endpoint_handle, channel_msg_t *msg) {
     }
 
     spinlock_irq_release(&ch->lock, flags);
+    if (enq == CHANNEL_ENQ_STALE) channel_entry_free(entry);
 
     //send is committed - now safe to remove sender's handles (MOVE semantics)
     if (msg->handle_count > 0 && msg->handles) {
@@ -318,65 +496,54 @@ int channel_send(process_t *proc, int32 endpoint_handle, channel_msg_t *msg) {
     return 0;
 }
 
-int channel_recv(process_t *proc, int32 endpoint_handle, channel_msg_t *msg) {
-    if (!proc || !msg) return -1;
-    if (!process_handle_has_rights(proc, endpoint_handle, HANDLE_RIGHT_READ)) {
-        return -4;
-    }
-
-    channel_endpoint_t *ep = channel_get_endpoint(proc, endpoint_handle);
-    if (!ep) return -1;
-
-    channel_t *ch = ep->channel;
-    int my_id = ep->endpoint_id;
+int channel_send(process_t *proc, int32 endpoint_handle, channel_msg_t *msg) {
+    return channel_send_common(proc, endpoint_handle, msg, false);
+}
 
-    //wait for a message (blocking)
-    irq_state_t flags = spinlock_irq_acquire(&ch->lock);
+//block until my_id's queue is non-empty, entered and left with ch->lock held
+//on error the lock has been dropped: -2 peer closed, -3 interrupted
+static int channel_wait_locked(channel_t *ch, int my_id, irq_state_t *flags) {
     while (!ch->queue[my_id]) {
         //check if peer closed
         if (ch->closed[1 - my_id]) {
-            spinlock_irq_release(&ch->lock, flags);
+            spinlock_irq_release(&ch->lock, *flags);
             return -2;  //peer closed, no more messages
         }
         
-        spinlock_irq_release(&ch->lock, flags);
+        spinlock_irq_release(&ch->lock, *flags);
         bottom_half_run_budget(16);
         if (proc_current_should_abort_blocking()) {
             return -3;  //interrupted by process event
         }
-        flags = spinlock_irq_acquire(&ch->lock);
+        *flags = spinlock_irq_acquire(&ch->lock);
 
         if (ch->queue[my_id]) {
             break;
         }
         if (ch->closed[1 - my_id]) {
-            spinlock_irq_release(&ch->lock, flags);
+            spinlock_irq_release(&ch->lock, *flags);
             return -2;
         }
 
         //atomically release channel lock + sleep to avoid missed wakeups
-        thread_sleep_locked_irq(&ch->waiters[my_id], &ch->lock, &flags);
+        thread_sleep_locked_irq(&ch->waiters[my_id], &ch->lock, flags);
 
         //if peer closed while we were sleeping, return error
         if (ch->closed[1 - my_id] && !ch->queue[my_id]) {
-            spinlock_irq_release(&ch->lock, flags);
+            spinlock_irq_release(&ch->lock, *flags);
             return -2;
         }
     }
+    return 0;
+}
 
-    //dequeue message
-    channel_msg_entry_t *entry = ch->queue[my_id];
-    ch->queue[my_id] = entry->next;
-    if (!ch->queue[my_id]) {
-        ch->queue_tail[my_id] = NULL;
-    }
-    ch->queue_len[my_id]--;
-    spinlock_irq_release(&ch->lock, flags);
-
-    //copy data to caller (outside lock - entry is ours now)
+//hand a dequeued entry to the receiver: payload ownership moves to msg and
+//transferred objects become handles in proc. entry is always consumed
+static int channel_entry_deliver(process_t *proc, channel_msg_entry_t *entry, channel_msg_t *msg) {
     msg->data = entry->data;  //caller takes ownership
     msg->data_len = entry->data_len;
     msg->sender_pid = entry->sender_pid;
+    msg->txid = entry->txid;
     entry->data = NULL;  //don't free it
 
     //grant handles to receiver
@@ -390,6 +557,10 @@ int channel_recv(process_t *proc, int32 endpoint_handle, channel_msg_t *msg) {
             kfree(entry->objects);
             kfree(entry->rights);
             kfree(entry);
+            //free the payload we already handed to the caller
+            if (msg->data) kfree(msg->data);
+            msg->data = NULL;
+            msg->data_len = 0;
             return -1;
         }
         msg->handle_count = entry->object_count;
@@ -432,6 +603,186 @@ int channel_recv(process_t *proc, int32 endpoint_handle, channel_msg_t *msg) {
     return 0;
 }
 
+//payloads of a batch that is refused as a whole
+static void channel_batch_drop(channel_msg_t *msgs, uint32 count) {
+    for (uint32 i = 0; i < count; i++) {
+        kfree(msgs[i].data);
+        msgs[i].data = NULL;
+    }
+}
+
+int channel_send_batch(process_t *proc, int32 endpoint_handle, channel_msg_t *msgs, uint32 count) {
+    if (!proc || !msgs) return -EINVAL;
+    if (count == 0) return 0;
+    if (count > CHANNEL_BATCH_MAX) {
+        channel_batch_drop(msgs, count);
+        return -EINVAL;
+    }
+    if (!process_handle_has_rights(proc, endpoint_handle, HANDLE_RIGHT_WRITE)) {
+        channel_batch_drop(msgs, count);
+        return -EACCES;
+    }
+
+    channel_endpoint_t *ep = channel_get_endpoint(proc, endpoint_handle);
+    if (!ep) {
+        channel_batch_drop(msgs, count);
+        return -EBADF;
+    }
+
+    channel_t *ch = ep->channel;
+    int peer_id = 1 - ep->endpoint_id;
+
+    //kernel handlers dispatch synchronously per message so take the normal path
+    if (ch->endpoints[peer_id].handler) {
+        uint32 sent = 0;
+        for (; sent < count; sent++) {
+            int rc = channel_send(proc, endpoint_handle, &msgs[sent]);
+            kfree(msgs[sent].data);
+            msgs[sent].data = NULL;
+            if (rc != 0) {
+                for (uint32 i = sent + 1; i < count; i++) {
+                    kfree(msgs[i].data);
+                    msgs[i].data = NULL;
+                }
+                return sent ? (int)sent : rc;
+            }
+        }
+        return (int)sent;
+    }
+
+    //build every entry before taking the lock, payloads are adopted not copied
+    channel_msg_entry_t *entries[CHANNEL_BATCH_MAX];
+    for (uint32 i = 0; i < count; i++) {
+        entries[i] = kzalloc(sizeof(channel_msg_entry_t));
+        if (!entries[i]) {
+            for (uint32 j = 0; j < i; j++) channel_entry_free(entries[j]);
+            channel_batch_drop(msgs + i, count - i);
+            return -ENOMEM;
+        }
+        entries[i]->data = msgs[i].data;
+        entries[i]->data_len = msgs[i].data ? msgs[i].data_len : 0;
+        entries[i]->sender_pid = proc->pid;
+        msgs[i].data = NULL;
+    }
+
+    irq_state_t flags = spinlock_irq_acquire(&ch->lock);
+    if (ch->closed[peer_id]) {
+        spinlock_irq_release(&ch->lock, flags);
+        for (uint32 i = 0; i < count; i++) channel_entry_free(entries[i]);
+        return -2;  //peer closed
+    }
+
+    //enqueue as many as fit, one wakeup and one signal update for the lot
+    uint32 room = CHANNEL_MSG_QUEUE_SIZE - ch->queue_len[peer_id];
+    uint32 sent = count < room ? count : room;
+    for (uint32 i = 0; i < sent; i++) {
+        channel_msg_entry_t *entry = entries[i];
+        entry->next = NULL;
+        if (ch->queue_tail[peer_id]) {
+            ch->queue_tail[peer_id]->next = entry;
+        } else {
+            ch->queue[peer_id] = entry;
+        }
+        ch->queue_tail[peer_id] = entry;
+    }
+    ch->queue_len[peer_id] += sent;
+    if (sent > 0) {
+        thread_wake_all(&ch->waiters[peer_id]);
+        channel_update_signals_locked(ch);
+    }
+    spinlock_irq_release(&ch->lock, flags);
+
+    for (uint32 i = sent; i < count; i++) channel_entry_free(entries[i]);
+    return sent ? (int)sent : -3;  //queue full
+}
+
+int channel_recv_batch(process_t *proc, int32 endpoint_handle, channel_msg_t *msgs,
+                       uint32 count, bool block) {
+    if (!proc || !msgs) return -EINVAL;
+    if (count == 0) return 0;
+    if (count > CHANNEL_BATCH_MAX) return -EINVAL;
+    if (!process_handle_has_rights(proc, endpoint_handle, HANDLE_RIGHT_READ)) {
+        return -EACCES;
+    }
+
+    channel_endpoint_t *ep = channel_get_endpoint(proc, endpoint_handle);
+    if (!ep) return -EBADF;
+
+    channel_t *ch = ep->channel;
+    int my_id = ep->endpoint_id;
+
+    irq_state_t flags = spinlock_irq_acquire(&ch->lock);
+    if (block) {
+        int rc = channel_wait_locked(ch, my_id, &flags);
+        if (rc != 0) return rc;
+    } else if (!ch->queue[my_id]) {
+        int rc = ch->closed[1 - my_id] ? -2 : -3;
+        spinlock_irq_release(&ch->lock, flags);
+        return rc;
+    }
+
+    //detach up to count entries in one go
+    channel_msg_entry_t *head = ch->queue[my_id];
+    channel_msg_entry_t *last = head;
+    uint32 taken = 1;
+    while (taken < count && last->next) {
+        last = last->next;
+        taken++;
+    }
+    ch->queue[my_id] = last->next;
+    if (!ch->queue[my_id]) ch->queue_tail[my_id] = NULL;
+    ch->queue_len[my_id] -= taken;
+    last->next = NULL;
+    channel_update_signals_locked(ch);
+    spinlock_irq_release(&ch->lock, flags);
+
+    //data-only receive: transferred handles are dropped like sys_channel_recv does
+    channel_msg_entry_t *entry = head;
+    for (uint32 i = 0; i < taken; i++) {
+        channel_msg_entry_t *next = entry->next;
+        msgs[i].data = entry->data;  //caller takes ownership
+        msgs[i].data_len = entry->data_len;
+        msgs[i].sender_pid = entry->sender_pid;
+        msgs[i].txid = entry->txid;
+        msgs[i].handles = NULL;
+        msgs[i].handle_count = 0;
+        entry->data = NULL;
+        channel_entry_free(entry);
+        entry = next;
+    }
+    return (int)taken;
+}
+
+int channel_recv(process_t *proc, int32 endpoint_handle, channel_msg_t *msg) {
+    if (!proc || !msg) return -1;
+    if (!process_handle_has_rights(proc, endpoint_handle, HANDLE_RIGHT_READ)) {
+        return -4;
+    }
+
+    channel_endpoint_t *ep = channel_get_endpoint(proc, endpoint_handle);
+    if (!ep) return -1;
+
+    channel_t *ch = ep->channel;
+    int my_id = ep->endpoint_id;
+
+    //wait for a message (blocking)
+    irq_state_t flags = spinlock_irq_acquire(&ch->lock);
+    int rc = channel_wait_locked(ch, my_id, &flags);
+    if (rc != 0) return rc;
+
+    //dequeue message
+    channel_msg_entry_t *entry = ch->queue[my_id];
+    ch->queue[my_id] = entry->next;
+    if (!ch->queue[my_id]) {
+        ch->queue_tail[my_id] = NULL;
+    }
+    ch->queue_len[my_id]--;
+    channel_update_signals_locked(ch);
+    spinlock_irq_release(&ch->lock, flags);
+
+    return channel_entry_deliver(proc, entry, msg);
+}
+
 int channel_try_recv(process_t *proc, int32 endpoint_handle, channel_msg_t *msg) {
     if (!proc || !msg) return -1;
     if (!process_handle_has_rights(proc, endpoint_handle, HANDLE_RIGHT_READ)) {
@@ -464,69 +815,74 @@ int channel_try_recv(process_t *proc, int32 endpoint_handle, channel_msg_t *msg)
         ch->queue_tail[my_id] = NULL;
     }
     ch->queue_len[my_id]--;
+    channel_update_signals_locked(ch);
     spinlock_irq_release(&ch->lock, flags);
 
-    //copy data to caller (outside lock - entry is ours now)
-    msg->data = entry->data;  //caller takes ownership
-    msg->data_len = entry->data_len;
-    msg->sender_pid = entry->sender_pid;
-    entry->data = NULL;  //don't free it
+    return channel_entry_deliver(proc, entry, msg);
+}
 
-    //grant handles to receiver
-    if (entry->object_count > 0) {
-        msg->handles = kzalloc(entry->object_count * sizeof(int32));
-        if (!msg->handles) {
-            //cleanup objects
-            for (uint32 i = 0; i < entry->object_count; i++) {
-                if (entry->objects[i]) object_deref(entry->objects[i]);
-            }
-            kfree(entry->objects);
-            kfree(entry->rights);
-            kfree(entry);
-            //free the payload we already handed to the caller
-            if (msg->data) kfree(msg->data);
-            msg->data = NULL;
-            msg->data_len = 0;
-            return -1;
-        }
-        msg->handle_count = entry->object_count;
+//kernel-generated txids have the top bit set so they are never 0 and never
+//collide with ids a server picks for its own messages
+static uint32 channel_txid_next;
 
-        for (uint32 i = 0; i < entry->object_count; i++) {
-            int h = process_grant_handle(proc, entry->objects[i], entry->rights[i]);
-            if (h < 0) {
-                //partial failure close already-granted handles
-                for (uint32 j = 0; j < i; j++) {
-                    process_close_handle(proc, msg->handles[j]);
-                }
-                //deref remaining objects
-                for (uint32 j = i; j < entry->object_count; j++) {
-                    if (entry->objects[j]) object_deref(entry->objects[j]);
-                }
-                kfree(msg->handles);
-                msg->handles = NULL;
-                msg->handle_count = 0;
-                //free the payload we already handed to the caller
-                if (msg->data) kfree(msg->data);
-                msg->data = NULL;
-                msg->data_len = 0;
-                kfree(entry->objects);
-                kfree(entry->rights);
-                kfree(entry);
-                return -1;
+int channel_call(process_t *proc, int32 endpoint_handle, channel_msg_t *msg,
+                 channel_msg_t *reply, uint64 deadline_ns) {
+    if (!proc || !msg || !reply) return -1;
+    if (!process_handle_has_rights(proc, endpoint_handle, HANDLE_RIGHT_READ)) {
+        return -4;
+    }
+
+    channel_endpoint_t *ep = channel_get_endpoint(proc, endpoint_handle);
+    if (!ep) return -1;
+
+    channel_t *ch = ep->channel;
+    int my_id = ep->endpoint_id;
+
+    channel_caller_t call;
+    call.txid = __atomic_add_fetch(&channel_txid_next, 1, __ATOMIC_RELAXED) | CHANNEL_TXID_KERNEL;
+    call.reply = NULL;
+    wait_queue_init(&call.wq);
+    msg->txid = call.txid;
+
+    //register before sending so a reply racing in from another CPU finds us
+    irq_state_t flags = spinlock_irq_acquire(&ch->lock);
+    call.next = ch->callers[my_id];
+    ch->callers[my_id] = &call;
+    spinlock_irq_release(&ch->lock, flags);
+
+    //hand the CPU to the server thread, we give it up as soon as we sleep below
+    int rc = channel_send_common(proc, endpoint_handle, msg, true);
+
+    bool expired = false;
+    flags = spinlock_irq_acquire(&ch->lock);
+    while (rc == 0 && !call.reply) {
+        if (ch->closed[1 - my_id]) {
+            rc = -2;  //peer closed before replying
+        } else if (expired) {
+            rc = -ETIMEDOUT;
+        } else if (proc_current_should_abort_blocking()) {
+            rc = -3;  //interrupted by process event
+        } else if (deadline_ns == CHANNEL_WAIT_FOREVER) {
+            thread_sleep_locked_irq(&call.wq, &ch->lock, &flags);
+        } else {
+            //one more check after the deadline in case the reply beat the timer
+            expired = thread_sleep_locked_irq_until(&call.wq, &ch->lock,
+                                                    &flags, deadline_ns) != 0;
+        }
+    }
+    //still registered unless the reply unlinked us, a late reply is dropped
+    if (!call.reply) {
+        for (channel_caller_t **pp = &ch->callers[my_id]; *pp; pp = &(*pp)->next) {
+            if (*pp == &call) {
+                *pp = call.next;
+                break;
             }
-            msg->handles[i] = h;
-            object_deref(entry->objects[i]);  //grant added ref sp we remove ours
         }
-
-        kfree(entry->objects);
-        kfree(entry->rights);
-    } else {
-        msg->handles = NULL;
-        msg->handle_count = 0;
     }
+    spinlock_irq_release(&ch->lock, flags);
 
-    kfree(entry);
-    return 0;
+    if (!call.reply) return rc;
+    return channel_entry_deliver(proc, call.reply, reply);
 }
 
 int channel_close(process_t *proc, int32 endpoint_handle) {
@@ -579,6 +935,7 @@ int channel_reply(channel_endpoint_t *ep, channel_msg_t *msg) {
         memcpy(entry->data, msg->data, msg->data_len);
         entry->data_len = msg->data_len;
     }
+    entry->txid = msg->txid;
 
     //handle transfer: copy objects from kernel-side fields
     if (msg->object_count > 0 && msg->objects && msg->rights) {
@@ -623,17 +980,10 @@ int channel_reply(channel_endpoint_t *ep, channel_msg_t *msg) {
         return -2;
     }
 
-    //enqueue to peer
-    entry->next = NULL;
-    if (ch->queue_tail[peer_id]) {
-        ch->queue_tail[peer_id]->next = entry;
-    } else {
-        ch->queue[peer_id] = entry;
-    }
-    ch->queue_tail[peer_id] = entry;
-    ch->queue_len[peer_id]++;
-
+    //enqueue to peer, straight to the caller if it is parked in channel_call
+    channel_enq_t enq = channel_enqueue_locked(ch, peer_id, entry, false);
     spinlock_irq_release(&ch->lock, flags);
+    if (enq == CHANNEL_ENQ_STALE) channel_entry_free(entry);
 
     return 0;
 }
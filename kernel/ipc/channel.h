@@ -19,10 +19,14 @@
 #define CHANNEL_MAX_MSG_SIZE    4096
 #define CHANNEL_MAX_MSG_HANDLES 64
 #define CHANNEL_MSG_QUEUE_SIZE  16
+#define CHANNEL_BATCH_MAX       CHANNEL_MSG_QUEUE_SIZE  //a batch never needs more than a full queue
+#define CHANNEL_TXID_KERNEL     0x80000000u             //set on every txid channel_call stamps, so never 0
+#define CHANNEL_WAIT_FOREVER    UINT64_MAX
 
 //forward declarations
 struct process;
 struct channel;
+struct vmo;
 
 //message structure (for sending/receiving)
 typedef struct channel_msg {
@@ -31,6 +35,7 @@ typedef struct channel_msg {
     int32 *handles;          //array of handles to transfer (for userspace)
     uint32 handle_count;     //number of handles
     uint32 sender_pid;       //PID of the process that sent this message (0 if kernel)
+    uint32 txid;             //channel_call transaction the message belongs to, 0 if none
     
     //kernel-side: raw objects for kernel handlers (not for userspace)
     struct object **objects; //transferred objects (with +1 ref)
@@ -46,6 +51,7 @@ typedef struct channel_msg_entry {
     handle_rights_t *rights; //rights for each transferred object
     uint32 object_count;
     uint32 sender_pid; //PID of the sending process
+    uint32 txid; //transaction id from the header, 0 for plain messages
     struct channel_msg_entry *next;
 } channel_msg_entry_t;
 
@@ -71,10 +77,15 @@ typedef struct channel {
     
     //wait queues (threads waiting for messages on each endpoint)
     wait_queue_t waiters[2];
+    struct channel_caller *callers[2]; //threads parked in channel_call on each endpoint
     
     //state
     int closed[2]; //1 if endpoint is closed
     
+    //shared ring VMO for ring channels (NULL for message-only channels)
+    //layout is ring_ctrl_t from sys/ring.h, the channel holds one ref
+    struct vmo *ring_vmo;
+    
     //channel lifetime refcount: starts at 2 (one per endpoint), kfree'd when it reaches 0
     //this is separate from the per-endpoint object refcounts which track handle ownership
     uint32 ch_refcount;
@@ -91,10 +102,37 @@ int channel_create(struct process *proc,
                    int32 *out_endpoint0, 
                    int32 *out_endpoint1);
 
+//create a channel pair with a shared SPSC ring VMO (see sys/ring.h)
+//ring_size is the per-direction data size and must be a power of two
+//the caller also gets a handle to the ring VMO in *out_vmo
+int channel_create_ring(struct process *proc,
+                        handle_rights_t rights,
+                        uint32 ring_size,
+                        int32 *out_endpoint0,
+                        int32 *out_endpoint1,
+                        int32 *out_vmo);
+
+//grant a handle to a ring channel's VMO, for the process holding the other end
+//returns the endpoint id (ring direction) or negative error
+int channel_ring_get_vmo(struct process *proc, int32 endpoint_handle, int32 *out_vmo);
+
 //send a message through a channel endpoint
 //handles listed in msg are MOVED from sender (removed from their table)
 int channel_send(struct process *proc, int32 endpoint_handle, channel_msg_t *msg);
 
+//send up to CHANNEL_BATCH_MAX data-only messages under one lock acquisition
+//msgs[i].data must be kmalloc'd and is always consumed (set to NULL)
+//returns how many were queued (a prefix of msgs) or negative if none were:
+//-EINVAL for a bad count, -EACCES without the write right, -2 peer closed, -3 queue full
+int channel_send_batch(struct process *proc, int32 endpoint_handle, channel_msg_t *msgs, uint32 count);
+
+//dequeue up to count messages under one lock acquisition, waiting for the
+//first one if block is set. transferred handles are dropped
+//returns the number received, caller frees each msgs[i].data, -EINVAL for a
+//bad count, -EACCES without the read right, -2 peer closed, -3 nothing queued
+int channel_recv_batch(struct process *proc, int32 endpoint_handle, channel_msg_t *msgs,
+                       uint32 count, bool block);
+
 //receive a message from a channel endpoint
 //handles in the message are added to receiver's handle table
 //caller must free msg->data after use
@@ -103,6 +141,18 @@ int channel_recv(struct process *proc, int32 endpoint_handle, channel_msg_t *msg
 //non-blocking version of channel_recv
 int channel_try_recv(struct process *proc, int32 endpoint_handle, channel_msg_t *msg);
 
+//synchronous request/reply in one step
+//msg->txid is set to a fresh transaction id carried in the message header, the
+//payload is not touched. a message sent back with the same txid is handed
+//straight to this caller and never queued, so plain receives on the endpoint
+//cannot take it. a reply arriving after the call gave up is dropped
+//the server thread is woken to run next on this CPU (direct handoff) and the
+//reply wakes us the same way. deadline_ns is absolute ktimer_now() time
+//returns 0 with *reply filled like channel_recv, -2 peer closed, -3 interrupted,
+//-ETIMEDOUT, or a channel_send error
+int channel_call(struct process *proc, int32 endpoint_handle, channel_msg_t *msg,
+                 channel_msg_t *reply, uint64 deadline_ns);
+
 //close a channel endpoint
 //the peer endpoint will receive a "peer closed" signal
 int channel_close(struct process *proc, int32 endpoint_handle);
@@ -113,6 +163,10 @@ int channel_peer_closed(struct process *proc, int32 endpoint_handle);
 //get the channel endpoint object from a handle (returns NULL if not a channel)
 channel_endpoint_t *channel_get_endpoint(struct process *proc, int32 handle);
 
+//append a prebuilt entry to peer_id's queue, wake a receiver and update signals
+//caller holds ch->lock and has already checked for room (drivers pushing from IRQs)
+void channel_push_locked(channel_t *ch, int peer_id, channel_msg_entry_t *entry);
+
 //channel server functions (for kernel-side handlers)
 void channel_set_handler(channel_endpoint_t *ep, 
                          void (*handler)(channel_endpoint_t *, channel_msg_t *, void *),
@@ -0,0 +1,182 @@
+#include <ipc/futex.h>
+#include <proc/process.h>
+#include <proc/thread.h>
+#include <proc/wait.h>
+#include <proc/event.h>
+#include <syscall/syscall.h>
+#include <lib/spinlock.h>
+#include <errno.h>
+
+#define FUTEX_BUCKETS 64
+
+typedef struct {
+    const void *base;   //backing object, or the process for private memory
+    uintptr offset;     //offset into the object, or the user address
+} futex_key_t;
+
+//one sleeping thread, lives on its own kernel stack
+typedef struct futex_waiter {
+    futex_key_t key;
+    wait_queue_t wq;
+    bool woken;
+    struct futex_waiter *next;
+} futex_waiter_t;
+
+typedef struct {
+    spinlock_irq_t lock;
+    futex_waiter_t *head;
+} futex_bucket_t;
+
+static futex_bucket_t futex_table[FUTEX_BUCKETS];
+
+static inline bool futex_key_eq(const futex_key_t *a, const futex_key_t *b) {
+    return a->base == b->base && a->offset == b->offset;
+}
+
+static futex_bucket_t *futex_bucket(const futex_key_t *key) {
+    uint64 h = ((uintptr)key->base >> 4) ^ (key->offset >> 2);
+    h *= 0x9E3779B97F4A7C15ULL;
+    return &futex_table[h >> 58];
+}
+
+//resolve a user address to its futex key
+//VMO-backed words take a ref on the object so the key stays unique while in use
+static int futex_key_get(process_t *proc, uint32 *uaddr, futex_key_t *key, object_t **ref) {
+    uintptr addr = (uintptr)uaddr;
+    *ref = NULL;
+    if (addr & (sizeof(uint32) - 1)) return -EINVAL;
+    if (addr < USER_SPACE_START || addr > USER_SPACE_END - sizeof(uint32)) return -EFAULT;
+
+    //an unmap can free the VMA as soon as the lock is dropped
+    spinlock_acquire(&proc->vma_lock);
+    proc_vma_t *vma = process_vma_find_locked(proc, addr);
+    if (vma && vma->obj) {
+        object_ref(vma->obj);
+        *ref = vma->obj;
+        key->base = vma->obj;
+        key->offset = vma->obj_offset + (addr - vma->start);
+    } else {
+        key->base = proc;
+        key->offset = addr;
+    }
+    spinlock_release(&proc->vma_lock);
+    return 0;
+}
+
+//caller holds the bucket lock
+static void futex_unlink(futex_bucket_t *b, futex_waiter_t *w) {
+    for (futex_waiter_t **pp = &b->head; *pp; pp = &(*pp)->next) {
+        if (*pp == w) {
+            *pp = w->next;
+            return;
+        }
+    }
+}
+
+int futex_wait(process_t *proc, uint32 *uaddr, uint32 expected, uint64 deadline_ns) {
+    if (!proc) return -EINVAL;
+
+    futex_key_t key;
+    object_t *ref;
+    int rc = futex_key_get(proc, uaddr, &key, &ref);
+    if (rc != 0) return rc;
+
+    uint32 val;
+    futex_bucket_t *b = futex_bucket(&key);
+    futex_waiter_t w;
+    w.key = key;
+    w.woken = false;
+    wait_queue_init(&w.wq);
+
+    //wakers change the word before taking the bucket lock, so reading it under
+    //the lock either sees the new value or queues us in time to be woken
+    //the read under the lock must not fault, so the word is paged in with
+    //interrupts on first and again if it went away in between
+    irq_state_t flags;
+    for (;;) {
+        if (copy_user_bytes(uaddr, &val, sizeof(val)) != 0) {
+            rc = -EFAULT;
+            goto out;
+        }
+        flags = spinlock_irq_acquire(&b->lock);
+        if (copy_user_bytes_nofault(uaddr, &val, sizeof(val)) == 0) break;
+        spinlock_irq_release(&b->lock, flags);
+    }
+    if (val != expected) {
+        spinlock_irq_release(&b->lock, flags);
+        rc = -EAGAIN;
+        goto out;
+    }
+
+    w.next = b->head;
+    b->head = &w;
+
+    rc = 0;
+    while (!w.woken) {
+        if (proc_current_should_abort_blocking()) {
+            rc = -EINTR;
+            break;
+        }
+        if (deadline_ns == FUTEX_WAIT_FOREVER) {
+            thread_sleep_locked_irq(&w.wq, &b->lock, &flags);
+        } else if (thread_sleep_locked_irq_until(&w.wq, &b->lock, &flags, deadline_ns) < 0 &&
+                   !w.woken) {
+            rc = -ETIMEDOUT;
+            break;
+        }
+    }
+    if (!w.woken) {
+        futex_unlink(b, &w);
+    } else {
+        rc = 0;
+    }
+    spinlock_irq_release(&b->lock, flags);
+
+out:
+    if (ref) object_deref(ref);
+    return rc;
+}
+
+static int futex_wake_key(const futex_key_t *key, uint32 count) {
+    futex_bucket_t *b = futex_bucket(key);
+    int woken = 0;
+
+    //a woken waiter cannot return (and pop its stack) until we drop the lock
+    irq_state_t flags = spinlock_irq_acquire(&b->lock);
+    futex_waiter_t **pp = &b->head;
+    while (*pp && (uint32)woken < count) {
+        futex_waiter_t *w = *pp;
+        if (!futex_key_eq(&w->key, key)) {
+            pp = &w->next;
+            continue;
+        }
+        *pp = w->next;
+        w->woken = true;
+        thread_wake_one(&w->wq);
+        woken++;
+    }
+    spinlock_irq_release(&b->lock, flags);
+    return woken;
+}
+
+int futex_wake(process_t *proc, uint32 *uaddr, uint32 count) {
+    if (!proc) return -EINVAL;
+    if (count == 0) return 0;
+
+    futex_key_t key;
+    object_t *ref;
+    int rc = futex_key_get(proc, uaddr, &key, &ref);
+    if (rc != 0) return rc;
+
+    int woken = futex_wake_key(&key, count);
+    if (ref) object_deref(ref);
+    return woken;
+}
+
+int futex_wake_object(object_t *obj, uintptr offset, uint32 count) {
+    if (!obj || (offset & (sizeof(uint32) - 1))) return -EINVAL;
+    if (count == 0) return 0;
+
+    futex_key_t key = { .base = obj, .offset = offset };
+    return futex_wake_key(&key, count);
+}
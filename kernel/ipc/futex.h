@@ -0,0 +1,34 @@
+#ifndef IPC_FUTEX_H
+#define IPC_FUTEX_H
+
+#include <arch/types.h>
+
+struct process;
+struct object;
+
+/*
+ *futexes - kernel-assisted blocking for userspace locks
+ *
+ *a futex is just an aligned 32-bit word in user memory. userspace does the
+ *fast path with atomics and only calls in to sleep while the word holds an
+ *expected value or to wake sleepers after changing it
+ *
+ *words inside a VMO mapping are keyed on (VMO, offset) so every process that
+ *maps the same VMO meets on the same futex no matter where it is mapped.
+ *anything else is keyed on (process, address) and is private to the process
+ */
+
+#define FUTEX_WAIT_FOREVER UINT64_MAX
+
+//sleep while *uaddr == expected, until woken or the absolute deadline passes
+//returns 0 when woken, -EAGAIN if the value differed, -ETIMEDOUT, -EINTR or -EFAULT
+int futex_wait(struct process *proc, uint32 *uaddr, uint32 expected, uint64 deadline_ns);
+
+//wake up to count threads sleeping on uaddr, returns how many were woken
+int futex_wake(struct process *proc, uint32 *uaddr, uint32 count);
+
+//wake sleepers on the word at offset inside a VMO, for kernel code that
+//updates shared memory directly (the caller holds a ref on obj)
+int futex_wake_object(struct object *obj, uintptr offset, uint32 count);
+
+#endif
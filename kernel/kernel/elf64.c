@@ -330,27 +330,17 @@ int elf_load_user(const void *data, size len, process_t *proc, elf_load_info_t *
         }
         size seg_pages = seg_size / PAGE_SIZE;
         uint64 seg_offset = phdr->p_vaddr - seg_vaddr;
-        
-        //allocate physical pages
-        void *phys = pmm_alloc(seg_pages);
-        if (!phys) {
-            //rollback already allocated segments
+        if (phdr->p_filesz > 0 &&
+            (seg_offset > seg_size || phdr->p_filesz > seg_size - seg_offset)) {
             elf_unload_user(pagemap, info);
-            return ELF_ERR_NO_MEMORY;
+            return ELF_ERR_INVALID;
         }
-        
-        //zero the pages via HHDM
-        void *virt_access = P2V(phys);
-        memset(virt_access, 0, seg_size);
-        
-        //copy file data
+
+        //only pages holding file data are populated now, the bss beyond them
+        //is anonymous memory the page fault handler zero fills on first touch
+        size file_pages = 0;
         if (phdr->p_filesz > 0) {
-            if (seg_offset > seg_size || phdr->p_filesz > seg_size - seg_offset) {
-                elf_unload_user(pagemap, info);
-                pmm_free(phys, seg_pages);
-                return ELF_ERR_INVALID;
-            }
-            memcpy((uint8 *)virt_access + seg_offset, base + phdr->p_offset, phdr->p_filesz);
+            file_pages = (seg_offset + phdr->p_filesz + PAGE_SIZE - 1) / PAGE_SIZE;
         }
         
         //build MMU flags from ELF flags
@@ -360,9 +350,26 @@ int elf_load_user(const void *data, size len, process_t *proc, elf_load_info_t *
         
         //unmap before mapping to avoid leaking physical pages if segments overlap or repeat
         vmm_unmap(pagemap, seg_vaddr, seg_pages);
-        
-        //map into user address space
-        vmm_map(pagemap, seg_vaddr, (uintptr)phys, seg_pages, mmu_flags);
+
+        void *phys = NULL;
+        if (file_pages > 0) {
+            phys = pmm_alloc(file_pages);
+            if (!phys) {
+                //rollback already allocated segments
+                elf_unload_user(pagemap, info);
+                return ELF_ERR_NO_MEMORY;
+            }
+
+            //copy file data via HHDM and only clear the page slack around it
+            uint8 *virt_access = P2V(phys);
+            size data_end = seg_offset + phdr->p_filesz;
+            memset(virt_access, 0, seg_offset);
+            memcpy(virt_access + seg_offset, base + phdr->p_offset, phdr->p_filesz);
+            memset(virt_access + data_end, 0, file_pages * PAGE_SIZE - data_end);
+
+            //map into user address space
+            vmm_map(pagemap, seg_vaddr, (uintptr)phys, file_pages, mmu_flags);
+        }
         
         //register in VMA list so allocator knows this region is occupied
         process_vma_add(proc, seg_vaddr, seg_size, mmu_flags, NULL, 0);
@@ -371,7 +378,7 @@ int elf_load_user(const void *data, size len, process_t *proc, elf_load_info_t *
         elf_segment_t *seg = &info->segments[info->segment_count++];
         seg->virt_addr = seg_vaddr;
         seg->phys_addr = (uint64)phys;
-        seg->pages = seg_pages;
+        seg->pages = file_pages;
     }
     
     //update vma_next_addr to point past the loaded program
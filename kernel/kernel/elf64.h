@@ -131,7 +131,8 @@ int elf_validate(const void *data, size len);
 int elf_load(const void *data, size len, elf_load_info_t *info);
 
 //load an ELF64 executable into a user address space
-//allocates pages and maps them with user permissions
+//allocates pages for the file-backed part of each segment and maps them with
+//user permissions, bss past the file data is demand-zero through the VMA
 //also registers segments in process VMA list for proper address space tracking
 struct process;
 int elf_load_user(const void *data, size len, struct process *proc, elf_load_info_t *info);
@@ -17,7 +17,7 @@ static inline void spinlock_init(spinlock_t *sl) {
 
 static inline void spinlock_acquire(spinlock_t *sl) {
     while (__atomic_test_and_set(&sl->lock, __ATOMIC_ACQUIRE)) {
-        arch_pause();
+        arch_spin_relax();
     }
 }
 
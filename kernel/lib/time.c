@@ -2,6 +2,8 @@
 #include <arch/timer.h>
 #include <arch/percpu.h>
 #include <proc/sched.h>
+#include <proc/thread.h>
+#include <proc/wait.h>
 
 static void wait_ticks(uint64 ticks_needed) {
     if (ticks_needed == 0) return;
@@ -17,7 +19,18 @@ static void wait_ticks(uint64 ticks_needed) {
     }
 }
 
+//once threads exist a sleep blocks on a kernel timer instead of yielding in a loop
+static bool sleep_can_block(void) {
+    percpu_t *cpu = percpu_get();
+    return cpu && cpu->sched_running && thread_current();
+}
+
 void usleep(uint32 microseconds) {
+    if (sleep_can_block()) {
+        thread_sleep_ns((uint64)microseconds * 1000);
+        return;
+    }
+
     uint32 freq = arch_timer_getfreq(); // Hz
     uint64 ticks_needed = ((uint64)freq * microseconds) / 1000000;
     if (microseconds && ticks_needed == 0) ticks_needed = 1;
@@ -26,6 +39,11 @@ void usleep(uint32 microseconds) {
 }
 
 void sleep(uint32 milliseconds) {
+    if (sleep_can_block()) {
+        thread_sleep_ns((uint64)milliseconds * 1000000);
+        return;
+    }
+
     uint32 freq = arch_timer_getfreq(); // Hz
     uint64 ticks_needed = ((uint64)freq * milliseconds) / 1000;
     if (milliseconds && ticks_needed == 0) ticks_needed = 1;
@@ -2,7 +2,9 @@
 #include <mm/vmm.h>
 #include <mm/pmm.h>
 #include <mm/mm.h>
+#include <mm/vmem.h>
 #include <arch/cpu.h>
+#include <arch/percpu.h>
 #include <lib/io.h>
 #include <lib/string.h>
 #include <lib/spinlock.h>
@@ -11,166 +13,69 @@
 static slab_cache_t buckets[BUCKET_COUNT];
 static size bucket_sizes[BUCKET_COUNT] = {16, 32, 64, 128, 256, 512, 1024, 2048};
 
-#define BACKING_TRACK_MAX 4096
-
-static uintptr heap_virt_cursor = KHEAP_VIRT_START;
 static bool kheap_ready = false;
 static spinlock_irq_t kheap_lock = SPINLOCK_IRQ_INIT;
 static uint64 current_slab_used = 0;
 static uint64 current_slab_capacity = 0;
 static uint64 current_large_used = 0;
 
-//when pages are freed we record the virtual address range as a hole so it
-//can be reused by future allocations this prevents unbounded virtual address space
-#define VHOLE_MAX_COUNT 4096
+//per-CPU magazines sit in front of the slab buckets
+//each CPU keeps a small stack of free objects per bucket that it can hand out
+//and take back with only IRQs disabled and the global lock is only taken to
+//refill or drain a magazine in batches of KHEAP_MAG_BATCH objects
+#define KHEAP_MAG_SIZE  32
+#define KHEAP_MAG_BATCH (KHEAP_MAG_SIZE / 2)
 
 typedef struct {
-    uintptr addr;
-    size pages;
-    bool in_use;
-} vhole_t;
-
-static vhole_t vholes[VHOLE_MAX_COUNT];
+    uint32 count;
+    void *objs[KHEAP_MAG_SIZE];
+} kheap_mag_t;
 
 typedef struct {
-    uintptr virt;
-    uintptr phys;
-    size pages;
-    bool in_use;
-} backing_track_t;
-
-static backing_track_t backing_tracks[BACKING_TRACK_MAX];
-
-static void backing_track_add(uintptr virt, uintptr phys, size pages) {
-    for (int i = 0; i < BACKING_TRACK_MAX; i++) {
-        if (!backing_tracks[i].in_use) {
-            backing_tracks[i].virt = virt;
-            backing_tracks[i].phys = phys;
-            backing_tracks[i].pages = pages;
-            backing_tracks[i].in_use = true;
-            return;
-        }
-    }
-
-    printf("[kheap] WARN: backing metadata full, falling back to slow free path\n");
-}
+    kheap_mag_t mags[BUCKET_COUNT];
+    uint64 hits;
+    uint64 misses;
+} kheap_cpu_cache_t;
 
-static backing_track_t *backing_track_take(uintptr virt, size pages) {
-    for (int i = 0; i < BACKING_TRACK_MAX; i++) {
-        if (!backing_tracks[i].in_use) continue;
-        if (backing_tracks[i].virt != virt || backing_tracks[i].pages != pages) continue;
+static kheap_cpu_cache_t cpu_caches[MAX_CPUS];
+static bool kheap_percpu_ready = false;
 
-        backing_tracks[i].in_use = false;
-        return &backing_tracks[i];
-    }
+//heap virtual addresses come from a vmem arena over the heap window so freed
+//ranges are merged and reused without bound on how many exist
+static vmem_t kheap_arena;
 
-    return NULL;
-}
-
-//find and reclaim a virtual hole of the exact size needed
+//map fresh pages at a free heap address, pages are one contiguous pmm run
 static void *backing_alloc(size pages) {
-    //try to find a hole that fits
-    for (int i = 0; i < VHOLE_MAX_COUNT; i++) {
-        if (vholes[i].in_use && vholes[i].pages >= pages) {
-            uintptr vaddr = vholes[i].addr;
-
-            void *paddr = pmm_alloc(pages);
-            if (!paddr) return NULL;
-
-            if (vholes[i].pages == pages) {
-                vholes[i].in_use = false;
-            } else {
-                //split the hole only after we know backing pages exist
-                vholes[i].addr += pages * PAGE_SIZE;
-                vholes[i].pages -= pages;
-            }
-
-            vmm_kernel_map(vaddr, (uintptr)paddr, pages, MMU_FLAG_PRESENT | MMU_FLAG_WRITE);
-            backing_track_add(vaddr, (uintptr)paddr, pages);
-            return (void *)vaddr;
-        }
-    }
-
-    //no suitable hole found so bump allocate from cursor
-    if (heap_virt_cursor + (pages * PAGE_SIZE) > KHEAP_VIRT_END) {
+    uintptr vaddr = vmem_alloc(&kheap_arena, pages * PAGE_SIZE);
+    if (!vaddr) {
         printf("[kheap] ERR: virtual address space exhausted\n");
         return NULL;
     }
 
     void *paddr = pmm_alloc(pages);
-    if (!paddr) return NULL;
+    if (!paddr) {
+        vmem_free(&kheap_arena, vaddr, pages * PAGE_SIZE);
+        return NULL;
+    }
 
-    void *vaddr = (void *)heap_virt_cursor;
-    vmm_kernel_map(heap_virt_cursor, (uintptr)paddr, pages, MMU_FLAG_PRESENT | MMU_FLAG_WRITE);
-    backing_track_add((uintptr)vaddr, (uintptr)paddr, pages);
-    heap_virt_cursor += pages * PAGE_SIZE;
-    
-    //printf("[kheap] bump: virt=0x%lx phys=0x%lx pages=%zu\n", (uintptr)vaddr, (uintptr)paddr, pages);
-    return vaddr;
+    vmm_kernel_map(vaddr, (uintptr)paddr, pages, MMU_FLAG_PRESENT | MMU_FLAG_WRITE);
+    return (void *)vaddr;
 }
 
-//free backing pages and record the virtual range as a hole for reuse
+//unmap and free backing pages then give the virtual range back to the arena
 static void backing_free(void *virt, size pages) {
     if ((uintptr)virt < KHEAP_VIRT_START || (uintptr)virt >= KHEAP_VIRT_END) {
         return;
     }
     pagemap_t *map = mmu_get_kernel_pagemap();
-    backing_track_t *track = backing_track_take((uintptr)virt, pages);
-
-    if (track) {
-        pmm_free((void *)track->phys, pages);
-    } else {
-        //fall back to resolving each page when metadata is unavailable
-        for (size i = 0; i < pages; i++) {
-            uintptr vaddr = (uintptr)virt + (i * PAGE_SIZE);
-            uintptr paddr = mmu_virt_to_phys(map, vaddr);
-            if (paddr != (uintptr)-1) {
-                pmm_free((void *)paddr, 1);
-            }
-        }
-    }
 
-    //unmap the virtual range
+    //backing_alloc maps one contiguous run so the first page locates all of them
+    //pages only go back to the pmm once no CPU can still reach them
+    uintptr paddr = mmu_virt_to_phys(map, (uintptr)virt);
     vmm_unmap(map, (uintptr)virt, pages);
+    if (paddr != (uintptr)-1) pmm_free((void *)paddr, pages);
 
-    uintptr start = (uintptr)virt;
-    size total_pages = pages;
-
-    //aggregate adjacent holes to prevent fragmentation
-    for (int i = 0; i < VHOLE_MAX_COUNT; i++) {
-        if (!vholes[i].in_use) continue;
-
-        uintptr h_start = vholes[i].addr;
-        uintptr h_end = h_start + vholes[i].pages * PAGE_SIZE;
-
-        if (h_end == start) {
-            //new range is immediately after existing hole
-            start = h_start;
-            total_pages += vholes[i].pages;
-            vholes[i].in_use = false;
-            //restart search to find further merges
-            i = -1;
-        } else if (start + total_pages * PAGE_SIZE == h_start) {
-            //new range is immediately before existing hole
-            total_pages += vholes[i].pages;
-            vholes[i].in_use = false;
-            //restart search
-            i = -1;
-        }
-    }
-
-    //record the (possibly merged) range as a hole
-    for (int i = 0; i < VHOLE_MAX_COUNT; i++) {
-        if (!vholes[i].in_use) {
-            vholes[i].addr = start;
-            vholes[i].pages = total_pages;
-            vholes[i].in_use = true;
-            return;
-        }
-    }
-
-    //no free slots so virtual address is leaked (rare asf edge case)
-    printf("[kheap] WARN: vhole table full, leaking %zu pages at %P\n", pages, virt);
+    vmem_free(&kheap_arena, (uintptr)virt, pages * PAGE_SIZE);
 }
 
 static void list_remove(slab_t **head, slab_t *slab) {
@@ -239,67 +144,161 @@ void kheap_init(void) {
     current_slab_used = 0;
     current_slab_capacity = 0;
     current_large_used = 0;
+    if (vmem_init(&kheap_arena, "kheap", KHEAP_VIRT_START, KHEAP_VIRT_END - KHEAP_VIRT_START, PAGE_SIZE) < 0) {
+        printf("[kheap] ERR: could not set up the heap arena\n");
+        return;
+    }
     kheap_ready = true;
     printf("[kheap] initialized (buckets: 16B-2KB, range: 0x%lX...)\n", KHEAP_VIRT_START);
 }
 
+void kheap_init_percpu(void) {
+    memset(cpu_caches, 0, sizeof(cpu_caches));
+    kheap_percpu_ready = true;
+}
+
+//take one object from a cache's slabs (kheap_lock held)
+static void *slab_alloc_obj(slab_cache_t *cache) {
+    //find a slab with free space
+    slab_t *slab = cache->partial_slabs;
+    if (!slab) {
+        slab = cache->empty_slabs;
+        if (!slab) {
+            slab = slab_create(cache);
+            if (!slab) return NULL;
+        } else {
+            list_remove(&cache->empty_slabs, slab);
+        }
+        list_prepend(&cache->partial_slabs, slab);
+    }
+
+    //allocate from the slab's free list
+    slab_obj_t *obj = slab->free_list;
+    slab->free_list = obj->next;
+    slab->free_objs--;
+    current_slab_used += cache->obj_size;
+
+    //move to full list if slab is now exhausted
+    if (slab->free_objs == 0) {
+        list_remove(&cache->partial_slabs, slab);
+        list_prepend(&cache->full_slabs, slab);
+    }
+
+    return obj;
+}
+
+//return one object to its owning slab (kheap_lock held)
+static void slab_free_obj(slab_t *slab, void *p) {
+    slab_cache_t *cache = slab->cache;
+
+    slab_obj_t *obj = (slab_obj_t *)p;
+    obj->next = slab->free_list;
+    slab->free_list = obj;
+    slab->free_objs++;
+    current_slab_used -= cache->obj_size;
+
+    //manage slab list transitions
+    if (slab->free_objs == 1) {
+        //was full and now partial
+        list_remove(&cache->full_slabs, slab);
+        list_prepend(&cache->partial_slabs, slab);
+    } else if (slab->free_objs == slab->total_objs) {
+        //was partial and now empty
+        list_remove(&cache->partial_slabs, slab);
+        list_prepend(&cache->empty_slabs, slab);
+
+        //eagerly destroy this slab if we have other slabs available
+        //keep at least one empty slab per cache to avoid thrashing
+        bool have_other_slabs = cache->partial_slabs ||
+                                (cache->empty_slabs && cache->empty_slabs->next);
+        if (have_other_slabs) {
+            slab_destroy(slab);
+        }
+    }
+}
+
+//allocate a bucket object through the current CPU's magazine
+static void *mag_alloc(int bucket) {
+    irq_state_t flags = arch_irq_save();
+    kheap_cpu_cache_t *cc = &cpu_caches[arch_cpu_index()];
+    kheap_mag_t *mag = &cc->mags[bucket];
+
+    if (mag->count == 0) {
+        //magazine is empty so refill half of it from the slab lists at once
+        cc->misses++;
+        spinlock_acquire(&kheap_lock.lock);
+        while (mag->count < KHEAP_MAG_BATCH) {
+            void *obj = slab_alloc_obj(&buckets[bucket]);
+            if (!obj) break;
+            mag->objs[mag->count++] = obj;
+        }
+        spinlock_release(&kheap_lock.lock);
+
+        if (mag->count == 0) {
+            arch_irq_restore(flags);
+            return NULL;
+        }
+    } else {
+        cc->hits++;
+    }
+
+    void *obj = mag->objs[--mag->count];
+    arch_irq_restore(flags);
+    return obj;
+}
+
+//free a bucket object into the current CPU's magazine
+static void mag_free(int bucket, void *p) {
+    irq_state_t flags = arch_irq_save();
+    kheap_cpu_cache_t *cc = &cpu_caches[arch_cpu_index()];
+    kheap_mag_t *mag = &cc->mags[bucket];
+
+    if (mag->count == KHEAP_MAG_SIZE) {
+        //magazine is full so push the oldest half back to the slabs at once
+        cc->misses++;
+        spinlock_acquire(&kheap_lock.lock);
+        for (uint32 i = 0; i < KHEAP_MAG_BATCH; i++) {
+            void *obj = mag->objs[i];
+            slab_free_obj((slab_t *)((uintptr)obj & ~(PAGE_SIZE - 1)), obj);
+        }
+        spinlock_release(&kheap_lock.lock);
+
+        memmove(&mag->objs[0], &mag->objs[KHEAP_MAG_BATCH],
+                (KHEAP_MAG_SIZE - KHEAP_MAG_BATCH) * sizeof(void *));
+        mag->count -= KHEAP_MAG_BATCH;
+    } else {
+        cc->hits++;
+    }
+
+    mag->objs[mag->count++] = p;
+    arch_irq_restore(flags);
+}
+
 void *kmalloc(size n) {
     if (n == 0 || !kheap_ready) return NULL;
 
-    irq_state_t flags = spinlock_irq_acquire(&kheap_lock);
-
     //try to satisfy from a slab bucket
     for (int i = 0; i < BUCKET_COUNT; i++) {
         if (n <= bucket_sizes[i]) {
-            slab_cache_t *cache = &buckets[i];
-
-            //find a slab with free space
-            slab_t *slab = cache->partial_slabs;
-            if (!slab) {
-                slab = cache->empty_slabs;
-                if (!slab) {
-                    slab = slab_create(cache);
-                    if (!slab) {
-                        spinlock_irq_release(&kheap_lock, flags);
-                        return NULL;
-                    }
-                } else {
-                    list_remove(&cache->empty_slabs, slab);
-                }
-                list_prepend(&cache->partial_slabs, slab);
-            }
-
-            //allocate from the slab's free list
-            slab_obj_t *obj = slab->free_list;
-            slab->free_list = obj->next;
-            slab->free_objs--;
-            current_slab_used += cache->obj_size;
-
-            //move to full list if slab is now exhausted
-            if (slab->free_objs == 0) {
-                list_remove(&cache->partial_slabs, slab);
-                list_prepend(&cache->full_slabs, slab);
-            }
+            if (kheap_percpu_ready) return mag_alloc(i);
 
+            irq_state_t flags = spinlock_irq_acquire(&kheap_lock);
+            void *obj = slab_alloc_obj(&buckets[i]);
             spinlock_irq_release(&kheap_lock, flags);
-            return (void *)obj;
+            return obj;
         }
     }
 
     //when large allocation allocate pages directly with header
     //the returned pointer is aligned after the header, so include that padding in the backing size
     size data_off = (sizeof(kheap_large_t) + KHEAP_MIN_ALIGN - 1) & ~(KHEAP_MIN_ALIGN - 1);
-    if (n > SIZE_MAX - data_off) {
-        spinlock_irq_release(&kheap_lock, flags);
-        return NULL;
-    }
+    if (n > SIZE_MAX - data_off) return NULL;
     size total = data_off + n;
-    if (total > SIZE_MAX - (PAGE_SIZE - 1)) {
-        spinlock_irq_release(&kheap_lock, flags);
-        return NULL;
-    }
+    if (total > SIZE_MAX - (PAGE_SIZE - 1)) return NULL;
     size pages = (total + PAGE_SIZE - 1) / PAGE_SIZE;
 
+    irq_state_t flags = spinlock_irq_acquire(&kheap_lock);
+
     kheap_large_t *large = (kheap_large_t *)backing_alloc(pages);
     if (!large) {
         spinlock_irq_release(&kheap_lock, flags);
@@ -334,9 +333,8 @@ void kfree(void *p) {
         return;
     }
 
-    irq_state_t flags = spinlock_irq_acquire(&kheap_lock);
-
     //determine allocation type by checking magic at page start
+    //a live object keeps its slab (or large header) mapped so this is safe unlocked
     uintptr page_addr = (uintptr)p & ~(PAGE_SIZE - 1);
     slab_t *meta = (slab_t *)page_addr;
 
@@ -354,48 +352,34 @@ void kfree(void *p) {
             cache_addr >= buckets_end ||
             ((cache_addr - buckets_begin) % sizeof(buckets[0])) != 0) {
             printf("[kheap] ERR: kfree corrupt cache ptr %P\n", p);
-            spinlock_irq_release(&kheap_lock, flags);
             return;
         }
 
-        slab_obj_t *obj = (slab_obj_t *)p;
-        obj->next = slab->free_list;
-        slab->free_list = obj;
-        slab->free_objs++;
-        current_slab_used -= cache->obj_size;
-
-        //manage slab list transitions
-        if (slab->free_objs == 1) {
-            //was full and now partial
-            list_remove(&cache->full_slabs, slab);
-            list_prepend(&cache->partial_slabs, slab);
-        } else if (slab->free_objs == slab->total_objs) {
-            //was partial and now empty
-            list_remove(&cache->partial_slabs, slab);
-            list_prepend(&cache->empty_slabs, slab);
-
-            //eagerly destroy this slab if we have other slabs available
-            //keep at least one empty slab per cache to avoid thrashing
-            bool have_other_slabs = cache->partial_slabs ||
-                                    (cache->empty_slabs && cache->empty_slabs->next);
-            if (have_other_slabs) {
-                slab_destroy(slab);
-            }
+        if (kheap_percpu_ready) {
+            mag_free((int)(cache - buckets), p);
+            return;
         }
+
+        irq_state_t flags = spinlock_irq_acquire(&kheap_lock);
+        slab_free_obj(slab, p);
+        spinlock_irq_release(&kheap_lock, flags);
+        return;
+    }
+
+    irq_state_t flags = spinlock_irq_acquire(&kheap_lock);
+
+    //large allocation: find header and free pages
+    kheap_large_t *large = (kheap_large_t *)page_addr;
+    if (large->magic == KHEAP_MAGIC_LARGE) {
+        size pages = large->pages;
+        current_large_used -= large->used_bytes;
+        //clear magic BEFORE freeing to prevent use-after-free cascades
+        //if a stale pointer tries to kfree this address after reuse,
+        //it will fail the magic check instead of freeing the new allocation
+        large->magic = 0;
+        backing_free(large, pages);
     } else {
-        //large allocation: find header and free pages
-        kheap_large_t *large = (kheap_large_t *)page_addr;
-        if (large->magic == KHEAP_MAGIC_LARGE) {
-            size pages = large->pages;
-            current_large_used -= large->used_bytes;
-            //clear magic BEFORE freeing to prevent use-after-free cascades
-            //if a stale pointer tries to kfree this address after reuse,
-            //it will fail the magic check instead of freeing the new allocation
-            large->magic = 0;
-            backing_free(large, pages);
-        } else {
-            printf("[kheap] ERR: kfree invalid pointer %P (magic 0x%X)\n", p, meta->magic);
-        }
+        printf("[kheap] ERR: kfree invalid pointer %P (magic 0x%X)\n", p, meta->magic);
     }
     
     spinlock_irq_release(&kheap_lock, flags);
@@ -465,17 +449,85 @@ void kheap_free_pages(void *p, size pages) {
     spinlock_irq_release(&kheap_lock, flags);
 }
 
+//unmap pages backed one by one and free them, the virtual range stays reserved
+//pages only go back to the pmm once no CPU can still reach them, so they are
+//looked up a batch at a time before the unmap
+static void scattered_release(uintptr virt, size pages) {
+    pagemap_t *map = mmu_get_kernel_pagemap();
+    uintptr phys[64];
+    for (size done = 0; done < pages; ) {
+        size n = pages - done;
+        if (n > 64) n = 64;
+        uintptr start = virt + done * PAGE_SIZE;
+
+        irq_state_t flags = spinlock_irq_acquire(&kheap_lock);
+        for (size i = 0; i < n; i++) phys[i] = mmu_virt_to_phys(map, start + i * PAGE_SIZE);
+        vmm_unmap(map, start, n);
+        spinlock_irq_release(&kheap_lock, flags);
+
+        for (size i = 0; i < n; i++) {
+            if (phys[i] != (uintptr)-1) pmm_free((void *)phys[i], 1);
+        }
+        done += n;
+    }
+}
+
+//back each page on its own so a large table never needs one long physical run
+//the page tables are only touched under the heap lock like backing_alloc does
+void *kheap_alloc_scattered(size pages) {
+    if (pages == 0) return NULL;
+    uintptr vaddr = vmem_alloc(&kheap_arena, pages * PAGE_SIZE);
+    if (!vaddr) {
+        printf("[kheap] ERR: virtual address space exhausted\n");
+        return NULL;
+    }
+
+    for (size i = 0; i < pages; i++) {
+        void *paddr = pmm_alloc(1);
+        if (!paddr) {
+            scattered_release(vaddr, i);
+            vmem_free(&kheap_arena, vaddr, pages * PAGE_SIZE);
+            return NULL;
+        }
+        irq_state_t flags = spinlock_irq_acquire(&kheap_lock);
+        vmm_kernel_map(vaddr + i * PAGE_SIZE, (uintptr)paddr, 1, MMU_FLAG_PRESENT | MMU_FLAG_WRITE);
+        spinlock_irq_release(&kheap_lock, flags);
+    }
+    return (void *)vaddr;
+}
+
+void kheap_free_scattered(void *p, size pages) {
+    uintptr virt = (uintptr)p;
+    if (virt < KHEAP_VIRT_START || virt >= KHEAP_VIRT_END || pages == 0) return;
+    scattered_release(virt, pages);
+    vmem_free(&kheap_arena, virt, pages * PAGE_SIZE);
+}
+
 void kheap_get_stats(kheap_stats_t *stats) {
     if (!stats) return;
     
     irq_state_t flags = spinlock_irq_acquire(&kheap_lock);
     
-    stats->slab_used = 0;
-    stats->slab_capacity = 0;
-    stats->large_used = 0;
     stats->slab_used = current_slab_used;
     stats->slab_capacity = current_slab_capacity;
     stats->large_used = current_large_used;
+    stats->mag_cached = 0;
+    stats->mag_hits = 0;
+    stats->mag_misses = 0;
+
+    //objects parked in magazines are free from the caller's point of view
+    //counters are read racily since each CPU only updates its own
+    for (uint32 c = 0; c < MAX_CPUS; c++) {
+        kheap_cpu_cache_t *cc = &cpu_caches[c];
+        for (int i = 0; i < BUCKET_COUNT; i++) {
+            stats->mag_cached += (uint64)cc->mags[i].count * bucket_sizes[i];
+        }
+        stats->cpu[c].hits = cc->hits;
+        stats->cpu[c].misses = cc->misses;
+        stats->mag_hits += cc->hits;
+        stats->mag_misses += cc->misses;
+    }
+    stats->slab_used -= stats->mag_cached;
     
     spinlock_irq_release(&kheap_lock, flags);
 }
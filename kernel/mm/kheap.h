@@ -3,6 +3,7 @@
 
 #include <arch/types.h>
 #include <arch/mmu.h>
+#include <arch/percpu.h>
 
 //magic numbers for allocation validation
 #define KHEAP_MAGIC_SLAB  0x51AB51AB
@@ -52,6 +53,9 @@ typedef struct {
 //initialize the kernel heap
 void kheap_init(void);
 
+//enable per-CPU magazines (call once per-CPU data is live on the BSP)
+void kheap_init_percpu(void);
+
 //allocate n bytes
 void *kmalloc(size n);
 
@@ -68,11 +72,26 @@ void kfree(void *p);
 void *kheap_alloc_pages(size pages);
 void kheap_free_pages(void *p, size pages);
 
+//page-granular allocator for big tables: virtually contiguous but each page is
+//backed separately, so not usable as a DMA buffer
+void *kheap_alloc_scattered(size pages);
+void kheap_free_scattered(void *p, size pages);
+
+//per-CPU magazine counters
+typedef struct {
+    uint64 hits;           //allocs/frees served from the local magazine
+    uint64 misses;         //allocs/frees that had to refill/drain under the heap lock
+} kheap_cpu_stats_t;
+
 //heap statistics
 typedef struct {
     uint64 slab_used;      //bytes allocated via slab
     uint64 slab_capacity;  //total slab capacity
     uint64 large_used;     //bytes in large allocations
+    uint64 mag_cached;     //bytes parked in per-CPU magazines
+    uint64 mag_hits;       //sum of per-CPU hits
+    uint64 mag_misses;     //sum of per-CPU misses
+    kheap_cpu_stats_t cpu[MAX_CPUS];
 } kheap_stats_t;
 
 void kheap_get_stats(kheap_stats_t *stats);
@@ -1,24 +1,288 @@
 #include <mm/pmm.h>
 #include <mm/mm.h>
 #include <arch/cpu.h>
+#include <arch/percpu.h>
 #include <boot/db.h>
 #include <drivers/serial.h>
 #include <lib/spinlock.h>
+#include <lib/string.h>
+
+/*
+ *binary buddy allocator
+ *
+ *free memory is kept as naturally aligned blocks of 2^order pages on per-zone
+ *free lists, the list links live in the free pages themselves (through the HHDM)
+ *allocating splits the smallest block that fits and freeing merges a block
+ *with its buddy for as long as the buddy is free too, so both are O(MAX_ORDER)
+ *
+ *requests that are not a power of two take the next order up and give the
+ *tail back immediately, so callers keep freeing arbitrary page ranges
+ *
+ *single pages, by far the most common request, go through small per-CPU
+ *caches that only need IRQs disabled and hit the global lock once per batch
+ *
+ *callers that want zeroed pages draw from a pool that idle CPUs keep topped
+ *up, so the clearing happens off the allocation path
+ */
+
+#define PMM_PCP_SIZE  64
+#define PMM_PCP_BATCH (PMM_PCP_SIZE / 4)
+
+//zero pool capacity (1MB) and the free memory it leaves alone when refilling
+#define PMM_ZERO_POOL_SIZE 256
+#define PMM_ZERO_MIN_FREE  (PMM_ZERO_POOL_SIZE * 4)
+
+//page_state values, anything <= PMM_MAX_ORDER marks the head of a free block
+#define PMM_PAGE_NONE 0xFF  //allocated, reserved or inside a free block
+#define PMM_PAGE_PCP  0xFE  //parked in a per-CPU cache
+#define PMM_PAGE_ZERO 0xFD  //cleared and parked in the zero pool
+
+//zones never share a buddy block, they are tried in this order by pmm_alloc
+//so low memory stays available for devices that can only address it
+enum {
+    PMM_ZONE_NORMAL,    //everything above 4GB
+    PMM_ZONE_DMA32,     //ARCH_PMM_ZONE_MIN_ADDR up to 4GB
+    PMM_ZONE_LOW,       //below ARCH_PMM_ZONE_MIN_ADDR
+};
+
+typedef struct pmm_block {
+    struct pmm_block *next;
+    struct pmm_block *prev;
+} pmm_block_t;
+
+typedef struct {
+    size start_page;
+    size end_page;
+    pmm_block_t *free_list[PMM_MAX_ORDER + 1];
+    size free_blocks[PMM_MAX_ORDER + 1];
+    size free_pages;
+} pmm_zone_t;
+
+typedef struct {
+    uint32 count;
+    size pfns[PMM_PCP_SIZE];
+    uint64 hits;
+    uint64 misses;
+} pmm_pcp_t;
 
 static spinlock_irq_t pmm_lock = SPINLOCK_IRQ_INIT;
-static uint8 *bitmap = NULL;
+static uint8 *bitmap = NULL;        //1 = allocated/reserved, 0 = free in the buddy lists
+static uint8 *page_state = NULL;    //one byte per page, see PMM_PAGE_*
 static size bitmap_size = 0; //in bytes
 size max_pages = 0;
 
+static pmm_zone_t zones[PMM_ZONE_COUNT];
+static pmm_pcp_t pcp[MAX_CPUS];
+static bool pmm_percpu_ready = false;
+
+static size pcp_cached_pages(void);
+
+//pool pages stay allocated in the bitmap, the pool is taken before pmm_lock
+static spinlock_irq_t zero_lock = SPINLOCK_IRQ_INIT;
+static size zero_pool[PMM_ZERO_POOL_SIZE];
+static uint32 zero_count = 0;
+static uint64 zero_hits = 0;
+static uint64 zero_misses = 0;
+
 #define BITMAP_SET(bit)   (bitmap[(bit) / 8] |= (1 << ((bit) % 8)))
 #define BITMAP_CLEAR(bit) (bitmap[(bit) / 8] &= ~(1 << ((bit) % 8)))
 #define BITMAP_TEST(bit)  (bitmap[(bit) / 8] & (1 << ((bit) % 8)))
 
-static size last_free_page = 0;
-static size last_zone_free_page = ARCH_PMM_ZONE_MIN_ADDR / PAGE_SIZE;
-size free_pages = 0;
+#define PFN_TO_BLOCK(pfn) ((pmm_block_t *)P2V((uintptr)(pfn) * PAGE_SIZE))
+#define BLOCK_TO_PFN(b)   (((uintptr)(b) - HHDM_OFFSET) / PAGE_SIZE)
+
+size free_pages = 0;    //pages on the buddy lists, per-CPU caches are counted separately
 size total_usable_pages = 0;
 
+static pmm_zone_t *zone_of(size pfn) {
+    for (int z = 0; z < PMM_ZONE_COUNT; z++) {
+        if (pfn >= zones[z].start_page && pfn < zones[z].end_page) return &zones[z];
+    }
+    return NULL;
+}
+
+static void free_list_add(pmm_zone_t *zone, size pfn, uint32 order) {
+    pmm_block_t *b = PFN_TO_BLOCK(pfn);
+    b->prev = NULL;
+    b->next = zone->free_list[order];
+    if (b->next) b->next->prev = b;
+    zone->free_list[order] = b;
+    zone->free_blocks[order]++;
+    page_state[pfn] = (uint8)order;
+}
+
+static void free_list_remove(pmm_zone_t *zone, size pfn, uint32 order) {
+    pmm_block_t *b = PFN_TO_BLOCK(pfn);
+    if (b->prev) b->prev->next = b->next;
+    else zone->free_list[order] = b->next;
+    if (b->next) b->next->prev = b->prev;
+    zone->free_blocks[order]--;
+    page_state[pfn] = PMM_PAGE_NONE;
+}
+
+//put one aligned block back and merge it upwards, pmm_lock held
+static void buddy_free_block(pmm_zone_t *zone, size pfn, uint32 order) {
+    zone->free_pages += (size)1 << order;
+    free_pages += (size)1 << order;
+
+    while (order < PMM_MAX_ORDER) {
+        size buddy = pfn ^ ((size)1 << order);
+        if (buddy < zone->start_page || buddy + ((size)1 << order) > zone->end_page) break;
+        if (page_state[buddy] != order) break;
+
+        free_list_remove(zone, buddy, order);
+        if (buddy < pfn) pfn = buddy;
+        order++;
+    }
+    free_list_add(zone, pfn, order);
+}
+
+//give [pfn, pfn + count) to the buddy lists as the largest aligned blocks that fit
+//the range must lie inside one zone and already be clear in the bitmap, pmm_lock held
+static void buddy_free_range(pmm_zone_t *zone, size pfn, size count) {
+    while (count > 0) {
+        uint32 order = 0;
+        while (order < PMM_MAX_ORDER &&
+               (pfn & (((size)2 << order) - 1)) == 0 &&
+               ((size)2 << order) <= count) {
+            order++;
+        }
+        buddy_free_block(zone, pfn, order);
+        pfn += (size)1 << order;
+        count -= (size)1 << order;
+    }
+}
+
+//take a 2^order block whose end is at or below limit_page, pmm_lock held
+//returns the first pfn or 0 (page 0 is always reserved)
+static size buddy_alloc_block(pmm_zone_t *zone, uint32 order, size limit_page) {
+    for (uint32 o = order; o <= PMM_MAX_ORDER; o++) {
+        for (pmm_block_t *b = zone->free_list[o]; b; b = b->next) {
+            size pfn = BLOCK_TO_PFN(b);
+            //the low half is what we keep when splitting so only its end matters
+            if (pfn + ((size)1 << order) > limit_page) continue;
+
+            free_list_remove(zone, pfn, o);
+            while (o > order) {
+                o--;
+                free_list_add(zone, pfn + ((size)1 << o), o);
+            }
+            zone->free_pages -= (size)1 << order;
+            free_pages -= (size)1 << order;
+            return pfn;
+        }
+    }
+    return 0;
+}
+
+//pull the free page pfn out of whichever free block holds it, pmm_lock held
+//the rest of that block goes back on the lists
+static void buddy_claim_page(pmm_zone_t *zone, size pfn) {
+    for (uint32 order = 0; order <= PMM_MAX_ORDER; order++) {
+        size head = pfn & ~(((size)1 << order) - 1);
+        if (head < zone->start_page) break;
+        if (page_state[head] != order) continue;
+
+        free_list_remove(zone, head, order);
+        zone->free_pages -= (size)1 << order;
+        free_pages -= (size)1 << order;
+        if (pfn > head) buddy_free_range(zone, head, pfn - head);
+        size end = head + ((size)1 << order);
+        if (end > pfn + 1) buddy_free_range(zone, pfn + 1, end - pfn - 1);
+        return;
+    }
+}
+
+static uint32 order_for(size pages) {
+    uint32 order = 0;
+    while (((size)1 << order) < pages) order++;
+    return order;
+}
+
+//allocations larger than the biggest buddy block fall back to a bitmap scan
+//for a free run and carve it out of the lists, pmm_lock held
+static size pmm_alloc_run_locked(pmm_zone_t *zone, size pages, size limit_page) {
+    size end = zone->end_page < limit_page ? zone->end_page : limit_page;
+    size run = 0;
+    for (size i = zone->start_page; i < end; i++) {
+        if (BITMAP_TEST(i)) {
+            run = 0;
+            continue;
+        }
+        if (++run < pages) continue;
+
+        size start = i + 1 - pages;
+        for (size j = start; j <= i; j++) buddy_claim_page(zone, j);
+        return start;
+    }
+    return 0;
+}
+
+static void *pmm_alloc_locked(size pages, size start_page, size limit_page) {
+    if (pages == 0) return NULL;
+
+    uint32 order = order_for(pages);
+    for (int z = 0; z < PMM_ZONE_COUNT; z++) {
+        pmm_zone_t *zone = &zones[z];
+        if (zone->start_page < start_page || zone->start_page >= limit_page) continue;
+        if (zone->free_pages < pages) continue;
+
+        size pfn;
+        if (order > PMM_MAX_ORDER) {
+            pfn = pmm_alloc_run_locked(zone, pages, limit_page);
+        } else {
+            pfn = buddy_alloc_block(zone, order, limit_page);
+            //hand back the part of the block the caller did not ask for
+            if (pfn && ((size)1 << order) > pages) {
+                buddy_free_range(zone, pfn + pages, ((size)1 << order) - pages);
+            }
+        }
+        if (!pfn) continue;
+
+        for (size i = 0; i < pages; i++) BITMAP_SET(pfn + i);
+        return (void *)(uintptr)(pfn * PAGE_SIZE);
+    }
+    return NULL;
+}
+
+//return pages whose bitmap bits are set to the buddy lists, pmm_lock held
+//pages that are already free or parked in a cache or the zero pool are skipped
+static void pmm_free_locked(size start, size pages) {
+    size run_start = 0, run_len = 0;
+    pmm_zone_t *run_zone = NULL;
+
+    for (size pfn = start; pfn <= start + pages; pfn++) {
+        bool take = false;
+        pmm_zone_t *zone = NULL;
+        if (pfn < start + pages && BITMAP_TEST(pfn) &&
+            page_state[pfn] != PMM_PAGE_PCP && page_state[pfn] != PMM_PAGE_ZERO) {
+            zone = zone_of(pfn);
+            take = zone != NULL;
+        }
+
+        if (take && run_len > 0 && zone == run_zone) {
+            BITMAP_CLEAR(pfn);
+            run_len++;
+            continue;
+        }
+        if (run_len > 0) buddy_free_range(run_zone, run_start, run_len);
+        run_len = 0;
+        if (take) {
+            BITMAP_CLEAR(pfn);
+            run_zone = zone;
+            run_start = pfn;
+            run_len = 1;
+        }
+    }
+}
+
+//mark [start_page, start_page + count) as reserved during init
+static void pmm_reserve_range(size start_page, size count) {
+    for (size i = 0; i < count; i++) {
+        if (start_page + i < max_pages) BITMAP_SET(start_page + i);
+    }
+}
+
 void pmm_init(void) {
     struct db_tag_memory_map *mmap = db_get_memory_map();
     if (!mmap) {
@@ -75,23 +339,26 @@ void pmm_init(void) {
     bitmap_size = max_pages / 8;
     if (max_pages % 8) bitmap_size++;
 
+    //the bitmap and the per-page state bytes share one allocation
+    size meta_size = bitmap_size + max_pages;
+
     serial_write("[pmm] max_addr: ");
     serial_write_hex(max_addr);
-    serial_write(", bitmap_size: ");
-    serial_write_hex(bitmap_size);
+    serial_write(", metadata: ");
+    serial_write_hex(meta_size);
     serial_write(" bytes\n");
 
-    //find a place for the bitmap (avoiding the first 1MB if possible)
+    //find a place for the metadata (avoiding the first 1MB if possible)
     bool found = false;
     for (uint32 i = 0; i < mmap->entry_count; i++) {
         struct db_mmap_entry *current = (struct db_mmap_entry *)(entries_ptr + i * mmap->entry_size);
         if (current->length > 0 && current->base + current->length < current->base) {
             continue;
         }
-        if (current->type == DB_MEM_USABLE && current->length >= bitmap_size) {
-            //don't put bitmap at address 0 try to keep it above 1MB
+        if (current->type == DB_MEM_USABLE && current->length >= meta_size) {
+            //don't put metadata at address 0 try to keep it above 1MB
             if (current->base >= 0x100000) {
-                //use HHDM for bitmap address
+                //use HHDM for metadata address
                 bitmap = (uint8 *)P2V(current->base);
                 found = true;
                 break;
@@ -106,7 +373,7 @@ void pmm_init(void) {
             if (current->length > 0 && current->base + current->length < current->base) {
                 continue;
             }
-            if (current->type == DB_MEM_USABLE && current->length >= bitmap_size && current->base > 0) {
+            if (current->type == DB_MEM_USABLE && current->length >= meta_size && current->base > 0) {
                 bitmap = (uint8 *)P2V(current->base);
                 found = true;
                 break;
@@ -119,6 +386,9 @@ void pmm_init(void) {
         return;
     }
 
+    page_state = bitmap + bitmap_size;
+    memset(page_state, PMM_PAGE_NONE, max_pages);
+
     //initially mark everything as reserved (1)
     for (size i = 0; i < bitmap_size; i++) bitmap[i] = 0xFF;
 
@@ -135,184 +405,241 @@ void pmm_init(void) {
                 if (start_page + j < max_pages) {
                     if (BITMAP_TEST(start_page + j)) {
                         BITMAP_CLEAR(start_page + j);
-                        free_pages++;
                         total_usable_pages++;
                     }
                 }
             }
         }
     }
-    
-    //reserve the bitmap itself
-    uintptr bitmap_phys = V2P(bitmap);
-    size bitmap_start_page = bitmap_phys / PAGE_SIZE;
-    size bitmap_page_count = bitmap_size / PAGE_SIZE;
-    if (bitmap_size % PAGE_SIZE) bitmap_page_count++;
-    for (size i = 0; i < bitmap_page_count; i++) {
-        if (!BITMAP_TEST(bitmap_start_page + i)) {
-            BITMAP_SET(bitmap_start_page + i);
-            free_pages--;
-        }
-    }
+
+    //reserve the metadata itself
+    uintptr meta_phys = V2P(bitmap);
+    pmm_reserve_range(meta_phys / PAGE_SIZE, (meta_size + PAGE_SIZE - 1) / PAGE_SIZE);
 
     //reserve the kernel physical segments
     struct db_tag_kernel_phys *kphys = db_get_kernel_phys();
-    if (kphys) {
-        if (kphys->phys_length == 0) {
-            goto skip_kernel_reserve;
-        }
-        size k_start = kphys->phys_base / PAGE_SIZE;
-        size k_count = kphys->phys_length / PAGE_SIZE;
-        if (kphys->phys_length % PAGE_SIZE) k_count++;
-        for (size i = 0; i < k_count; i++) {
-            if (k_start + i < max_pages) {
-                if (!BITMAP_TEST(k_start + i)) {
-                    BITMAP_SET(k_start + i);
-                    free_pages--;
-                }
-            }
-        }
+    if (kphys && kphys->phys_length != 0) {
+        pmm_reserve_range(kphys->phys_base / PAGE_SIZE,
+                          (kphys->phys_length + PAGE_SIZE - 1) / PAGE_SIZE);
     }
-skip_kernel_reserve:;
 
     //reserve the boot info structure and all tags (the tags region)
     struct db_boot_info *info = db_get_boot_info();
     if (info) {
         if (info->total_size == 0) {
             serial_write("[pmm] WARN: boot info size is zero\n");
-            return;
-        }
-        size info_start = (uintptr)V2P(info) / PAGE_SIZE;
-        size info_count = info->total_size / PAGE_SIZE;
-        if (info->total_size % PAGE_SIZE) info_count++;
-        for (size i = 0; i < info_count; i++) {
-            if (info_start + i < max_pages) {
-                if (!BITMAP_TEST(info_start + i)) {
-                    BITMAP_SET(info_start + i);
-                    free_pages--;
-                }
-            }
+        } else {
+            pmm_reserve_range((uintptr)V2P(info) / PAGE_SIZE,
+                              (info->total_size + PAGE_SIZE - 1) / PAGE_SIZE);
         }
     }
-    
+
     //reserve Initrd
     struct db_tag_initrd *initrd = db_get_initrd();
-    if (initrd) {
-        if (initrd->length == 0) {
-            goto skip_initrd_reserve;
-        }
+    if (initrd && initrd->length != 0) {
         if (initrd->start + initrd->length < initrd->start) {
             serial_write("[pmm] WARN: skipping overflowed initrd range\n");
-            goto skip_initrd_reserve;
-        }
-        size rd_start = initrd->start / PAGE_SIZE;
-        size rd_count = initrd->length / PAGE_SIZE;
-        if (initrd->length % PAGE_SIZE) rd_count++;
-        for (size i = 0; i < rd_count; i++) {
-            if (rd_start + i < max_pages) {
-                if (!BITMAP_TEST(rd_start + i)) {
-                    BITMAP_SET(rd_start + i);
-                    free_pages--;
-                }
-            }
+        } else {
+            pmm_reserve_range(initrd->start / PAGE_SIZE,
+                              (initrd->length + PAGE_SIZE - 1) / PAGE_SIZE);
         }
     }
-skip_initrd_reserve:
-    ;
 
     //reserve page 0
-    if (!BITMAP_TEST(0)) {
-        BITMAP_SET(0);
-        free_pages--;
+    BITMAP_SET(0);
+
+    //lay the zones over the page range, empty zones just never match
+    size low_end = ARCH_PMM_ZONE_MIN_ADDR / PAGE_SIZE;
+    size dma32_end = ARCH_PMM_ZONE_DMA32_ADDR / PAGE_SIZE;
+    if (low_end > max_pages) low_end = max_pages;
+    if (dma32_end > max_pages) dma32_end = max_pages;
+    zones[PMM_ZONE_LOW].start_page = 0;
+    zones[PMM_ZONE_LOW].end_page = low_end;
+    zones[PMM_ZONE_DMA32].start_page = low_end;
+    zones[PMM_ZONE_DMA32].end_page = dma32_end;
+    zones[PMM_ZONE_NORMAL].start_page = dma32_end;
+    zones[PMM_ZONE_NORMAL].end_page = max_pages;
+
+    //feed every free run to the buddy lists
+    for (int z = 0; z < PMM_ZONE_COUNT; z++) {
+        pmm_zone_t *zone = &zones[z];
+        size run = 0;
+        for (size pfn = zone->start_page; pfn <= zone->end_page; pfn++) {
+            if (pfn < zone->end_page && !BITMAP_TEST(pfn)) {
+                run++;
+                continue;
+            }
+            if (run > 0) buddy_free_range(zone, pfn - run, run);
+            run = 0;
+        }
     }
 
-    serial_write("[pmm] initialized, bitmap @ ");
+    serial_write("[pmm] initialized, metadata @ ");
     serial_write_hex((uintptr)bitmap);
+    serial_write(", free pages: ");
+    serial_write_hex(free_pages);
     serial_write("\n");
 }
 
-static void *pmm_alloc_window_internal(size pages, size start_page, size limit_page, size *cursor) {
-    if (pages == 0) return NULL;
-    if (start_page >= limit_page) return NULL;
-
-    size consecutive = 0;
-    size start_bit = 0;
-    size scan_start = (cursor && *cursor >= start_page && *cursor < limit_page) ? *cursor : start_page;
-
-    //word skipping optimization
-    uword *bitmap_words = (uword *)bitmap;
-    size max_words = limit_page / ARCH_BITS;
+void pmm_init_percpu(void) {
+    memset(pcp, 0, sizeof(pcp));
+    pmm_percpu_ready = true;
+}
 
-    for (size i = scan_start; i < limit_page; ) {
-        //if we are at the start of a word and need more than current bit try skipping
-        if ((i % ARCH_BITS == 0) && (consecutive == 0)) {
-            while (i / ARCH_BITS < max_words && bitmap_words[i / ARCH_BITS] == (uword)-1) {
-                i += ARCH_BITS;
-            }
-            if (i >= limit_page) break;
+//single page from the current CPU's cache, refilled from the buddy lists in batches
+static void *pcp_alloc(void) {
+    irq_state_t flags = arch_irq_save();
+    pmm_pcp_t *cache = &pcp[arch_cpu_index()];
+
+    if (cache->count == 0) {
+        cache->misses++;
+        spinlock_acquire(&pmm_lock.lock);
+        while (cache->count < PMM_PCP_BATCH) {
+            void *p = pmm_alloc_locked(1, 0, max_pages);
+            if (!p) break;
+            size pfn = (uintptr)p / PAGE_SIZE;
+            page_state[pfn] = PMM_PAGE_PCP;
+            cache->pfns[cache->count++] = pfn;
         }
+        spinlock_release(&pmm_lock.lock);
 
-        if (!BITMAP_TEST(i)) {
-            if (consecutive == 0) start_bit = i;
-            consecutive++;
-            if (consecutive == pages) {
-                for (size j = 0; j < pages; j++) {
-                    BITMAP_SET(start_bit + j);
-                }
-                free_pages -= pages;
-                if (cursor) *cursor = start_bit + pages;
-                return (void *)(uintptr)(start_bit * PAGE_SIZE);
-            }
-        } else {
-            consecutive = 0;
+        if (cache->count == 0) {
+            arch_irq_restore(flags);
+            return NULL;
         }
-        i++;
+    } else {
+        cache->hits++;
     }
 
-    //if we reached the end try searching from the beginning once
-    if (scan_start > start_page) {
-        size search_limit = scan_start < limit_page ? scan_start : limit_page;
-        consecutive = 0;
-        for (size i = start_page; i < search_limit; ) {
-            if ((i % ARCH_BITS == 0) && (consecutive == 0)) {
-                while (i / ARCH_BITS < max_words && i + ARCH_BITS <= search_limit && bitmap_words[i / ARCH_BITS] == (uword)-1) {
-                    i += ARCH_BITS;
-                }
-                if (i >= search_limit) break;
-            }
+    size pfn = cache->pfns[--cache->count];
+    page_state[pfn] = PMM_PAGE_NONE;
+    arch_irq_restore(flags);
+    return (void *)(uintptr)(pfn * PAGE_SIZE);
+}
 
-            if (!BITMAP_TEST(i)) {
-                if (consecutive == 0) start_bit = i;
-                consecutive++;
-                if (consecutive == pages) {
-                    for (size j = 0; j < pages; j++) {
-                        BITMAP_SET(start_bit + j);
-                    }
-                    free_pages -= pages;
-                    if (cursor) *cursor = start_bit + pages;
-                    return (void *)(uintptr)(start_bit * PAGE_SIZE);
-                }
-            } else {
-                consecutive = 0;
-            }
-            i++;
+//single page into the current CPU's cache, the oldest half goes back when full
+static void pcp_free(size pfn) {
+    irq_state_t flags = arch_irq_save();
+    pmm_pcp_t *cache = &pcp[arch_cpu_index()];
+
+    //a page that is not allocated is a double free, drop it like the buddy path does
+    if (!BITMAP_TEST(pfn) || page_state[pfn] == PMM_PAGE_PCP || page_state[pfn] == PMM_PAGE_ZERO) {
+        arch_irq_restore(flags);
+        return;
+    }
+
+    if (cache->count == PMM_PCP_SIZE) {
+        cache->misses++;
+        spinlock_acquire(&pmm_lock.lock);
+        for (uint32 i = 0; i < PMM_PCP_BATCH; i++) {
+            size old = cache->pfns[i];
+            page_state[old] = PMM_PAGE_NONE;
+            pmm_free_locked(old, 1);
         }
+        spinlock_release(&pmm_lock.lock);
+
+        memmove(&cache->pfns[0], &cache->pfns[PMM_PCP_BATCH],
+                (PMM_PCP_SIZE - PMM_PCP_BATCH) * sizeof(size));
+        cache->count -= PMM_PCP_BATCH;
+    } else {
+        cache->hits++;
     }
 
-    return NULL;
+    page_state[pfn] = PMM_PAGE_PCP;
+    cache->pfns[cache->count++] = pfn;
+    arch_irq_restore(flags);
 }
 
-static void *pmm_alloc_internal(size pages, size limit_page) {
-    return pmm_alloc_window_internal(pages, 0, limit_page, &last_free_page);
+//one page out of the zero pool, NULL if it is empty
+static void *zero_pool_take(void) {
+    void *page = NULL;
+    irq_state_t flags = spinlock_irq_acquire(&zero_lock);
+    if (zero_count > 0) {
+        size pfn = zero_pool[--zero_count];
+        page_state[pfn] = PMM_PAGE_NONE;
+        page = (void *)(uintptr)(pfn * PAGE_SIZE);
+    }
+    spinlock_irq_release(&zero_lock, flags);
+    return page;
+}
+
+//hand the whole zero pool back to the buddy lists when memory runs out
+//returns whether there was anything to give back
+static bool zero_pool_drain(void) {
+    irq_state_t flags = spinlock_irq_acquire(&zero_lock);
+    uint32 count = zero_count;
+    if (count > 0) {
+        spinlock_acquire(&pmm_lock.lock);
+        for (uint32 i = 0; i < count; i++) {
+            page_state[zero_pool[i]] = PMM_PAGE_NONE;
+            pmm_free_locked(zero_pool[i], 1);
+        }
+        spinlock_release(&pmm_lock.lock);
+        zero_count = 0;
+    }
+    spinlock_irq_release(&zero_lock, flags);
+    return count > 0;
 }
 
 void *pmm_alloc(size pages) {
+    if (pages == 1 && pmm_percpu_ready) {
+        void *page = pcp_alloc();
+        //pool pages are free memory too, they just happen to be clear already
+        return page ? page : zero_pool_take();
+    }
+
     irq_state_t flags = spinlock_irq_acquire(&pmm_lock);
-    void *res = pmm_alloc_internal(pages, max_pages);
+    void *res = pmm_alloc_locked(pages, 0, max_pages);
     spinlock_irq_release(&pmm_lock, flags);
+    if (!res && zero_pool_drain()) {
+        flags = spinlock_irq_acquire(&pmm_lock);
+        res = pmm_alloc_locked(pages, 0, max_pages);
+        spinlock_irq_release(&pmm_lock, flags);
+    }
     return res;
 }
 
+void *pmm_alloc_zeroed(void) {
+    void *page = zero_pool_take();
+    if (page) {
+        zero_hits++;
+        return page;
+    }
+
+    zero_misses++;
+    page = pmm_alloc(1);
+    if (page) memset(P2V(page), 0, PAGE_SIZE);
+    return page;
+}
+
+uint32 pmm_zero_refill(uint32 budget) {
+    if (!pmm_percpu_ready) return 0;
+
+    uint32 added = 0;
+    while (added < budget && zero_count < PMM_ZERO_POOL_SIZE) {
+        //never hold on to the last of the free memory
+        if (free_pages + pcp_cached_pages() < PMM_ZERO_MIN_FREE) break;
+
+        void *page = pcp_alloc();
+        if (!page) break;
+        arch_page_zero_nt(P2V(page));
+
+        size pfn = (uintptr)page / PAGE_SIZE;
+        irq_state_t flags = spinlock_irq_acquire(&zero_lock);
+        if (zero_count == PMM_ZERO_POOL_SIZE) {
+            //another CPU filled the last slot while we were clearing
+            spinlock_irq_release(&zero_lock, flags);
+            pmm_free(page, 1);
+            break;
+        }
+        page_state[pfn] = PMM_PAGE_ZERO;
+        zero_pool[zero_count++] = pfn;
+        spinlock_irq_release(&zero_lock, flags);
+        added++;
+    }
+    return added;
+}
+
 void *pmm_alloc_zone(size pages, uintptr max_addr) {
     size limit_page = max_addr / PAGE_SIZE;
     if (limit_page > max_pages) limit_page = max_pages;
@@ -320,7 +647,7 @@ void *pmm_alloc_zone(size pages, uintptr max_addr) {
     if (start_page >= limit_page) return NULL;
 
     irq_state_t flags = spinlock_irq_acquire(&pmm_lock);
-    void *res = pmm_alloc_window_internal(pages, start_page, limit_page, &last_zone_free_page);
+    void *res = pmm_alloc_locked(pages, start_page, limit_page);
     spinlock_irq_release(&pmm_lock, flags);
     return res;
 }
@@ -328,42 +655,23 @@ void *pmm_alloc_zone(size pages, uintptr max_addr) {
 void pmm_free(void *ptr, size pages) {
     if (!ptr) return;
 
-    irq_state_t flags = spinlock_irq_acquire(&pmm_lock);
     uintptr addr = (uintptr)ptr;
 
     //check page alignment and range overflow to avoid OOB bitmap access
-    if (addr % PAGE_SIZE != 0) {
-        spinlock_irq_release(&pmm_lock, flags);
-        return; //unaligned
-    }
+    if (addr % PAGE_SIZE != 0) return; //unaligned
     size start_bit = addr / PAGE_SIZE;
     //check for wrapping
-    if (pages == 0 || start_bit + pages < start_bit) {
-        spinlock_irq_release(&pmm_lock, flags);
-        return;
-    }
+    if (pages == 0 || start_bit + pages < start_bit) return;
     //verify range lies within physical memory limits
-    if (start_bit >= max_pages || start_bit + pages > max_pages) {
-        spinlock_irq_release(&pmm_lock, flags);
-        return;
-    }
+    if (start_bit >= max_pages || start_bit + pages > max_pages) return;
 
-    bool freed_any = false;
-    for (size i = 0; i < pages; i++) {
-        if (!BITMAP_TEST(start_bit + i)) continue;
-        BITMAP_CLEAR(start_bit + i);
-        free_pages++;
-        freed_any = true;
-    }
-
-    if (freed_any) {
-        if (start_bit < last_free_page) last_free_page = start_bit;
-        if (start_bit < last_zone_free_page &&
-            start_bit >= (ARCH_PMM_ZONE_MIN_ADDR / PAGE_SIZE)) {
-            last_zone_free_page = start_bit;
-        }
+    if (pages == 1 && pmm_percpu_ready) {
+        pcp_free(start_bit);
+        return;
     }
 
+    irq_state_t flags = spinlock_irq_acquire(&pmm_lock);
+    pmm_free_locked(start_bit, pages);
     spinlock_irq_release(&pmm_lock, flags);
 }
 
@@ -371,6 +679,51 @@ size pmm_get_total_pages(void) {
     return total_usable_pages;
 }
 
+//pages parked in per-CPU caches or the zero pool are free from the caller's point of view
+//counts are read racily since each CPU only updates its own
+static size pcp_cached_pages(void) {
+    size n = 0;
+    for (uint32 c = 0; c < MAX_CPUS; c++) n += pcp[c].count;
+    return n;
+}
+
 size pmm_get_free_pages(void) {
-    return free_pages;
+    return free_pages + pcp_cached_pages() + zero_count;
+}
+
+void pmm_get_stats(pmm_stats_t *stats) {
+    if (!stats) return;
+    memset(stats, 0, sizeof(*stats));
+
+    irq_state_t flags = spinlock_irq_acquire(&pmm_lock);
+    stats->total_pages = total_usable_pages;
+    stats->buddy_free_pages = free_pages;
+    for (int z = 0; z < PMM_ZONE_COUNT; z++) {
+        for (uint32 o = 0; o <= PMM_MAX_ORDER; o++) {
+            stats->free_blocks[o] += zones[z].free_blocks[o];
+        }
+    }
+    stats->dma_free_pages = zones[PMM_ZONE_DMA32].free_pages;
+    spinlock_irq_release(&pmm_lock, flags);
+
+    for (uint32 c = 0; c < MAX_CPUS; c++) {
+        stats->pcp_pages += pcp[c].count;
+        stats->pcp_hits += pcp[c].hits;
+        stats->pcp_misses += pcp[c].misses;
+    }
+    stats->zero_pages = zero_count;
+    stats->zero_hits = zero_hits;
+    stats->zero_misses = zero_misses;
+    stats->free_pages = stats->buddy_free_pages + stats->pcp_pages + stats->zero_pages;
+
+    //share of buddy memory that sits in blocks too small for PMM_FRAG_ORDER
+    size small = 0;
+    stats->largest_order = -1;
+    for (uint32 o = 0; o <= PMM_MAX_ORDER; o++) {
+        if (stats->free_blocks[o]) stats->largest_order = (int32)o;
+        if (o < PMM_FRAG_ORDER) small += stats->free_blocks[o] << o;
+    }
+    if (stats->buddy_free_pages) {
+        stats->frag_permille = (uint32)(small * 1000 / stats->buddy_free_pages);
+    }
 }
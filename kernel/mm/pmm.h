@@ -2,16 +2,50 @@
 #define MM_PMM_H
 
 #include <arch/types.h>
+#include <sys/pmm.h>
 
 #define PAGE_SIZE 4096
 
+#define PMM_ZONE_COUNT 3
+
+//free memory in blocks below this order counts as fragmented (2MB)
+#define PMM_FRAG_ORDER 9
+
+typedef struct {
+    uint64 total_pages;
+    uint64 free_pages;          //buddy lists, per-CPU caches and the zero pool
+    uint64 buddy_free_pages;
+    uint64 pcp_pages;           //free pages parked in per-CPU caches
+    uint64 pcp_hits;
+    uint64 pcp_misses;
+    uint64 zero_pages;          //pre-zeroed pages waiting in the zero pool
+    uint64 zero_hits;
+    uint64 zero_misses;
+    uint64 dma_free_pages;      //free pages pmm_alloc_zone can hand out below 4GB
+    uint64 free_blocks[PMM_MAX_ORDER + 1];  //free blocks of each order
+    int32 largest_order;        //order of the largest free block, -1 if none
+    uint32 frag_permille;       //buddy free memory in blocks below PMM_FRAG_ORDER
+} pmm_stats_t;
+
 void pmm_init(void);
 
+//enable per-CPU page caches (call once per-CPU data is live on the BSP)
+void pmm_init_percpu(void);
+
 void *pmm_alloc(size pages);
 void *pmm_alloc_zone(size pages, uintptr max_addr);
 void pmm_free(void *ptr, size pages);
 
+//single page that is already filled with zeroes, taken from the zero pool
+//when it has one and cleared on the spot otherwise
+void *pmm_alloc_zeroed(void);
+
+//clear up to budget free pages into the zero pool, returns how many were added
+//meant for idle time, it stops once the pool is full or memory runs low
+uint32 pmm_zero_refill(uint32 budget);
+
 size pmm_get_total_pages(void);
 size pmm_get_free_pages(void);
+void pmm_get_stats(pmm_stats_t *stats);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,258 @@
+#include <mm/vmem.h>
+#include <mm/pmm.h>
+#include <mm/mm.h>
+#include <lib/io.h>
+#include <lib/string.h>
+
+/*
+ *vmem style range allocator
+ *
+ *every range of the arena, free or allocated, is a segment with a boundary tag
+ *tags are linked in address order so a freed segment merges with its free
+ *neighbours in O(1). free segments sit on power of two lists by size and
+ *allocated ones in a hash table keyed by start address, so neither alloc nor
+ *free gets slower as the number of ranges grows
+ *
+ *allocation is instant fit: the lowest list whose members are all large enough
+ *is used, the list below is only searched when every such list is empty
+ *
+ *tags and the hash table live in whole pages reached through the HHDM, so the
+ *arena never depends on the heap it may be backing
+ */
+
+typedef struct vmem_seg {
+    uintptr start;
+    size length;
+    struct vmem_seg *prev;      //neighbours in address order
+    struct vmem_seg *next;
+    struct vmem_seg *fnext;     //free list, hash chain while allocated, spare list when unused
+    struct vmem_seg *fprev;
+    bool free;
+} vmem_seg_t;
+
+#define VMEM_TAGS_PER_PAGE (PAGE_SIZE / sizeof(vmem_seg_t))
+#define VMEM_HASH_PER_PAGE (PAGE_SIZE / sizeof(vmem_seg_t *))
+
+static inline uint32 vmem_log2(size n) {
+    return 63 - (uint32)__builtin_clzll(n);
+}
+
+static inline size vmem_hash_idx(vmem_t *vm, uintptr addr) {
+    size q = (addr - vm->base) / vm->quantum;
+    return (size)((q * 0x9E3779B97F4A7C15ULL) >> 32) & vm->hash_mask;
+}
+
+//make sure a spare tag is ready before touching any lists, vm->lock held
+static int vmem_tag_reserve(vmem_t *vm) {
+    if (vm->spare) return 0;
+
+    void *page = pmm_alloc(1);
+    if (!page) return -1;
+    vmem_seg_t *tags = P2V(page);
+    for (size i = 0; i < VMEM_TAGS_PER_PAGE; i++) {
+        tags[i].fnext = vm->spare;
+        vm->spare = &tags[i];
+    }
+    return 0;
+}
+
+static vmem_seg_t *vmem_tag_get(vmem_t *vm) {
+    vmem_seg_t *seg = vm->spare;
+    vm->spare = seg->fnext;
+    memset(seg, 0, sizeof(*seg));
+    return seg;
+}
+
+static void vmem_tag_put(vmem_t *vm, vmem_seg_t *seg) {
+    seg->fnext = vm->spare;
+    vm->spare = seg;
+}
+
+static void vmem_freelist_insert(vmem_t *vm, vmem_seg_t *seg) {
+    uint32 i = vmem_log2(seg->length / vm->quantum);
+    seg->free = true;
+    seg->fprev = NULL;
+    seg->fnext = vm->freelist[i];
+    if (seg->fnext) seg->fnext->fprev = seg;
+    vm->freelist[i] = seg;
+    vm->freemap |= 1ULL << i;
+}
+
+static void vmem_freelist_remove(vmem_t *vm, vmem_seg_t *seg) {
+    uint32 i = vmem_log2(seg->length / vm->quantum);
+    if (seg->fprev) seg->fprev->fnext = seg->fnext;
+    else vm->freelist[i] = seg->fnext;
+    if (seg->fnext) seg->fnext->fprev = seg->fprev;
+    if (!vm->freelist[i]) vm->freemap &= ~(1ULL << i);
+    seg->free = false;
+    seg->fnext = seg->fprev = NULL;
+}
+
+static void vmem_hash_insert(vmem_t *vm, vmem_seg_t *seg) {
+    size i = vmem_hash_idx(vm, seg->start);
+    seg->fnext = vm->hash[i];
+    vm->hash[i] = seg;
+    vm->alloc_count++;
+}
+
+static vmem_seg_t *vmem_hash_remove(vmem_t *vm, uintptr addr) {
+    vmem_seg_t **pp = &vm->hash[vmem_hash_idx(vm, addr)];
+    while (*pp && (*pp)->start != addr) pp = &(*pp)->fnext;
+
+    vmem_seg_t *seg = *pp;
+    if (seg) {
+        *pp = seg->fnext;
+        seg->fnext = NULL;
+        vm->alloc_count--;
+    }
+    return seg;
+}
+
+//double the table once chains average more than two entries
+//if memory is short the old table just keeps working with longer chains
+static void vmem_hash_grow(vmem_t *vm) {
+    size pages = vm->hash_pages * 2;
+    void *phys = pmm_alloc(pages);
+    if (!phys) return;
+    vmem_seg_t **table = P2V(phys);
+    memset(table, 0, pages * PAGE_SIZE);
+
+    vmem_seg_t **old = vm->hash;
+    size old_pages = vm->hash_pages;
+    size old_count = vm->hash_mask + 1;
+    vm->hash = table;
+    vm->hash_pages = pages;
+    vm->hash_mask = pages * VMEM_HASH_PER_PAGE - 1;
+
+    for (size i = 0; i < old_count; i++) {
+        vmem_seg_t *seg = old[i];
+        while (seg) {
+            vmem_seg_t *next = seg->fnext;
+            size j = vmem_hash_idx(vm, seg->start);
+            seg->fnext = table[j];
+            table[j] = seg;
+            seg = next;
+        }
+    }
+    pmm_free((void *)V2P(old), old_pages);
+}
+
+int vmem_init(vmem_t *vm, const char *name, uintptr base, size length, size quantum) {
+    if (!vm || base == 0 || quantum == 0 || (quantum & (quantum - 1))) return -1;
+    if (base & (quantum - 1)) return -1;
+    length &= ~(quantum - 1);
+    if (length == 0) return -1;
+
+    memset(vm, 0, sizeof(*vm));
+    vm->name = name;
+    vm->base = base;
+    vm->length = length;
+    vm->quantum = quantum;
+    spinlock_irq_init(&vm->lock);
+
+    void *phys = pmm_alloc(1);
+    if (!phys) return -1;
+    vm->hash = P2V(phys);
+    memset(vm->hash, 0, PAGE_SIZE);
+    vm->hash_pages = 1;
+    vm->hash_mask = VMEM_HASH_PER_PAGE - 1;
+
+    if (vmem_tag_reserve(vm) < 0) {
+        pmm_free(phys, 1);
+        return -1;
+    }
+    vmem_seg_t *seg = vmem_tag_get(vm);
+    seg->start = base;
+    seg->length = length;
+    vmem_freelist_insert(vm, seg);
+    vm->free_bytes = length;
+    return 0;
+}
+
+uintptr vmem_alloc(vmem_t *vm, size length) {
+    if (!vm || length == 0 || length > vm->length) return 0;
+    length = (length + vm->quantum - 1) & ~(vm->quantum - 1);
+    size q = length / vm->quantum;
+
+    irq_state_t flags = spinlock_irq_acquire(&vm->lock);
+    //a split needs a tag for the remainder
+    if (vmem_tag_reserve(vm) < 0) {
+        spinlock_irq_release(&vm->lock, flags);
+        return 0;
+    }
+
+    vmem_seg_t *seg = NULL;
+    uint32 low = vmem_log2(q);
+    uint32 first = (q & (q - 1)) ? low + 1 : low;
+    uint64 fit = first < VMEM_FREELISTS ? vm->freemap & ~((1ULL << first) - 1) : 0;
+    if (fit) {
+        seg = vm->freelist[__builtin_ctzll(fit)];
+    } else if (first != low) {
+        //no list is guaranteed to fit, the one below may still hold a large enough segment
+        for (seg = vm->freelist[low]; seg && seg->length < length; seg = seg->fnext);
+    }
+    if (!seg) {
+        spinlock_irq_release(&vm->lock, flags);
+        return 0;
+    }
+
+    vmem_freelist_remove(vm, seg);
+    if (seg->length > length) {
+        vmem_seg_t *rest = vmem_tag_get(vm);
+        rest->start = seg->start + length;
+        rest->length = seg->length - length;
+        rest->prev = seg;
+        rest->next = seg->next;
+        if (seg->next) seg->next->prev = rest;
+        seg->next = rest;
+        seg->length = length;
+        vmem_freelist_insert(vm, rest);
+    }
+    vmem_hash_insert(vm, seg);
+    vm->free_bytes -= length;
+    vm->used_bytes += length;
+    if (vm->alloc_count > 2 * (vm->hash_mask + 1)) vmem_hash_grow(vm);
+
+    uintptr addr = seg->start;
+    spinlock_irq_release(&vm->lock, flags);
+    return addr;
+}
+
+int vmem_free(vmem_t *vm, uintptr addr, size length) {
+    if (!vm || length == 0) return -1;
+    length = (length + vm->quantum - 1) & ~(vm->quantum - 1);
+
+    irq_state_t flags = spinlock_irq_acquire(&vm->lock);
+    vmem_seg_t *seg = vmem_hash_remove(vm, addr);
+    if (!seg || seg->length != length) {
+        if (seg) vmem_hash_insert(vm, seg);
+        spinlock_irq_release(&vm->lock, flags);
+        printf("[vmem] %s: bad free of %zu bytes at %P\n", vm->name, length, (void *)addr);
+        return -1;
+    }
+    vm->free_bytes += length;
+    vm->used_bytes -= length;
+
+    //merge with free neighbours, their tags go back on the spare list
+    vmem_seg_t *next = seg->next;
+    if (next && next->free) {
+        vmem_freelist_remove(vm, next);
+        seg->length += next->length;
+        seg->next = next->next;
+        if (next->next) next->next->prev = seg;
+        vmem_tag_put(vm, next);
+    }
+    vmem_seg_t *prev = seg->prev;
+    if (prev && prev->free) {
+        vmem_freelist_remove(vm, prev);
+        prev->length += seg->length;
+        prev->next = seg->next;
+        if (seg->next) seg->next->prev = prev;
+        vmem_tag_put(vm, seg);
+        seg = prev;
+    }
+    vmem_freelist_insert(vm, seg);
+
+    spinlock_irq_release(&vm->lock, flags);
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef MM_VMEM_H
+#define MM_VMEM_H
+
+#include <arch/types.h>
+#include <lib/spinlock.h>
+
+//one free list per power of two of a segment's size in quanta
+#define VMEM_FREELISTS 64
+
+struct vmem_seg;
+
+//address range arena, hands out quantum aligned ranges of [base, base + length)
+//segments are tracked with boundary tags so alloc and free never scan the arena
+typedef struct {
+    const char *name;
+    uintptr base;
+    size length;
+    size quantum;
+    spinlock_irq_t lock;
+
+    struct vmem_seg *freelist[VMEM_FREELISTS];  //free segments of 2^n to 2^(n+1)-1 quanta
+    uint64 freemap;                             //bit n set while freelist[n] is not empty
+
+    struct vmem_seg **hash;     //allocated segments by start address
+    size hash_pages;            //pages backing the hash table (a power of two)
+    size hash_mask;
+    size alloc_count;           //allocated segments, the table doubles past 2 per bucket
+
+    struct vmem_seg *spare;     //unused boundary tags
+    size free_bytes;
+    size used_bytes;
+} vmem_t;
+
+//set up an arena covering [base, base + length), returns -1 if metadata can't be allocated
+int vmem_init(vmem_t *vm, const char *name, uintptr base, size length, size quantum);
+
+//allocate length bytes (rounded up to the quantum), returns 0 when the arena is exhausted
+uintptr vmem_alloc(vmem_t *vm, size length);
+
+//give back a range from vmem_alloc, the length must match the allocation
+int vmem_free(vmem_t *vm, uintptr addr, size length);
+
+#endif
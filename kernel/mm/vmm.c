@@ -1,7 +1,11 @@
 #include <mm/vmm.h>
 #include <mm/pmm.h>
+#include <mm/mm.h>
+#include <mm/vmo.h>
 #include <arch/mmu.h>
+#include <proc/process.h>
 #include <lib/io.h>
+#include <lib/string.h>
 
 void vmm_map(pagemap_t *map, uintptr virt, uintptr phys, size pages, uint64 flags) {
     mmu_map_range(map, virt, phys, pages, flags);
@@ -25,3 +29,105 @@ void vmm_init(void) {
     //the kernel is already mapped by the bootloader (HHDM + Kernel ELF)
     //vmm_init can eventually set up heap guards whatever
 }
+
+int vmm_handle_fault(process_t *proc, uintptr addr, uint32 access) {
+    if (!proc || !proc->pagemap) return -1;
+    if (addr < USER_SPACE_START || addr >= USER_SPACE_END) return -1;
+
+    //the only protection faults handled here are writes to copy-on-write pages
+    if ((access & VMM_FAULT_PRESENT) && !(access & VMM_FAULT_WRITE)) return -1;
+
+    uintptr page_addr = addr & ~(uintptr)(PAGE_SIZE - 1);
+
+    //take what we need from the VMA and a ref on its object, the lock is not
+    //held while memory is allocated and filled
+    spinlock_acquire(&proc->vma_lock);
+    proc_vma_t *vma = process_vma_find_locked(proc, addr);
+    if (!vma ||
+        ((access & VMM_FAULT_WRITE) && !(vma->flags & MMU_FLAG_WRITE)) ||
+        ((access & VMM_FAULT_EXEC) && !(vma->flags & MMU_FLAG_EXEC))) {
+        spinlock_release(&proc->vma_lock);
+        return -1;
+    }
+
+    //another thread may have resolved this page while we were getting here
+    //a write to a mapped VMO page still has to break copy-on-write sharing
+    if (mmu_virt_to_phys(proc->pagemap, page_addr) != (uintptr)-1) {
+        if (!(access & VMM_FAULT_WRITE) || !vma->obj) {
+            spinlock_release(&proc->vma_lock);
+            return (access & VMM_FAULT_PRESENT) ? -1 : 0;
+        }
+    }
+
+    uintptr vma_start = vma->start;
+    uint32 vma_flags = vma->flags;
+    object_t *obj = vma->obj;
+    size obj_offset = vma->obj_offset;
+    size vma_length = vma->length;
+    if (obj) object_ref(obj);
+    spinlock_release(&proc->vma_lock);
+
+    int rc = -1;
+    uint64 gen = 0;
+    uintptr phys = 0;
+    uintptr map_addr = page_addr;
+    size map_pages = 1;
+    uint64 map_flags = vma_flags;
+    if (obj) {
+        if (obj->type != OBJECT_VMO) goto out;
+        vmo_t *vmo = (vmo_t *)obj;
+        size offset = obj_offset + (page_addr - vma_start);
+        gen = vmo_generation(vmo);
+
+        //a first touch inside a large page VMO maps the whole 2MB chunk with one
+        //entry when the VMA covers it and lines up with the chunk physically
+        uintptr huge_addr = addr & ~(uintptr)(VMO_HUGE_SIZE - 1);
+        if ((vmo->flags & VMO_FLAG_HUGE) && !(access & VMM_FAULT_PRESENT) &&
+            huge_addr >= vma_start && huge_addr + VMO_HUGE_SIZE <= vma_start + vma_length &&
+            !((offset ^ page_addr) & (VMO_HUGE_SIZE - 1))) {
+            phys = vmo_commit_huge(vmo, offset);
+            if (phys) {
+                map_addr = huge_addr;
+                map_pages = VMO_HUGE_PAGES;
+            }
+        }
+
+        if (!phys) {
+            bool shared = 0;
+            if (!(access & VMM_FAULT_WRITE)) phys = vmo_lookup_page(vmo, offset, &shared);
+            if (!phys) phys = vmo_commit_page(vmo, offset);
+            //a parent's page is mapped read-only, the first write faults again and copies it
+            if (shared) map_flags &= ~(uint64)MMU_FLAG_WRITE;
+        }
+    } else {
+        //anonymous memory (ELF bss and the like) is zero filled on first touch
+        //and freed with the VMA when the process goes away
+        phys = (uintptr)pmm_alloc_zeroed();
+    }
+    if (!phys) goto out;
+
+    //install only while the VMA still maps the same thing and the VMO has not
+    //freed or moved pages since the lookup, an unmap, resize, decommit or clone
+    //that got in meanwhile must not be left with our entry behind it, the
+    //access is retried either way and faults again against the new layout
+    rc = 0;
+    spinlock_acquire(&proc->vma_lock);
+    vma = process_vma_find_locked(proc, addr);
+    bool same = vma && vma->start == vma_start && vma->flags == vma_flags &&
+                vma->obj == obj && vma->obj_offset == obj_offset &&
+                map_addr + map_pages * PAGE_SIZE <= vma->start + vma->length &&
+                (!obj || vmo_generation((vmo_t *)obj) == gen);
+    bool mapped = mmu_virt_to_phys(proc->pagemap, page_addr) != (uintptr)-1;
+    //a racing fault on the same page may have got there first
+    if (same && (!mapped || ((access & VMM_FAULT_WRITE) && obj))) {
+        mmu_map_range(proc->pagemap, map_addr, phys, map_pages, map_flags);
+    }
+    spinlock_release(&proc->vma_lock);
+
+    //anonymous pages belong to the mapping only once installed
+    if (!obj && !(same && !mapped)) pmm_free((void *)phys, 1);
+
+out:
+    if (obj) object_deref(obj);
+    return rc;
+}
@@ -4,8 +4,21 @@
 #include <arch/types.h>
 #include <arch/mmu.h>
 
+struct process;
+
+//page fault access bits passed to vmm_handle_fault
+#define VMM_FAULT_PRESENT (1u << 0)     //the page was mapped (protection fault)
+#define VMM_FAULT_WRITE   (1u << 1)
+#define VMM_FAULT_USER    (1u << 2)
+#define VMM_FAULT_EXEC    (1u << 3)
+
 void vmm_init(void);
 
+//resolve a fault on a user address against the process VMAs
+//commits the backing page (VMO page or fresh zeroed anonymous page) and maps it
+//returns 0 if the access can be retried or -1 if it is a real fault
+int vmm_handle_fault(struct process *proc, uintptr addr, uint32 access);
+
 //higher-level mapping that handles multiple pages
 void vmm_map(pagemap_t *map, uintptr virt, uintptr phys, size pages, uint64 flags);
 void vmm_unmap(pagemap_t *map, uintptr virt, size pages);
@@ -9,26 +9,258 @@
 #include <lib/io.h>
 #include <lib/spinlock.h>
 
+#define VMO_PAGES(sz) (((sz) + PAGE_SIZE - 1) / PAGE_SIZE)
+
+//radix nodes are single pages of 512 entries like the page tables
+//interior entries hold the physical address of the child node, leaf entries
+//hold the physical address of the committed page
+#define VMO_RADIX_SHIFT   9
+#define VMO_RADIX_ENTRIES (1UL << VMO_RADIX_SHIFT)
+#define VMO_RADIX_MASK    (VMO_RADIX_ENTRIES - 1)
+#define VMO_RADIX_MAX_LEVELS 6
+
+//leaf value of a page that reads as zero instead of falling through to the
+//parent, left behind by a decommit in a copy-on-write child
+#define VMO_SLOT_ZERO     1
+
+//set on the hidden parents made by vmo_create_child, they have no handles and
+//live only as long as a child reads through them
+#define VMO_FLAG_HIDDEN   (1U << 31)
+
+static uintptr vmo_radix_node_alloc(void) {
+    return (uintptr)pmm_alloc_zeroed();
+}
+
+//add levels on top until the tree indexes at least pages entries
+static int vmo_radix_grow(vmo_t *vmo, size pages) {
+    while (vmo->levels < VMO_RADIX_MAX_LEVELS &&
+           (1UL << (VMO_RADIX_SHIFT * vmo->levels)) < pages) {
+        if (vmo->root) {
+            uintptr top = vmo_radix_node_alloc();
+            if (!top) return -1;
+            ((uintptr *)P2V(top))[0] = vmo->root;
+            vmo->root = top;
+        }
+        vmo->levels++;
+    }
+    return 0;
+}
+
+//leaf slot for page idx, creating missing nodes if asked
+//caller holds vmo->lock
+static uintptr *vmo_radix_slot(vmo_t *vmo, size idx, bool create) {
+    if (!vmo->root) {
+        if (!create || !(vmo->root = vmo_radix_node_alloc())) return NULL;
+    }
+
+    uintptr *node = (uintptr *)P2V(vmo->root);
+    for (uint32 level = vmo->levels - 1; level > 0; level--) {
+        uintptr *entry = &node[(idx >> (VMO_RADIX_SHIFT * level)) & VMO_RADIX_MASK];
+        if (!*entry) {
+            if (!create || !(*entry = vmo_radix_node_alloc())) return NULL;
+        }
+        node = (uintptr *)P2V(*entry);
+    }
+    return &node[idx & VMO_RADIX_MASK];
+}
+
+static void vmo_radix_free(uintptr node_phys, uint32 level) {
+    uintptr *node = (uintptr *)P2V(node_phys);
+    for (size i = 0; i < VMO_RADIX_ENTRIES; i++) {
+        if (!node[i]) continue;
+        if (level > 1) vmo_radix_free(node[i], level - 1);
+        else if (node[i] != VMO_SLOT_ZERO) pmm_free((void *)node[i], 1);
+    }
+    pmm_free((void *)node_phys, 1);
+}
+
+uintptr vmo_lookup_page(vmo_t *vmo, size offset, bool *shared) {
+    if (shared) *shared = 0;
+
+    //walk up the parent chain hand over hand, a parent is only replaced or
+    //emptied into its child under both their locks so the walk never sees
+    //pages half way through a collapse or a parent that went away
+    uintptr phys = 0;
+    vmo_t *cur = vmo;
+    irq_state_t flags = spinlock_irq_acquire(&cur->lock);
+    while (offset < cur->size) {
+        uintptr *slot = vmo_radix_slot(cur, offset / PAGE_SIZE, 0);
+        phys = slot ? *slot : 0;
+        if (phys == VMO_SLOT_ZERO) {
+            phys = 0;
+            break;
+        }
+        if (phys) {
+            if (shared && cur != vmo) *shared = 1;
+            break;
+        }
+        vmo_t *parent = cur->parent;
+        if (!parent || offset >= cur->parent_limit) break;
+        offset += cur->parent_offset;
+
+        irq_state_t inner = spinlock_irq_acquire(&parent->lock);
+        spinlock_irq_release(&cur->lock, inner);
+        cur = parent;
+    }
+    spinlock_irq_release(&cur->lock, flags);
+    return phys;
+}
+
+//commit the whole aligned chunk around offset as one naturally aligned block
+//gives up (returns 0) if memory is too fragmented or part of the chunk is
+//already committed, the caller then commits a single page
+static uintptr vmo_commit_chunk(vmo_t *vmo, size offset) {
+    size chunk = offset & ~(VMO_HUGE_SIZE - 1);
+    if (vmo->parent || chunk + VMO_HUGE_SIZE > vmo->size) return 0;
+
+    //an order 9 buddy block is always 2MB aligned physically
+    void *block = pmm_alloc(VMO_HUGE_PAGES);
+    if (!block) return 0;
+    memset(P2V(block), 0, VMO_HUGE_SIZE);
+
+    uintptr phys = 0;
+    irq_state_t flags = spinlock_irq_acquire(&vmo->lock);
+    uintptr *slot = NULL;
+    if (chunk + VMO_HUGE_SIZE <= vmo->size) slot = vmo_radix_slot(vmo, chunk / PAGE_SIZE, 1);
+    if (slot) {
+        //the chunk is exactly one leaf node, only take it over if every slot is empty
+        size i = 0;
+        while (i < VMO_HUGE_PAGES && !slot[i]) i++;
+        if (i == VMO_HUGE_PAGES) {
+            for (i = 0; i < VMO_HUGE_PAGES; i++) slot[i] = (uintptr)block + i * PAGE_SIZE;
+            vmo->committed += VMO_HUGE_SIZE;
+            phys = (uintptr)block + (offset - chunk);
+            block = NULL;
+        }
+    }
+    spinlock_irq_release(&vmo->lock, flags);
+
+    if (block) pmm_free(block, VMO_HUGE_PAGES);
+    return phys;
+}
+
+uintptr vmo_commit_page(vmo_t *vmo, size offset) {
+    bool shared;
+    uintptr src = vmo_lookup_page(vmo, offset, &shared);
+    if (src && !shared) return src;
+    if (offset >= vmo->size) return 0;
+
+    if (!src && (vmo->flags & VMO_FLAG_HUGE)) {
+        uintptr phys = vmo_commit_chunk(vmo, offset);
+        if (phys) return phys;
+    }
+
+    //allocate and fill outside the lock, if someone else commits first ours is dropped
+    //pages in a parent never change so copying without its lock is fine
+    void *page = src ? pmm_alloc(1) : pmm_alloc_zeroed();
+    if (!page) return 0;
+    if (src) memcpy(P2V(page), P2V(src), PAGE_SIZE);
+
+    uintptr phys;
+    irq_state_t flags = spinlock_irq_acquire(&vmo->lock);
+    uintptr *slot = NULL;
+    if (offset < vmo->size) slot = vmo_radix_slot(vmo, offset / PAGE_SIZE, 1);
+    if (!slot) {
+        phys = 0;   //shrunk underneath us or out of memory for a node
+    } else if (*slot && *slot != VMO_SLOT_ZERO) {
+        phys = *slot;
+    } else {
+        *slot = (uintptr)page;
+        vmo->committed += PAGE_SIZE;
+        phys = (uintptr)page;
+        page = NULL;
+    }
+    spinlock_irq_release(&vmo->lock, flags);
+
+    if (page) pmm_free(page, 1);
+    return phys;
+}
+
+uintptr vmo_commit_huge(vmo_t *vmo, size offset) {
+    if (!(vmo->flags & VMO_FLAG_HUGE) || vmo->parent) return 0;
+    size chunk = offset & ~(VMO_HUGE_SIZE - 1);
+    if (!vmo_commit_page(vmo, chunk)) return 0;
+
+    //pages of the chunk may have been committed one by one or partly decommitted
+    uintptr base = 0;
+    irq_state_t flags = spinlock_irq_acquire(&vmo->lock);
+    uintptr *slot = NULL;
+    if (chunk + VMO_HUGE_SIZE <= vmo->size) slot = vmo_radix_slot(vmo, chunk / PAGE_SIZE, 0);
+    if (slot && !(slot[0] & (VMO_HUGE_SIZE - 1))) {
+        size i = 1;
+        while (i < VMO_HUGE_PAGES && slot[i] == slot[0] + i * PAGE_SIZE) i++;
+        if (i == VMO_HUGE_PAGES) base = slot[0];
+    }
+    spinlock_irq_release(&vmo->lock, flags);
+    return base;
+}
+
+void vmo_link_vma(struct proc_vma *vma) {
+    if (!vma || !vma->obj || vma->obj->type != OBJECT_VMO) return;
+    vmo_t *vmo = (vmo_t *)vma->obj;
+
+    spinlock_acquire(&vmo->map_lock);
+    vma->obj_next = vmo->mappings;
+    vmo->mappings = vma;
+    spinlock_release(&vmo->map_lock);
+}
+
+void vmo_unlink_vma(struct proc_vma *vma) {
+    if (!vma || !vma->obj || vma->obj->type != OBJECT_VMO) return;
+    vmo_t *vmo = (vmo_t *)vma->obj;
+
+    spinlock_acquire(&vmo->map_lock);
+    for (proc_vma_t **pp = &vmo->mappings; *pp; pp = &(*pp)->obj_next) {
+        if (*pp == vma) {
+            *pp = vma->obj_next;
+            break;
+        }
+    }
+    spinlock_release(&vmo->map_lock);
+}
+
 //VMO object ops
 static ssize vmo_obj_read(object_t *obj, void *buf, size len, size offset) {
     vmo_t *vmo = (vmo_t *)obj;
-    if (!vmo || !vmo->pages) return -1;
+    if (!vmo) return -1;
     
     if (offset >= vmo->size) return 0;
     if (len > vmo->size - offset) len = vmo->size - offset;
     
-    memcpy(buf, (char *)vmo->pages + offset, len);
+    for (size done = 0; done < len; ) {
+        size off = offset + done;
+        size chunk = PAGE_SIZE - (off % PAGE_SIZE);
+        if (chunk > len - done) chunk = len - done;
+
+        //pages nobody has written yet read as zero without being committed
+        uintptr phys = vmo_lookup_page(vmo, off, NULL);
+        if (phys) {
+            memcpy((char *)buf + done, (char *)P2V(phys) + (off % PAGE_SIZE), chunk);
+        } else {
+            memset((char *)buf + done, 0, chunk);
+        }
+        done += chunk;
+    }
     return len;
 }
 
 static ssize vmo_obj_write(object_t *obj, const void *buf, size len, size offset) {
     vmo_t *vmo = (vmo_t *)obj;
-    if (!vmo || !vmo->pages) return -1;
+    if (!vmo) return -1;
     
     if (offset >= vmo->size) return 0;
     if (len > vmo->size - offset) len = vmo->size - offset;
     
-    memcpy((char *)vmo->pages + offset, buf, len);
+    for (size done = 0; done < len; ) {
+        size off = offset + done;
+        size chunk = PAGE_SIZE - (off % PAGE_SIZE);
+        if (chunk > len - done) chunk = len - done;
+
+        uintptr phys = vmo_commit_page(vmo, off);
+        if (!phys) return done ? (ssize)done : -1;
+        memcpy((char *)P2V(phys) + (off % PAGE_SIZE), (const char *)buf + done, chunk);
+        done += chunk;
+    }
     return len;
 }
 
@@ -41,15 +273,146 @@ static int vmo_obj_stat(object_t *obj, struct stat *st) {
     return 0;
 }
 
+//vmo->lock held, pages are about to be freed or moved
+static inline void vmo_bump_gen(vmo_t *vmo) {
+    __atomic_add_fetch(&vmo->gen, 1, __ATOMIC_RELEASE);
+}
+
+//take a reference unless the object is already on its way out
+static bool vmo_tryref(vmo_t *vmo) {
+    uint32 refs = __atomic_load_n(&vmo->obj.refcount, __ATOMIC_SEQ_CST);
+    while (refs) {
+        if (__atomic_compare_exchange_n(&vmo->obj.refcount, &refs, refs + 1, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//parent->lock held
+static void vmo_child_unlink(vmo_t *parent, vmo_t *child) {
+    for (vmo_t **pp = &parent->children; *pp; pp = &(*pp)->sibling) {
+        if (*pp == child) {
+            *pp = child->sibling;
+            break;
+        }
+    }
+    child->sibling = NULL;
+}
+
+//parent->lock held
+static void vmo_child_link(vmo_t *parent, vmo_t *child) {
+    child->sibling = parent->children;
+    parent->children = child;
+}
+
+//fold a hidden parent with a single child left into that child: the child
+//takes the parent's pages it can see and reads through the grandparent
+//instead, the parent then loses its last reference
+static void vmo_collapse(vmo_t *vmo) {
+    spinlock_acquire(&vmo->map_lock);
+    irq_state_t flags = spinlock_irq_acquire(&vmo->lock);
+    vmo_t *parent = vmo->parent;
+    if (!parent || !(parent->flags & VMO_FLAG_HIDDEN)) {
+        spinlock_irq_release(&vmo->lock, flags);
+        spinlock_release(&vmo->map_lock);
+        return;
+    }
+    irq_state_t pflags = spinlock_irq_acquire(&parent->lock);
+    if (parent->children != vmo || vmo->sibling) {
+        spinlock_irq_release(&parent->lock, pflags);
+        spinlock_irq_release(&vmo->lock, flags);
+        spinlock_release(&vmo->map_lock);
+        return;
+    }
+
+    //pages move without being copied, they stay mapped read-only where they
+    //already are and the next write fault finds them private
+    vmo_bump_gen(vmo);
+    size base = vmo->parent_offset / PAGE_SIZE;
+    size visible = VMO_PAGES(vmo->parent_limit);
+    bool complete = true;
+    for (size i = 0; i < visible && parent->root; i++) {
+        if (base + i >= VMO_PAGES(parent->size)) break;
+        uintptr *pslot = vmo_radix_slot(parent, base + i, 0);
+        if (!pslot || !*pslot) continue;
+        uintptr *slot = vmo_radix_slot(vmo, i, 1);
+        if (!slot) {
+            complete = false;   //out of memory for a node, try again next time
+            break;
+        }
+        if (*slot) continue;
+        *slot = *pslot;
+        *pslot = 0;
+        if (*slot != VMO_SLOT_ZERO) {
+            vmo->committed += PAGE_SIZE;
+            parent->committed -= PAGE_SIZE;
+        }
+    }
+    if (!complete) {
+        spinlock_irq_release(&parent->lock, pflags);
+        spinlock_irq_release(&vmo->lock, flags);
+        spinlock_release(&vmo->map_lock);
+        return;
+    }
+
+    //the grandparent takes the child in the parent's place
+    vmo_t *grand = parent->parent;
+    size limit = 0;
+    if (grand && vmo->parent_offset < parent->parent_limit) {
+        limit = parent->parent_limit - vmo->parent_offset;
+        if (limit > vmo->parent_limit) limit = vmo->parent_limit;
+    }
+    if (grand && limit) {
+        irq_state_t gflags = spinlock_irq_acquire(&grand->lock);
+        vmo_child_unlink(grand, parent);
+        vmo_child_link(grand, vmo);
+        spinlock_irq_release(&grand->lock, gflags);
+        object_ref(&grand->obj);
+        vmo->parent = grand;
+        vmo->parent_offset += parent->parent_offset;
+        vmo->parent_limit = limit;
+    } else {
+        vmo->parent = NULL;
+        vmo->parent_offset = 0;
+        vmo->parent_limit = 0;
+    }
+    parent->children = NULL;
+    spinlock_irq_release(&parent->lock, pflags);
+    spinlock_irq_release(&vmo->lock, flags);
+    spinlock_release(&vmo->map_lock);
+
+    object_deref(&parent->obj);
+}
+
 static int vmo_obj_close(object_t *obj) {
     vmo_t *vmo = (vmo_t *)obj;
     if (!vmo) return -1;
     
     //free the backing memory
-    if (vmo->pages) {
-        size pages = (vmo->size + PAGE_SIZE - 1) / PAGE_SIZE;
-        kheap_free_pages(vmo->pages, pages);
-        vmo->pages = NULL;
+    if (vmo->root) {
+        vmo_radix_free(vmo->root, vmo->levels);
+        vmo->root = 0;
+    }
+    if (vmo->parent) {
+        //a hidden parent left with one child is folded into it
+        vmo_t *parent = vmo->parent;
+        vmo_t *last = NULL;
+        irq_state_t flags = spinlock_irq_acquire(&parent->lock);
+        vmo_child_unlink(parent, vmo);
+        if ((parent->flags & VMO_FLAG_HIDDEN) && parent->children &&
+            !parent->children->sibling && vmo_tryref(parent->children)) {
+            last = parent->children;
+        }
+        spinlock_irq_release(&parent->lock, flags);
+
+        vmo->parent = NULL;
+        object_deref(&parent->obj);
+        if (last) {
+            vmo_collapse(last);
+            object_deref(&last->obj);
+        }
     }
     
     return 0;
@@ -64,23 +427,18 @@ static object_ops_t vmo_ops = {
     .stat = vmo_obj_stat
 };
 
-int32 vmo_create(process_t *proc, size vmo_size, uint32 flags, handle_rights_t rights) {
-    if (!proc || vmo_size == 0) return -1;
-    
-    //allocate VMO structure
+static vmo_t *vmo_alloc(size vmo_size, uint32 flags) {
     vmo_t *vmo = kzalloc(sizeof(vmo_t));
-    if (!vmo) return -1;
+    if (!vmo) return NULL;
     
-    //allocate backing memory (for now fully committed)
-    size pages = (vmo_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    vmo->pages = kheap_alloc_pages(pages);
-    if (!vmo->pages) {
-        printf("[vmo] ERR: vmo_create failed to allocate %zu pages\n", pages);
+    //nothing is allocated up front, radix nodes and pages appear on first touch
+    vmo->levels = 1;
+    if (vmo_radix_grow(vmo, VMO_PAGES(vmo_size)) < 0) {
         kfree(vmo);
-        return -1;
+        return NULL;
     }
-    //raw allocator doesn't zero memory so we must do it manually via HHDM
-    memset(vmo->pages, 0, pages * PAGE_SIZE);
+    spinlock_irq_init(&vmo->lock);
+    spinlock_init(&vmo->map_lock);
     
     //initialize embedded object
     vmo->obj.type = OBJECT_VMO;
@@ -89,13 +447,21 @@ int32 vmo_create(process_t *proc, size vmo_size, uint32 flags, handle_rights_t r
     vmo->obj.data = vmo;
     
     vmo->size = vmo_size;
-    vmo->committed = vmo_size;
+    vmo->committed = 0;
     vmo->flags = flags;
+    return vmo;
+}
+
+int32 vmo_create(process_t *proc, size vmo_size, uint32 flags, handle_rights_t rights) {
+    if (!proc || vmo_size == 0) return -1;
+    
+    //allocate VMO structure
+    vmo_t *vmo = vmo_alloc(vmo_size, flags & ~VMO_FLAG_HIDDEN);
+    if (!vmo) return -1;
     
     //grant handle to process
     int32 h = process_grant_handle(proc, &vmo->obj, rights);
     if (h < 0) {
-        kheap_free_pages(vmo->pages, pages);
         kfree(vmo);
         return -1;
     }
@@ -103,6 +469,100 @@ int32 vmo_create(process_t *proc, size vmo_size, uint32 flags, handle_rights_t r
     return h;
 }
 
+int32 vmo_create_child(process_t *proc, int32 handle, size offset, size len,
+                       uint32 flags, handle_rights_t rights) {
+    if (!proc || len == 0) return -1;
+    if (!(flags & VMO_CHILD_COW)) return -1;    //copy-on-write is the only kind of child
+    if (offset % PAGE_SIZE || offset > (size)-1 - len) return -1;
+    
+    if (!process_handle_has_rights(proc, handle, HANDLE_RIGHT_READ)) {
+        return -2;  //no read permission
+    }
+    
+    vmo_t *src = vmo_get(proc, handle);
+    if (!src) return -1;
+    
+    vmo_t *child = vmo_alloc(len, flags & VMO_FLAG_RESIZABLE);
+    if (!child) return -1;
+    vmo_t *hidden = vmo_alloc(0, VMO_FLAG_HIDDEN);
+    if (!hidden) {
+        kfree(child);
+        return -1;
+    }
+    
+    //the source's pages move into a hidden parent that both sides read through
+    //so neither sees the other's later writes. a source with no pages of its
+    //own can share its current parent directly since parents never change
+    spinlock_acquire(&src->map_lock);
+    irq_state_t irq = spinlock_irq_acquire(&src->lock);
+    bool moved = src->root != 0;
+    if (moved) {
+        vmo_bump_gen(src);
+        hidden->root = src->root;
+        hidden->levels = src->levels;
+        hidden->size = src->size;
+        hidden->committed = src->committed;
+        hidden->parent = src->parent;
+        hidden->parent_offset = src->parent_offset;
+        hidden->parent_limit = src->parent_limit;
+        
+        //the hidden parent takes the source's place among its parent's children
+        if (hidden->parent) {
+            irq_state_t pflags = spinlock_irq_acquire(&hidden->parent->lock);
+            vmo_child_unlink(hidden->parent, src);
+            vmo_child_link(hidden->parent, hidden);
+            spinlock_irq_release(&hidden->parent->lock, pflags);
+        }
+        
+        src->root = 0;
+        src->committed = 0;
+        src->parent = hidden;
+        src->parent_offset = 0;
+        src->parent_limit = src->size;
+        vmo_child_link(hidden, src);
+        object_ref(&hidden->obj);
+    }
+    if (src->parent) {
+        child->parent = src->parent;
+        child->parent_offset = src->parent_offset + offset;
+        child->parent_limit = 0;
+        if (offset < src->parent_limit) {
+            child->parent_limit = src->parent_limit - offset;
+            if (child->parent_limit > len) child->parent_limit = len;
+        }
+        irq_state_t pflags = spinlock_irq_acquire(&child->parent->lock);
+        vmo_child_link(child->parent, child);
+        spinlock_irq_release(&child->parent->lock, pflags);
+        object_ref(&child->parent->obj);
+    }
+    spinlock_irq_release(&src->lock, irq);
+    
+    //existing mappings of the source may still have the moved pages writable
+    //drop them so the next access faults the page back in read-only
+    if (moved) {
+        for (proc_vma_t *vma = src->mappings; vma; vma = vma->obj_next) {
+            spinlock_acquire(&vma->proc->vma_lock);
+            if (!vma->detached) {
+                mmu_unmap_range(vma->proc->pagemap, vma->start,
+                                (vma->length + PAGE_SIZE - 1) / PAGE_SIZE);
+            }
+            spinlock_release(&vma->proc->vma_lock);
+        }
+    }
+    spinlock_release(&src->map_lock);
+    if (!moved) kfree(hidden);
+    
+    int32 h = process_grant_handle(proc, &child->obj, rights);
+    if (h < 0) {
+        //the refcount is still zero so close it by hand
+        vmo_obj_close(&child->obj);
+        kfree(child);
+        return -1;
+    }
+    
+    return h;
+}
+
 vmo_t *vmo_get(process_t *proc, int32 handle) {
     if (!proc) return NULL;
     
@@ -146,6 +606,54 @@ size vmo_get_size(process_t *proc, int32 handle) {
     return vmo->size;
 }
 
+//committed pages are gathered into physically contiguous runs and mapped in
+//bulk, own pages with the mapping flags and pages still owned by a parent
+//read-only until the first write copies them
+#define VMO_MAP_RUNS 32
+
+typedef struct {
+    mmu_run_t runs[VMO_MAP_RUNS];
+    size count;
+} vmo_run_list_t;
+
+static void vmo_run_add(vmo_run_list_t *list, pagemap_t *map, uint64 flags,
+                        uintptr virt, uintptr phys) {
+    if (list->count) {
+        mmu_run_t *last = &list->runs[list->count - 1];
+        if (last->virt + last->pages * PAGE_SIZE == virt &&
+            last->phys + last->pages * PAGE_SIZE == phys) {
+            last->pages++;
+            return;
+        }
+    }
+    if (list->count == VMO_MAP_RUNS) {
+        mmu_map_runs(map, list->runs, list->count, flags);
+        list->count = 0;
+    }
+    list->runs[list->count++] = (mmu_run_t){ .virt = virt, .phys = phys, .pages = 1 };
+}
+
+static void vmo_premap(vmo_t *vmo, pagemap_t *map, uintptr vaddr, size offset,
+                       size pages, uint64 flags) {
+    uint64 ro_flags = flags & ~(uint64)MMU_FLAG_WRITE;
+    vmo_run_list_t own = { .count = 0 };
+    vmo_run_list_t shared = { .count = 0 };
+
+    //nothing committed anywhere, skip the walk (large lazily used VMOs are mapped this way)
+    if (!vmo->committed && !vmo->parent) return;
+
+    for (size p = 0; p < pages; p++) {
+        bool is_shared;
+        uintptr phys = vmo_lookup_page(vmo, offset + (p * PAGE_SIZE), &is_shared);
+        if (!phys) continue;
+        if (is_shared) vmo_run_add(&shared, map, ro_flags, vaddr + (p * PAGE_SIZE), phys);
+        else vmo_run_add(&own, map, flags, vaddr + (p * PAGE_SIZE), phys);
+    }
+
+    if (own.count) mmu_map_runs(map, own.runs, own.count, flags);
+    if (shared.count) mmu_map_runs(map, shared.runs, shared.count, ro_flags);
+}
+
 void *vmo_map(process_t *proc, int32 handle, void *vaddr_hint,
               size offset, size len, handle_rights_t map_rights) {
     if (!proc) return NULL;
@@ -169,20 +677,15 @@ void *vmo_map(process_t *proc, int32 handle, void *vaddr_hint,
     if (len > vmo->size - offset) return NULL;
     if (len == 0) len = vmo->size - offset;
     
-    //for kernel process (NULL pagemap) return direct pointer
-    if (!proc->pagemap) {
-        return (char *)vmo->pages + offset;
-    }
+    //pages are not contiguous in kernel space any more so the kernel process
+    //has nothing to map into, kernel code goes through vmo_commit_page instead
+    if (!proc->pagemap) return NULL;
     
     //for user processes we need to map pages into their address space    
     uint64 flags = MMU_FLAG_PRESENT | MMU_FLAG_USER;
     if (map_rights & HANDLE_RIGHT_WRITE) flags |= MMU_FLAG_WRITE;
     if (map_rights & HANDLE_RIGHT_EXECUTE) flags |= MMU_FLAG_EXEC;
     
-    //get kernel pagemap for physical address lookups - must use page table lookup
-    //because kernel heap addresses (0xFFFF9...) are not in HHDM range (0xFFFF8...)
-    pagemap_t *kmap = mmu_get_kernel_pagemap();
-    
     //choose virtual address - use hint if provided or allocate from VMA
     uintptr vaddr;
     if (vaddr_hint) {
@@ -193,8 +696,16 @@ void *vmo_map(process_t *proc, int32 handle, void *vaddr_hint,
             return NULL;
         }
     } else {
-        //allocate a free region using VMA
-        vaddr = process_vma_find_free(proc, len);
+        //allocate a free region using VMA, large page VMOs get an address
+        //congruent to the offset modulo 2MB so whole chunks can map as one entry
+        size slack = 0;
+        if (vmo->flags & VMO_FLAG_HUGE) {
+            slack = offset & (VMO_HUGE_SIZE - 1) & ~(size)0xFFF;
+            vaddr = process_vma_find_free_aligned(proc, len + slack, VMO_HUGE_SIZE);
+        } else {
+            vaddr = process_vma_find_free(proc, len);
+        }
+        if (vaddr) vaddr += slack;
         if (!vaddr) {
             printf("[vmo] ERR: vmo_map no free virtual region for len 0x%lx\n", len);
             return NULL;
@@ -205,13 +716,12 @@ void *vmo_map(process_t *proc, int32 handle, void *vaddr_hint,
         }
     }
     
-    //map pages
-    size pages = (len + 0xFFF) / 0x1000;
-    for (size p = 0; p < pages; p++) {
-        uintptr vmo_virt = (uintptr)vmo->pages + offset + (p * PAGE_SIZE);
-        uintptr phys = mmu_virt_to_phys(kmap, vmo_virt);
-        mmu_map_range(proc->pagemap, vaddr + (p * PAGE_SIZE), phys, 1, flags);
-    }
+    //map what is already committed so shared contents show up at once
+    //everything else is filled in by the page fault handler on first touch
+    //map_lock keeps a resize from freeing pages between lookup and mapping
+    spinlock_acquire(&vmo->map_lock);
+    vmo_premap(vmo, proc->pagemap, vaddr, offset, (len + 0xFFF) / 0x1000, flags);
+    spinlock_release(&vmo->map_lock);
     
     return (void *)vaddr;
 }
@@ -219,91 +729,20 @@ void *vmo_map(process_t *proc, int32 handle, void *vaddr_hint,
 int vmo_unmap(process_t *proc, void *vaddr, size len) {
     if (!proc || !vaddr || !proc->pagemap) return -1;
     
+    //take the VMA out of the tree first so a racing fault cannot map the range again
+    proc_vma_t *vma = process_vma_detach(proc, (uintptr)vaddr);
+
     //unmap pages
     size pages = (len + 0xFFF) / 0x1000;
     mmu_unmap_range(proc->pagemap, (uintptr)vaddr, pages);
-    
-    //remove VMA entry
-    process_vma_remove(proc, (uintptr)vaddr);
+
+    //the VMA may hold the last reference to the VMO, whose pages go back to
+    //the pmm with it, so it is only dropped once no TLB can reach them
+    process_vma_release(vma);
     
     return 0;
 }
 
-typedef struct {
-    vmo_t *vmo;
-    uintptr new_phys; //this assumes new physical pages are contiguous btw (which they are from pmm_alloc)
-    size old_vmo_size;
-    size new_vmo_size;
-    int status;
-} vmo_update_data_t;
-
-static void vmo_update_mapping_cb(process_t *proc, void *data) {
-    vmo_update_data_t *ud = (vmo_update_data_t *)data;
-    if (!proc->pagemap) return;
-
-    spinlock_acquire(&proc->lock);
-    for (proc_vma_t *vma = proc->vma_list; vma; vma = vma->next) {
-        if (vma->obj == &ud->vmo->obj) {
-            size old_map_pages = (vma->length + PAGE_SIZE - 1) / PAGE_SIZE;
-            
-            //if the VMO grew and this VMA was mapping up to its end, try to grow the VMA
-            if (ud->new_vmo_size > ud->old_vmo_size && vma->obj_offset + vma->length == ud->old_vmo_size) {
-                size growth = ud->new_vmo_size - ud->old_vmo_size;
-                uintptr new_end = vma->start + vma->length + growth;
-                
-                //check for collisions with other VMAs in this process
-                int collision = 0;
-                for (proc_vma_t *vma_check = proc->vma_list; vma_check; vma_check = vma_check->next) {
-                    if (vma_check == vma) continue;
-                    if ((vma->start + vma->length) < (vma_check->start + vma_check->length) && vma_check->start < new_end) {
-                        collision = 1;
-                        break;
-                    }
-                }
-
-                if (!collision) {
-                    vma->length += growth;
-                } else {
-                    ud->status = -1; //signal collision
-                }
-            }
-
-            //if the VMO shrank clamp the VMA length so bookkeeping matches the remapped pages
-            if (vma->obj_offset >= ud->new_vmo_size) {
-                vma->length = 0;
-            } else {
-                size max_len = ud->new_vmo_size - vma->obj_offset;
-                if (vma->length > max_len) {
-                    vma->length = max_len;
-                }
-            }
-
-            //unmap all previously mapped pages for this VMA
-            mmu_unmap_range(proc->pagemap, vma->start, old_map_pages);
-
-            //remap based on new VMO location and (possibly updated) VMA boundaries
-            //we clamp to VMO size in case it shrank
-            if (vma->obj_offset < ud->new_vmo_size) {
-                size remaining_vmo = ud->new_vmo_size - vma->obj_offset;
-                size map_len = (vma->length < remaining_vmo) ? vma->length : remaining_vmo;
-                size map_pages = (map_len + PAGE_SIZE - 1) / PAGE_SIZE;
-
-                if (map_pages > 0) {
-                    //must map page by page as VMO pages might not be physically contiguous
-                    //(though currently they are, the kernel heap doesn't guarantee it for grow/move)
-                    pagemap_t *kmap = mmu_get_kernel_pagemap();
-                    for (size p = 0; p < map_pages; p++) {
-                        uintptr vmo_virt = (uintptr)ud->vmo->pages + vma->obj_offset + (p * PAGE_SIZE);
-                        uintptr phys = mmu_virt_to_phys(kmap, vmo_virt);
-                        mmu_map_range(proc->pagemap, vma->start + (p * PAGE_SIZE), phys, 1, vma->flags);
-                    }
-                }
-            }
-        }
-    }
-    spinlock_release(&proc->lock);
-}
-
 int vmo_resize(process_t *proc, int32 handle, size new_size) {
     if (!proc || new_size == 0) return -1;
     
@@ -316,54 +755,197 @@ int vmo_resize(process_t *proc, int32 handle, size new_size) {
     if (!vmo) return -1;
     
     if (!(vmo->flags & VMO_FLAG_RESIZABLE)) return -2;
+
+    //map_lock keeps the mapping list stable and one resize at a time
+    spinlock_acquire(&vmo->map_lock);
     size old_vmo_size = vmo->size;
-    if (new_size == old_vmo_size) return 0;
-    
-    size old_pages = (old_vmo_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    size new_pages = (new_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    
-    if (new_pages == old_pages) {
-        vmo->size = new_size;
+    if (new_size == old_vmo_size) {
+        spinlock_release(&vmo->map_lock);
         return 0;
     }
     
-    void *new_p = kheap_alloc_pages(new_pages);
-    if (!new_p) return -1;
-    
-    //copy the allocated bytes (page-aligned)
-    size old_alloc_size = old_pages * PAGE_SIZE;
-    size copy_size = (old_alloc_size < new_size) ? old_alloc_size : new_size;
-    memcpy(new_p, vmo->pages, copy_size);
+    size old_pages = VMO_PAGES(old_vmo_size);
+    size new_pages = VMO_PAGES(new_size);
 
-    if (new_pages * PAGE_SIZE > copy_size) {
-        memset((char *)new_p + copy_size, 0, (new_pages * PAGE_SIZE) - copy_size);
+    //a partial last page still shared with a parent is copied first so its
+    //tail can be cleared below without touching the parent
+    if (new_size < old_vmo_size && (new_size % PAGE_SIZE)) {
+        bool shared;
+        if (vmo_lookup_page(vmo, new_size - 1, &shared) && shared) {
+            vmo_commit_page(vmo, new_size - 1);
+        }
     }
-    
-    pagemap_t *kmap = mmu_get_kernel_pagemap();
-    uintptr new_phys = mmu_virt_to_phys(kmap, (uintptr)new_p);
 
-    void *old_pages_addr = vmo->pages;
-    vmo->pages = new_p;
+    //growing only adds radix levels, the new range starts out uncommitted
+    //shrinking moves the end first so nothing past it can be committed again
+    irq_state_t flags = spinlock_irq_acquire(&vmo->lock);
+    if (vmo_radix_grow(vmo, new_pages) < 0) {
+        spinlock_irq_release(&vmo->lock, flags);
+        spinlock_release(&vmo->map_lock);
+        return -1;
+    }
+    //bytes past the end of a partial last page must read as zero if it grows again
+    uintptr tail = 0;
+    if (new_size < old_vmo_size && (new_size % PAGE_SIZE)) {
+        uintptr *slot = vmo_radix_slot(vmo, new_pages - 1, 0);
+        if (slot && *slot != VMO_SLOT_ZERO) tail = *slot;
+    }
+    if (new_size < old_vmo_size) vmo_bump_gen(vmo);
     vmo->size = new_size;
-    vmo->committed = new_size;
+    //parent data past a shrink must not come back if the VMO grows again
+    if (vmo->parent_limit > new_pages * PAGE_SIZE) vmo->parent_limit = new_pages * PAGE_SIZE;
+    spinlock_irq_release(&vmo->lock, flags);
+
+    if (tail) {
+        memset((char *)P2V(tail) + (new_size % PAGE_SIZE), 0, PAGE_SIZE - (new_size % PAGE_SIZE));
+    }
+
+    //fit every mapping to the new size, nothing is remapped since pages never move
+    //growth is faulted in later and shrinking only unmaps the dropped tail
+    int status = 0;
+    for (proc_vma_t *vma = vmo->mappings; vma; vma = vma->obj_next) {
+        process_t *mp = vma->proc;
+        spinlock_acquire(&mp->vma_lock);
+        if (vma->detached) {
+            spinlock_release(&mp->vma_lock);
+            continue;
+        }
+
+        size old_map_pages = (vma->length + PAGE_SIZE - 1) / PAGE_SIZE;
 
-    vmo_update_data_t ud = { 
-        .vmo = vmo, 
-        .new_phys = new_phys, 
-        .old_vmo_size = old_vmo_size,
-        .new_vmo_size = new_size,
-        .status = 0
-    };
-    process_iterate(vmo_update_mapping_cb, &ud);
+        //if the VMO grew and this VMA was mapping up to its end, try to grow the VMA
+        if (new_size > old_vmo_size && vma->obj_offset + vma->length == old_vmo_size) {
+            uintptr old_end = vma->start + vma->length;
+            uintptr new_end = old_end + (new_size - old_vmo_size);
 
-    kheap_free_pages(old_pages_addr, old_pages);
+            //VMAs are address ordered and disjoint, only the next one can be in the way
+            if (!vma->next || vma->next->start >= new_end) {
+                process_vma_set_length_locked(mp, vma, new_end - vma->start);
+            } else {
+                status = -1; //signal collision
+            }
+        }
 
-    if (ud.status != 0) {
-        //one or more VMAs could not be grown buttttt we've already moved the data
-        //this is a kinda serious fucking problem for the process that failed but we must continue
-        //later just rollback (try atleast) but rn it's a TODO
-        return ud.status;
+        //if the VMO shrank clamp the VMA and drop the mappings past the new end
+        if (vma->obj_offset >= new_size) {
+            process_vma_set_length_locked(mp, vma, 0);
+        } else if (vma->length > new_size - vma->obj_offset) {
+            process_vma_set_length_locked(mp, vma, new_size - vma->obj_offset);
+        }
+        size keep_pages = (vma->length + PAGE_SIZE - 1) / PAGE_SIZE;
+        if (keep_pages < old_map_pages) {
+            mmu_unmap_range(mp->pagemap, vma->start + keep_pages * PAGE_SIZE,
+                            old_map_pages - keep_pages);
+        }
+        spinlock_release(&mp->vma_lock);
     }
-    
-    return 0;
+
+    //nobody maps the dropped pages any more so they can go back to the pmm
+    if (new_pages < old_pages) {
+        flags = spinlock_irq_acquire(&vmo->lock);
+        for (size i = new_pages; i < old_pages; i++) {
+            uintptr *slot = vmo_radix_slot(vmo, i, 0);
+            if (!slot || !*slot) continue;
+            if (*slot != VMO_SLOT_ZERO) {
+                pmm_free((void *)*slot, 1);
+                vmo->committed -= PAGE_SIZE;
+            }
+            *slot = 0;
+        }
+        spinlock_irq_release(&vmo->lock, flags);
+    }
+    spinlock_release(&vmo->map_lock);
+
+    //a VMA that could not grow keeps its old length, the VMO itself is fine
+    return status;
+}
+
+//pages dropped per pass, each pass unmaps its range from every mapping before freeing
+#define VMO_DECOMMIT_BATCH 64
+
+int vmo_decommit(process_t *proc, int32 handle, size offset, size len) {
+    if (!proc || len == 0) return -1;
+    if (offset > (size)-1 - len) return -1;
+
+    if (!process_handle_has_rights(proc, handle, HANDLE_RIGHT_WRITE)) {
+        return -3;
+    }
+
+    vmo_t *vmo = vmo_get(proc, handle);
+    if (!vmo) return -1;
+
+    //only pages wholly inside the range are dropped
+    size first = VMO_PAGES(offset);
+    size end = (offset + len) / PAGE_SIZE;
+
+    //map_lock keeps resizes and premaps out while pages disappear
+    int rc = 0;
+    spinlock_acquire(&vmo->map_lock);
+    if (end > VMO_PAGES(vmo->size)) end = VMO_PAGES(vmo->size);
+
+    //a range reaching the end of what the parent shows just hides the rest of it
+    bool clamped = false;
+    irq_state_t flags = spinlock_irq_acquire(&vmo->lock);
+    if (vmo->parent && first < end && first * PAGE_SIZE < vmo->parent_limit &&
+        VMO_PAGES(vmo->parent_limit) <= end) {
+        vmo->parent_limit = first * PAGE_SIZE;
+        clamped = true;
+    }
+    spinlock_irq_release(&vmo->lock, flags);
+
+    while (first < end) {
+        size stop = end - first > VMO_DECOMMIT_BATCH ? first + VMO_DECOMMIT_BATCH : end;
+        uintptr pages[VMO_DECOMMIT_BATCH];
+        uint32 count = 0;
+        bool covered = clamped;
+
+        //take the pages out of the tree first, a fault from here on commits a fresh one
+        //pages the parent still shows are covered so they read as zero too
+        flags = spinlock_irq_acquire(&vmo->lock);
+        vmo_bump_gen(vmo);
+        for (size i = first; i < stop; i++) {
+            bool cover = vmo->parent && i * PAGE_SIZE < vmo->parent_limit;
+            uintptr *slot = vmo_radix_slot(vmo, i, cover);
+            if (!slot) {
+                if (cover) {
+                    rc = -1;    //out of memory for a node
+                    stop = i;
+                    break;
+                }
+                continue;
+            }
+            if (*slot && *slot != VMO_SLOT_ZERO) {
+                pages[count++] = *slot;
+                vmo->committed -= PAGE_SIZE;
+            }
+            if (cover && *slot != VMO_SLOT_ZERO) covered = true;
+            *slot = cover ? VMO_SLOT_ZERO : 0;
+        }
+        spinlock_irq_release(&vmo->lock, flags);
+
+        //then make sure no mapping still reaches them, including read-only
+        //mappings of the parent's pages. a fault that looked a page up before
+        //the generation bump either installs it before this pass takes the
+        //VMA lock and is unmapped here, or sees the new generation and retries
+        if ((count || covered) && first < stop) {
+            size lo = first * PAGE_SIZE, hi = stop * PAGE_SIZE;
+            for (proc_vma_t *vma = vmo->mappings; vma; vma = vma->obj_next) {
+                process_t *mp = vma->proc;
+                spinlock_acquire(&mp->vma_lock);
+                size vlo = vma->obj_offset, vhi = vma->obj_offset + vma->length;
+                if (!vma->detached && vlo < hi && vhi > lo) {
+                    size from = vlo > lo ? vlo : lo;
+                    size to = vhi < hi ? vhi : hi;
+                    mmu_unmap_range(mp->pagemap, vma->start + (from - vlo),
+                                    (to - from + PAGE_SIZE - 1) / PAGE_SIZE);
+                }
+                spinlock_release(&mp->vma_lock);
+            }
+            for (uint32 i = 0; i < count; i++) pmm_free((void *)pages[i], 1);
+        }
+        if (rc < 0) break;
+        first = stop;
+    }
+    spinlock_release(&vmo->map_lock);
+    return rc;
 }
@@ -4,6 +4,7 @@
 #include <arch/types.h>
 #include <obj/object.h>
 #include <obj/rights.h>
+#include <lib/spinlock.h>
 
 /*
  *virtual memory object
@@ -12,28 +13,65 @@
  *- read from / written to directly
  *- mapped into a process's address space
  *- shared between processes via handle transfer
+ *
+ *backing pages are committed lazily: a page gets physical memory the first
+ *time it is written through the object or touched through a mapping
+ *
+ *pages are indexed by a radix tree of page sized nodes so growing only adds
+ *levels on top and shrinking only drops the pages past the new end, pages
+ *never move once committed so existing mappings stay valid across resizes
+ *
+ *copy-on-write children read through to the pages of a parent and get their
+ *own copy of a page on the first write to it. cloning moves the source's
+ *pages into a hidden parent shared by both sides, so the child is a snapshot
+ *and later writes on either side stay private. once only one child of a
+ *hidden parent is left it takes the pages it can see and the parent goes away
 */
 
 //VMO flags
 #define VMO_FLAG_NONE       0
 #define VMO_FLAG_RESIZABLE  (1 << 0)   //can be resized after creation
+#define VMO_CHILD_COW       (1 << 1)   //vmo_create_child: copy-on-write snapshot
+#define VMO_FLAG_HUGE       (1 << 2)   //commit in aligned 2MB chunks so mappings can use large pages
+
+//pages per large page chunk of a VMO_FLAG_HUGE VMO
+#define VMO_HUGE_PAGES      512
+#define VMO_HUGE_SIZE       0x200000UL
 
 //forward declarations
 struct process;
+struct proc_vma;
 
 //VMO structure
 typedef struct vmo {
     object_t obj;           //kernel object (embedded)
-    void *pages;            //physical memory backing (kernel virtual address)
+    uintptr root;           //physical address of the top radix node, 0 if empty
+    uint32 levels;          //radix depth, each level indexes 512 entries
     size size;              //size in bytes
     size committed;         //actually allocated bytes
     uint32 flags;
+    spinlock_irq_t lock;    //protects the radix tree, size and committed
+    struct proc_vma *mappings;  //every VMA mapping this VMO
+    spinlock_t map_lock;    //protects mappings and serialises resizes and clones
+    struct vmo *parent;     //copy-on-write parent, pages missing here are read from it
+    size parent_offset;     //where offset 0 of this VMO lies in the parent
+    size parent_limit;      //bytes of the parent visible through this VMO
+    struct vmo *children;   //VMOs whose parent this is, under this VMO's lock
+    struct vmo *sibling;    //next child of the same parent, under the parent's lock
+    uint64 gen;             //bumped under lock before committed pages are freed or moved
 } vmo_t;
 
 //create a new VMO of the specified size
 //returns handle to the VMO or INVALID_HANDLE
 int32 vmo_create(struct process *proc, size size, uint32 flags, handle_rights_t rights);
 
+//create a child VMO covering [offset, offset + len) of an existing one
+//flags must include VMO_CHILD_COW and may include VMO_FLAG_RESIZABLE
+//offset must be page aligned, the parent handle needs read rights
+//returns handle to the child or negative error
+int32 vmo_create_child(struct process *proc, int32 handle, size offset, size len,
+                       uint32 flags, handle_rights_t rights);
+
 //get VMO from handle (returns NULL if not a VMO)
 vmo_t *vmo_get(struct process *proc, int32 handle);
 
@@ -57,8 +95,41 @@ void *vmo_map(struct process *proc, int32 handle, void *vaddr_hint,
 //unmap VMO from a process's address space
 int vmo_unmap(struct process *proc, void *vaddr, size len);
 
+//physical address of the page holding offset, committing a page private to
+//this VMO if needed (a copy of the parent's page or a zeroed one)
+//returns 0 if offset is past the end or memory ran out
+uintptr vmo_commit_page(vmo_t *vmo, size offset);
+
+//physical base of the VMO_HUGE_SIZE chunk holding offset if it is committed as
+//one aligned contiguous block owned by this VMO, committing it if needed
+//returns 0 when the chunk has to be mapped a page at a time
+uintptr vmo_commit_huge(vmo_t *vmo, size offset);
+
+//physical address of the page holding offset or 0 if it was never committed
+//the page may belong to a parent, in which case shared is set and the page
+//must only be mapped read-only (shared may be NULL)
+uintptr vmo_lookup_page(vmo_t *vmo, size offset, bool *shared);
+
+//a page found by vmo_lookup_page or vmo_commit_page may only be mapped if the
+//generation read before the lookup is unchanged when the mapping goes in under
+//the process's VMA lock. every path that frees or moves pages bumps it before
+//it unmaps them under those same locks, so a stale page never stays mapped
+static inline uint64 vmo_generation(vmo_t *vmo) {
+    return __atomic_load_n(&vmo->gen, __ATOMIC_ACQUIRE);
+}
+
+//track a VMA that maps a VMO so resizes can find it
+//no-op for VMAs not backed by a VMO
+void vmo_link_vma(struct proc_vma *vma);
+void vmo_unlink_vma(struct proc_vma *vma);
+
 //resize a VMO
 //returns 0 on success or negative error
 int vmo_resize(struct process *proc, int32 handle, size new_size);
 
+//free the committed pages wholly inside [offset, offset + len) and unmap them
+//everywhere, the range reads back as zeroes afterwards, also in a
+//copy-on-write child where it no longer shows the parent's snapshot
+int vmo_decommit(struct process *proc, int32 handle, size offset, size len);
+
 #endif
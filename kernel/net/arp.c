@@ -6,8 +6,11 @@
 #include <lib/spinlock.h>
 #include <arch/cpu.h>
 #include <arch/timer.h>
+#include <proc/wait.h>
+#include <proc/ktimer.h>
 
 #define ARP_CACHE_SIZE 32
+#define ARP_TIMEOUT_NS 500000000ULL
 
 typedef struct {
     uint32 ip;
@@ -17,6 +20,7 @@ typedef struct {
 
 static arp_entry_t arp_cache[ARP_CACHE_SIZE];
 static spinlock_irq_t arp_lock = SPINLOCK_IRQ_INIT;
+static wait_queue_t arp_wq;     //resolvers sleeping until a cache update
 
 static void arp_cache_update(uint32 ip, const uint8 *mac) {
     irq_state_t flags = spinlock_irq_acquire(&arp_lock);
@@ -26,6 +30,7 @@ static void arp_cache_update(uint32 ip, const uint8 *mac) {
         if (arp_cache[i].valid && arp_cache[i].ip == ip) {
             memcpy(arp_cache[i].mac, mac, 6);
             spinlock_irq_release(&arp_lock, flags);
+            thread_wake_all(&arp_wq);
             return;
         }
     }
@@ -37,6 +42,7 @@ static void arp_cache_update(uint32 ip, const uint8 *mac) {
             memcpy(arp_cache[i].mac, mac, 6);
             arp_cache[i].valid = true;
             spinlock_irq_release(&arp_lock, flags);
+            thread_wake_all(&arp_wq);
             return;
         }
     }
@@ -46,17 +52,25 @@ static void arp_cache_update(uint32 ip, const uint8 *mac) {
     memcpy(arp_cache[0].mac, mac, 6);
     arp_cache[0].valid = true;
     spinlock_irq_release(&arp_lock, flags);
+    thread_wake_all(&arp_wq);
 }
 
-static bool arp_cache_lookup(uint32 ip, uint8 *mac_out) {
-    irq_state_t flags = spinlock_irq_acquire(&arp_lock);
+static bool arp_cache_lookup_locked(uint32 ip, uint8 *mac_out) {
     for (int i = 0; i < ARP_CACHE_SIZE; i++) {
         if (arp_cache[i].valid && arp_cache[i].ip == ip) {
             memcpy(mac_out, arp_cache[i].mac, 6);
-            spinlock_irq_release(&arp_lock, flags);
             return true;
         }
     }
+    return false;
+}
+
+static bool arp_cache_lookup(uint32 ip, uint8 *mac_out) {
+    irq_state_t flags = spinlock_irq_acquire(&arp_lock);
+    if (arp_cache_lookup_locked(ip, mac_out)) {
+        spinlock_irq_release(&arp_lock, flags);
+        return true;
+    }
     spinlock_irq_release(&arp_lock, flags);
     return false;
 }
@@ -129,23 +143,36 @@ int arp_resolve(netif_t *nif, uint32 ip, uint8 *mac_out) {
         return 0;
     }
     
-    uint32 freq = arch_timer_getfreq();
-    if (freq == 0) freq = 1000; //fallback
-    
-    //send ARP request and poll for response
+    //send ARP request and wait for the reply to land in the cache
     for (int attempt = 0; attempt < 3; attempt++) {
         arp_send_request(nif, ip);
         
-        //wait up to 500ms using the system timer
-        uint64 start = arch_timer_get_ticks();
-        uint32 timeout_ticks = freq / 2;
-        
-        while (arch_timer_get_ticks() - start < timeout_ticks) {
+        //wait up to 500ms
+        uint64 deadline = ktimer_now() + ARP_TIMEOUT_NS;
+
+        if (net_can_block()) {
+            //sleep until a cache update or the deadline, checked under arp_lock
+            //so an update between lookup and sleep cannot be missed
+            irq_state_t flags = spinlock_irq_acquire(&arp_lock);
+            for (;;) {
+                if (arp_cache_lookup_locked(ip, mac_out)) {
+                    spinlock_irq_release(&arp_lock, flags);
+                    return 0;
+                }
+                if (thread_sleep_locked_irq_until(&arp_wq, &arp_lock, &flags, deadline) < 0) break;
+            }
+            spinlock_irq_release(&arp_lock, flags);
+            continue;
+        }
+
+        //called from RX/IRQ context: nothing may sleep, poll the NICs instead
+        while (ktimer_now() < deadline) {
             if (arp_cache_lookup(ip, mac_out)) return 0;
             net_poll();
             arch_pause();
         }
     }
+    if (arp_cache_lookup(ip, mac_out)) return 0;
     
     printf("[arp] Failed to resolve ");
     net_print_ip(ip);
@@ -155,6 +182,7 @@ int arp_resolve(netif_t *nif, uint32 ip, uint8 *mac_out) {
 
 void arp_init(void) {
     memset(arp_cache, 0, sizeof(arp_cache));
+    wait_queue_init(&arp_wq);
 }
 
 void arp_seed(uint32 ip, const uint8 *mac) {
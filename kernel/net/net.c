@@ -11,6 +11,8 @@
 #include <proc/process.h>
 #include <proc/sched.h>
 #include <proc/thread.h>
+#include <arch/cpu.h>
+#include <arch/percpu.h>
 
 static netif_t *netif_list = NULL;
 static netif_t *netif_tail = NULL;
@@ -99,6 +101,11 @@ void net_rx(netif_t *nif, void *data, size len) {
     ethernet_recv(nif, data, len);
 }
 
+bool net_can_block(void) {
+    percpu_t *cpu = percpu_get();
+    return cpu && cpu->sched_running && thread_current() && arch_irq_enabled();
+}
+
 void net_poll(void) {
     //keep RX moving even if the interrupt line is flaky or delayed
     netif_t *snapshot[MAX_NETIFS];
@@ -62,6 +62,10 @@ void net_init(void);
 //opportunistically service network RX while waiting for replies
 void net_poll(void);
 
+//true when the caller may sleep waiting for RX (thread context, interrupts on)
+//packet handlers run from IRQ/poll context and must fall back to polling
+bool net_can_block(void);
+
 //send a test ping to the gateway
 void net_test(void);
 //make an IPv4 address from 4 octets (in network byte order)
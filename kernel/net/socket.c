@@ -47,6 +47,7 @@ static ssize socket_write(object_t *obj, const void *buf, size len, size offset)
 static int socket_close(object_t *obj) {
     tcp_conn_t *conn = (tcp_conn_t *)obj->data;
     if (conn) {
+        tcp_bind_object(conn, NULL);
         tcp_close(conn);
     }
     return 0;
@@ -67,6 +68,7 @@ handle_t socket_object_create(tcp_conn_t *conn) {
     
     object_t *obj = object_create(OBJECT_SOCKET, &socket_ops, conn);
     if (!obj) return INVALID_HANDLE;
+    tcp_bind_object(conn, obj);
     
     handle_t h = handle_alloc(obj, HANDLE_RIGHTS_DEFAULT);
     //handle_alloc increments refcount so we deref our creation ref
@@ -3,6 +3,7 @@
 #include <net/ipv6.h>
 #include <net/ethernet.h>
 #include <net/endian.h>
+#include <obj/object.h>
 #include <lib/io.h>
 #include <lib/string.h>
 #include <lib/spinlock.h>
@@ -13,6 +14,12 @@
 #include <arch/timer.h>
 #include <proc/sched.h>
 #include <proc/event.h>
+#include <proc/wait.h>
+#include <proc/ktimer.h>
+
+#define TCP_CONNECT_TIMEOUT_NS  2000000000ULL   //per SYN attempt
+#define TCP_READ_TIMEOUT_NS     10000000000ULL
+#define TCP_ACCEPT_TIMEOUT_NS   30000000000ULL
 
 static tcp_conn_t connections[TCP_MAX_CONNECTIONS];
 static spinlock_irq_t tcp_lock = SPINLOCK_IRQ_INIT;
@@ -145,6 +152,7 @@ static tcp_conn_t *tcp_alloc_conn_locked(void) {
         if (!connections[i].active) {
             memset(&connections[i], 0, sizeof(tcp_conn_t));
             connections[i].active = true;
+            wait_queue_init(&connections[i].wait);
             return &connections[i];
         }
     }
@@ -171,6 +179,68 @@ static tcp_conn_t *tcp_find_conn(const net_addr_t *local_addr, uint16 local_port
     return NULL;
 }
 
+//wake sleepers on a connection. callers hold tcp_lock, so woken threads
+//re-check conn state only after the segment has been fully applied
+static void tcp_wake_locked(tcp_conn_t *conn) {
+    if (conn->wait.head) thread_wake_all(&conn->wait);
+}
+
+//first child of a listener that finished its handshake and wasn't handed out yet
+static tcp_conn_t *tcp_accept_ready_locked(const tcp_conn_t *listener) {
+    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
+        tcp_conn_t *c = &connections[i];
+        if (c->active && !c->listening && !c->accepted &&
+            c->local_port == listener->local_port &&
+            (tcp_addr_is_unspecified(&listener->local_addr) ||
+             tcp_addr_equal(&c->local_addr, &listener->local_addr)) &&
+            c->state == TCP_STATE_ESTABLISHED) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+#define TCP_SOCKET_SIGNALS (OBJECT_SIGNAL_READABLE | OBJECT_SIGNAL_WRITABLE | \
+                            OBJECT_SIGNAL_PEER_CLOSED)
+
+//mirror connection state into the bound socket's signals. a listener is readable
+//while a child is ready to accept. a connection is readable while data or EOF is
+//waiting, writable while tcp_send would go out and peer-closed once the remote
+//side sent FIN or reset
+static void tcp_update_signals_locked(tcp_conn_t *conn) {
+    if (!conn->obj) return;
+
+    uint32 set = 0;
+    if (conn->listening) {
+        if (tcp_accept_ready_locked(conn)) set |= OBJECT_SIGNAL_READABLE;
+    } else {
+        bool peer_closed = conn->state == TCP_STATE_CLOSE_WAIT ||
+                           conn->state == TCP_STATE_LAST_ACK ||
+                           conn->state == TCP_STATE_CLOSED;
+        if (conn->rx_len > 0 || peer_closed) set |= OBJECT_SIGNAL_READABLE;
+        if (conn->state == TCP_STATE_ESTABLISHED) set |= OBJECT_SIGNAL_WRITABLE;
+        if (peer_closed) set |= OBJECT_SIGNAL_PEER_CLOSED;
+    }
+    object_signal(conn->obj, TCP_SOCKET_SIGNALS & ~set, set);
+}
+
+//drop tcp_lock once a segment has been applied to conn, publishing its signals first
+static void tcp_unlock_conn(tcp_conn_t *conn, irq_state_t flags) {
+    tcp_update_signals_locked(conn);
+    spinlock_irq_release(&tcp_lock, flags);
+}
+
+//a child finishing its handshake is what a blocked tcp_accept is waiting for
+static void tcp_wake_listener_locked(const tcp_conn_t *child) {
+    for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
+        tcp_conn_t *l = &connections[i];
+        if (l->active && l->listening && l->local_port == child->local_port) {
+            tcp_wake_locked(l);
+            tcp_update_signals_locked(l);
+        }
+    }
+}
+
 static int tcp_checksum(const net_addr_t *src_addr, const net_addr_t *dst_addr,
                         const void *tcp_data, size tcp_len, uint16 *out_sum) {
     if (src_addr->family == NET_ADDR_FAMILY_IPV6) {
@@ -403,12 +473,16 @@ static void tcp_recv_common(netif_t *nif, const net_addr_t *src_addr,
         return;
     }
 
+    //any segment can change what a sleeper on this connection waits for
+    tcp_wake_locked(conn);
+
     switch (conn->state) {
         case TCP_STATE_SYN_RECEIVED:
             if ((flags & TCP_ACK) && ack == conn->snd_nxt) {
                 conn->snd_una = ack;
                 conn->state = TCP_STATE_ESTABLISHED;
-                spinlock_irq_release(&tcp_lock, lock_flags);
+                tcp_wake_listener_locked(conn);
+                tcp_unlock_conn(conn, lock_flags);
                 return;
             }
             break;
@@ -419,7 +493,7 @@ static void tcp_recv_common(netif_t *nif, const net_addr_t *src_addr,
                     conn->rcv_nxt = seq + 1;
                     conn->snd_una = ack;
                     conn->state = TCP_STATE_ESTABLISHED;
-                    spinlock_irq_release(&tcp_lock, lock_flags);
+                    tcp_unlock_conn(conn, lock_flags);
                     //send ACK
                     tcp_send_segment(conn, TCP_ACK, NULL, 0);
                     return;
@@ -431,7 +505,7 @@ static void tcp_recv_common(netif_t *nif, const net_addr_t *src_addr,
             if (flags & TCP_RST) {
                 conn->state = TCP_STATE_CLOSED;
                 conn->active = false;
-                spinlock_irq_release(&tcp_lock, lock_flags);
+                tcp_unlock_conn(conn, lock_flags);
                 return;
             }
 
@@ -454,18 +528,18 @@ static void tcp_recv_common(netif_t *nif, const net_addr_t *src_addr,
                         if (copy == payload_len) {
                             conn->rcv_nxt = seq + copy + 1;
                             conn->state = TCP_STATE_CLOSE_WAIT;
-                            spinlock_irq_release(&tcp_lock, lock_flags);
+                            tcp_unlock_conn(conn, lock_flags);
                             tcp_send_segment(conn, TCP_ACK, NULL, 0);
                             return;
                         }
                     }
 
-                    spinlock_irq_release(&tcp_lock, lock_flags);
+                    tcp_unlock_conn(conn, lock_flags);
                     //send ACK for the newly buffered data
                     tcp_send_segment(conn, TCP_ACK, NULL, 0);
                     return;
                 } else {
-                    spinlock_irq_release(&tcp_lock, lock_flags);
+                    tcp_unlock_conn(conn, lock_flags);
                     //buffer full, don't advance rcv_nxt and don't ACK
                     return;
                 }
@@ -475,7 +549,7 @@ static void tcp_recv_common(netif_t *nif, const net_addr_t *src_addr,
             if ((flags & TCP_FIN) && seq == conn->rcv_nxt) {
                 conn->rcv_nxt = seq + payload_len + 1;
                 conn->state = TCP_STATE_CLOSE_WAIT;
-                spinlock_irq_release(&tcp_lock, lock_flags);
+                tcp_unlock_conn(conn, lock_flags);
                 tcp_send_segment(conn, TCP_ACK, NULL, 0);
                 return;
             }
@@ -487,7 +561,7 @@ static void tcp_recv_common(netif_t *nif, const net_addr_t *src_addr,
                     conn->rcv_nxt = seq + 1;
                     conn->state = TCP_STATE_CLOSED;
                     conn->active = false;
-                    spinlock_irq_release(&tcp_lock, lock_flags);
+                    tcp_unlock_conn(conn, lock_flags);
                     tcp_send_segment(conn, TCP_ACK, NULL, 0);
                     return;
                 } else {
@@ -501,7 +575,7 @@ static void tcp_recv_common(netif_t *nif, const net_addr_t *src_addr,
                 conn->rcv_nxt = seq + 1;
                 conn->state = TCP_STATE_CLOSED;
                 conn->active = false;
-                spinlock_irq_release(&tcp_lock, lock_flags);
+                tcp_unlock_conn(conn, lock_flags);
                 tcp_send_segment(conn, TCP_ACK, NULL, 0);
                 return;
             }
@@ -517,7 +591,7 @@ static void tcp_recv_common(netif_t *nif, const net_addr_t *src_addr,
         default:
             break;
     }
-    spinlock_irq_release(&tcp_lock, lock_flags);
+    tcp_unlock_conn(conn, lock_flags);
 }
 
 void tcp_recv(netif_t *nif, uint32 src_ip, uint32 dst_ip, void *data, size len) {
@@ -585,26 +659,25 @@ tcp_conn_t *tcp_connect_addr(netif_t *nif, const net_addr_t *dst_addr,
     tcp_send_segment(conn, TCP_SYN, NULL, 0);
 
     //wait for SYN-ACK with retransmission (3 attempts 2 sec each)
-    uint32 freq = arch_timer_getfreq();
-    if (freq == 0) freq = 1000;
-
     for (int attempt = 0; attempt < 3; attempt++) {
-        uint64 start = arch_timer_get_ticks();
-        uint64 timeout = (uint64)freq * 2;
+        uint64 deadline = ktimer_now() + TCP_CONNECT_TIMEOUT_NS;
 
-        while (arch_timer_get_ticks() - start < timeout) {
+        lock_flags = spinlock_irq_acquire(&tcp_lock);
+        for (;;) {
             if (proc_current_should_abort_blocking()) {
                 //Do not send RST on local async abort; the peer will retransmit until timeout.
-                lock_flags = spinlock_irq_acquire(&tcp_lock);
                 conn->state = TCP_STATE_CLOSED;
                 conn->active = false;
                 spinlock_irq_release(&tcp_lock, lock_flags);
                 return NULL;
             }
-            if (conn->state == TCP_STATE_ESTABLISHED) return conn;
-            net_poll();
-            sched_yield();
+            if (conn->state == TCP_STATE_ESTABLISHED) {
+                spinlock_irq_release(&tcp_lock, lock_flags);
+                return conn;
+            }
+            if (thread_sleep_locked_irq_until(&conn->wait, &tcp_lock, &lock_flags, deadline) < 0) break;
         }
+        spinlock_irq_release(&tcp_lock, lock_flags);
 
         //retransmit SYN
         if (attempt < 2) {
@@ -650,10 +723,7 @@ int tcp_send(tcp_conn_t *conn, const void *data, size len) {
 int tcp_read(tcp_conn_t *conn, void *buf, size len) {
     if (!conn) return -1;
 
-    uint32 freq = arch_timer_getfreq();
-    if (freq == 0) freq = 1000;
-    uint64 start = arch_timer_get_ticks();
-    uint64 timeout = (uint64)freq * 10; //10 seconds
+    uint64 deadline = ktimer_now() + TCP_READ_TIMEOUT_NS;
 
     irq_state_t flags = spinlock_irq_acquire(&tcp_lock);
     while (conn->rx_len == 0) {
@@ -671,15 +741,12 @@ int tcp_read(tcp_conn_t *conn, void *buf, size len) {
             return 0; //connection closed/closing and no data
         }
 
-        if (arch_timer_get_ticks() - start > timeout) {
+        //sleep until tcp_recv queues data or changes state
+        if (thread_sleep_locked_irq_until(&conn->wait, &tcp_lock, &flags, deadline) < 0 &&
+            conn->rx_len == 0) {
             spinlock_irq_release(&tcp_lock, flags);
             return -1; //timeout
         }
-
-        spinlock_irq_release(&tcp_lock, flags);
-        net_poll();
-        sched_yield();
-        flags = spinlock_irq_acquire(&tcp_lock);
     }
 
     size copy = (conn->rx_len < len) ? conn->rx_len : len;
@@ -691,7 +758,7 @@ int tcp_read(tcp_conn_t *conn, void *buf, size len) {
     }
     conn->rx_len -= copy;
 
-    spinlock_irq_release(&tcp_lock, flags);
+    tcp_unlock_conn(conn, flags);
     return (int)copy;
 }
 
@@ -705,17 +772,18 @@ int tcp_close(tcp_conn_t *conn) {
         conn->listening = false;
         conn->active    = false;
         conn->state     = TCP_STATE_CLOSED;
-        spinlock_irq_release(&tcp_lock, flags);
+        tcp_wake_locked(conn);
+        tcp_unlock_conn(conn, flags);
         return 0;
     }
 
     if (conn->state == TCP_STATE_ESTABLISHED) {
         conn->state = TCP_STATE_FIN_WAIT_1;
-        spinlock_irq_release(&tcp_lock, flags);
+        tcp_unlock_conn(conn, flags);
         tcp_send_segment(conn, TCP_FIN | TCP_ACK, NULL, 0);
     } else if (conn->state == TCP_STATE_CLOSE_WAIT) {
         conn->state = TCP_STATE_LAST_ACK;
-        spinlock_irq_release(&tcp_lock, flags);
+        tcp_unlock_conn(conn, flags);
         tcp_send_segment(conn, TCP_FIN | TCP_ACK, NULL, 0);
     } else {
         spinlock_irq_release(&tcp_lock, flags);
@@ -740,40 +808,44 @@ tcp_conn_t *tcp_listen_addr(netif_t *nif, const net_addr_t *local_addr, uint16 p
 tcp_conn_t *tcp_accept(tcp_conn_t *listener) {
     if (!listener || !listener->listening) return NULL;
 
-    uint32 freq = arch_timer_getfreq();
-    if (freq == 0) freq = 1000;
-    uint64 timeout = (uint64)freq * 30; //30 second accept timeout
-    uint64 start = arch_timer_get_ticks();
+    uint64 deadline = ktimer_now() + TCP_ACCEPT_TIMEOUT_NS;
 
-    while (arch_timer_get_ticks() - start < timeout) {
-        irq_state_t scan_flags = spinlock_irq_acquire(&tcp_lock);
+    bool timed_out = false;
+
+    irq_state_t scan_flags = spinlock_irq_acquire(&tcp_lock);
+    for (;;) {
         if (!listener->listening || !listener->active) {
             spinlock_irq_release(&tcp_lock, scan_flags);
             return NULL;
         }
 
-        //scan for connections on this port that completed handshake
-        for (int i = 0; i < TCP_MAX_CONNECTIONS; i++) {
-            tcp_conn_t *c = &connections[i];
-            if (c->active && !c->listening && !c->accepted &&
-                c->local_port == listener->local_port &&
-                (tcp_addr_is_unspecified(&listener->local_addr) ||
-                 tcp_addr_equal(&c->local_addr, &listener->local_addr)) &&
-                c->state == TCP_STATE_ESTABLISHED) {
-                c->accepted = true;
-                spinlock_irq_release(&tcp_lock, scan_flags);
-                return c;
-            }
+        //take a connection on this port that completed its handshake
+        tcp_conn_t *c = tcp_accept_ready_locked(listener);
+        if (c) {
+            c->accepted = true;
+            tcp_unlock_conn(listener, scan_flags);
+            return c;
         }
-        spinlock_irq_release(&tcp_lock, scan_flags);
 
-        if (proc_current_should_abort_blocking()) {
-            return NULL;
+        if (timed_out || proc_current_should_abort_blocking()) {
+            break;
         }
 
-        net_poll();
-        sched_yield();
+        //children finishing their handshake wake the listener, rescan once more
+        //after the deadline in case one landed right at it
+        if (thread_sleep_locked_irq_until(&listener->wait, &tcp_lock, &scan_flags, deadline) < 0) {
+            timed_out = true;
+        }
     }
+    spinlock_irq_release(&tcp_lock, scan_flags);
 
     return NULL; //timeout
 }
+
+void tcp_bind_object(tcp_conn_t *conn, struct object *obj) {
+    if (!conn) return;
+
+    irq_state_t flags = spinlock_irq_acquire(&tcp_lock);
+    conn->obj = obj;
+    tcp_unlock_conn(conn, flags);
+}
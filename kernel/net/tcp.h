@@ -4,6 +4,7 @@
 #include <arch/types.h>
 #include <net/net.h>
 #include <arch/timer.h>
+#include <proc/wait.h>
 
 //TCP flags
 #define TCP_FIN  0x01
@@ -79,6 +80,12 @@ typedef struct tcp_conn {
     bool active;
     bool listening;         //true if this is a listening socket
     bool accepted;          //true if this connection has been returned by tcp_accept
+
+    //threads blocked in connect/read (or accept on a listener), woken under tcp_lock
+    wait_queue_t wait;
+
+    //socket object whose signals track this connection, NULL when unbound
+    struct object *obj;
 } tcp_conn_t;
 
 //receive a TCP segment (called from IPv4/IPv6 layers)
@@ -105,6 +112,10 @@ tcp_conn_t *tcp_listen_addr(netif_t *nif, const net_addr_t *local_addr, uint16 p
 //accept an incoming connection on a listening socket
 tcp_conn_t *tcp_accept(tcp_conn_t *listener);
 
+//bind (or with NULL unbind) the socket object that receives the connection's
+//READABLE/WRITABLE/PEER_CLOSED signals, publishing the current state on bind
+void tcp_bind_object(tcp_conn_t *conn, struct object *obj);
+
 //initialize TCP subsystem
 void tcp_init(void);
 
@@ -61,6 +61,12 @@ static intptr system_get_info(object_t *obj, uint32 topic, void *buf, size len)
         st.heap_used = heap.slab_used + heap.large_used;
         st.heap_free = heap.slab_capacity - heap.slab_used;
         
+        memcpy(buf, &st, sizeof(st));
+        return 0;
+    } else if (topic == OBJ_INFO_PMM_STATS) {
+        if (len < sizeof(pmm_stats_t)) return -1;
+        pmm_stats_t st;
+        pmm_get_stats(&st);
         memcpy(buf, &st, sizeof(st));
         return 0;
     } else if (topic == OBJ_INFO_TIME_STATS) {
@@ -1,6 +1,9 @@
 #include <obj/object.h>
 #include <mm/kheap.h>
 #include <lib/io.h>
+#include <errno.h>
+#include <proc/wait.h>
+#include <proc/event.h>
 
 object_t *object_create(uint32 type, object_ops_t *ops, void *data) {
     object_t *obj = kmalloc(sizeof(object_t));
@@ -11,6 +14,9 @@ object_t *object_create(uint32 type, object_ops_t *ops, void *data) {
     obj->flags = OBJECT_FLAG_NONE;
     obj->ops = ops;
     obj->data = data;
+    obj->signals = 0;
+    obj->observers = NULL;
+    spinlock_irq_init(&obj->signal_lock);
     
     return obj;
 }
@@ -57,3 +63,135 @@ const char *object_get_type_name(object_t *obj) {
     if (!obj) return "null";
     return object_type_name(obj->type);
 }
+
+void object_signal(object_t *obj, uint32 clear_mask, uint32 set_mask) {
+    if (!obj) return;
+
+    irq_state_t flags = spinlock_irq_acquire(&obj->signal_lock);
+    uint32 old = obj->signals;
+    uint32 now = (old & ~clear_mask) | set_mask;
+    obj->signals = now;
+
+    //only edges wake anyone, a waiter that registered while a bit was
+    //already set saw it in its snapshot
+    uint32 raised = now & ~old;
+    if (raised) {
+        for (object_observer_t *ob = obj->observers; ob; ob = ob->next) {
+            if (ob->mask & raised) ob->notify(ob, now);
+        }
+    }
+    spinlock_irq_release(&obj->signal_lock, flags);
+}
+
+uint32 object_get_signals(object_t *obj) {
+    if (!obj) return 0;
+    return __atomic_load_n(&obj->signals, __ATOMIC_ACQUIRE);
+}
+
+uint32 object_observe(object_t *obj, object_observer_t *ob) {
+    if (!obj || !ob) return 0;
+
+    irq_state_t flags = spinlock_irq_acquire(&obj->signal_lock);
+    ob->next = obj->observers;
+    obj->observers = ob;
+    uint32 signals = obj->signals;
+    spinlock_irq_release(&obj->signal_lock, flags);
+    return signals;
+}
+
+void object_unobserve(object_t *obj, object_observer_t *ob) {
+    if (!obj || !ob) return;
+
+    //notify runs under signal_lock so once we hold it no callback is in flight
+    irq_state_t flags = spinlock_irq_acquire(&obj->signal_lock);
+    object_observer_t **pp = &obj->observers;
+    while (*pp) {
+        if (*pp == ob) {
+            *pp = ob->next;
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+    ob->next = NULL;
+    spinlock_irq_release(&obj->signal_lock, flags);
+}
+
+//one blocked object_wait_many call, shared by all of its observers
+typedef struct {
+    spinlock_irq_t lock;
+    wait_queue_t wq;
+    bool fired;             //an observer triggered since the last check
+} object_waiter_t;
+
+static void object_waiter_notify(object_observer_t *ob, uint32 signals) {
+    (void)signals;
+    object_waiter_t *w = ob->ctx;
+
+    irq_state_t flags = spinlock_irq_acquire(&w->lock);
+    w->fired = true;
+    spinlock_irq_release(&w->lock, flags);
+    thread_wake_all(&w->wq);
+}
+
+static int object_wait_collect(object_t **objs, const uint32 *masks, uint32 *pending, uint32 count) {
+    int ready = 0;
+    for (uint32 i = 0; i < count; i++) {
+        pending[i] = object_get_signals(objs[i]);
+        if (pending[i] & masks[i]) ready++;
+    }
+    return ready;
+}
+
+int object_wait_many(object_t **objs, const uint32 *masks, uint32 *pending,
+                     uint32 count, uint64 deadline_ns) {
+    if (!objs || !masks || !pending) return -EINVAL;
+    if (count == 0 || count > OBJECT_WAIT_MANY_MAX) return -EINVAL;
+
+    object_waiter_t w;
+    spinlock_irq_init(&w.lock);
+    wait_queue_init(&w.wq);
+    w.fired = false;
+
+    object_observer_t obs[OBJECT_WAIT_MANY_MAX];
+    int ready = 0;
+    for (uint32 i = 0; i < count; i++) {
+        obs[i].mask = masks[i];
+        obs[i].notify = object_waiter_notify;
+        obs[i].ctx = &w;
+        pending[i] = object_observe(objs[i], &obs[i]);
+        if (pending[i] & masks[i]) ready++;
+    }
+
+    int ret = 0;
+    while (ready == 0) {
+        if (proc_current_should_abort_blocking()) {
+            ret = -EINTR;
+            break;
+        }
+
+        //fired is checked under w.lock so a notify between the snapshot and
+        //the sleep is never lost
+        bool timed_out = false;
+        irq_state_t flags = spinlock_irq_acquire(&w.lock);
+        if (!w.fired) {
+            if (deadline_ns == UINT64_MAX) {
+                thread_sleep_locked_irq(&w.wq, &w.lock, &flags);
+            } else {
+                timed_out = thread_sleep_locked_irq_until(&w.wq, &w.lock, &flags, deadline_ns) < 0;
+            }
+        }
+        w.fired = false;
+        spinlock_irq_release(&w.lock, flags);
+
+        ready = object_wait_collect(objs, masks, pending, count);
+        if (ready == 0 && timed_out) {
+            ret = -ETIMEDOUT;
+            break;
+        }
+    }
+
+    for (uint32 i = 0; i < count; i++) {
+        object_unobserve(objs[i], &obs[i]);
+    }
+    return ready > 0 ? ready : ret;
+}
@@ -2,6 +2,7 @@
 #define OBJ_OBJECT_H
 
 #include <arch/types.h>
+#include <lib/spinlock.h>
 
 struct stat;
 
@@ -22,7 +23,16 @@ struct stat;
 //object_deref will call the close handler but will NOT call kfree on the object pointer
 #define OBJECT_FLAG_EMBEDDED  0x02
 
+//object signals - state bits that threads can block on with object_wait_many
+//each object type asserts the subset that makes sense for it
+#define OBJECT_SIGNAL_READABLE    (1u << 0) //data is queued (channel endpoints, sockets)
+#define OBJECT_SIGNAL_WRITABLE    (1u << 1) //a send would not fail with queue full or closed
+#define OBJECT_SIGNAL_PEER_CLOSED (1u << 2) //the other end of a channel or socket is gone
+#define OBJECT_SIGNAL_EXITED      (1u << 3) //process or thread has terminated
+#define OBJECT_SIGNAL_ALL         0x0F
+
 struct object;
+struct object_observer;
 
 //polymorphic operations for objects
 typedef struct object_ops {
@@ -42,8 +52,22 @@ typedef struct object {
     uint32 flags;          //OBJECT_FLAG_* bitmask
     object_ops_t *ops;     //polymorphic operations
     void *data;            //type-specific data
+
+    //signal state, zero-initialized objects start with nothing asserted
+    uint32 signals;                     //OBJECT_SIGNAL_* currently asserted
+    struct object_observer *observers;  //waiters notified on signal changes
+    spinlock_irq_t signal_lock;
 } object_t;
 
+//a registered interest in an object's signals
+//notify runs under the object's signal lock with IRQs off, so keep it short
+typedef struct object_observer {
+    struct object_observer *next;
+    uint32 mask;                        //signals this observer cares about
+    void (*notify)(struct object_observer *ob, uint32 signals);
+    void *ctx;
+} object_observer_t;
+
 //create a new object
 object_t *object_create(uint32 type, object_ops_t *ops, void *data);
 
@@ -68,6 +92,28 @@ static inline ssize object_read(object_t *obj, void *buf, size len, size offset)
     return obj->ops->read(obj, buf, len, offset);
 }
 
+//clear then set signal bits, notifying observers whose mask has a newly asserted bit
+void object_signal(object_t *obj, uint32 clear_mask, uint32 set_mask);
+
+//current signal state
+uint32 object_get_signals(object_t *obj);
+
+//register an observer and return the signal state at registration time
+//the snapshot and registration are atomic so no change can slip in between
+uint32 object_observe(object_t *obj, object_observer_t *ob);
+
+//unregister an observer, after this returns notify will not run for it
+void object_unobserve(object_t *obj, object_observer_t *ob);
+
+#define OBJECT_WAIT_MANY_MAX 32
+
+//block until any object has a signal from its mask asserted or the deadline
+//(absolute ktimer_now() ns, UINT64_MAX for none) passes
+//pending[i] receives the asserted signals of objs[i]
+//returns the number of satisfied objects, -ETIMEDOUT or -EINTR
+int object_wait_many(object_t **objs, const uint32 *masks, uint32 *pending,
+                     uint32 count, uint64 deadline_ns);
+
 //get type name (for debugging)
 const char *object_get_type_name(object_t *obj);
 
@@ -0,0 +1,276 @@
+//per-CPU kernel timers
+//each CPU keeps a binary min-heap of armed timers ordered by deadline and the
+//arch timer is programmed for whichever comes first: the earliest deadline or
+//(if the CPU has runnable work) the next scheduler tick. an idle CPU therefore
+//sleeps straight through to its next real deadline instead of ticking
+
+#include <proc/ktimer.h>
+#include <proc/thread.h>
+#include <arch/cpu.h>
+#include <arch/timer.h>
+#include <arch/percpu.h>
+#include <lib/spinlock.h>
+#include <lib/io.h>
+#include <lib/string.h>
+#include <mm/kheap.h>
+
+#define NS_PER_SEC 1000000000ULL
+
+//heap slots every CPU starts with, arming past them doubles the heap
+#define KTIMER_HEAP_INITIAL 256
+
+//upper bound on how long an idle CPU sleeps without a deadline
+//the BSP wakes more often since it drives vt cursor blink and net_poll
+#define KTIMER_IDLE_MAX_NS      1000000000ULL
+#define KTIMER_IDLE_MAX_BSP_NS  50000000ULL
+
+#define KTIMER_SLOT_NONE 0xFFFFFFFF
+
+typedef struct {
+    spinlock_irq_t lock;
+    ktimer_t **heap;        //initial, or a kmalloc'd array once it has grown
+    uint32 count;
+    uint32 cap;
+    ktimer_t *running;      //timer whose callback is executing right now
+    uint64 next_tick;       //when the next scheduler tick is due
+    ktimer_t *initial[KTIMER_HEAP_INITIAL];
+} ktimer_cpu_t;
+
+static ktimer_cpu_t ktimer_cpus[MAX_CPUS];
+
+static inline ktimer_cpu_t *ktimer_local(void) {
+    return &ktimer_cpus[arch_cpu_index()];
+}
+
+static uint64 ktimer_tick_ns(void) {
+    uint32 freq = arch_timer_getfreq();
+    return freq ? NS_PER_SEC / freq : NS_PER_SEC / 1000;
+}
+
+static inline void heap_set(ktimer_cpu_t *tc, uint32 i, ktimer_t *t) {
+    tc->heap[i] = t;
+    t->slot = i;
+}
+
+static void heap_sift_up(ktimer_cpu_t *tc, uint32 i) {
+    ktimer_t *t = tc->heap[i];
+    while (i > 0) {
+        uint32 parent = (i - 1) / 2;
+        if (tc->heap[parent]->deadline <= t->deadline) break;
+        heap_set(tc, i, tc->heap[parent]);
+        i = parent;
+    }
+    heap_set(tc, i, t);
+}
+
+static void heap_sift_down(ktimer_cpu_t *tc, uint32 i) {
+    ktimer_t *t = tc->heap[i];
+    for (;;) {
+        uint32 child = 2 * i + 1;
+        if (child >= tc->count) break;
+        if (child + 1 < tc->count && tc->heap[child + 1]->deadline < tc->heap[child]->deadline) {
+            child++;
+        }
+        if (t->deadline <= tc->heap[child]->deadline) break;
+        heap_set(tc, i, tc->heap[child]);
+        i = child;
+    }
+    heap_set(tc, i, t);
+}
+
+//unlink a timer from its heap (lock held)
+static void heap_remove(ktimer_cpu_t *tc, ktimer_t *t) {
+    uint32 i = t->slot;
+    ktimer_t *last = tc->heap[--tc->count];
+    t->slot = KTIMER_SLOT_NONE;
+    if (i == tc->count) return;
+
+    heap_set(tc, i, last);
+    if (i > 0 && tc->heap[(i - 1) / 2]->deadline > last->deadline) {
+        heap_sift_up(tc, i);
+    } else {
+        heap_sift_down(tc, i);
+    }
+}
+
+void ktimer_init(ktimer_t *timer, ktimer_fn_t fn, void *arg) {
+    if (!timer) return;
+    timer->deadline = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->cpu = -1;
+    timer->slot = KTIMER_SLOT_NONE;
+}
+
+uint64 ktimer_now(void) {
+    return arch_timer_get_ns();
+}
+
+//double the heap of whichever CPU we are on now, lock not held
+//the array is allocated with interrupts on and swapped in under the lock,
+//so a CPU that grew meanwhile just gets the spare freed again
+static int ktimer_grow(uint32 cap) {
+    ktimer_t **bigger = kmalloc((size)cap * 2 * sizeof(ktimer_t *));
+    if (!bigger) return -1;
+
+    irq_state_t flags = arch_irq_save();
+    ktimer_cpu_t *tc = ktimer_local();
+    spinlock_acquire(&tc->lock.lock);
+    ktimer_t **old = NULL;
+    if (tc->cap <= cap) {
+        memcpy(bigger, tc->heap, tc->count * sizeof(ktimer_t *));
+        old = tc->heap;
+        tc->heap = bigger;
+        tc->cap = cap * 2;
+        bigger = NULL;
+    }
+    spinlock_release(&tc->lock.lock);
+    arch_irq_restore(flags);
+
+    if (bigger) kfree(bigger);
+    if (old && old != tc->initial) kfree(old);
+    return 0;
+}
+
+int ktimer_arm(ktimer_t *timer, uint64 deadline_ns) {
+    if (!timer || !timer->fn) return -1;
+
+    //timers are always armed locally, pull it off any other CPU first
+    ktimer_cancel(timer);
+
+    //only a caller running with interrupts on may allocate, callbacks re-arming
+    //from the timer interrupt are limited to the slots already there
+    bool can_grow = arch_irq_enabled();
+
+    irq_state_t flags;
+    uint32 cpu;
+    ktimer_cpu_t *tc;
+    for (;;) {
+        flags = arch_irq_save();
+        cpu = arch_cpu_index();
+        tc = &ktimer_cpus[cpu];
+
+        spinlock_acquire(&tc->lock.lock);
+        if (!tc->heap) {
+            tc->heap = tc->initial;
+            tc->cap = KTIMER_HEAP_INITIAL;
+        }
+        if (tc->count < tc->cap) break;
+
+        uint32 cap = tc->cap;
+        spinlock_release(&tc->lock.lock);
+        arch_irq_restore(flags);
+        if (!can_grow || ktimer_grow(cap) != 0) {
+            printf("[ktimer] ERR: timer heap full on cpu %u\n", cpu);
+            return -1;
+        }
+    }
+
+    timer->deadline = deadline_ns;
+    timer->cpu = (int32)cpu;
+    tc->heap[tc->count] = timer;
+    timer->slot = tc->count++;
+    heap_sift_up(tc, timer->slot);
+    bool earliest = tc->heap[0] == timer;
+    spinlock_release(&tc->lock.lock);
+
+    //a new earliest deadline has to reach the hardware right away
+    if (earliest) ktimer_reprogram();
+
+    arch_irq_restore(flags);
+    return 0;
+}
+
+bool ktimer_cancel(ktimer_t *timer) {
+    if (!timer) return false;
+
+    //the owning CPU can change under us (fire + re-arm) so re-check after locking
+    for (;;) {
+        int32 cpu = timer->cpu;
+        if (cpu < 0) return false;
+
+        ktimer_cpu_t *tc = &ktimer_cpus[cpu];
+        irq_state_t flags = spinlock_irq_acquire(&tc->lock);
+        if (timer->cpu != cpu) {
+            spinlock_irq_release(&tc->lock, flags);
+            continue;
+        }
+
+        if (timer->slot != KTIMER_SLOT_NONE) {
+            heap_remove(tc, timer);
+            timer->cpu = -1;
+            spinlock_irq_release(&tc->lock, flags);
+            return true;
+        }
+
+        //the callback is running - a timer cancelling itself just returns,
+        //anyone else waits until the callback is done with the timer
+        bool self = (uint32)cpu == arch_cpu_index() && tc->running == timer;
+        spinlock_irq_release(&tc->lock, flags);
+        if (self) return false;
+        arch_pause();
+    }
+}
+
+bool ktimer_run_expired(void) {
+    ktimer_cpu_t *tc = ktimer_local();
+    uint64 now = ktimer_now();
+
+    irq_state_t flags = spinlock_irq_acquire(&tc->lock);
+    while (tc->count > 0 && tc->heap[0]->deadline <= now) {
+        ktimer_t *t = tc->heap[0];
+        heap_remove(tc, t);
+        tc->running = t;
+        spinlock_irq_release(&tc->lock, flags);
+
+        t->fn(t, t->arg);
+
+        flags = spinlock_irq_acquire(&tc->lock);
+        tc->running = NULL;
+        //leave ownership alone if the callback re-armed the timer
+        if (t->slot == KTIMER_SLOT_NONE && t->cpu == (int32)arch_cpu_index()) {
+            t->cpu = -1;
+        }
+    }
+
+    //periodic timers tick on schedule, one-shot ones also fire for deadlines
+    bool tick_due = true;
+    if (arch_timer_is_tickless()) {
+        tick_due = now >= tc->next_tick;
+        if (tick_due) tc->next_tick = now + ktimer_tick_ns();
+    }
+    spinlock_irq_release(&tc->lock, flags);
+
+    return tick_due;
+}
+
+void ktimer_reprogram(void) {
+    if (!arch_timer_is_tickless()) return;
+
+    irq_state_t flags = arch_irq_save();
+    percpu_t *pc = percpu_get();
+    ktimer_cpu_t *tc = &ktimer_cpus[pc->cpu_index];
+    uint64 now = ktimer_now();
+
+    //keep ticking until the scheduler runs and whenever there is work to slice
+    thread_t *cur = (thread_t *)pc->current_thread;
+    bool busy = !pc->sched_running || pc->run_queue_count > 0 ||
+                (cur && cur != pc->idle_thread);
+
+    uint64 next;
+    if (busy) {
+        if (tc->next_tick <= now) tc->next_tick = now + ktimer_tick_ns();
+        next = tc->next_tick;
+    } else {
+        next = now + (pc->cpu_index == 0 ? KTIMER_IDLE_MAX_BSP_NS : KTIMER_IDLE_MAX_NS);
+    }
+
+    spinlock_acquire(&tc->lock.lock);
+    if (tc->count > 0 && tc->heap[0]->deadline < next) {
+        next = tc->heap[0]->deadline;
+    }
+    spinlock_release(&tc->lock.lock);
+
+    arch_timer_program(next);
+    arch_irq_restore(flags);
+}
@@ -0,0 +1,45 @@
+#ifndef PROC_KTIMER_H
+#define PROC_KTIMER_H
+
+#include <arch/types.h>
+
+struct ktimer;
+
+//callbacks run from the timer interrupt with IRQs disabled so keep them short
+//(waking a thread or raising a bottom half is fine, heap allocation is not)
+//a callback may re-arm its own timer but must not free it
+typedef void (*ktimer_fn_t)(struct ktimer *timer, void *arg);
+
+//one-shot kernel timer - embed it in the owning object and arm it per deadline
+typedef struct ktimer {
+    uint64 deadline;        //absolute arch_timer_get_ns() time to fire at
+    ktimer_fn_t fn;
+    void *arg;
+    int32 cpu;              //CPU whose heap holds (or is firing) the timer, -1 if idle
+    uint32 slot;            //heap index while armed
+} ktimer_t;
+
+//prepare a timer before its first use
+void ktimer_init(ktimer_t *timer, ktimer_fn_t fn, void *arg);
+
+//arm the timer on the current CPU to fire at an absolute deadline
+//re-arming an already armed timer moves it. the heap grows on demand, returns
+//-1 only if it is full and cannot (out of memory, or called with interrupts off)
+int ktimer_arm(ktimer_t *timer, uint64 deadline_ns);
+
+//disarm the timer, waiting out a callback that is running on another CPU
+//returns true if the timer was still pending
+bool ktimer_cancel(ktimer_t *timer);
+
+//current monotonic time in nanoseconds
+uint64 ktimer_now(void);
+
+//timer interrupt hook: fires expired timers on this CPU
+//returns true when a scheduler tick is due
+bool ktimer_run_expired(void);
+
+//re-arm this CPU's hardware timer for its next event
+//busy CPUs keep a periodic scheduler tick, idle CPUs sleep until the next deadline
+void ktimer_reprogram(void);
+
+#endif
@@ -3,6 +3,7 @@
 #include <mm/pmm.h>
 #include <mm/kheap.h>
 #include <mm/mm.h>
+#include <mm/vmo.h>
 #include <arch/mmu.h>
 #include <arch/cpu.h>
 #include <lib/string.h>
@@ -170,6 +171,7 @@ process_t *process_create(const char *name) {
     proc->pending_events = 0;
     wait_queue_init(&proc->exit_wait);
     spinlock_init(&proc->lock);
+    spinlock_init(&proc->vma_lock);
     spinlock_irq_init(&proc->event_lock);
     
     //add to process list
@@ -227,6 +229,7 @@ void process_destroy(process_t *proc) {
     
     //wake any threads waiting for this process to exit
     thread_wake_all(&proc->exit_wait);
+    object_signal(proc->obj, 0, OBJECT_SIGNAL_EXITED);
     
     //close all handles
     for (uint32 i = 0; i < proc->handle_capacity; i++) {
@@ -240,6 +243,10 @@ void process_destroy(process_t *proc) {
     //free user address space if present
     if (proc->pagemap) {
         //first, free all VMAs and their physical memory
+        //the whole teardown shares one TLB batch, no thread of the process runs
+        //any more so pages can go back before the single flush at the end
+        mmu_tlb_batch_t batch;
+        mmu_tlb_batch_init(&batch, proc->pagemap);
         proc_vma_t *vma = proc->vma_list;
         while (vma) {
             proc_vma_t *next = vma->next;
@@ -252,19 +259,23 @@ void process_destroy(process_t *proc) {
                 //we have to use the pagemap to find them or walk the range
                 for (uintptr addr = vma->start; addr < vma->start + vma->length; addr += 4096) {
                     uintptr phys = mmu_virt_to_phys(proc->pagemap, addr);
-                    if (phys) {
+                    if (phys != (uintptr)-1) {
                         //unmap first to prevent double-free via overlapping VMAs
-                        mmu_unmap_range(proc->pagemap, addr, 1);
+                        mmu_unmap_range_batch(&batch, addr, 1);
                         pmm_free((void *)phys, 1);
                     }
                 }
             }
             
+            //must leave the VMO list before the pagemap goes away under a resize
+            vmo_unlink_vma(vma);
             if (vma->obj) object_deref(vma->obj);
             kfree(vma);
             vma = next;
         }
         proc->vma_list = NULL;
+        proc->vma_root = NULL;
+        mmu_tlb_batch_flush(&batch);
 
         mmu_pagemap_destroy(proc->pagemap);
         proc->pagemap = NULL;
@@ -455,47 +466,222 @@ void proc_init(void) {
     printf("[proc] initialized (kernel PID 0)\n");
 }
 
+//VMA tree
+//AVL tree over non-overlapping VMAs, augmented with the free gap below each
+//VMA so the lowest fitting hole can be found without walking every mapping
+//all of these run with proc->vma_lock held
+
+static inline int32 vma_height(proc_vma_t *n) {
+    return n ? n->height : 0;
+}
+
+static inline size vma_subtree_gap(proc_vma_t *n) {
+    return n ? n->subtree_gap : 0;
+}
+
+static void vma_update(proc_vma_t *n) {
+    int32 hl = vma_height(n->left), hr = vma_height(n->right);
+    n->height = 1 + (hl > hr ? hl : hr);
+    size g = n->gap;
+    if (vma_subtree_gap(n->left) > g) g = vma_subtree_gap(n->left);
+    if (vma_subtree_gap(n->right) > g) g = vma_subtree_gap(n->right);
+    n->subtree_gap = g;
+}
+
+//gap below n given its address ordered predecessor, nothing below USER_SPACE_START counts
+static void vma_set_gap(proc_vma_t *n) {
+    uintptr floor = n->prev ? n->prev->start + n->prev->length : USER_SPACE_START;
+    if (floor < USER_SPACE_START) floor = USER_SPACE_START;
+    n->gap = n->start > floor ? n->start - floor : 0;
+}
+
+static void vma_replace_child(process_t *proc, proc_vma_t *parent, proc_vma_t *old, proc_vma_t *new) {
+    if (!parent) proc->vma_root = new;
+    else if (parent->left == old) parent->left = new;
+    else parent->right = new;
+    if (new) new->parent = parent;
+}
+
+static proc_vma_t *vma_rotate_left(process_t *proc, proc_vma_t *x) {
+    proc_vma_t *y = x->right;
+    vma_replace_child(proc, x->parent, x, y);
+    x->right = y->left;
+    if (x->right) x->right->parent = x;
+    y->left = x;
+    x->parent = y;
+    vma_update(x);
+    vma_update(y);
+    return y;
+}
+
+static proc_vma_t *vma_rotate_right(process_t *proc, proc_vma_t *x) {
+    proc_vma_t *y = x->left;
+    vma_replace_child(proc, x->parent, x, y);
+    x->left = y->right;
+    if (x->left) x->left->parent = x;
+    y->right = x;
+    x->parent = y;
+    vma_update(x);
+    vma_update(y);
+    return y;
+}
+
+//restore balance and the gap summaries from n up to the root
+static void vma_rebalance(process_t *proc, proc_vma_t *n) {
+    while (n) {
+        vma_update(n);
+        int32 bf = vma_height(n->left) - vma_height(n->right);
+        if (bf > 1) {
+            if (vma_height(n->left->left) < vma_height(n->left->right)) vma_rotate_left(proc, n->left);
+            n = vma_rotate_right(proc, n);
+        } else if (bf < -1) {
+            if (vma_height(n->right->right) < vma_height(n->right->left)) vma_rotate_right(proc, n->right);
+            n = vma_rotate_left(proc, n);
+        }
+        n = n->parent;
+    }
+}
+
+//VMA with the highest start <= addr
+static proc_vma_t *vma_lookup_le(process_t *proc, uintptr addr) {
+    proc_vma_t *n = proc->vma_root, *best = NULL;
+    while (n) {
+        if (n->start <= addr) {
+            best = n;
+            n = n->right;
+        } else {
+            n = n->left;
+        }
+    }
+    return best;
+}
+
+static void vma_tree_insert(process_t *proc, proc_vma_t *vma) {
+    proc_vma_t *parent = NULL, **link = &proc->vma_root;
+    proc_vma_t *prev = NULL, *next = NULL;
+    while (*link) {
+        parent = *link;
+        if (vma->start < parent->start) {
+            next = parent;
+            link = &parent->left;
+        } else {
+            prev = parent;
+            link = &parent->right;
+        }
+    }
+    vma->left = vma->right = NULL;
+    vma->parent = parent;
+    vma->height = 1;
+    *link = vma;
+
+    vma->prev = prev;
+    vma->next = next;
+    if (prev) prev->next = vma;
+    else proc->vma_list = vma;
+    if (next) next->prev = vma;
+
+    vma_set_gap(vma);
+    vma_rebalance(proc, vma);
+    if (next) {
+        vma_set_gap(next);
+        vma_rebalance(proc, next);
+    }
+}
+
+static void vma_tree_erase(process_t *proc, proc_vma_t *vma) {
+    proc_vma_t *from;
+    if (!vma->left || !vma->right) {
+        proc_vma_t *child = vma->left ? vma->left : vma->right;
+        from = vma->parent;
+        vma_replace_child(proc, vma->parent, vma, child);
+    } else {
+        //the in-order successor takes vma's place in the tree
+        proc_vma_t *s = vma->right;
+        while (s->left) s = s->left;
+        if (s->parent == vma) {
+            from = s;
+        } else {
+            from = s->parent;
+            from->left = s->right;
+            if (s->right) s->right->parent = from;
+            s->right = vma->right;
+            s->right->parent = s;
+        }
+        s->left = vma->left;
+        s->left->parent = s;
+        s->height = vma->height;
+        vma_replace_child(proc, vma->parent, vma, s);
+    }
+    vma_rebalance(proc, from);
+
+    proc_vma_t *next = vma->next;
+    if (vma->prev) vma->prev->next = next;
+    else proc->vma_list = next;
+    if (next) {
+        next->prev = vma->prev;
+        vma_set_gap(next);
+        vma_rebalance(proc, next);
+    }
+    vma->left = vma->right = vma->parent = vma->next = vma->prev = NULL;
+}
+
+//lowest address >= lo inside a gap of at least length bytes, 0 if none
+static uintptr vma_gap_search(proc_vma_t *n, uintptr lo, size length) {
+    if (!n || n->subtree_gap < length) return 0;
+
+    //every gap in the left subtree ends before n starts
+    if (n->start > lo) {
+        uintptr addr = vma_gap_search(n->left, lo, length);
+        if (addr) return addr;
+    }
+
+    uintptr gap_start = n->start - n->gap;
+    if (gap_start < lo) gap_start = lo;
+    if (n->gap && n->start > gap_start && n->start - gap_start >= length) return gap_start;
+
+    return vma_gap_search(n->right, lo, length);
+}
+
+static uintptr vma_find_free_from(process_t *proc, uintptr lo, size length) {
+    uintptr addr = vma_gap_search(proc->vma_root, lo, length);
+    if (addr) return addr;
+
+    //the space above the highest VMA is not anyone's gap
+    proc_vma_t *last = proc->vma_root;
+    while (last && last->right) last = last->right;
+    uintptr top = last ? last->start + last->length : USER_SPACE_START;
+    if (top < lo) top = lo;
+    if (top <= USER_SPACE_END && USER_SPACE_END - top >= length) return top;
+    return 0;
+}
+
 uintptr process_vma_find_free(process_t *proc, size length) {
+    return process_vma_find_free_aligned(proc, length, 0x1000);
+}
+
+uintptr process_vma_find_free_aligned(process_t *proc, size length, size align) {
     if (!proc || length == 0) return 0;
-    if (length > (size)(-1) - 0xFFFULL) return 0;
+    if (align < 0x1000 || (align & (align - 1))) return 0;
+    if (length > (size)(-1) - 0xFFFULL - align) return 0;
     
-    //page-align the length
+    //page-align the length, a gap with room to slide up to the alignment always fits
     length = (length + 0xFFF) & ~0xFFFULL;
+    size search = length + align - 0x1000;
     
-    spinlock_acquire(&proc->lock);
-    //start from the hint or default
-    uintptr addr = proc->vma_next_addr;
-    if (addr < USER_SPACE_START) addr = USER_SPACE_START;
+    spinlock_acquire(&proc->vma_lock);
+    //start from the hint or default, then retry from the bottom
+    uintptr hint = proc->vma_next_addr;
+    if (hint < USER_SPACE_START) hint = USER_SPACE_START;
     
-    //scan for a free region
-    while (addr + length <= USER_SPACE_END) {
-        int conflict = 0;
-        
-        //check against all existing VMAs
-        for (proc_vma_t *vma = proc->vma_list; vma; vma = vma->next) {
-            uintptr vma_end = vma->start + vma->length;
-            uintptr region_end = addr + length;
-            
-            //check for overlap
-            if (addr < vma_end && region_end > vma->start) {
-                //overlap - skip past this VMA
-                addr = vma_end;
-                addr = (addr + 0xFFF) & ~0xFFFULL;  //page align
-                conflict = 1;
-                break;
-            }
-        }
-        
-        if (!conflict) {
-            //found a free region
-            proc->vma_next_addr = addr + length;
-            spinlock_release(&proc->lock);
-            return addr;
-        }
+    uintptr addr = vma_find_free_from(proc, hint, search);
+    if (!addr && hint > USER_SPACE_START) addr = vma_find_free_from(proc, USER_SPACE_START, search);
+    if (addr) {
+        addr = (addr + align - 1) & ~(uintptr)(align - 1);
+        proc->vma_next_addr = addr + length;
     }
     
-    spinlock_release(&proc->lock);
-    return 0;  //no space found
+    spinlock_release(&proc->vma_lock);
+    return addr;  //0 if no space found
 }
 
 int process_vma_add(process_t *proc, uintptr start, size length, 
@@ -517,26 +703,25 @@ int process_vma_add(process_t *proc, uintptr start, size length,
     vma->flags = flags;
     vma->obj = backing_obj;
     vma->obj_offset = obj_offset;
+    vma->proc = proc;
     
     if (backing_obj) object_ref(backing_obj);
     
-    spinlock_acquire(&proc->lock);
-    //reject overlapping VMAs
+    spinlock_acquire(&proc->vma_lock);
+    //reject overlapping VMAs, only the last one starting below our end can overlap
     uintptr end = start + length;
-    for (proc_vma_t *cur = proc->vma_list; cur; cur = cur->next) {
-        uintptr cur_end = cur->start + cur->length;
-        if (start < cur_end && end > cur->start) {
-            spinlock_release(&proc->lock);
-            if (backing_obj) object_deref(backing_obj);
-            kfree(vma);
-            return -1;
-        }
+    proc_vma_t *cur = vma_lookup_le(proc, end - 1);
+    if (cur && cur->start + cur->length > start) {
+        spinlock_release(&proc->vma_lock);
+        if (backing_obj) object_deref(backing_obj);
+        kfree(vma);
+        return -1;
     }
 
-    //insert at head of list
-    vma->next = proc->vma_list;
-    proc->vma_list = vma;
-    spinlock_release(&proc->lock);
+    vma_tree_insert(proc, vma);
+    spinlock_release(&proc->vma_lock);
+
+    vmo_link_vma(vma);
     
     return 0;
 }
@@ -554,41 +739,60 @@ uintptr process_vma_alloc(process_t *proc, size length, uint32 flags,
     return addr;
 }
 
-int process_vma_remove(process_t *proc, uintptr start) {
-    if (!proc) return -1;
+proc_vma_t *process_vma_detach(process_t *proc, uintptr start) {
+    if (!proc) return NULL;
     
-    spinlock_acquire(&proc->lock);
-    proc_vma_t **pp = &proc->vma_list;
-    while (*pp) {
-        if ((*pp)->start == start) {
-            proc_vma_t *vma = *pp;
-            *pp = vma->next;
-            
-            if (vma->obj) object_deref(vma->obj);
-            kfree(vma);
-            spinlock_release(&proc->lock);
-            return 0;
-        }
-        pp = &(*pp)->next;
+    spinlock_acquire(&proc->vma_lock);
+    proc_vma_t *vma = vma_lookup_le(proc, start);
+    if (!vma || vma->start != start) {
+        spinlock_release(&proc->vma_lock);
+        return NULL;  //not found
     }
-    spinlock_release(&proc->lock);
-    
-    return -1;  //not found
+    vma_tree_erase(proc, vma);
+    vma->detached = 1;
+    spinlock_release(&proc->vma_lock);
+    return vma;
+}
+
+void process_vma_release(proc_vma_t *vma) {
+    if (!vma) return;
+
+    //the VMO list is locked before process locks so it is left after dropping ours
+    vmo_unlink_vma(vma);
+    if (vma->obj) object_deref(vma->obj);
+    kfree(vma);
+}
+
+int process_vma_remove(process_t *proc, uintptr start) {
+    proc_vma_t *vma = process_vma_detach(proc, start);
+    if (!vma) return -1;
+    process_vma_release(vma);
+    return 0;
+}
+
+proc_vma_t *process_vma_find_locked(process_t *proc, uintptr addr) {
+    proc_vma_t *vma = vma_lookup_le(proc, addr);
+    if (vma && addr < vma->start + vma->length) return vma;
+    return NULL;
 }
 
 proc_vma_t *process_vma_find(process_t *proc, uintptr addr) {
     if (!proc) return NULL;
     
-    spinlock_acquire(&proc->lock);
-    for (proc_vma_t *vma = proc->vma_list; vma; vma = vma->next) {
-        if (addr >= vma->start && addr < vma->start + vma->length) {
-            spinlock_release(&proc->lock);
-            return vma;
-        }
-    }
-    spinlock_release(&proc->lock);
+    spinlock_acquire(&proc->vma_lock);
+    proc_vma_t *vma = process_vma_find_locked(proc, addr);
+    spinlock_release(&proc->vma_lock);
     
-    return NULL;
+    return vma;
+}
+
+void process_vma_set_length_locked(process_t *proc, proc_vma_t *vma, size length) {
+    vma->length = length;
+    //only the gap above us moved
+    if (vma->next) {
+        vma_set_gap(vma->next);
+        vma_rebalance(proc, vma->next);
+    }
 }
 
 uintptr process_setup_user_stack(uintptr stack_phys, uintptr stack_base, 
@@ -30,13 +30,24 @@ typedef struct {
 } proc_handle_t;
 
 //virtual memory area (for tracking user mappings)
+//VMAs sit in an AVL tree keyed by start, each node also tracks the free gap
+//below it and the largest gap in its subtree so free space is found in
+//O(log n). next/prev keep them in address order for plain walks
 typedef struct proc_vma {
     uintptr start;              //start virtual address
     size length;                //length in bytes
     uint32 flags;               //mapping flags
     object_t *obj;              //backing object (VMO) if any
     size obj_offset;            //offset into backing object
-    struct proc_vma *next;      //linked list
+    struct proc_vma *next;      //next VMA by address
+    struct proc_vma *prev;      //previous VMA by address
+    struct proc_vma *left, *right, *parent;
+    int32 height;
+    size gap;                   //free bytes between the previous VMA (or USER_SPACE_START) and start
+    size subtree_gap;           //largest gap in this subtree
+    struct process *proc;       //owning process
+    struct proc_vma *obj_next;  //next mapping of the same VMO
+    bool detached;              //removed from the process, still on the VMO list
 } proc_vma_t;
 
 
@@ -61,7 +72,8 @@ typedef struct process {
     void *pagemap;
     
     //virtual memory areas (for address space tracking)
-    proc_vma_t *vma_list;       //head of VMA list
+    proc_vma_t *vma_list;       //lowest VMA, head of the address ordered list
+    proc_vma_t *vma_root;       //root of the VMA tree
     uintptr vma_next_addr;      //next allocation address hint
     
     //threads in this process
@@ -86,6 +98,9 @@ typedef struct process {
 
     //always acquire lock before event_lock when both are needed
     spinlock_t lock;
+    //protects the VMA tree and vma_next_addr and orders page faults against
+    //unmaps, taken after a VMO's map_lock and never together with lock
+    spinlock_t vma_lock;
     //protects pending_events and event_actions
     spinlock_irq_t event_lock;
 } process_t;
@@ -161,15 +176,31 @@ uintptr process_vma_alloc(process_t *proc, size length, uint32 flags, object_t *
 //find free virtual address region
 uintptr process_vma_find_free(process_t *proc, size length);
 
+//same but the region starts on a multiple of align (a power of two, at least a page)
+uintptr process_vma_find_free_aligned(process_t *proc, size length, size align);
+
 //add a VMA entry (for tracking existing mappings)
 int process_vma_add(process_t *proc, uintptr start, size length, uint32 flags, object_t *backing_obj, size obj_offset);
 
 //remove a VMA entry
 int process_vma_remove(process_t *proc, uintptr start);
 
+//the two halves of process_vma_remove for callers that must tear down the
+//page tables in between: detach takes the VMA out of the tree so faults can't
+//refill it, release drops its object reference and frees it
+proc_vma_t *process_vma_detach(process_t *proc, uintptr start);
+void process_vma_release(proc_vma_t *vma);
+
 //find VMA containing the given address
 proc_vma_t *process_vma_find(process_t *proc, uintptr addr);
 
+//same with proc->vma_lock already held, the VMA stays valid until it is released
+proc_vma_t *process_vma_find_locked(process_t *proc, uintptr addr);
+
+//change the length of a VMA in place, caller holds proc->vma_lock and has made
+//sure the new end does not run into the next VMA
+void process_vma_set_length_locked(process_t *proc, proc_vma_t *vma, size length);
+
 //setup user stack with argc/argv
 //returns adjusted stack pointer to use for thread creation
 uintptr process_setup_user_stack(uintptr stack_phys, uintptr stack_base,
@@ -11,12 +11,17 @@
 #include <arch/percpu.h>
 #include <arch/smp.h>
 #include <proc/bottom_half.h>
+#include <proc/ktimer.h>
+#include <mm/pmm.h>
 
 #define KERNEL_STACK_SIZE 16384  //16KB
 
 //switch every 10 ticks
 static uint32 time_slice = 10;
 
+//every 10 slices each CPU lifts its threads back to their base priority
+#define SCHED_BOOST_TICKS 100
+
 //dead thread list - threads waiting to have their resources freed
 static thread_t *dead_list_head = NULL;
 static spinlock_irq_t dead_lock = SPINLOCK_IRQ_INIT;
@@ -75,7 +80,7 @@ void sched_reap(void) {
     spinlock_irq_release(&dead_lock, flags);
 }
 
-//idle thread entry - just halts forever
+//idle thread entry - steals work from busy siblings, halts when there is none
 static void idle_thread_entry(void *arg) {
     (void)arg;
     
@@ -84,7 +89,28 @@ static void idle_thread_entry(void *arg) {
         //that schedule bottom halves can still make progress even when the
         //system is otherwise idle or only running kernel code
         bottom_half_run_budget(32);
-        arch_halt();
+        if (sched_steal()) {
+            sched_yield();
+            continue;
+        }
+
+        //clear a few pages for the zero pool at a time so new work is
+        //noticed quickly, we only halt once the pool is full
+        if (percpu_get()->run_queue_count == 0 && pmm_zero_refill(8)) continue;
+
+        //check for work and stop the tick with IRQs off so a wakeup landing
+        //in between can't leave us halted with a runnable thread queued
+        //sti;hlt only lets interrupts in once the CPU is halted
+        percpu_t *pc = percpu_get();
+        irq_state_t flags = arch_irq_save();
+        if (pc->run_queue_count == 0) {
+            ktimer_reprogram();
+            arch_idle();
+        }
+        arch_irq_restore(flags);
+
+        //bring the tick back before running whatever woke us
+        ktimer_reprogram();
         sched_yield();
     }
 }
@@ -93,8 +119,13 @@ void sched_init(void) {
     dead_list_head = NULL;
     percpu_t *pc = percpu_get();
     pc->tick_count = 0;
-    pc->run_queue_head = NULL;
-    pc->run_queue_tail = NULL;
+    for (int i = 0; i < SCHED_PRIO_LEVELS; i++) {
+        pc->run_queue_head[i] = NULL;
+        pc->run_queue_tail[i] = NULL;
+    }
+    pc->run_queue_bitmap = 0;
+    pc->run_queue_count = 0;
+    pc->steal_count = 0;
     pc->idle_thread = NULL;
     pc->prev_thread = NULL;
     pc->sched_running = 0;
@@ -113,8 +144,13 @@ void sched_init(void) {
 void sched_init_ap(void) {
     percpu_t *pc = percpu_get();
     pc->tick_count = 0;
-    pc->run_queue_head = NULL;
-    pc->run_queue_tail = NULL;
+    for (int i = 0; i < SCHED_PRIO_LEVELS; i++) {
+        pc->run_queue_head[i] = NULL;
+        pc->run_queue_tail[i] = NULL;
+    }
+    pc->run_queue_bitmap = 0;
+    pc->run_queue_count = 0;
+    pc->steal_count = 0;
     pc->idle_thread = NULL;
     pc->prev_thread = NULL;
     pc->sched_running = 0;
@@ -130,8 +166,143 @@ void sched_init_ap(void) {
     pc->idle_thread->state = THREAD_STATE_READY;
 }
 
+//O(1) run queue primitives - caller holds pc->sched_lock
+static inline void rq_enqueue(percpu_t *pc, thread_t *thread) {
+    uint32 prio = thread->priority;
+    if (prio > SCHED_PRIO_LOWEST) prio = SCHED_PRIO_LOWEST;
+    thread->priority = (uint8)prio;
+
+    thread->sched_next = NULL;
+    thread->sched_prev = pc->run_queue_tail[prio];
+    if (thread->sched_prev) {
+        thread->sched_prev->sched_next = thread;
+    } else {
+        pc->run_queue_head[prio] = thread;
+    }
+    pc->run_queue_tail[prio] = thread;
+    thread->rq_cpu = (int)pc->cpu_index;
+
+    pc->run_queue_bitmap |= 1u << prio;
+    pc->run_queue_count++;
+}
+
+//queue at the head of its level so it is the next pick at that priority
+static inline void rq_enqueue_front(percpu_t *pc, thread_t *thread) {
+    uint32 prio = thread->priority;
+    if (prio > SCHED_PRIO_LOWEST) prio = SCHED_PRIO_LOWEST;
+    thread->priority = (uint8)prio;
+
+    thread->sched_prev = NULL;
+    thread->sched_next = pc->run_queue_head[prio];
+    if (thread->sched_next) {
+        thread->sched_next->sched_prev = thread;
+    } else {
+        pc->run_queue_tail[prio] = thread;
+    }
+    pc->run_queue_head[prio] = thread;
+    thread->rq_cpu = (int)pc->cpu_index;
+
+    pc->run_queue_bitmap |= 1u << prio;
+    pc->run_queue_count++;
+}
+
+static inline void rq_dequeue(percpu_t *pc, thread_t *thread) {
+    uint32 prio = thread->priority;
+
+    if (thread->sched_prev) {
+        thread->sched_prev->sched_next = thread->sched_next;
+    } else {
+        pc->run_queue_head[prio] = thread->sched_next;
+    }
+    if (thread->sched_next) {
+        thread->sched_next->sched_prev = thread->sched_prev;
+    } else {
+        pc->run_queue_tail[prio] = thread->sched_prev;
+    }
+    thread->sched_next = NULL;
+    thread->sched_prev = NULL;
+    thread->rq_cpu = -1;
+
+    if (!pc->run_queue_head[prio]) {
+        pc->run_queue_bitmap &= ~(1u << prio);
+    }
+    pc->run_queue_count--;
+}
+
+//highest priority queued thread or NULL
+static inline thread_t *rq_peek(percpu_t *pc) {
+    if (!pc->run_queue_bitmap) return NULL;
+    return pc->run_queue_head[__builtin_ctz(pc->run_queue_bitmap)];
+}
+
+//next thread this CPU would run if it rescheduled now
+static inline thread_t *sched_peek(percpu_t *pc) {
+    thread_t *next = rq_peek(pc);
+    return next ? next : pc->idle_thread;
+}
+
+//once we are running on the new thread the previous context switch on this
+//CPU has completed so the outgoing thread may now run (or be stolen) elsewhere
+static inline void sched_release_prev(percpu_t *pc) {
+    if (!pc->prev_thread) return;
+
+    thread_t *prev = (thread_t *)pc->prev_thread;
+    irq_state_t prev_flags = spinlock_irq_acquire(&prev->lock);
+    if (prev->cpu_id == (int)pc->cpu_index) {
+        prev->cpu_id = -1;
+    }
+    spinlock_irq_release(&prev->lock, prev_flags);
+    pc->prev_thread = NULL;
+}
+
+//runnable work on a CPU: queued threads plus whatever it is running now
+static uint32 sched_cpu_load(percpu_t *pc) {
+    uint32 load = pc->run_queue_count;
+    thread_t *cur = (thread_t *)pc->current_thread;
+    if (cur && cur != pc->idle_thread) load++;
+    return load;
+}
+
+//send a reschedule IPI to one idle sibling so it comes looking for work
+static void sched_kick_idle(percpu_t *busy) {
+    uint32 cpu_count = percpu_cpu_count();
+    uint32 self = percpu_get()->cpu_index;
+
+    for (uint32 i = 0; i < cpu_count; i++) {
+        percpu_t *pc = percpu_get_by_index(i);
+        if (!pc || pc == busy || i == self || !pc->started || !pc->sched_running) continue;
+        if (sched_cpu_load(pc) == 0) {
+            arch_smp_send_resched(i);
+            return;
+        }
+    }
+}
+
+//rotating scan origin so ties between equally loaded CPUs are spread out
 static uint32 last_cpu = 0;
 
+static uint32 sched_pick_cpu(void) {
+    uint32 cpu_count = percpu_cpu_count();
+    uint32 origin = __sync_fetch_and_add(&last_cpu, 1) % cpu_count;
+    uint32 best = percpu_get()->cpu_index;
+    uint32 best_load = (uint32)-1;
+
+    for (uint32 i = 0; i < cpu_count; i++) {
+        uint32 idx = (origin + i) % cpu_count;
+        percpu_t *pc = percpu_get_by_index(idx);
+        if (!pc || !pc->started) continue;
+
+        uint32 load = sched_cpu_load(pc);
+        if (load < best_load) {
+            best = idx;
+            best_load = load;
+            if (load == 0) break;
+        }
+    }
+
+    return best;
+}
+
 void sched_add_cpu(thread_t *thread, uint32 cpu_index) {
     if (!thread) return;
 
@@ -142,15 +313,10 @@ void sched_add_cpu(thread_t *thread, uint32 cpu_index) {
 
     irq_state_t flags = spinlock_irq_acquire(&pc->sched_lock);
 
-    thread->sched_next = NULL;
-
-    if (!pc->run_queue_tail) {
-        pc->run_queue_head = thread;
-        pc->run_queue_tail = thread;
-    } else {
-        pc->run_queue_tail->sched_next = thread;
-        pc->run_queue_tail = thread;
-    }
+    //threads entering from outside the scheduler (new or just woken) get their
+    //base priority back so interactive work runs ahead of CPU-bound work
+    thread->priority = thread->base_priority;
+    rq_enqueue(pc, thread);
 
     thread->state = THREAD_STATE_READY;
 
@@ -160,50 +326,117 @@ void sched_add_cpu(thread_t *thread, uint32 cpu_index) {
     if (pc != percpu_get()) {
         arch_smp_send_resched(pc->cpu_index);
     }
+
+    //idle CPUs no longer tick so wake one to steal the backlog
+    if (sched_cpu_load(pc) > 1) {
+        sched_kick_idle(pc);
+    }
+}
+
+void sched_add_handoff(thread_t *thread, uint32 fallback_cpu) {
+    if (!thread) return;
+
+    percpu_t *pc = percpu_get();
+    if (thread == pc->idle_thread) return;
+
+    //a thread still switching out on another CPU must not be picked here until
+    //that switch completes, so let it wake where it blocked instead
+    int on_cpu = thread->cpu_id;
+    if (on_cpu >= 0 && on_cpu != (int)pc->cpu_index) {
+        sched_add_cpu(thread, fallback_cpu);
+        return;
+    }
+
+    irq_state_t flags = spinlock_irq_acquire(&pc->sched_lock);
+    thread->priority = thread->base_priority;
+    rq_enqueue_front(pc, thread);
+    thread->state = THREAD_STATE_READY;
+    spinlock_irq_release(&pc->sched_lock, flags);
 }
 
 void sched_add(thread_t *thread) {
     if (!thread) return;
 
-    //simple load balancing: round-robin for new threads
-    uint32 cpu_count = percpu_cpu_count();
-    uint32 target_idx = (__sync_fetch_and_add(&last_cpu, 1)) % cpu_count;
-    sched_add_cpu(thread, target_idx);
+    //place new threads on the least loaded CPU
+    sched_add_cpu(thread, sched_pick_cpu());
 }
 
 void sched_remove(thread_t *thread) {
     if (!thread) return;
-    percpu_t *pc = percpu_get();
-    if (thread == pc->idle_thread) return;  //idle never in queue
-    
-    irq_state_t flags = spinlock_irq_acquire(&pc->sched_lock);
-    
-    thread_t **tp = &pc->run_queue_head;
-    while (*tp) {
-        if (*tp == thread) {
-            *tp = thread->sched_next;
-            if (pc->run_queue_tail == thread) {
-                //find new tail
-                thread_t *t = pc->run_queue_head;
-                while (t && t->sched_next) t = t->sched_next;
-                pc->run_queue_tail = t;
-            }
-            thread->sched_next = NULL;
-            break;
+
+    //a sibling may steal the thread while we wait for the lock so
+    //re-check ownership once the owning CPU's lock is held
+    for (;;) {
+        int cpu = thread->rq_cpu;
+        if (cpu < 0) return;
+
+        percpu_t *pc = percpu_get_by_index((uint32)cpu);
+        if (!pc || thread == pc->idle_thread) return;  //idle never in queue
+
+        irq_state_t flags = spinlock_irq_acquire(&pc->sched_lock);
+        if (thread->rq_cpu == cpu) {
+            rq_dequeue(pc, thread);
+            spinlock_irq_release(&pc->sched_lock, flags);
+            return;
         }
-        tp = &(*tp)->sched_next;
+        spinlock_irq_release(&pc->sched_lock, flags);
     }
-    
-    spinlock_irq_release(&pc->sched_lock, flags);
+}
+
+//take one stealable thread off a victim CPU (victim sched_lock held)
+//threads still marked as on a CPU may be mid context switch so they stay put
+static thread_t *rq_steal_one(percpu_t *victim) {
+    uint32 bitmap = victim->run_queue_bitmap;
+    while (bitmap) {
+        uint32 prio = __builtin_ctz(bitmap);
+        bitmap &= bitmap - 1;
+
+        //take from the tail since the head is what the victim runs next
+        for (thread_t *t = victim->run_queue_tail[prio]; t; t = t->sched_prev) {
+            if (t->cpu_id != -1) continue;
+            if (t->process && t->process->state == PROC_STATE_DEAD) continue;
+            rq_dequeue(victim, t);
+            return t;
+        }
+    }
+    return NULL;
+}
+
+bool sched_steal(void) {
+    percpu_t *self = percpu_get();
+    if (!self->sched_running) return false;
+
+    uint32 cpu_count = percpu_cpu_count();
+    percpu_t *victim = NULL;
+    uint32 victim_load = 0;
+
+    //pick the sibling with the most queued work
+    for (uint32 i = 0; i < cpu_count; i++) {
+        percpu_t *pc = percpu_get_by_index(i);
+        if (!pc || pc == self || !pc->started || !pc->sched_running) continue;
+        if (pc->run_queue_count > victim_load) {
+            victim = pc;
+            victim_load = pc->run_queue_count;
+        }
+    }
+    if (!victim) return false;
+
+    irq_state_t flags = spinlock_irq_acquire(&victim->sched_lock);
+    thread_t *stolen = rq_steal_one(victim);
+    spinlock_irq_release(&victim->sched_lock, flags);
+    if (!stolen) return false;
+
+    //the two run queue locks are never held together so there is no lock order
+    flags = spinlock_irq_acquire(&self->sched_lock);
+    rq_enqueue(self, stolen);
+    self->steal_count++;
+    spinlock_irq_release(&self->sched_lock, flags);
+    return true;
 }
 
 //pick next thread - returns idle thread if no other threads
 static thread_t *pick_next(void) {
-    percpu_t *pc = percpu_get();
-    if (pc->run_queue_head) {
-        return pc->run_queue_head;
-    }
-    return pc->idle_thread;
+    return sched_peek(percpu_get());
 }
 
 //activate a thread (switch address space, stack and shit)
@@ -222,6 +455,7 @@ static void sched_activate(thread_t *next) {
     //set kernel stack for ring 3 -> ring 0 transitions
     void *kernel_stack_top = (char *)next->kernel_stack + next->kernel_stack_size;
     arch_set_kernel_stack(kernel_stack_top);
+    arch_set_tls_base(next->tls_base);
 
     //use TS to defer FP state work until the thread actually executes FP code
     arch_fpu_activate_thread(next);
@@ -238,16 +472,9 @@ static inline void sched_requeue_or_dead(percpu_t *pc, thread_t *current) {
     }
 
     //normal preemption path puts the still-runnable current thread at the tail
-    //of this CPU run queue
+    //of its priority level on this CPU
     current->state = THREAD_STATE_READY;
-    current->sched_next = NULL;
-    if (!pc->run_queue_tail) {
-        pc->run_queue_head = current;
-        pc->run_queue_tail = current;
-    } else {
-        pc->run_queue_tail->sched_next = current;
-        pc->run_queue_tail = current;
-    }
+    rq_enqueue(pc, current);
 }
 
 static inline thread_t *sched_drain_dead_head(percpu_t *pc, thread_t *next) {
@@ -255,36 +482,17 @@ static inline thread_t *sched_drain_dead_head(percpu_t *pc, thread_t *next) {
     //sibling exits so drain them before selecting a runnable next thread
     while (next != pc->idle_thread && next && next->process &&
            next->process->state == PROC_STATE_DEAD) {
-        pc->run_queue_head = next->sched_next;
-        if (!pc->run_queue_head) {
-            pc->run_queue_tail = NULL;
-        }
-        next->sched_next = NULL;
+        rq_dequeue(pc, next);
         sched_queue_dead(next);
-        next = pc->run_queue_head ? pc->run_queue_head : pc->idle_thread;
+        next = sched_peek(pc);
     }
     return next;
 }
 
 static inline void sched_dequeue_thread(percpu_t *pc, thread_t *next) {
     if (!next || next == pc->idle_thread) return;
-
-    //unlink the chosen thread from the run queue and recompute the tail if the
-    //selected entry was the last one
-    thread_t **tp = &pc->run_queue_head;
-    while (*tp) {
-        if (*tp == next) {
-            *tp = next->sched_next;
-            if (pc->run_queue_tail == next) {
-                thread_t *t = pc->run_queue_head;
-                while (t && t->sched_next) t = t->sched_next;
-                pc->run_queue_tail = t;
-            }
-            next->sched_next = NULL;
-            break;
-        }
-        tp = &(*tp)->sched_next;
-    }
+    if (next->rq_cpu != (int)pc->cpu_index) return;
+    rq_dequeue(pc, next);
 }
 
 //pick next thread and switch to it
@@ -298,19 +506,11 @@ static void schedule(void) {
     //SAFE POINT: We just entered schedule. If there was a prev_thread,
     //it means the PREVIOUS context switch COMPLETED and we are now running
     //the current thread. So the prev_thread is no longer using this CPU.
-    if (pc->prev_thread) {
-        thread_t *prev = (thread_t *)pc->prev_thread;
-        irq_state_t prev_flags = spinlock_irq_acquire(&prev->lock);
-        if (prev->cpu_id == (int)pc->cpu_index) {
-            prev->cpu_id = -1;
-        }
-        spinlock_irq_release(&prev->lock, prev_flags);
-        pc->prev_thread = NULL;
-    }
+    sched_release_prev(pc);
 
     irq_state_t flags = spinlock_irq_acquire(&pc->sched_lock);
     
-    thread_t *next = pc->run_queue_head ? pc->run_queue_head : pc->idle_thread;
+    thread_t *next = sched_peek(pc);
     
     if (!next || (next == current && current->state == THREAD_STATE_RUNNING)) {
         spinlock_irq_release(&pc->sched_lock, flags);
@@ -319,7 +519,7 @@ static void schedule(void) {
 
     //if current is runnable, move it back to run queue unless its process exited
     sched_requeue_or_dead(pc, current);
-    next = pc->run_queue_head ? pc->run_queue_head : pc->idle_thread;
+    next = sched_peek(pc);
 
     //drop any queued threads whose process is already dead
     //the scheduler may see them before wait/reap has cleaned them up
@@ -383,10 +583,14 @@ void sched_exit(void) {
 //only updates scheduler state no context switch
 void sched_preempt(void) {
     percpu_t *pc = percpu_get();
+
+    //we are in an ISR on top of the current thread so the last switch is done
+    sched_release_prev(pc);
+
     irq_state_t flags = spinlock_irq_acquire(&pc->sched_lock);
     
     thread_t *current = thread_current();
-    thread_t *next = pc->run_queue_head ? pc->run_queue_head : pc->idle_thread;
+    thread_t *next = sched_peek(pc);
     
     if (!next || next == current) {
         spinlock_irq_release(&pc->sched_lock, flags);
@@ -394,7 +598,7 @@ void sched_preempt(void) {
     }
 
     sched_requeue_or_dead(pc, current);
-    next = pc->run_queue_head ? pc->run_queue_head : pc->idle_thread;
+    next = sched_peek(pc);
 
     //skip stale runnable entries from processes already marked dead
     //preemption only updates scheduler state, so cleanup is deferred
@@ -412,6 +616,33 @@ void sched_preempt(void) {
     spinlock_irq_release(&pc->sched_lock, flags);
 }
 
+//threads that keep using whole slices sink to the lowest level and only get
+//lifted again when they block, so a CPU-bound thread could wait forever behind
+//newer ones. once per boost period everything on this CPU starts over at its
+//base level, including the running thread
+static void sched_boost(percpu_t *pc) {
+    irq_state_t flags = spinlock_irq_acquire(&pc->sched_lock);
+    //levels are walked top down so a lifted thread is never visited twice
+    for (uint32 prio = SCHED_PRIO_HIGHEST + 1; prio < SCHED_PRIO_LEVELS; prio++) {
+        thread_t *t = pc->run_queue_head[prio];
+        while (t) {
+            thread_t *next = t->sched_next;
+            if (t->priority > t->base_priority) {
+                rq_dequeue(pc, t);
+                t->priority = t->base_priority;
+                rq_enqueue(pc, t);
+            }
+            t = next;
+        }
+    }
+    thread_t *current = thread_current();
+    if (current && current != pc->idle_thread && current->rq_cpu == -1 &&
+        current->priority > current->base_priority) {
+        current->priority = current->base_priority;
+    }
+    spinlock_irq_release(&pc->sched_lock, flags);
+}
+
 void sched_tick(int from_usermode) {
     percpu_t *pc = percpu_get();
     
@@ -423,9 +654,23 @@ void sched_tick(int from_usermode) {
         sched_reap();
     }
     
+    if (++pc->boost_ticks >= SCHED_BOOST_TICKS) {
+        pc->boost_ticks = 0;
+        sched_boost(pc);
+    }
+
     pc->tick_count++;
     if (from_usermode && pc->tick_count >= time_slice) {
         pc->tick_count = 0;
+
+        //a thread that used its whole slice sinks one level so threads that
+        //block early (interactive, I/O bound) keep running ahead of it
+        thread_t *current = thread_current();
+        if (current && current != pc->idle_thread && current->rq_cpu == -1 &&
+            current->priority < SCHED_PRIO_LOWEST) {
+            current->priority++;
+        }
+
         //preempt usermode threads when their slice is over
         sched_preempt();  //ISR-safe: only updates current_thread and sched state
     }
@@ -467,6 +712,7 @@ void sched_start(void) {
     //set kernel stack for ring 3 -> ring 0 transitions
     void *kernel_stack_top = (char *)first->kernel_stack + first->kernel_stack_size;
     arch_set_kernel_stack(kernel_stack_top);
+    arch_set_tls_base(first->tls_base);
 
     //defer FP state work until the thread actually needs it
     arch_fpu_activate_thread(first);
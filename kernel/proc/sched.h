@@ -2,6 +2,14 @@
 #define PROC_SCHED_H
 
 #include <proc/thread.h>
+#include <arch/percpu.h>
+
+//priority levels: new and freshly woken threads start at their base level and
+//threads that burn a whole time slice sink one level per slice, every CPU
+//lifts all of its threads back to their base level periodically
+#define SCHED_PRIO_HIGHEST  0
+#define SCHED_PRIO_DEFAULT  2
+#define SCHED_PRIO_LOWEST   (SCHED_PRIO_LEVELS - 1)
 
 //initialize scheduler
 void sched_init(void);
@@ -9,13 +17,22 @@ void sched_init(void);
 //initialize scheduler for an AP
 void sched_init_ap(void);
 
-//add thread to run queue
+//add thread to the least loaded CPU's run queue
 void sched_add(thread_t *thread);
 void sched_add_cpu(thread_t *thread, uint32 cpu_index);
 
+//direct handoff: queue thread on this CPU ahead of its priority peers so it
+//runs as soon as the caller blocks (synchronous IPC). no IPI is sent
+//falls back to fallback_cpu while thread is still switching out elsewhere
+void sched_add_handoff(thread_t *thread, uint32 fallback_cpu);
+
 //remove thread from run queue
 void sched_remove(thread_t *thread);
 
+//pull a runnable thread from the busiest sibling CPU onto this one
+//returns true if a thread was stolen
+bool sched_steal(void);
+
 //yield current thread (cooperative)
 void sched_yield(void);
 
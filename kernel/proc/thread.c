@@ -58,6 +58,9 @@ thread_t *thread_create(process_t *proc, void (*entry)(void *), void *arg) {
     thread->state = THREAD_STATE_READY;
     thread->cpu_id = -1;
     thread->wait_cpu = -1;
+    thread->rq_cpu = -1;
+    thread->priority = SCHED_PRIO_DEFAULT;
+    thread->base_priority = SCHED_PRIO_DEFAULT;
     spinlock_irq_init(&thread->lock);
     
     //create kernel object for this thread
@@ -99,6 +102,13 @@ void thread_destroy(thread_t *thread) {
     if (!thread) return;
     
     process_t *proc = thread->process;
+
+    //joiners only trust data while the thread is still on its process list,
+    //so it is cleared before the thread leaves the list
+    if (thread->obj) {
+        object_signal(thread->obj, 0, OBJECT_SIGNAL_EXITED);
+        thread->obj->data = NULL;  //clear back-pointer
+    }
     
     //remove from process thread list
     if (proc) {
@@ -116,10 +126,7 @@ void thread_destroy(thread_t *thread) {
     }
     
     //free the thread object
-    if (thread->obj) {
-        thread->obj->data = NULL;  //clear back-pointer
-        object_deref(thread->obj);
-    }
+    if (thread->obj) object_deref(thread->obj);
     
     kfree(thread->kernel_stack);
     kfree(thread);
@@ -137,6 +144,7 @@ void thread_destroy(thread_t *thread) {
         if (!last_thread) return;
 
         thread_wake_all(&proc->exit_wait);
+        object_signal(proc->obj, 0, OBJECT_SIGNAL_EXITED);
         process_t *parent = process_find_ref(proc->parent_pid);
         if (parent) {
             proc_post_event(parent, PROC_EVENT_CHILD);
@@ -173,7 +181,7 @@ static void user_thread_trampoline(void *thread_ptr) {
     thread_exit();
 }
 
-thread_t *thread_create_user(process_t *proc, void *entry, void *user_stack) {
+thread_t *thread_create_user(process_t *proc, void *entry, void *user_stack, void *arg) {
     if (!proc) return NULL;
     
     thread_t *thread = kzalloc(sizeof(thread_t));
@@ -186,6 +194,9 @@ thread_t *thread_create_user(process_t *proc, void *entry, void *user_stack) {
     thread->state = THREAD_STATE_READY;
     thread->cpu_id = -1;
     thread->wait_cpu = -1;
+    thread->rq_cpu = -1;
+    thread->priority = SCHED_PRIO_DEFAULT;
+    thread->base_priority = SCHED_PRIO_DEFAULT;
     spinlock_irq_init(&thread->lock);
     
     //create kernel object for this thread
@@ -210,7 +221,7 @@ thread_t *thread_create_user(process_t *proc, void *entry, void *user_stack) {
     arch_fpu_init_thread(&thread->fpu_state);
     
     //setup usermode state in user_context
-    arch_context_init_user(&thread->user_context, user_stack, entry, NULL);
+    arch_context_init_user(&thread->user_context, user_stack, entry, arg);
     
     //setup initial KERNEL context to run the trampoline
     void *stack_top = (char *)thread->kernel_stack + KERNEL_STACK_SIZE;
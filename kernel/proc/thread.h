@@ -76,12 +76,19 @@ typedef struct thread {
     //linked list within process
     struct thread *next;
     
-    //scheduler queue link
+    //scheduler queue links (sched_next doubles as the dead list link)
     struct thread *sched_next;
+    struct thread *sched_prev;
+    int rq_cpu;             //CPU whose run queue holds this thread (-1 if not queued)
+    uint8 priority;         //effective run queue level (0 = highest)
+    uint8 base_priority;    //level restored whenever the thread wakes up
     
     //wait queue link (for blocking)
     struct thread *wait_next;
     struct wait_queue *blocked_on;
+
+    //userspace thread pointer loaded into the arch TLS register on switch
+    uintptr tls_base;
 } thread_t;
 
 //create a thread in a process
@@ -94,7 +101,8 @@ void thread_destroy(thread_t *thread);
 object_t *thread_get_object(thread_t *thread);
 
 //create a usermode thread (entry/stack are in user address space)
-thread_t *thread_create_user(struct process *proc, void *entry, void *user_stack);
+//arg is passed as the first argument to entry
+thread_t *thread_create_user(struct process *proc, void *entry, void *user_stack, void *arg);
 
 //exit current thread (never returns)
 void thread_exit(void);
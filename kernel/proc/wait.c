@@ -2,6 +2,9 @@
 #include <proc/process.h>
 #include <proc/thread.h>
 #include <proc/sched.h>
+#include <proc/ktimer.h>
+#include <proc/event.h>
+#include <errno.h>
 #include <arch/interrupts.h>
 #include <arch/cpu.h>
 #include <arch/percpu.h>
@@ -49,7 +52,7 @@ void thread_sleep(wait_queue_t *wq) {
     current->blocked_on = NULL;
 }
 
-void thread_wake_one(wait_queue_t *wq) {
+static void wait_wake_one(wait_queue_t *wq, bool handoff) {
     irq_state_t flags = spinlock_irq_acquire(&wq->lock);
 
     thread_t *thread = wq->head;
@@ -71,13 +74,25 @@ void thread_wake_one(wait_queue_t *wq) {
             uint32 target_cpu = (thread->wait_cpu >= 0) ? (uint32)thread->wait_cpu
                                                         : percpu_get()->cpu_index;
             thread->wait_cpu = -1;
-            sched_add_cpu(thread, target_cpu);
+            if (handoff) {
+                sched_add_handoff(thread, target_cpu);
+            } else {
+                sched_add_cpu(thread, target_cpu);
+            }
         }
     }
 
     spinlock_irq_release(&wq->lock, flags);
 }
 
+void thread_wake_one(wait_queue_t *wq) {
+    wait_wake_one(wq, false);
+}
+
+void thread_wake_one_handoff(wait_queue_t *wq) {
+    wait_wake_one(wq, true);
+}
+
 void thread_wake_all(wait_queue_t *wq) {
     irq_state_t flags = spinlock_irq_acquire(&wq->lock);
 
@@ -228,3 +243,141 @@ void thread_wake_thread(thread_t *thread) {
     }
     spinlock_irq_release(&wq->lock, wq_flags);
 }
+
+//timeout state for one timed sleep, lives on the sleeping thread's stack
+typedef struct {
+    ktimer_t timer;
+    thread_t *thread;
+    volatile bool expired;
+    bool unarmed;           //no timer slot, the wait is rejected
+} wait_timeout_t;
+
+static void wait_timeout_fire(ktimer_t *timer, void *arg) {
+    (void)timer;
+    wait_timeout_t *wt = arg;
+    wt->expired = true;
+    thread_wake_thread(wt->thread);
+}
+
+//caller holds wq->lock
+static void wait_enqueue(wait_queue_t *wq, thread_t *current) {
+    current->state = THREAD_STATE_BLOCKED;
+    current->wait_cpu = (int)percpu_get()->cpu_index;
+    current->blocked_on = wq;
+    current->wait_next = NULL;
+    if (wq->tail) {
+        wq->tail->wait_next = current;
+    } else {
+        wq->head = current;
+    }
+    wq->tail = current;
+}
+
+//arm only once the thread is queued so an early expiry still finds it blocked
+static void wait_timeout_start(wait_timeout_t *wt, thread_t *current, uint64 deadline_ns) {
+    wt->thread = current;
+    wt->expired = false;
+    wt->unarmed = false;
+    ktimer_init(&wt->timer, wait_timeout_fire, wt);
+    if (ktimer_arm(&wt->timer, deadline_ns) != 0) {
+        //nothing would ever wake us: unlink ourselves and fail the wait
+        wt->unarmed = true;
+        thread_wake_thread(current);
+    }
+}
+
+//cancel also waits out a callback still running on another CPU so the
+//stack-resident timer is dead once this returns
+static int wait_timeout_finish(wait_timeout_t *wt, uint64 deadline_ns) {
+    ktimer_cancel(&wt->timer);
+    if (wt->unarmed) return -ENOMEM;
+    return (wt->expired || ktimer_now() >= deadline_ns) ? -1 : 0;
+}
+
+static void wait_block(thread_t *current) {
+    while (current->state == THREAD_STATE_BLOCKED) {
+        sched_yield();
+    }
+}
+
+static void wait_resume(thread_t *current) {
+    sched_remove(current);
+    current->state = THREAD_STATE_RUNNING;
+    current->blocked_on = NULL;
+}
+
+int thread_sleep_until(wait_queue_t *wq, uint64 deadline_ns) {
+    thread_t *current = thread_current();
+    if (!current) return -1;
+    if (ktimer_now() >= deadline_ns) return -1;
+
+    wait_timeout_t wt;
+    irq_state_t flags = spinlock_irq_acquire(&wq->lock);
+    wait_enqueue(wq, current);
+    spinlock_irq_release(&wq->lock, flags);
+
+    wait_timeout_start(&wt, current, deadline_ns);
+    wait_block(current);
+    wait_resume(current);
+    return wait_timeout_finish(&wt, deadline_ns);
+}
+
+int thread_sleep_locked_until(wait_queue_t *wq, spinlock_t *lock, uint64 deadline_ns) {
+    thread_t *current = thread_current();
+    if (!current) return -1;
+    if (ktimer_now() >= deadline_ns) return -1;
+
+    wait_timeout_t wt;
+    irq_state_t flags = spinlock_irq_acquire(&wq->lock);
+    wait_enqueue(wq, current);
+    spinlock_irq_release(&wq->lock, flags);
+    spinlock_release(lock);
+
+    wait_timeout_start(&wt, current, deadline_ns);
+    wait_block(current);
+    wait_resume(current);
+    int ret = wait_timeout_finish(&wt, deadline_ns);
+
+    spinlock_acquire(lock);
+    return ret;
+}
+
+int thread_sleep_locked_irq_until(wait_queue_t *wq, spinlock_irq_t *lock, irq_state_t *flags,
+                                  uint64 deadline_ns) {
+    thread_t *current = thread_current();
+    if (!current || !flags) return -1;
+    if (ktimer_now() >= deadline_ns) return -1;
+
+    wait_timeout_t wt;
+    irq_state_t wq_flags = spinlock_irq_acquire(&wq->lock);
+    wait_enqueue(wq, current);
+    spinlock_irq_release(&wq->lock, wq_flags);
+
+    spinlock_release(&lock->lock);
+    arch_irq_restore(*flags);
+
+    wait_timeout_start(&wt, current, deadline_ns);
+    wait_block(current);
+    wait_resume(current);
+    int ret = wait_timeout_finish(&wt, deadline_ns);
+
+    *flags = spinlock_irq_acquire(lock);
+    return ret;
+}
+
+int thread_sleep_ns(uint64 ns) {
+    if (ns == 0) return 0;
+
+    //nobody else ever sees this queue, so an early wakeup is a process
+    //event (kill, interrupt) posted through thread_wake_thread
+    wait_queue_t wq;
+    wait_queue_init(&wq);
+    uint64 now = ktimer_now();
+    uint64 deadline = ns > UINT64_MAX - now ? UINT64_MAX : now + ns;
+    for (;;) {
+        if (proc_current_should_abort_blocking()) return -EINTR;
+        int rc = thread_sleep_until(&wq, deadline);
+        if (rc == -ENOMEM) return rc;
+        if (rc != 0) return 0;
+    }
+}
@@ -24,6 +24,10 @@ void thread_sleep(wait_queue_t *wq);
 //removes from wait queue, adds to run queue
 void thread_wake_one(wait_queue_t *wq);
 
+//wake one thread onto this CPU to run next, for a waker that is about to block
+//(request/reply IPC) so the CPU passes straight to the woken thread
+void thread_wake_one_handoff(wait_queue_t *wq);
+
 //wake all threads from wait queue
 void thread_wake_all(wait_queue_t *wq);
 
@@ -36,4 +40,19 @@ void thread_sleep_locked_irq(wait_queue_t *wq, spinlock_irq_t *lock, irq_state_t
 
 void thread_wake_thread(struct thread *thread);
 
+//timed variants take an absolute deadline in ktimer_now() nanoseconds
+//they return 0 when woken (possibly spuriously), -1 once the deadline passed and
+//-ENOMEM without sleeping if no timer could be armed for the deadline
+//callers re-check their condition either way, exactly like the untimed sleeps
+int thread_sleep_until(wait_queue_t *wq, uint64 deadline_ns);
+int thread_sleep_locked_until(wait_queue_t *wq, spinlock_t *lock, uint64 deadline_ns);
+int thread_sleep_locked_irq_until(wait_queue_t *wq, spinlock_irq_t *lock, irq_state_t *flags,
+                                  uint64 deadline_ns);
+
+//block the current thread for at least ns nanoseconds without using the CPU
+//returns 0 once the time is up, -EINTR if the process was told to stop
+//or interrupted, or -ENOMEM if no timer could be armed
+//deadlines past the end of the clock sleep until then
+int thread_sleep_ns(uint64 ns);
+
 #endif
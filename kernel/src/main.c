@@ -228,7 +228,7 @@ static int spawn_init(void) {
     }
     printf("[init] stack at 0x%lX, argc=1, argv[0]=%s\n", user_stack_top, init_argv[0]);
 
-    thread_t *thread = thread_create_user(proc, (void*)real_entry, (void*)user_stack_top);
+    thread_t *thread = thread_create_user(proc, (void*)real_entry, (void*)user_stack_top, NULL);
     if (!thread) {
         printf("[init] failed to create thread\n");
         process_destroy(proc);
@@ -2,6 +2,8 @@
 #include <obj/handle.h>
 #include <obj/namespace.h>
 #include <proc/process.h>
+#include <proc/ktimer.h>
+#include <errno.h>
 
 intptr sys_get_obj(handle_t parent, const char *path, handle_rights_t rights) {
     if (!path) return -1;
@@ -67,3 +69,49 @@ intptr sys_ns_register(const char *path, handle_t h, handle_rights_t max_rights)
     
     return (intptr)ns_register(k_path, obj, max_rights);
 }
+
+intptr sys_object_wait_many(object_wait_item_t *items, uint32 count, uint64 timeout_ns) {
+    if (!items || count == 0 || count > OBJECT_WAIT_MANY_MAX) return -EINVAL;
+
+    process_t *proc = process_current();
+    if (!proc) return -1;
+
+    object_wait_item_t k_items[OBJECT_WAIT_MANY_MAX];
+    if (copy_user_bytes(items, k_items, count * sizeof(object_wait_item_t)) != 0) return -EFAULT;
+
+    //hold a ref on every object so a concurrent handle close cannot free it mid-wait
+    //watching an object needs the read right, the same as receiving from it
+    object_t *objs[OBJECT_WAIT_MANY_MAX];
+    uint32 masks[OBJECT_WAIT_MANY_MAX];
+    uint32 pending[OBJECT_WAIT_MANY_MAX];
+    for (uint32 i = 0; i < count; i++) {
+        proc_handle_t *entry = process_get_handle_entry(proc, k_items[i].handle);
+        int err = !entry ? -EBADF : !rights_has(entry->rights, HANDLE_RIGHT_READ) ? -EPERM : 0;
+        if (err) {
+            for (uint32 j = 0; j < i; j++) object_deref(objs[j]);
+            return err;
+        }
+        object_t *obj = entry->obj;
+        object_ref(obj);
+        objs[i] = obj;
+        masks[i] = k_items[i].waitfor & OBJECT_SIGNAL_ALL;
+    }
+
+    uint64 deadline = OBJECT_WAIT_FOREVER;
+    if (timeout_ns != OBJECT_WAIT_FOREVER) {
+        uint64 now = ktimer_now();
+        deadline = (timeout_ns > OBJECT_WAIT_FOREVER - now) ? OBJECT_WAIT_FOREVER - 1 : now + timeout_ns;
+    }
+
+    int ret = object_wait_many(objs, masks, pending, count, deadline);
+
+    for (uint32 i = 0; i < count; i++) {
+        k_items[i].pending = pending[i];
+        object_deref(objs[i]);
+    }
+    if (ret < 0 && ret != -ETIMEDOUT) return ret;
+
+    //pending is meaningful on timeout too (all zero in the masked bits)
+    if (copy_to_user_bytes(items, k_items, count * sizeof(object_wait_item_t)) != 0) return -EFAULT;
+    return ret;
+}
@@ -1,8 +1,11 @@
 #include <syscall/syscall.h>
 #include <ipc/channel.h>
+#include <ipc/futex.h>
+#include <proc/ktimer.h>
 #include <proc/process.h>
 #include <mm/kheap.h>
 #include <lib/string.h>
+#include <errno.h>
 
 intptr sys_channel_create(int32 *ep0_out, int32 *ep1_out) {
     if (!ep0_out || !ep1_out) return -1;
@@ -13,7 +16,43 @@ intptr sys_channel_create(int32 *ep0_out, int32 *ep1_out) {
     return channel_create(proc, HANDLE_RIGHTS_DEFAULT, ep0_out, ep1_out);
 }
 
-intptr sys_channel_send(handle_t ep, const void *data, size len) {
+intptr sys_channel_create_ring(int32 *ep0_out, int32 *ep1_out, int32 *vmo_out, uint32 ring_size) {
+    if (!ep0_out || !ep1_out || !vmo_out) return -EINVAL;
+
+    process_t *proc = process_current();
+    if (!proc) return -1;
+
+    int32 out[3];
+    int rc = channel_create_ring(proc, HANDLE_RIGHTS_DEFAULT, ring_size, &out[0], &out[1], &out[2]);
+    if (rc != 0) return rc;
+
+    if (copy_to_user_bytes(ep0_out, &out[0], sizeof(int32)) != 0 ||
+        copy_to_user_bytes(ep1_out, &out[1], sizeof(int32)) != 0 ||
+        copy_to_user_bytes(vmo_out, &out[2], sizeof(int32)) != 0) {
+        for (int i = 0; i < 3; i++) process_close_handle(proc, out[i]);
+        return -EFAULT;
+    }
+    return 0;
+}
+
+intptr sys_channel_ring_vmo(handle_t ep, int32 *vmo_out) {
+    if (!vmo_out) return -EINVAL;
+
+    process_t *proc = process_current();
+    if (!proc) return -1;
+
+    int32 vh;
+    int id = channel_ring_get_vmo(proc, ep, &vh);
+    if (id < 0) return id;
+
+    if (copy_to_user_bytes(vmo_out, &vh, sizeof(int32)) != 0) {
+        process_close_handle(proc, vh);
+        return -EFAULT;
+    }
+    return id;
+}
+
+static intptr channel_send_user(handle_t ep, const void *data, size len, uint32 txid) {
     if (!data && len > 0) return -1;
     if (len > CHANNEL_MAX_MSG_SIZE) return -2;
     
@@ -32,6 +71,7 @@ intptr sys_channel_send(handle_t ep, const void *data, size len) {
     msg.data_len = len;
     msg.handles = NULL;
     msg.handle_count = 0;
+    msg.txid = txid;
     
     int result = channel_send(proc, ep, &msg);
     if (kbuf) kfree(kbuf);
@@ -39,6 +79,15 @@ intptr sys_channel_send(handle_t ep, const void *data, size len) {
     return result;
 }
 
+intptr sys_channel_send(handle_t ep, const void *data, size len) {
+    return channel_send_user(ep, data, len, 0);
+}
+
+intptr sys_channel_send_reply(handle_t ep, uint32 txid, const void *data, size len) {
+    if (txid == 0) return -EINVAL;
+    return channel_send_user(ep, data, len, txid);
+}
+
 intptr sys_channel_recv(handle_t ep, void *buf, size buflen) {
     if (!buf && buflen > 0) return -1;
     
@@ -65,6 +114,120 @@ intptr sys_channel_recv(handle_t ep, void *buf, size buflen) {
     return (intptr)msg.data_len;
 }
 
+intptr sys_channel_call(handle_t ep, const void *req, size req_len,
+                        void *reply_buf, size reply_len, uint64 timeout_ns) {
+    if (!req && req_len > 0) return -1;
+    if (req_len > CHANNEL_MAX_MSG_SIZE) return -2;
+    if (!reply_buf && reply_len > 0) return -1;
+
+    process_t *proc = process_current();
+    if (!proc) return -1;
+
+    void *kbuf = NULL;
+    if (req_len > 0) {
+        kbuf = kmalloc(req_len);
+        if (!kbuf) return -3;
+        if (copy_user_bytes(req, kbuf, req_len) != 0) {
+            kfree(kbuf);
+            return -EFAULT;
+        }
+    }
+
+    uint64 deadline = CHANNEL_WAIT_FOREVER;
+    if (timeout_ns != CHANNEL_WAIT_FOREVER) {
+        uint64 now = ktimer_now();
+        deadline = (timeout_ns > CHANNEL_WAIT_FOREVER - now) ? CHANNEL_WAIT_FOREVER - 1 : now + timeout_ns;
+    }
+
+    channel_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.data = kbuf;
+    msg.data_len = req_len;
+
+    channel_msg_t reply;
+    memset(&reply, 0, sizeof(reply));
+    int result = channel_call(proc, ep, &msg, &reply, deadline);
+    if (kbuf) kfree(kbuf);
+    if (result != 0) return result;
+
+    //data-only like sys_channel_recv, handles carried by the reply are dropped
+    for (uint32 i = 0; i < reply.handle_count; i++) {
+        process_close_handle(proc, reply.handles[i]);
+    }
+    if (reply.handles) kfree(reply.handles);
+
+    size to_copy = reply.data_len < reply_len ? reply.data_len : reply_len;
+    intptr ret = (intptr)reply.data_len;
+    if (to_copy > 0 && copy_to_user_bytes(reply_buf, reply.data, to_copy) != 0) ret = -EFAULT;
+    if (reply.data) kfree(reply.data);
+    return ret;
+}
+
+intptr sys_channel_send_batch(handle_t ep, const channel_batch_msg_t *msgs, uint32 count) {
+    if (!msgs || count == 0 || count > CHANNEL_BATCH_MAX) return -EINVAL;
+
+    process_t *proc = process_current();
+    if (!proc) return -ESRCH;
+
+    channel_batch_msg_t ubatch[CHANNEL_BATCH_MAX];
+    if (copy_user_bytes(msgs, ubatch, count * sizeof(channel_batch_msg_t)) != 0) return -EFAULT;
+
+    //snapshot every payload first, channel_send_batch adopts the buffers
+    channel_msg_t kmsgs[CHANNEL_BATCH_MAX];
+    memset(kmsgs, 0, count * sizeof(channel_msg_t));
+    for (uint32 i = 0; i < count; i++) {
+        uint32 len = ubatch[i].len;
+        int err = 0;
+        if (len > CHANNEL_MAX_MSG_SIZE) err = -EINVAL;
+        else if (len > 0 && !ubatch[i].data) err = -EFAULT;
+        else if (len > 0) {
+            kmsgs[i].data = kmalloc(len);
+            if (!kmsgs[i].data) err = -ENOMEM;
+            else if (copy_user_bytes(ubatch[i].data, kmsgs[i].data, len) != 0) err = -EFAULT;
+        }
+        if (err) {
+            for (uint32 j = 0; j <= i; j++) {
+                if (kmsgs[j].data) kfree(kmsgs[j].data);
+            }
+            return err;
+        }
+        kmsgs[i].data_len = len;
+    }
+
+    return channel_send_batch(proc, ep, kmsgs, count);
+}
+
+intptr sys_channel_recv_batch(handle_t ep, channel_batch_msg_t *msgs, uint32 count, uint32 flags) {
+    if (!msgs || count == 0) return -EINVAL;
+    if (count > CHANNEL_BATCH_MAX) count = CHANNEL_BATCH_MAX;
+
+    process_t *proc = process_current();
+    if (!proc) return -ESRCH;
+
+    channel_batch_msg_t ubatch[CHANNEL_BATCH_MAX];
+    if (copy_user_bytes(msgs, ubatch, count * sizeof(channel_batch_msg_t)) != 0) return -EFAULT;
+
+    channel_msg_t kmsgs[CHANNEL_BATCH_MAX];
+    int n = channel_recv_batch(proc, ep, kmsgs, count, !(flags & CHANNEL_BATCH_NONBLOCK));
+    if (n <= 0) return n;
+
+    //messages are already dequeued so keep going after a fault and report it at the end
+    int fault = 0;
+    for (int i = 0; i < n; i++) {
+        size to_copy = kmsgs[i].data_len < ubatch[i].len ? kmsgs[i].data_len : ubatch[i].len;
+        if (to_copy > 0 && kmsgs[i].data &&
+            copy_to_user_bytes(ubatch[i].data, kmsgs[i].data, to_copy) != 0) {
+            fault = 1;
+        }
+        ubatch[i].actual = (uint32)kmsgs[i].data_len;
+        ubatch[i].sender_pid = kmsgs[i].sender_pid;
+        if (kmsgs[i].data) kfree(kmsgs[i].data);
+    }
+
+    if (copy_to_user_bytes(msgs, ubatch, n * sizeof(channel_batch_msg_t)) != 0) fault = 1;
+    return fault ? -EFAULT : n;
+}
+
 intptr sys_channel_recv_msg(handle_t ep, void *data_buf, size data_len,
                                    int32 *handles_buf, uint32 handles_len,
                                    channel_recv_result_t *result_out) {
@@ -94,6 +257,7 @@ intptr sys_channel_recv_msg(handle_t ep, void *data_buf, size data_len,
     result_out->data_len = msg.data_len;
     result_out->handle_count = msg.handle_count;
     result_out->sender_pid = msg.sender_pid;
+    result_out->txid = msg.txid;
     
     if (msg.data) kfree(msg.data);
     if (msg.handles) kfree(msg.handles);
@@ -156,9 +320,28 @@ intptr sys_channel_try_recv_msg(handle_t ep, void *data_buf, size data_len,
     result_out->data_len = msg.data_len;
     result_out->handle_count = msg.handle_count;
     result_out->sender_pid = msg.sender_pid;
+    result_out->txid = msg.txid;
     
     if (msg.data) kfree(msg.data);
     if (msg.handles) kfree(msg.handles);
     
     return 0;
 }
+
+intptr sys_futex_wait(uint32 *uaddr, uint32 expected, uint64 timeout_ns) {
+    process_t *proc = process_current();
+    if (!proc) return -1;
+
+    uint64 deadline = FUTEX_WAIT_FOREVER;
+    if (timeout_ns != FUTEX_WAIT_FOREVER) {
+        uint64 now = ktimer_now();
+        deadline = (timeout_ns > FUTEX_WAIT_FOREVER - now) ? FUTEX_WAIT_FOREVER - 1 : now + timeout_ns;
+    }
+    return futex_wait(proc, uaddr, expected, deadline);
+}
+
+intptr sys_futex_wake(uint32 *uaddr, uint32 count) {
+    process_t *proc = process_current();
+    if (!proc) return -1;
+    return futex_wake(proc, uaddr, count);
+}
@@ -6,6 +6,7 @@
 #include <net/icmpv6.h>
 #include <net/dns.h>
 #include <proc/process.h>
+#include <proc/wait.h>
 #include <arch/percpu.h>
 #include <errno.h>
 
@@ -49,6 +50,20 @@ intptr sys_get_ticks(void) {
     return (intptr)arch_timer_get_ticks();
 }
 
+intptr sys_clock_ns(void) {
+    return (intptr)arch_timer_get_ns();
+}
+
+intptr sys_sleep(uint64 ms) {
+    //clamp so the nanosecond conversion cannot wrap, the deadline saturates
+    if (ms > UINT64_MAX / 1000000) ms = UINT64_MAX / 1000000;
+    return thread_sleep_ns(ms * 1000000);
+}
+
+intptr sys_nanosleep(uint64 ns) {
+    return thread_sleep_ns(ns);
+}
+
 intptr sys_object_get_info(handle_t h, uint32 topic, void *ptr, size len) {
     if (!handle_has_rights(h, HANDLE_RIGHT_GET_INFO)) return -1;
     
@@ -26,6 +26,17 @@ int copy_user_bytes(const void *user_ptr, void *kernel_buf, size len) {
     return 0;
 }
 
+int copy_user_bytes_nofault(const void *user_ptr, void *kernel_buf, size len) {
+    //the flag belongs to this CPU, so we must not migrate while it is set
+    irq_state_t flags = arch_irq_save();
+    percpu_t *cpu = percpu_get();
+    cpu->user_nofault = 1;
+    int rc = copy_user_bytes(user_ptr, kernel_buf, len);
+    cpu->user_nofault = 0;
+    arch_irq_restore(flags);
+    return rc;
+}
+
 int copy_user_cstr(const char *user_str, char *kernel_buf, size kernel_len) {
     if (!user_str || !kernel_buf || kernel_len == 0) return -1;
     if ((uintptr)user_str < USER_SPACE_START || (uintptr)user_str >= USER_SPACE_END) return -1;
@@ -1,12 +1,16 @@
 #include <syscall/syscall.h>
 #include <arch/power.h>
+#include <fs/bcache.h>
 
 intptr sys_reboot(void) {
+    //cached filesystem writes would be lost with the power
+    bcache_sync(NULL);
     arch_power_reboot();
     return 0;
 }
 
 intptr sys_shutdown(void) {
+    bcache_sync(NULL);
     arch_power_shutdown();
     return 0;
 }
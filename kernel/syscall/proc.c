@@ -4,12 +4,15 @@
 #include <proc/bottom_half.h>
 #include <proc/thread.h>
 #include <proc/sched.h>
+#include <proc/ktimer.h>
+#include <arch/cpu.h>
 #include <kernel/elf64.h>
 #include <mm/pmm.h>
 #include <mm/kheap.h>
 #include <lib/string.h>
 #include <lib/io.h>
 #include <obj/handle.h>
+#include <errno.h>
 
 //strings are copied through this temporary kernel buffer limit before they are
 //duplicated again into the destination process cotext
@@ -359,7 +362,7 @@ static intptr sys_spawn_impl(const char *path, int argc, char **argv,
     if (k_argv_store) kfree(k_argv_store);
     if (k_argv) kfree(k_argv);
 
-    thread_t *thread = thread_create_user(proc, (void*)real_entry, (void*)user_stack_top);
+    thread_t *thread = thread_create_user(proc, (void*)real_entry, (void*)user_stack_top, NULL);
     if (!thread) {
         kfree(buf);
         return -1;
@@ -488,13 +491,97 @@ intptr sys_process_start(handle_t proc_h, uintptr entry, uintptr stack) {
     process_t *target = (process_t *)proc_entry->obj->data;
     if (!target) return -3;
 
-    thread_t *thread = thread_create_user(target, (void *)entry, (void *)stack);
+    thread_t *thread = thread_create_user(target, (void *)entry, (void *)stack, NULL);
     if (!thread) return -4;
 
     sched_add(thread);
     return (intptr)target->pid;
 }
 
+static bool user_addr_ok(uintptr addr) {
+    return addr >= USER_SPACE_START && addr < USER_SPACE_END;
+}
+
+intptr sys_thread_create(uintptr entry, uintptr stack, uintptr arg, uintptr tls) {
+    process_t *proc = process_current();
+    if (!proc || !proc->pagemap) return -ESRCH;
+    if (!user_addr_ok(entry) || !user_addr_ok(stack)) return -EINVAL;
+    //a non-canonical FS base would fault on the MSR write during the switch
+    if (tls && !user_addr_ok(tls)) return -EINVAL;
+
+    spinlock_acquire(&proc->lock);
+    uint32 state = proc->state;
+    spinlock_release(&proc->lock);
+    if (state == PROC_STATE_DEAD || state == PROC_STATE_ZOMBIE) return -ESRCH;
+
+    thread_t *thread = thread_create_user(proc, (void *)entry, (void *)stack, (void *)arg);
+    if (!thread) return -ENOMEM;
+    thread->tls_base = tls;
+
+    //grant the handle before the thread can run so a fast exit cannot race it
+    int h = process_grant_handle(proc, thread->obj, HANDLE_RIGHTS_ALL);
+    if (h < 0) {
+        thread_destroy(thread);
+        return -ENOMEM;
+    }
+
+    sched_add(thread);
+    return h;
+}
+
+intptr sys_thread_exit(void) {
+    thread_exit();
+    return 0;
+}
+
+intptr sys_thread_join(handle_t h, uint64 timeout_ns) {
+    process_t *proc = process_current();
+    if (!proc) return -ESRCH;
+
+    //the handle table and our thread list are both under proc->lock, a thread
+    //of ours cannot be freed while it is still on the list
+    spinlock_acquire(&proc->lock);
+    object_t *obj = process_get_handle(proc, h);
+    if (!obj || obj->type != OBJECT_THREAD) {
+        spinlock_release(&proc->lock);
+        return -EBADF;
+    }
+    object_ref(obj);
+
+    //data is cleared before the thread leaves the list, EXITED is latched by then
+    thread_t *target = (thread_t *)obj->data;
+    thread_t *t = proc->threads;
+    while (t && t != target) t = t->next;
+    spinlock_release(&proc->lock);
+
+    if (target && (!t || target == thread_current())) {
+        object_deref(obj);
+        return -EINVAL;
+    }
+
+    uint64 deadline = OBJECT_WAIT_FOREVER;
+    if (timeout_ns != OBJECT_WAIT_FOREVER) {
+        uint64 now = ktimer_now();
+        deadline = (timeout_ns > OBJECT_WAIT_FOREVER - now) ? OBJECT_WAIT_FOREVER - 1 : now + timeout_ns;
+    }
+    uint32 mask = OBJECT_SIGNAL_EXITED;
+    uint32 pending = 0;
+    int ret = object_wait_many(&obj, &mask, &pending, 1, deadline);
+    object_deref(obj);
+
+    return ret < 0 ? ret : 0;
+}
+
+intptr sys_thread_set_tls(uintptr base) {
+    thread_t *current = thread_current();
+    if (!current) return -ESRCH;
+    if (base && !user_addr_ok(base)) return -EINVAL;
+
+    current->tls_base = base;
+    arch_set_tls_base(base);
+    return 0;
+}
+
 //check if caller has permission to signal target process
 static int check_signal_permission(process_t *caller, process_t *target) {
     //a process can always send signals/events to itself
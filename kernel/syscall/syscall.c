@@ -19,9 +19,20 @@ intptr syscall_dispatch(uintptr num, uintptr arg1, uintptr arg2, uintptr arg3,
         case SYS_HANDLE_CLOSE: return sys_handle_close((handle_t)arg1);
         case SYS_HANDLE_DUP: return sys_handle_dup((handle_t)arg1, (handle_rights_t)arg2);
         case SYS_CHANNEL_CREATE: return sys_channel_create((int32 *)arg1, (int32 *)arg2);
+        case SYS_CHANNEL_CREATE_RING: return sys_channel_create_ring((int32 *)arg1, (int32 *)arg2,
+                                                                     (int32 *)arg3, (uint32)arg4);
+        case SYS_CHANNEL_RING_VMO: return sys_channel_ring_vmo((handle_t)arg1, (int32 *)arg2);
         case SYS_CHANNEL_SEND: return sys_channel_send((handle_t)arg1, (const void *)arg2, (size)arg3);
+        case SYS_CHANNEL_SEND_REPLY: return sys_channel_send_reply((handle_t)arg1, (uint32)arg2,
+                                                                   (const void *)arg3, (size)arg4);
         case SYS_CHANNEL_RECV: return sys_channel_recv((handle_t)arg1, (void *)arg2, (size)arg3);
         case SYS_CHANNEL_TRY_RECV: return sys_channel_try_recv((handle_t)arg1, (void *)arg2, (size)arg3);
+        case SYS_CHANNEL_CALL: return sys_channel_call((handle_t)arg1, (const void *)arg2, (size)arg3,
+                                                       (void *)arg4, (size)arg5, (uint64)arg6);
+        case SYS_CHANNEL_SEND_BATCH: return sys_channel_send_batch((handle_t)arg1, (const channel_batch_msg_t *)arg2,
+                                                                   (uint32)arg3);
+        case SYS_CHANNEL_RECV_BATCH: return sys_channel_recv_batch((handle_t)arg1, (channel_batch_msg_t *)arg2,
+                                                                   (uint32)arg3, (uint32)arg4);
         case SYS_VMO_CREATE: return sys_vmo_create((size)arg1, (uint32)arg2, (handle_rights_t)arg3);
         case SYS_VMO_READ: return sys_vmo_read((handle_t)arg1, (void *)arg2, (size)arg3, (size)arg4);
         case SYS_VMO_WRITE: return sys_vmo_write((handle_t)arg1, (const void *)arg2, (size)arg3, (size)arg4);
@@ -31,6 +42,8 @@ intptr syscall_dispatch(uintptr num, uintptr arg1, uintptr arg2, uintptr arg3,
         case SYS_CHANNEL_TRY_RECV_MSG: return sys_channel_try_recv_msg((handle_t)arg1, (void *)arg2, (size)arg3,
                                                                 (int32 *)arg4, (uint32)arg5,
                                                                 (channel_recv_result_t *)arg6);
+        case SYS_FUTEX_WAIT: return sys_futex_wait((uint32 *)arg1, (uint32)arg2, (uint64)arg3);
+        case SYS_FUTEX_WAKE: return sys_futex_wake((uint32 *)arg1, (uint32)arg2);
         case SYS_VMO_MAP: return sys_vmo_map((handle_t)arg1, (uintptr)arg2, (size)arg3, (size)arg4, (uint32)arg5);
         case SYS_VMO_UNMAP: return sys_vmo_unmap((uintptr)arg1, (size)arg2);
         case SYS_NS_REGISTER: return sys_ns_register((const char *)arg1, (handle_t)arg2, (handle_rights_t)arg3);
@@ -41,19 +54,29 @@ intptr syscall_dispatch(uintptr num, uintptr arg1, uintptr arg2, uintptr arg3,
         case SYS_PROCESS_CREATE: return sys_process_create((const char *)arg1);
         case SYS_HANDLE_GRANT: return sys_handle_grant((handle_t)arg1, (handle_t)arg2, (handle_rights_t)arg3);
         case SYS_PROCESS_START: return sys_process_start((handle_t)arg1, arg2, arg3);
+        case SYS_THREAD_CREATE: return sys_thread_create(arg1, arg2, arg3, arg4);
+        case SYS_THREAD_EXIT: return sys_thread_exit();
+        case SYS_THREAD_JOIN: return sys_thread_join((handle_t)arg1, (uint64)arg2);
+        case SYS_THREAD_SET_TLS: return sys_thread_set_tls(arg1);
         
         case SYS_VMO_RESIZE: return sys_vmo_resize((handle_t)arg1, (size)arg2);
+        case SYS_VMO_CREATE_CHILD: return sys_vmo_create_child((handle_t)arg1, (size)arg2, (size)arg3, (uint32)arg4, (handle_rights_t)arg5);
+        case SYS_VMO_DECOMMIT: return sys_vmo_decommit((handle_t)arg1, (size)arg2, (size)arg3);
         case SYS_READDIR: return sys_readdir((handle_t)arg1, (dirent_t *)arg2, (uint32)arg3, (uint32 *)arg4);
         case SYS_CHDIR: return sys_chdir((const char *)arg1);
         case SYS_GETCWD: return sys_getcwd((char *)arg1, (size)arg2);
         case SYS_MOUNT: return sys_mount((handle_t)arg1, (const char *)arg2, (const char *)arg3);
         case SYS_GET_TICKS: return sys_get_ticks();
+        case SYS_CLOCK_NS: return sys_clock_ns();
+        case SYS_SLEEP: return sys_sleep((uint64)arg1);
+        case SYS_NANOSLEEP: return sys_nanosleep((uint64)arg1);
         case SYS_MKNODE: return sys_mknode((const char *)arg1, (uint32)arg2);
         case SYS_REMOVE: return sys_remove((const char *)arg1);
         case SYS_FSTAT: return sys_fstat((handle_t)arg1, (stat_t *)arg2);
         case SYS_REBOOT: return sys_reboot();
         case SYS_SHUTDOWN: return sys_shutdown();
         case SYS_OBJECT_GET_INFO: return sys_object_get_info((handle_t)arg1, (uint32)arg2, (void *)arg3, (size)arg4);
+        case SYS_OBJECT_WAIT_MANY: return sys_object_wait_many((object_wait_item_t *)arg1, (uint32)arg2, (uint64)arg3);
         case SYS_PING: return sys_ping((uint32)arg1, (const void *)arg2, (uint32)arg3, (uint32)arg4);
         case SYS_DNS_RESOLVE: return sys_dns_resolve((const char *)arg1, (uint32 *)arg2);
         case SYS_DNS_RESOLVE_AAAA: return sys_dns_resolve_aaaa((const char *)arg1, (uint8 *)arg2);
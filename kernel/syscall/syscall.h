@@ -17,7 +17,8 @@ typedef enum {
     OBJ_INFO_BOOT_CMDLINE = 6,  //boot cmdline string (requires system handle)
     OBJ_INFO_BLOCK_DEVICE = 7,  //block_device_info_t (requires device handle)
     OBJ_INFO_VT_STATE = 8,      //vt_info_t (requires vt device handle)
-    OBJ_INFO_BLOCK_RESCAN = 9   //trigger partition rescan (requires device handle)
+    OBJ_INFO_BLOCK_RESCAN = 9,  //trigger partition rescan (requires device handle)
+    OBJ_INFO_PMM_STATS = 10     //pmm_stats_t (requires system handle)
 } object_info_topic_t;
 
 //info structures
@@ -72,13 +73,37 @@ typedef struct {
     char cpu_brand[48];     //CPU brand string (e.g. "Intel Core i7...")
 } system_stats_t;
 
+//one entry for object_wait_many
+typedef struct {
+    handle_t handle;     //handle to wait on
+    uint32 waitfor;      //OBJECT_SIGNAL_* bits of interest
+    uint32 pending;      //out: signals asserted when the call returned
+} object_wait_item_t;
+
+//timeout value for object_wait_many that never expires
+#define OBJECT_WAIT_FOREVER UINT64_MAX
+
 //result struct for channel_recv_msg
 typedef struct {
     size data_len;       //actual bytes of data received
     uint32 handle_count; //number of handles received
     uint32 sender_pid;   //PID of the process that sent this message (0 if kernel)
+    uint32 txid;         //channel_call transaction to answer, 0 for plain messages
+    uint32 reserved;
 } channel_recv_result_t;
 
+//one message for channel_send_batch / channel_recv_batch
+typedef struct {
+    void *data;          //send: payload, recv: buffer
+    uint32 len;          //send: payload length, recv: buffer size
+    uint32 actual;       //recv out: full message length (copy is truncated to len)
+    uint32 sender_pid;   //recv out: PID of the sender (0 if kernel)
+    uint32 reserved;
+} channel_batch_msg_t;
+
+//channel_recv_batch flags
+#define CHANNEL_BATCH_NONBLOCK  (1 << 0)    //return -3 instead of waiting for the first message
+
 typedef enum {
     CONTEXT_VALUE_STRING = 1,
     CONTEXT_VALUE_I64 = 2,
@@ -120,27 +145,42 @@ intptr sys_wait(uintptr pid);
 intptr sys_process_create(const char *name);
 intptr sys_handle_grant(handle_t proc_h, handle_t local_h, handle_rights_t rights);
 intptr sys_process_start(handle_t proc_h, uintptr entry, uintptr stack);
+intptr sys_thread_create(uintptr entry, uintptr stack, uintptr arg, uintptr tls);
+intptr sys_thread_exit(void);
+intptr sys_thread_join(handle_t h, uint64 timeout_ns);
+intptr sys_thread_set_tls(uintptr base);
 intptr sys_get_obj(handle_t parent, const char *path, handle_rights_t rights);
 intptr sys_handle_close(handle_t h);
 intptr sys_handle_dup(handle_t h, handle_rights_t new_rights);
 intptr sys_ns_register(const char *path, handle_t h, handle_rights_t max_rights);
 
 intptr sys_channel_create(int32 *ep0_out, int32 *ep1_out);
+intptr sys_channel_create_ring(int32 *ep0_out, int32 *ep1_out, int32 *vmo_out, uint32 ring_size);
+intptr sys_channel_ring_vmo(handle_t ep, int32 *vmo_out);
 intptr sys_channel_send(handle_t ep, const void *data, size len);
+intptr sys_channel_send_reply(handle_t ep, uint32 txid, const void *data, size len);
 intptr sys_channel_recv(handle_t ep, void *buf, size buflen);
 intptr sys_channel_try_recv(handle_t ep, void *buf, size buflen);
+intptr sys_channel_call(handle_t ep, const void *req, size req_len,
+                        void *reply_buf, size reply_len, uint64 timeout_ns);
+intptr sys_channel_send_batch(handle_t ep, const channel_batch_msg_t *msgs, uint32 count);
+intptr sys_channel_recv_batch(handle_t ep, channel_batch_msg_t *msgs, uint32 count, uint32 flags);
 intptr sys_channel_recv_msg(handle_t ep, void *data_buf, size data_len,
                            int32 *handles_buf, uint32 handles_len,
                            channel_recv_result_t *result_out);
 intptr sys_channel_try_recv_msg(handle_t ep, void *data_buf, size data_len,
                                int32 *handles_buf, uint32 handles_len,
                                channel_recv_result_t *result_out);
+intptr sys_futex_wait(uint32 *uaddr, uint32 expected, uint64 timeout_ns);
+intptr sys_futex_wake(uint32 *uaddr, uint32 count);
 intptr sys_vmo_create(size sz, uint32 flags, handle_rights_t rights);
 intptr sys_vmo_read(handle_t h, void *buf, size len, size offset);
 intptr sys_vmo_write(handle_t h, const void *buf, size len, size offset);
 intptr sys_vmo_map(handle_t h, uintptr vaddr_hint, size offset, size len, uint32 flags);
 intptr sys_vmo_unmap(uintptr vaddr, size len);
 intptr sys_vmo_resize(handle_t vmo_h, size new_size);
+intptr sys_vmo_create_child(handle_t h, size offset, size len, uint32 flags, handle_rights_t rights);
+intptr sys_vmo_decommit(handle_t h, size offset, size len);
 intptr sys_stat(const char *path, stat_t *st);
 intptr sys_fstat(handle_t h, stat_t *st);
 intptr sys_readdir(handle_t h, dirent_t *entries, uint32 count, uint32 *index);
@@ -154,9 +194,13 @@ intptr sys_handle_write(handle_t h, const void *buf, size len);
 intptr sys_handle_seek(handle_t h, size offset, int mode);
 intptr sys_debug_write(const char *buf, size count);
 intptr sys_get_ticks(void);
+intptr sys_clock_ns(void);
+intptr sys_sleep(uint64 ms);
+intptr sys_nanosleep(uint64 ns);
 intptr sys_reboot(void);
 intptr sys_shutdown(void);
 intptr sys_object_get_info(handle_t h, uint32 topic, void *ptr, size len);
+intptr sys_object_wait_many(object_wait_item_t *items, uint32 count, uint64 timeout_ns);
 intptr sys_ping(uint32 family, const void *dst_addr, uint32 addr_len, uint32 count);
 intptr sys_dns_resolve(const char *hostname, uint32 *ip_out);
 intptr sys_dns_resolve_aaaa(const char *hostname, uint8 *ipv6_out);
@@ -178,6 +222,8 @@ intptr sys_proc_set_console_foreground(uintptr pid);
 
 //helper for safe user-space copies
 int copy_user_bytes(const void *user_ptr, void *kernel_buf, size len);
+//fails instead of paging anything in, safe with interrupts off or spinlocks held
+int copy_user_bytes_nofault(const void *user_ptr, void *kernel_buf, size len);
 int copy_user_cstr(const char *user_str, char *kernel_buf, size kernel_len);
 int copy_to_user_bytes(void *user_ptr, const void *kernel_buf, size len);
 
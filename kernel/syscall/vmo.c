@@ -49,4 +49,18 @@ intptr sys_vmo_resize(handle_t vmo_h, size new_size) {
     return vmo_resize(current, vmo_h, new_size);
 }
 
+intptr sys_vmo_create_child(handle_t h, size offset, size len, uint32 flags, handle_rights_t rights) {
+    if (len == 0) return -1;
+    process_t *proc = process_current();
+    if (!proc) return -1;
+    return vmo_create_child(proc, h, offset, len, flags, rights);
+}
+
+intptr sys_vmo_decommit(handle_t h, size offset, size len) {
+    if (len == 0) return -1;
+    process_t *proc = process_current();
+    if (!proc) return -1;
+    return vmo_decommit(proc, h, offset, len);
+}
+
 #endif
@@ -6,9 +6,17 @@
 
 //client connection
 handle_t comp_connect(void);
+//send req on the server channel and wait for the MSG_ACK answering it
+bool comp_request(handle_t server_ch, const comp_msg_t *req, comp_msg_t *ack);
 bool comp_claim_wm(handle_t server_ch, handle_t *out_wm_ch);
 void comp_unclaim_wm(handle_t wm_ch);
 
+//batching: between begin and end, messages for ch are queued locally and
+//sent with channel_send_batch (flushed early whenever the batch fills)
+void comp_batch_begin(handle_t ch);
+bool comp_batch_flush(void);
+bool comp_batch_end(void);
+
 //window manager operations
 bool comp_set_position(handle_t wm_ch, surface_id_t id, int16 x, int16 y, uint16 w, uint16 h);
 bool comp_set_focus(handle_t ch, surface_id_t id);
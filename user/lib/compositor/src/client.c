@@ -3,6 +3,62 @@
 #include <io.h>
 #include <string.h>
 
+//how long a flush waits for the peer to drain a full queue before giving up
+#define COMP_BATCH_WAIT_NS 100000000ULL
+
+//messages for batch_ch are held here until comp_batch_flush
+static handle_t batch_ch = INVALID_HANDLE;
+static comp_msg_t batch_msgs[CHANNEL_BATCH_MAX];
+static uint32 batch_count = 0;
+
+bool comp_batch_flush(void) {
+    channel_batch_msg_t iov[CHANNEL_BATCH_MAX];
+    for (uint32 i = 0; i < batch_count; i++) {
+        iov[i] = (channel_batch_msg_t){ .data = &batch_msgs[i], .len = sizeof(comp_msg_t) };
+    }
+
+    uint32 done = 0;
+    bool ok = true;
+    while (done < batch_count) {
+        int rc = channel_send_batch(batch_ch, iov + done, batch_count - done);
+        if (rc > 0) {
+            done += rc;
+            continue;
+        }
+        //queue full: sleep until the peer drains some of it
+        object_wait_item_t item = { .handle = batch_ch, .waitfor = OBJECT_SIGNAL_WRITABLE | OBJECT_SIGNAL_PEER_CLOSED };
+        if (rc != -3 || object_wait_many(&item, 1, COMP_BATCH_WAIT_NS) <= 0 ||
+            (item.pending & OBJECT_SIGNAL_PEER_CLOSED)) {
+            ok = false;
+            break;
+        }
+    }
+    batch_count = 0;
+    return ok;
+}
+
+void comp_batch_begin(handle_t ch) {
+    if (batch_ch != INVALID_HANDLE) comp_batch_flush();
+    batch_ch = ch;
+    batch_count = 0;
+}
+
+bool comp_batch_end(void) {
+    bool ok = comp_batch_flush();
+    batch_ch = INVALID_HANDLE;
+    return ok;
+}
+
+//queue into the open batch for ch, or send straight away
+static bool comp_send(handle_t ch, comp_msg_t *msg) {
+    if (ch == INVALID_HANDLE) return false;
+    if (ch != batch_ch) return channel_send(ch, msg, sizeof(*msg)) == 0;
+
+    if (batch_count == CHANNEL_BATCH_MAX && !comp_batch_flush()) return false;
+    batch_msgs[batch_count++] = *msg;
+    return true;
+}
+
 handle_t comp_connect(void) {
     handle_t h = INVALID_HANDLE;
     for (int i = 0; i < 50; i++) {
@@ -13,23 +69,22 @@ handle_t comp_connect(void) {
     return h;
 }
 
+//the compositor serves its server channel once a frame
+#define COMP_REQUEST_TIMEOUT_NS 1000000000ULL
+
+bool comp_request(handle_t server_ch, const comp_msg_t *req, comp_msg_t *ack) {
+    //every client shares the server channel, channel_call keeps our ack from
+    //being picked up by another client waiting on the same endpoint
+    int rc = channel_call(server_ch, req, sizeof(*req), ack, sizeof(*ack), COMP_REQUEST_TIMEOUT_NS);
+    return rc == (int)sizeof(*ack) && ack->type == MSG_ACK;
+}
+
 bool comp_claim_wm(handle_t server_ch, handle_t *out_wm_ch) {
     if (server_ch == INVALID_HANDLE || !out_wm_ch) return false;
 
     comp_msg_t msg = { .type = MSG_CLAIM_WM };
-    if (channel_send(server_ch, &msg, sizeof(msg)) != 0) return false;
-
     comp_msg_t resp;
-    bool got_ack = false;
-    for (int i = 0; i < 100; i++) {
-        int rc = channel_try_recv(server_ch, &resp, sizeof(resp));
-        if (rc == (ssize)sizeof(resp) && resp.type == MSG_ACK && resp.u.ack.ok) {
-            got_ack = true;
-            break;
-        }
-        yield();
-    }
-    if (!got_ack) return false;
+    if (!comp_request(server_ch, &msg, &resp) || !resp.u.ack.ok) return false;
 
     char path[64];
     snprintf(path, sizeof(path), "$gui/display/%u_wm/ch", getpid());
@@ -48,6 +103,8 @@ bool comp_claim_wm(handle_t server_ch, handle_t *out_wm_ch) {
 
 void comp_unclaim_wm(handle_t wm_ch) {
     if (wm_ch == INVALID_HANDLE) return;
+    //anything still batched has to land before the unclaim
+    if (batch_ch == wm_ch) comp_batch_end();
     comp_msg_t msg = { .type = MSG_UNCLAIM_WM };
     channel_send(wm_ch, &msg, sizeof(msg));
 }
@@ -58,7 +115,7 @@ bool comp_set_position(handle_t wm_ch, surface_id_t id, int16 x, int16 y, uint16
         .type = MSG_SET_POSITION,
         .u.set_position = { .id = id, .x = x, .y = y, .w = w, .h = h }
     };
-    return channel_send(wm_ch, &msg, sizeof(msg)) == 0;
+    return comp_send(wm_ch, &msg);
 }
 
 bool comp_set_focus(handle_t ch, surface_id_t id) {
@@ -67,7 +124,7 @@ bool comp_set_focus(handle_t ch, surface_id_t id) {
         .type = MSG_SET_FOCUS,
         .u.set_focus = { .id = id }
     };
-    return channel_send(ch, &msg, sizeof(msg)) == 0;
+    return comp_send(ch, &msg);
 }
 
 bool comp_set_decoration(handle_t wm_ch, surface_id_t id, comp_decoration_t d) {
@@ -76,7 +133,7 @@ bool comp_set_decoration(handle_t wm_ch, surface_id_t id, comp_decoration_t d) {
         .type = MSG_SET_DECORATION,
         .u.set_decoration = { .id = id, .d = d }
     };
-    return channel_send(wm_ch, &msg, sizeof(msg)) == 0;
+    return comp_send(wm_ch, &msg);
 }
 
 bool comp_set_stacking(handle_t wm_ch, const surface_id_t *ids, uint8 count) {
@@ -86,7 +143,7 @@ bool comp_set_stacking(handle_t wm_ch, const surface_id_t *ids, uint8 count) {
         .u.set_stacking = { .count = count }
     };
     memcpy(msg.u.set_stacking.ids, ids, count * sizeof(surface_id_t));
-    return channel_send(wm_ch, &msg, sizeof(msg)) == 0;
+    return comp_send(wm_ch, &msg);
 }
 
 bool comp_set_client_area(handle_t wm_ch, surface_id_t id, uint16 x, uint16 y, uint16 w, uint16 h) {
@@ -95,7 +152,7 @@ bool comp_set_client_area(handle_t wm_ch, surface_id_t id, uint16 x, uint16 y, u
         .type = MSG_SET_CLIENT_AREA,
         .u.set_client_area = { .id = id, .x = x, .y = y, .w = w, .h = h }
     };
-    return channel_send(wm_ch, &msg, sizeof(msg)) == 0;
+    return comp_send(wm_ch, &msg);
 }
 
 bool comp_pass_through(handle_t wm_ch, surface_id_t id, kbd_event_t ev) {
@@ -104,7 +161,7 @@ bool comp_pass_through(handle_t wm_ch, surface_id_t id, kbd_event_t ev) {
         .type = MSG_PASS_THROUGH,
         .u.pass_through = { .id = id, .data = ev }
     };
-    return channel_send(wm_ch, &msg, sizeof(msg)) == 0;
+    return comp_send(wm_ch, &msg);
 }
 
 //sk the compositor to immediately remove a surface on the WM channel
@@ -116,7 +173,7 @@ bool comp_wm_destroy_surface(handle_t wm_ch, surface_id_t id) {
         .type = MSG_DESTROY_SURFACE,
         .u.destroy_surface = { .id = id }
     };
-    return channel_send(wm_ch, &msg, sizeof(msg)) == 0;
+    return comp_send(wm_ch, &msg);
 }
 
 bool comp_create_surface(handle_t server_ch, uint16 w, uint16 h, surface_id_t *out_id, handle_t *out_ch) {
@@ -126,19 +183,8 @@ bool comp_create_surface(handle_t server_ch, uint16 w, uint16 h, surface_id_t *o
         .type = MSG_CREATE_SURFACE,
         .u.create_surface = { .w = w, .h = h }
     };
-    if (channel_send(server_ch, &req, sizeof(req)) != 0) return false;
-
     comp_msg_t ack = {0};
-    bool got_ack = false;
-    for (int i = 0; i < 50; i++) {
-        int rc = channel_try_recv(server_ch, &ack, sizeof(ack));
-        if (rc == (ssize)sizeof(ack) && ack.type == MSG_ACK) {
-            got_ack = ack.u.ack.ok;
-            break;
-        }
-        yield();
-    }
-    if (!got_ack) return false;
+    if (!comp_request(server_ch, &req, &ack) || !ack.u.ack.ok) return false;
 
     char path[64];
     snprintf(path, sizeof(path), "$gui/display/%u_%u/ch", getpid(), ack.u.ack.id);
@@ -166,13 +212,13 @@ bool comp_create_surface(handle_t server_ch, uint16 w, uint16 h, surface_id_t *o
 void comp_commit(handle_t surface_ch, surface_id_t id) {
     if (surface_ch == INVALID_HANDLE) return;
     comp_msg_t msg = { .type = MSG_COMMIT, .u.commit.id = id };
-    channel_send(surface_ch, &msg, sizeof(msg));
+    comp_send(surface_ch, &msg);
 }
 
 void comp_destroy_surface(handle_t surface_ch, surface_id_t id) {
     if (surface_ch == INVALID_HANDLE) return;
     comp_msg_t msg = { .type = MSG_DESTROY_SURFACE, .u.destroy_surface.id = id };
-    channel_send(surface_ch, &msg, sizeof(msg));
+    comp_send(surface_ch, &msg);
 }
 
 void comp_resize_surface(handle_t surface_ch, surface_id_t id, uint16 w, uint16 h) {
@@ -181,7 +227,7 @@ void comp_resize_surface(handle_t surface_ch, surface_id_t id, uint16 w, uint16
         .type = MSG_RESIZE_SURFACE,
         .u.resize_surface = { .id = id, .w = w, .h = h }
     };
-    channel_send(surface_ch, &msg, sizeof(msg));
+    comp_send(surface_ch, &msg);
 }
 
 void comp_set_title(handle_t surface_ch, surface_id_t id, const char *title) {
@@ -193,5 +239,5 @@ void comp_set_title(handle_t surface_ch, surface_id_t id, const char *title) {
         k++;
     }
     msg.u.set_title.text[k] = '\0';
-    channel_send(surface_ch, &msg, sizeof(msg));
+    comp_send(surface_ch, &msg);
 }
@@ -73,20 +73,8 @@ bool px_init() {
     if (server_handle == INVALID_HANDLE) return false;
 
     comp_msg_t msg = { .type = MSG_CLIENT_CONNECT };
-    channel_send(server_handle, &msg, sizeof(msg));
-
-    bool got_ack = false;
-    for (int i = 0; i < MAX_TRIES; i++) {
-        comp_msg_t resp;
-        int rc = channel_try_recv(server_handle, &resp, sizeof(resp));
-        if (rc == (ssize)sizeof(resp) && resp.type == MSG_ACK) {
-            got_ack = resp.u.ack.ok;
-            break;
-        }
-        yield();
-    }
-
-    if (!got_ack) {
+    comp_msg_t resp;
+    if (!comp_request(server_handle, &msg, &resp) || !resp.u.ack.ok) {
         handle_close(server_handle);
         server_handle = INVALID_HANDLE;
         return false;
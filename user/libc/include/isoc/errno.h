@@ -5,7 +5,10 @@ extern int *__errno_location(void);
 #define errno (*__errno_location())
 
 #define ENOENT 2
+#define EAGAIN 11
+#define ENOMEM 12
 #define EISDIR 21
 #define EINVAL 22
+#define ETIMEDOUT 110
 
 #endif
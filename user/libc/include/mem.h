@@ -4,11 +4,11 @@
 #include <types.h>
 #include <system.h>
 
-#define HEAP_SIZE 1048576   // one megabyte
+#define HEAP_RESERVE (512ULL * 1024 * 1024)    //address space for small allocations, committed on use
 
 extern handle_t _mem_vmo;
 extern void *_mem_addr;
-extern size heap_capacity;
+extern size heap_capacity;     //bytes of the heap VMO mapped at _mem_addr
 
 typedef struct {
     size s;
@@ -0,0 +1,52 @@
+#ifndef _LIBC_RING_H
+#define _LIBC_RING_H
+
+#include <types.h>
+#include <system.h>
+#include <errno.h>
+#include <sys/ring.h>
+
+/*
+ *shared memory ring channels
+ *
+ *create the pair with channel_create_ring(), hand one endpoint to the peer
+ *like any other channel handle, then ring_attach() on each side. send and
+ *recv are plain memcpys into the shared VMO, the kernel only sees a futex
+ *call when one side actually has to sleep or wake the other
+ *
+ *each direction is single-producer single-consumer: serialize senders (or
+ *receivers) yourself if several threads share one endpoint
+ */
+
+#define RING_ERR_AGAIN      (-EAGAIN)   //empty on recv, full on send
+#define RING_ERR_CLOSED     (-2)    //peer endpoint closed
+#define RING_ERR_TOO_LARGE  (-4)    //record does not fit the ring or the buffer
+#define RING_ERR_CORRUPT    (-5)    //peer left a record that does not fit what it published
+
+typedef struct {
+    ring_ctrl_t *ctrl;
+    handle_t vmo;
+    int id;             //this endpoint's id, we consume dir[id]
+    uint32 size;
+    ring_dir_t *rx;
+    ring_dir_t *tx;
+    uint8 *rx_data;
+    uint8 *tx_data;
+} ring_t;
+
+//map the ring of a ring channel endpoint, returns 0 or negative
+int ring_attach(ring_t *r, handle_t ep);
+void ring_detach(ring_t *r);
+
+//non-blocking, return 0 / bytes received or RING_ERR_*
+int ring_try_send(ring_t *r, const void *data, uint32 len);
+int ring_try_recv(ring_t *r, void *buf, uint32 buflen);
+
+//sleep until there is room / a record, return as above but never RING_ERR_AGAIN
+int ring_send(ring_t *r, const void *data, uint32 len);
+int ring_recv(ring_t *r, void *buf, uint32 buflen);
+
+//bytes queued towards this endpoint
+uint32 ring_pending(ring_t *r);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _LIBC_SYNC_H
+#define _LIBC_SYNC_H
+
+#include <types.h>
+
+/*
+ *futex-backed synchronization primitives
+ *uncontended lock/unlock/post stay entirely in userspace, the kernel is only
+ *entered to sleep or to wake a sleeper. all of them may live in a shared VMO
+ *to synchronize between processes
+ */
+
+//mutex states: 0 unlocked, 1 locked, 2 locked with possible sleepers
+typedef struct {
+    volatile uint32 state;
+} mutex_t;
+
+#define MUTEX_INIT { 0 }
+
+void mutex_init(mutex_t *m);
+void mutex_lock(mutex_t *m);
+bool mutex_trylock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+
+//condition variable: waiters sleep on a sequence word bumped by every signal
+typedef struct {
+    volatile uint32 seq;
+} cond_t;
+
+#define COND_INIT { 0 }
+
+void cond_init(cond_t *c);
+void cond_wait(cond_t *c, mutex_t *m);
+//returns 0 when signalled (or spuriously woken), -1 once timeout_ns elapsed
+int cond_timedwait(cond_t *c, mutex_t *m, uint64 timeout_ns);
+void cond_signal(cond_t *c);
+void cond_broadcast(cond_t *c);
+
+//counting semaphore
+typedef struct {
+    volatile uint32 count;
+    volatile uint32 waiters;    //threads in or about to enter futex_wait
+} sem_t;
+
+#define SEM_INIT(n) { (n), 0 }
+
+void sem_init(sem_t *s, uint32 value);
+void sem_wait(sem_t *s);
+bool sem_trywait(sem_t *s);
+//returns 0 once a unit was taken, -1 if timeout_ns elapsed first
+int sem_timedwait(sem_t *s, uint64 timeout_ns);
+void sem_post(sem_t *s);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <types.h>
 #include <sys/syscall.h>
+#include <sys/pmm.h>
 
 //handle rights
 #define RIGHT_NONE          0
@@ -17,6 +18,8 @@
 //VMO flags
 #define VMO_FLAG_NONE       0
 #define VMO_FLAG_RESIZABLE  (1 << 0)
+#define VMO_CHILD_COW       (1 << 1)   //vmo_create_child: copy-on-write snapshot
+#define VMO_FLAG_HUGE       (1 << 2)   //commit in aligned 2MB chunks mapped with large pages
 
 typedef int32 handle_t;
 
@@ -74,6 +77,9 @@ int spawn(char *path, int argc, char **argv);
 int spawn_ctx(char *path, int argc, char **argv, const context_spawn_entry_t *entries, size entry_count);
 int wait(int pid);
 uint64 get_ticks(void);
+uint64 clock_ns(void);        //monotonic nanoseconds since boot
+void sleep_ms(uint64 ms);     //block without spinning
+void nanosleep(uint64 ns);
 //process async event control
 int proc_send_event(uintptr pid, uint32 event);
 int proc_set_event_handler(uint32 event, proc_event_handler_t handler, uint32 flags);
@@ -88,6 +94,12 @@ int32 process_create(const char *name);              //create suspended process,
 int handle_grant(int32 proc_h, int32 local_h, uint32 rights);  //inject handle into child
 int process_start(int32 proc_h, uint64 entry, uint64 stack);   //start first thread
 
+//raw thread syscalls (see thread.h for the libc threading API)
+handle_t thread_spawn(void (*entry)(void *), void *stack, void *arg, void *tls);  //returns thread handle
+__attribute__((noreturn)) void thread_exit_self(void);  //exit only the calling thread
+int thread_wait(handle_t thread_h, uint64 timeout_ns);  //0 once exited, -110 on timeout
+int thread_set_tls(void *tls);                          //set the calling thread's FS base
+
 //capability-based object access
 handle_t get_obj(handle_t parent, const char *path, uint32 rights);
 int handle_read(handle_t h, void *buf, int len);
@@ -107,6 +119,18 @@ int channel_create(handle_t *ep0, handle_t *ep1);
 int channel_send(handle_t ep, const void *data, int len);
 int channel_recv(handle_t ep, void *buf, int buflen);
 int channel_try_recv(handle_t ep, void *buf, int buflen);
+//channel pair plus a shared ring VMO (see ring.h), ring_size is per direction
+int channel_create_ring(handle_t *ep0, handle_t *ep1, handle_t *ring_vmo, uint32 ring_size);
+//handle to a ring channel's VMO, returns this endpoint's id (0 or 1) or negative
+int channel_ring_vmo(handle_t ep, handle_t *ring_vmo);
+
+//futex: sleep while *uaddr == expected (timeout in ns, FUTEX_WAIT_FOREVER for none)
+//returns 0 when woken, -11 if the value already differed, -110 on timeout
+//words in a mapped VMO are shared with every process mapping the same VMO
+#define FUTEX_WAIT_FOREVER (~0ULL)
+int futex_wait(volatile uint32 *uaddr, uint32 expected, uint64 timeout_ns);
+//wake up to count sleepers, returns how many were woken
+int futex_wake(volatile uint32 *uaddr, uint32 count);
 
 //directory entry structure
 #define DIRENT_NAME_MAX 64
@@ -129,6 +153,8 @@ typedef struct {
     uint64 data_len;     //actual bytes of data received
     uint32 handle_count; //number of handles received
     uint32 sender_pid;   //PID of the process that sent this message (0 if kernel)
+    uint32 txid;         //channel_call transaction to answer, 0 for plain messages
+    uint32 reserved;
 } channel_recv_result_t;
 
 int channel_recv_msg(handle_t ep, void *data_buf, int data_len,
@@ -138,6 +164,39 @@ int channel_try_recv_msg(handle_t ep, void *data_buf, int data_len,
                      int32 *handles_buf, uint32 handles_len,
                      channel_recv_result_t *result);
 
+//batched data-only channel IO, one kernel crossing for up to CHANNEL_BATCH_MAX messages
+#define CHANNEL_BATCH_MAX       16
+#define CHANNEL_BATCH_NONBLOCK  (1 << 0)    //recv returns -3 instead of waiting
+
+typedef struct {
+    void *data;          //send: payload, recv: buffer
+    uint32 len;          //send: payload length, recv: buffer size
+    uint32 actual;       //recv: full message length (copy is truncated to len)
+    uint32 sender_pid;   //recv: PID of the sender (0 if kernel)
+    uint32 reserved;
+} channel_batch_msg_t;
+
+//returns how many leading messages were queued (stops when the peer queue fills)
+//-22 (EINVAL) for a count of 0 or over CHANNEL_BATCH_MAX, -13 (EACCES) without RIGHT_WRITE
+int channel_send_batch(handle_t ep, const channel_batch_msg_t *msgs, uint32 count);
+//returns how many messages were received into msgs[0..n)
+//-22 (EINVAL) for a count of 0, -13 (EACCES) without RIGHT_READ
+int channel_recv_batch(handle_t ep, channel_batch_msg_t *msgs, uint32 count, uint32 flags);
+
+//send req and block for its reply in one kernel crossing. the kernel tags the
+//request with a transaction id that the server sees in channel_recv_result_t
+//and answers with channel_send_reply. the payload is passed through untouched
+//and the reply goes to this caller only, other receivers on ep never see it
+//a reply sent after the call timed out is discarded
+//timeout_ns is relative, CHANNEL_CALL_FOREVER waits indefinitely
+//returns the full reply length (copy truncated to reply_len), -2 if the peer
+//closed, -110 (ETIMEDOUT) on timeout or another negative error
+#define CHANNEL_CALL_FOREVER    (~0ULL)
+int channel_call(handle_t ep, const void *req, uint32 req_len,
+                 void *reply, uint32 reply_len, uint64 timeout_ns);
+//answer the request tagged txid, txid must not be 0
+int channel_send_reply(handle_t ep, uint32 txid, const void *data, uint32 len);
+
 //virtual memory objects
 handle_t vmo_create(uint64 size, uint32 flags, uint32 rights);
 int vmo_read(handle_t h, void *buf, uint64 len, uint64 offset);
@@ -145,6 +204,13 @@ int vmo_write(handle_t h, const void *buf, uint64 len, uint64 offset);
 void *vmo_map(handle_t h, void *vaddr_hint, uint64 offset, uint64 len, uint32 flags);
 int vmo_unmap(void *vaddr, uint64 len);
 int vmo_resize(handle_t h, uint64 new_size);
+//copy-on-write child of [offset, offset + len) of h, offset must be page aligned
+//flags must include VMO_CHILD_COW, VMO_FLAG_RESIZABLE is allowed too
+//the child is a snapshot: later writes to either side are not seen by the other
+handle_t vmo_create_child(handle_t h, uint64 offset, uint64 len, uint32 flags, uint32 rights);
+//give the pages wholly inside [offset, offset + len) back to the system
+//the range stays mapped and reads as zeroes (or parent data) until written again
+int vmo_decommit(handle_t h, uint64 offset, uint64 len);
 
 //namespace operations
 int ns_register(const char *path, handle_t h, uint32 max_rights);
@@ -172,7 +238,8 @@ typedef enum {
     OBJ_INFO_BOOT_CMDLINE = 6,  //boot cmdline string (requires system handle)
     OBJ_INFO_BLOCK_DEVICE = 7,  //block_device_info_t (requires device handle)
     OBJ_INFO_VT_STATE = 8,      //vt_info_t (requires vt device handle)
-    OBJ_INFO_BLOCK_RESCAN = 9   //trigger partition rescan (requires device handle)
+    OBJ_INFO_BLOCK_RESCAN = 9,  //trigger partition rescan (requires device handle)
+    OBJ_INFO_PMM_STATS = 10     //pmm_stats_t (requires system handle)
 } object_info_topic_t;
 
 typedef struct {
@@ -198,6 +265,23 @@ typedef struct {
     uint64 heap_free;
 } kmem_stats_t;
 
+//physical page allocator state, free_blocks[n] counts free 4K << n blocks
+typedef struct {
+    uint64 total_pages;
+    uint64 free_pages;          //buddy lists, per-CPU caches and the zero pool
+    uint64 buddy_free_pages;
+    uint64 pcp_pages;           //free pages parked in per-CPU caches
+    uint64 pcp_hits;
+    uint64 pcp_misses;
+    uint64 zero_pages;          //pre-zeroed pages waiting in the zero pool
+    uint64 zero_hits;
+    uint64 zero_misses;
+    uint64 dma_free_pages;      //free pages below 4GB
+    uint64 free_blocks[PMM_MAX_ORDER + 1];
+    int32 largest_order;        //order of the largest free block, -1 if none
+    uint32 frag_permille;       //free memory in blocks smaller than 2MB
+} pmm_stats_t;
+
 typedef struct {
     uint64 uptime_ns;
     uint64 ticks;
@@ -228,6 +312,26 @@ typedef struct {
 
 int object_get_info(handle_t h, uint32 topic, void *ptr, uint64 len);
 
+//object signals for object_wait_many
+#define OBJECT_SIGNAL_READABLE    (1u << 0) //channel has a queued message, socket has data/EOF/a connection to accept
+#define OBJECT_SIGNAL_WRITABLE    (1u << 1) //channel send would not hit a full queue, socket is connected
+#define OBJECT_SIGNAL_PEER_CLOSED (1u << 2) //other end of the channel or socket is closed
+#define OBJECT_SIGNAL_EXITED      (1u << 3) //process or thread terminated
+
+#define OBJECT_WAIT_MANY_MAX 32
+#define OBJECT_WAIT_FOREVER  (~0ULL)
+
+typedef struct {
+    handle_t handle;     //handle to wait on
+    uint32 waitfor;      //OBJECT_SIGNAL_* bits of interest
+    uint32 pending;      //out: signals asserted when the call returned
+} object_wait_item_t;
+
+//block until at least one item has a waited-for signal or timeout_ns elapses
+//every handle needs RIGHT_READ, at most OBJECT_WAIT_MANY_MAX items
+//returns the number of ready items, -110 (ETIMEDOUT) on timeout or another negative error
+int object_wait_many(object_wait_item_t *items, uint32 count, uint64 timeout_ns);
+
 //typed process context
 int context_set_string(const char *key, const char *value, uint32 flags);
 int context_set_i64(const char *key, int64 value, uint32 flags);
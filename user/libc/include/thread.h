@@ -0,0 +1,43 @@
+#ifndef _LIBC_THREAD_H
+#define _LIBC_THREAD_H
+
+#include <types.h>
+#include <system.h>
+
+/*
+ *pthread-like threads on top of SYS_THREAD_CREATE/EXIT/JOIN
+ *every thread owns a control block reachable through the FS base, which
+ *carries its errno and its thread-specific data slots
+ */
+
+#define THREAD_STACK_SIZE   (256 * 1024)
+#define THREAD_KEYS_MAX     32
+
+typedef struct thread_tcb *thread_t;
+typedef uint32 thread_key_t;
+
+//start fn(arg) on a new thread, returns 0 or a negative error
+int thread_create(thread_t *out, void *(*fn)(void *), void *arg);
+//wait for a thread and collect its return value (NULL ret to discard)
+int thread_join(thread_t t, void **ret);
+//let a thread clean up after itself, it can no longer be joined
+int thread_detach(thread_t t);
+//terminate the calling thread (the process lives on until exit() or its last thread)
+__attribute__((noreturn)) void thread_exit(void *ret);
+thread_t thread_self(void);
+
+//thread-specific data, destructors run for non-NULL values on thread exit
+int thread_key_create(thread_key_t *key, void (*destructor)(void *));
+void *thread_getspecific(thread_key_t key);
+int thread_setspecific(thread_key_t key, const void *value);
+
+//call fn exactly once across all threads
+typedef struct {
+    volatile uint32 state;
+} thread_once_t;
+
+#define THREAD_ONCE_INIT { 0 }
+
+void thread_once(thread_once_t *once, void (*fn)(void));
+
+#endif
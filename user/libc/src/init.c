@@ -1,7 +1,10 @@
 extern void _mem_init();
 extern void _io_init();
+extern void _thread_init();
 
 void _lib_init(void) {
+    //TLS first so errno and thread_self work for everything after it
+    _thread_init();
     _io_init();
     _mem_init();
 }
\ No newline at end of file
@@ -0,0 +1,161 @@
+#include <ring.h>
+#include <string.h>
+
+//records are padded to 4 bytes so the length word never straddles the wrap
+static inline uint32 ring_record_size(uint32 len) {
+    return RING_RECORD_HDR + ((len + 3) & ~3u);
+}
+
+static void ring_copy_in(ring_t *r, uint32 pos, const void *src, uint32 len) {
+    uint32 off = pos & (r->size - 1);
+    uint32 first = r->size - off;
+    if (first > len) first = len;
+    memcpy(r->tx_data + off, src, first);
+    if (len > first) memcpy(r->tx_data, (const uint8 *)src + first, len - first);
+}
+
+static void ring_copy_out(ring_t *r, uint32 pos, void *dst, uint32 len) {
+    uint32 off = pos & (r->size - 1);
+    uint32 first = r->size - off;
+    if (first > len) first = len;
+    memcpy(dst, r->rx_data + off, first);
+    if (len > first) memcpy((uint8 *)dst + first, r->rx_data, len - first);
+}
+
+static inline bool ring_peer_closed(ring_t *r) {
+    return __atomic_load_n(&r->ctrl->closed, __ATOMIC_ACQUIRE) & (1u << (1 - r->id));
+}
+
+//wake the other side if it announced it is going to sleep on *waiting
+static inline void ring_kick(volatile uint32 *waiting) {
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST)) {
+        futex_wake(waiting, 1);
+    }
+}
+
+int ring_attach(ring_t *r, handle_t ep) {
+    handle_t vmo;
+    int id = channel_ring_vmo(ep, &vmo);
+    if (id < 0) return id;
+
+    //the size lives in the control page so map that first
+    ring_ctrl_t *ctrl = vmo_map(vmo, NULL, 0, RING_CTRL_SIZE, RIGHT_READ | RIGHT_WRITE | RIGHT_MAP);
+    if (!ctrl) {
+        handle_close(vmo);
+        return -ENOMEM;
+    }
+    uint32 size = ctrl->ring_size;
+    if (ctrl->magic != RING_MAGIC) {
+        vmo_unmap(ctrl, RING_CTRL_SIZE);
+        handle_close(vmo);
+        return -EINVAL;
+    }
+    vmo_unmap(ctrl, RING_CTRL_SIZE);
+
+    ctrl = vmo_map(vmo, NULL, 0, RING_VMO_SIZE(size), RIGHT_READ | RIGHT_WRITE | RIGHT_MAP);
+    if (!ctrl) {
+        handle_close(vmo);
+        return -ENOMEM;
+    }
+
+    r->ctrl = ctrl;
+    r->vmo = vmo;
+    r->id = id;
+    r->size = size;
+    r->rx = &ctrl->dir[id];
+    r->tx = &ctrl->dir[1 - id];
+    r->rx_data = (uint8 *)ctrl + RING_DATA_OFFSET(size, id);
+    r->tx_data = (uint8 *)ctrl + RING_DATA_OFFSET(size, 1 - id);
+    return 0;
+}
+
+void ring_detach(ring_t *r) {
+    if (!r->ctrl) return;
+    vmo_unmap(r->ctrl, RING_VMO_SIZE(r->size));
+    handle_close(r->vmo);
+    r->ctrl = NULL;
+    r->vmo = INVALID_HANDLE;
+}
+
+uint32 ring_pending(ring_t *r) {
+    return __atomic_load_n(&r->rx->head, __ATOMIC_ACQUIRE) - r->rx->tail;
+}
+
+int ring_try_send(ring_t *r, const void *data, uint32 len) {
+    uint32 need = ring_record_size(len);
+    if (need > r->size) return RING_ERR_TOO_LARGE;
+    if (ring_peer_closed(r)) return RING_ERR_CLOSED;
+
+    ring_dir_t *d = r->tx;
+    uint32 head = d->head;
+    uint32 tail = __atomic_load_n(&d->tail, __ATOMIC_ACQUIRE);
+    if (r->size - (head - tail) < need) return RING_ERR_AGAIN;
+
+    ring_copy_in(r, head, &len, RING_RECORD_HDR);
+    ring_copy_in(r, head + RING_RECORD_HDR, data, len);
+    __atomic_store_n(&d->head, head + need, __ATOMIC_SEQ_CST);
+
+    ring_kick(&d->consumer_waiting);
+    return 0;
+}
+
+int ring_try_recv(ring_t *r, void *buf, uint32 buflen) {
+    ring_dir_t *d = r->rx;
+    uint32 tail = d->tail;
+    uint32 head = __atomic_load_n(&d->head, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return ring_peer_closed(r) ? RING_ERR_CLOSED : RING_ERR_AGAIN;
+    }
+
+    //head, tail and the length word all live in memory the peer can scribble
+    //on, a record must fit both the ring and what was actually published
+    uint32 avail = head - tail;
+    if (avail > r->size || avail < RING_RECORD_HDR) return RING_ERR_CORRUPT;
+    uint32 len;
+    ring_copy_out(r, tail, &len, RING_RECORD_HDR);
+    if (len > r->size - RING_RECORD_HDR || ring_record_size(len) > avail) return RING_ERR_CORRUPT;
+    if (len > buflen) return RING_ERR_TOO_LARGE;
+    ring_copy_out(r, tail + RING_RECORD_HDR, buf, len);
+    __atomic_store_n(&d->tail, tail + ring_record_size(len), __ATOMIC_SEQ_CST);
+
+    ring_kick(&d->producer_waiting);
+    return (int)len;
+}
+
+//announce a sleep on *waiting, then recheck before actually sleeping
+//the peer either sees the flag and wakes us or we see its progress
+static void ring_sleep(volatile uint32 *waiting, bool (*ready)(ring_t *, uint32), ring_t *r, uint32 arg) {
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    if (ready(r, arg) || ring_peer_closed(r)) {
+        __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+        return;
+    }
+    futex_wait(waiting, 1, FUTEX_WAIT_FOREVER);
+}
+
+static bool ring_has_room(ring_t *r, uint32 need) {
+    ring_dir_t *d = r->tx;
+    return r->size - (d->head - __atomic_load_n(&d->tail, __ATOMIC_SEQ_CST)) >= need;
+}
+
+static bool ring_has_data(ring_t *r, uint32 unused) {
+    (void)unused;
+    return __atomic_load_n(&r->rx->head, __ATOMIC_SEQ_CST) != r->rx->tail;
+}
+
+int ring_send(ring_t *r, const void *data, uint32 len) {
+    for (;;) {
+        int rc = ring_try_send(r, data, len);
+        if (rc != RING_ERR_AGAIN) return rc;
+        ring_sleep(&r->tx->producer_waiting, ring_has_room, r, ring_record_size(len));
+    }
+}
+
+int ring_recv(ring_t *r, void *buf, uint32 buflen) {
+    for (;;) {
+        int rc = ring_try_recv(r, buf, buflen);
+        if (rc != RING_ERR_AGAIN) return rc;
+        ring_sleep(&r->rx->consumer_waiting, ring_has_data, r, 0);
+    }
+}
@@ -1,9 +1,14 @@
-#include <mem.h>
+#include "internal.h"
 #include <string.h>
 
 void *calloc(size nmemb, size element_size) {
+    if (element_size && nmemb > (size)-1 / element_size) return NULL;
     size total_len = nmemb * element_size;
-    void *p = malloc(total_len);
-    if (p) memset(p, 0, total_len);
+    if (total_len == 0) return NULL;
+
+    //a fresh large mapping is already zero filled
+    bool zeroed = false;
+    void *p = total_len <= MALLOC_SMALL_MAX ? _malloc_small(total_len) : _malloc_large(total_len, &zeroed);
+    if (p && !zeroed) memset(p, 0, total_len);
     return p;
 }
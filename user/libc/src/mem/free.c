@@ -3,7 +3,12 @@
 void free(void *ptr) {
     if (!ptr) return;
 
-    malloc_header_t *header = _malloc_get_header(ptr);
-    header->is_free = true;
-    _malloc_coalesce(header);
+    if (_malloc_is_small(ptr)) {
+        _malloc_free_small(ptr);
+        return;
+    }
+
+    malloc_large_t *large = _malloc_large_header(ptr);
+    if (large->magic != MALLOC_LARGE_MAGIC) return;
+    _malloc_free_large(large);
 }
@@ -1,46 +1,269 @@
+#include <thread.h>
+#include <string.h>
 #include "internal.h"
 
-malloc_header_t *_malloc_free_list = NULL;
+malloc_span_t _malloc_spans[MALLOC_SPAN_COUNT];
 
-malloc_header_t *_malloc_find_free_block(size desired_len) {
-    malloc_header_t *curr = _malloc_free_list;
-    while (curr) {
-        if (curr->is_free && curr->s >= desired_len) {
-            return curr;
-        }
-        curr = curr->next;
+static malloc_span_t *partial[MALLOC_CLASSES];  //spans of a class with objects left
+static malloc_span_t *empty_spans;              //no objects, pages still committed
+static malloc_span_t *released_spans;           //no objects, pages decommitted
+static uint32 empty_count;
+static size span_next;                          //spans from here on were never used
+
+static malloc_large_t *large_cache[MALLOC_LARGE_CACHE];
+static uint32 large_cache_next;
+
+static thread_key_t tcache_key;
+static bool tcache_ready;
+static thread_once_t tcache_once = THREAD_ONCE_INIT;
+
+static inline char *span_base(malloc_span_t *s) {
+    return (char *)_mem_addr + ((size)(s - _malloc_spans) << MALLOC_SPAN_SHIFT);
+}
+
+static inline uint32 span_objs(uint32 cls) {
+    return (uint32)(MALLOC_SPAN_SIZE / _malloc_class_size(cls));
+}
+
+static void span_list_push(malloc_span_t **head, malloc_span_t *s) {
+    s->prev = NULL;
+    s->next = *head;
+    if (*head) (*head)->prev = s;
+    *head = s;
+}
+
+static void span_list_remove(malloc_span_t **head, malloc_span_t *s) {
+    if (s->prev) s->prev->next = s->next;
+    else *head = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+}
+
+//hand a span to a class, committed empty spans first (lock held)
+static malloc_span_t *span_take(uint32 cls) {
+    if (!_mem_addr) _mem_init();
+
+    malloc_span_t *s;
+    if (empty_spans) {
+        s = empty_spans;
+        span_list_remove(&empty_spans, s);
+        empty_count--;
+    } else if (released_spans) {
+        s = released_spans;
+        span_list_remove(&released_spans, s);
+    } else if (span_next < MALLOC_SPAN_COUNT) {
+        s = &_malloc_spans[span_next++];
+    } else {
+        return NULL;
     }
-    return NULL;
+
+    s->cls = (uint8)cls;
+    s->state = MALLOC_SPAN_ACTIVE;
+    s->free_list = NULL;
+    s->bump = 0;
+    s->free_count = (uint16)span_objs(cls);
+    span_list_push(&partial[cls], s);
+    return s;
 }
 
-void _malloc_split_block(malloc_header_t *header, size aligned_len) {
-    if (header->s >= aligned_len + HEADER_SIZE + MIN_ALLOC_SIZE) {
-        malloc_header_t *new_block = (malloc_header_t *)((char *)header + HEADER_SIZE + aligned_len);
-        new_block->s = header->s - aligned_len - HEADER_SIZE;
-        new_block->is_free = true;
-        new_block->next = header->next;
-        new_block->prev = header;
-        
-        if (header->next) header->next->prev = new_block;
-        header->next = new_block;
-        header->s = aligned_len;
+//every object of the span came back, keep a few spans warm and return the rest (lock held)
+static void span_release(malloc_span_t *s) {
+    span_list_remove(&partial[s->cls], s);
+    s->state = MALLOC_SPAN_EMPTY;
+    if (empty_count < MALLOC_SPAN_KEEP) {
+        span_list_push(&empty_spans, s);
+        empty_count++;
+        return;
     }
+    vmo_decommit(_mem_vmo, (uint64)(span_base(s) - (char *)_mem_addr), MALLOC_SPAN_SIZE);
+    span_list_push(&released_spans, s);
 }
 
-void _malloc_coalesce(malloc_header_t *header) {
-    if (!header || !header->is_free) return;
+//one object of a class straight from the spans (lock held)
+static malloc_obj_t *span_pop(uint32 cls) {
+    malloc_span_t *s = partial[cls];
+    if (!s && !(s = span_take(cls))) return NULL;
 
-    if (header->next && header->next->is_free) {
-        header->s += HEADER_SIZE + header->next->s;
-        malloc_header_t *old_next = header->next;
-        header->next = old_next->next;
-        if (header->next) header->next->prev = header;
+    malloc_obj_t *o;
+    if (s->free_list) {
+        o = s->free_list;
+        s->free_list = o->next;
+    } else {
+        //objects past bump were never handed out so their pages may not exist yet
+        o = (malloc_obj_t *)(span_base(s) + s->bump);
+        s->bump += (uint32)_malloc_class_size(cls);
     }
+    if (--s->free_count == 0) span_list_remove(&partial[cls], s);
+    return o;
+}
 
-    if (header->prev && header->prev->is_free) {
-        malloc_header_t *prev = header->prev;
-        prev->s += HEADER_SIZE + header->s;
-        prev->next = header->next;
-        if (header->next) header->next->prev = prev;
+//put one object back on its span (lock held)
+static void span_push(malloc_obj_t *o) {
+    malloc_span_t *s = _malloc_span_of(o);
+    if (s->state != MALLOC_SPAN_ACTIVE) return;   //double free into an empty span
+
+    if (s->free_count == 0) span_list_push(&partial[s->cls], s);
+    o->next = s->free_list;
+    s->free_list = o;
+    if (++s->free_count == span_objs(s->cls)) span_release(s);
+}
+
+uint32 _malloc_refill(malloc_tcache_t *tc, uint32 cls, uint32 want) {
+    uint32 got = 0;
+    while (got < want) {
+        malloc_obj_t *o = span_pop(cls);
+        if (!o) break;
+        o->next = tc->head[cls];
+        tc->head[cls] = o;
+        tc->count[cls]++;
+        got++;
     }
+    return got;
+}
+
+void _malloc_flush(malloc_tcache_t *tc, uint32 cls, uint32 n) {
+    while (n-- > 0 && tc->head[cls]) {
+        malloc_obj_t *o = tc->head[cls];
+        tc->head[cls] = o->next;
+        tc->count[cls]--;
+        span_push(o);
+    }
+}
+
+//thread exit: everything cached goes back to the spans, the cache itself too
+static void tcache_destroy(void *arg) {
+    malloc_tcache_t *tc = arg;
+    mutex_lock(&_malloc_lock);
+    for (uint32 cls = 0; cls < MALLOC_CLASSES; cls++) _malloc_flush(tc, cls, tc->count[cls]);
+    span_push((malloc_obj_t *)tc);
+    mutex_unlock(&_malloc_lock);
+}
+
+static void tcache_key_init(void) {
+    tcache_ready = thread_key_create(&tcache_key, tcache_destroy) == 0;
+}
+
+malloc_tcache_t *_malloc_tcache(void) {
+    thread_once(&tcache_once, tcache_key_init);
+    if (!tcache_ready) return NULL;
+
+    malloc_tcache_t *tc = thread_getspecific(tcache_key);
+    if (tc) return tc;
+
+    //the cache comes straight from the spans since there is no cache to go through yet
+    mutex_lock(&_malloc_lock);
+    tc = (malloc_tcache_t *)span_pop(_malloc_class_of(sizeof(malloc_tcache_t)));
+    mutex_unlock(&_malloc_lock);
+    if (!tc) return NULL;
+    memset(tc, 0, sizeof(*tc));
+    thread_setspecific(tcache_key, tc);
+    return tc;
+}
+
+void *_malloc_small(size len) {
+    uint32 cls = _malloc_class_of(len);
+    malloc_tcache_t *tc = _malloc_tcache();
+
+    //no thread cache (out of keys or memory), go to the spans for every object
+    if (!tc) {
+        mutex_lock(&_malloc_lock);
+        void *p = span_pop(cls);
+        mutex_unlock(&_malloc_lock);
+        return p;
+    }
+
+    if (!tc->head[cls]) {
+        uint32 batch = _malloc_tcache_limit(cls) / 2;
+        mutex_lock(&_malloc_lock);
+        uint32 got = _malloc_refill(tc, cls, batch ? batch : 1);
+        mutex_unlock(&_malloc_lock);
+        if (!got) return NULL;
+    }
+
+    malloc_obj_t *o = tc->head[cls];
+    tc->head[cls] = o->next;
+    tc->count[cls]--;
+    return o;
+}
+
+void _malloc_free_small(void *ptr) {
+    malloc_tcache_t *tc = _malloc_tcache();
+    if (!tc) {
+        mutex_lock(&_malloc_lock);
+        span_push(ptr);
+        mutex_unlock(&_malloc_lock);
+        return;
+    }
+
+    uint32 cls = _malloc_span_of(ptr)->cls;
+    malloc_obj_t *o = ptr;
+    o->next = tc->head[cls];
+    tc->head[cls] = o;
+
+    //over the limit, half of the cached objects go back so other threads can use them
+    uint32 limit = _malloc_tcache_limit(cls);
+    if (++tc->count[cls] > limit) {
+        mutex_lock(&_malloc_lock);
+        _malloc_flush(tc, cls, limit / 2);
+        mutex_unlock(&_malloc_lock);
+    }
+}
+
+static void large_unmap(malloc_large_t *large) {
+    handle_t vmo = large->vmo;
+    vmo_unmap(large, large->mapped);
+    handle_close(vmo);
+}
+
+void *_malloc_large(size len, bool *zeroed) {
+    if (len > (size)-1 - LARGE_HEADER_SIZE - 0xFFF) return NULL;
+    size need = (LARGE_HEADER_SIZE + len + 0xFFF) & ~(size)0xFFF;
+
+    //a recently freed mapping that fits without wasting more than a quarter of it
+    malloc_large_t *large = NULL;
+    mutex_lock(&_malloc_lock);
+    for (uint32 i = 0; i < MALLOC_LARGE_CACHE; i++) {
+        malloc_large_t *c = large_cache[i];
+        if (c && c->mapped >= need && c->mapped - need <= need / 4) {
+            large = c;
+            large_cache[i] = NULL;
+            break;
+        }
+    }
+    mutex_unlock(&_malloc_lock);
+
+    if (large) {
+        *zeroed = false;
+    } else {
+        uint32 flags = need >= MALLOC_HUGE_MIN ? VMO_FLAG_HUGE : VMO_FLAG_NONE;
+        handle_t vmo = vmo_create(need, flags, RIGHT_READ | RIGHT_WRITE | RIGHT_MAP);
+        if (vmo == INVALID_HANDLE) return NULL;
+        large = vmo_map(vmo, NULL, 0, need, RIGHT_READ | RIGHT_WRITE | RIGHT_MAP);
+        if (!large) {
+            handle_close(vmo);
+            return NULL;
+        }
+        large->magic = MALLOC_LARGE_MAGIC;
+        large->vmo = vmo;
+        large->mapped = need;
+        *zeroed = true;
+    }
+    large->len = len;
+    return (char *)large + LARGE_HEADER_SIZE;
+}
+
+void _malloc_free_large(malloc_large_t *large) {
+    if (large->mapped > MALLOC_LARGE_CACHE_MAX) {
+        large_unmap(large);
+        return;
+    }
+
+    //park it in the cache, whatever it displaces goes back to the system
+    mutex_lock(&_malloc_lock);
+    malloc_large_t *old = large_cache[large_cache_next];
+    large_cache[large_cache_next] = large;
+    large_cache_next = (large_cache_next + 1) % MALLOC_LARGE_CACHE;
+    mutex_unlock(&_malloc_lock);
+
+    if (old) large_unmap(old);
 }
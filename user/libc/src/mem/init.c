@@ -5,28 +5,22 @@
 handle_t _mem_vmo = INVALID_HANDLE;
 void *_mem_addr = 0;
 size heap_capacity = 0;
+mutex_t _malloc_lock = MUTEX_INIT;
 
 #define HEAP_MAP_HINT (void*)0x4000000000ULL
 
 void _mem_init(void) {
     if (_mem_addr) return;
 
+    //the whole reserve is mapped once, pages are only committed when a span touches them
     //retry until vmo_create succeeds
-    while ((_mem_vmo = vmo_create(HEAP_SIZE, VMO_FLAG_RESIZABLE, RIGHT_READ | RIGHT_WRITE | RIGHT_MAP)) == INVALID_HANDLE) {
+    while ((_mem_vmo = vmo_create(HEAP_RESERVE, VMO_FLAG_NONE, RIGHT_READ | RIGHT_WRITE | RIGHT_MAP)) == INVALID_HANDLE) {
         yield();
     }
     
-    //retry until vmo_ma succeeds - use hint to avoid library collisions
-    while ((_mem_addr = vmo_map(_mem_vmo, HEAP_MAP_HINT, 0, HEAP_SIZE, RIGHT_READ | RIGHT_WRITE | RIGHT_MAP)) == NULL) {
+    //retry until vmo_map succeeds - use hint to avoid library collisions
+    while ((_mem_addr = vmo_map(_mem_vmo, HEAP_MAP_HINT, 0, HEAP_RESERVE, RIGHT_READ | RIGHT_WRITE | RIGHT_MAP)) == NULL) {
         yield();
     }
-    heap_capacity = HEAP_SIZE;
-
-    malloc_header_t *first = (malloc_header_t *)_mem_addr;
-    first->s = HEAP_SIZE - sizeof(malloc_header_t);
-    first->is_free = true;
-    first->next = NULL;
-    first->prev = NULL;
-    
-    _malloc_free_list = first;
-}
\ No newline at end of file
+    heap_capacity = HEAP_RESERVE;
+}
@@ -2,29 +2,114 @@
 #define _LIBC_MEM_INTERNAL_H
 
 #include <mem.h>
+#include <sync.h>
 
-typedef struct malloc_header {
-    size s;                  
-    bool is_free;
-    struct malloc_header *next;
-    struct malloc_header *prev;
-} malloc_header_t;
+/*
+ *size class allocator
+ *
+ *small requests are rounded up to one of MALLOC_CLASSES sizes and carved out
+ *of 64KB spans inside one lazily committed heap VMO, a span only ever holds
+ *objects of one class so an object needs no header: its span (and class) is
+ *found from the address alone
+ *
+ *each thread keeps a short free list per class that malloc and free use
+ *without locking, the shared spans are only touched under _malloc_lock to
+ *move objects in batches
+ *
+ *requests above MALLOC_SMALL_MAX get a VMO and mapping of their own that goes
+ *back to the system on free, empty spans past the first few have their pages
+ *decommitted
+ */
 
-#define MIN_ALLOC_SIZE 16
-#define HEADER_SIZE sizeof(malloc_header_t)
+#define MALLOC_ALIGN        16
+#define MALLOC_SPAN_SHIFT   16
+#define MALLOC_SPAN_SIZE    (1UL << MALLOC_SPAN_SHIFT)
+#define MALLOC_SPAN_COUNT   (HEAP_RESERVE / MALLOC_SPAN_SIZE)
+#define MALLOC_SMALL_MAX    32768
+#define MALLOC_CLASSES      40      //16 to 128 in steps of 16, then four per doubling
+#define MALLOC_SPAN_KEEP    4       //empty spans kept committed for reuse
+#define MALLOC_LARGE_CACHE  4       //freed large mappings kept for reuse
+#define MALLOC_LARGE_CACHE_MAX (8UL << 20)  //bigger mappings always go straight back
+#define MALLOC_HUGE_MIN     (2UL << 20)     //large mappings from here on ask for 2MB pages
+#define MALLOC_LARGE_MAGIC  0x4C41524745ULL
 
-extern malloc_header_t *_malloc_free_list;
+#define MALLOC_SPAN_UNUSED  0
+#define MALLOC_SPAN_ACTIVE  1       //owned by a class
+#define MALLOC_SPAN_EMPTY   2       //on the empty span list
 
-static inline size _malloc_align_up(size s) {
-    return (s + 15) & ~15;
+typedef struct malloc_obj {
+    struct malloc_obj *next;
+} malloc_obj_t;
+
+typedef struct malloc_span {
+    malloc_obj_t *free_list;        //objects given back to this span
+    uint32 bump;                    //offset of the first never used object
+    uint16 free_count;              //objects not handed out (free list plus bump)
+    uint8 cls;
+    uint8 state;
+    struct malloc_span *next;       //partial, empty or released list
+    struct malloc_span *prev;
+} malloc_span_t;
+
+//one per thread, reached through a thread-specific data key
+typedef struct {
+    malloc_obj_t *head[MALLOC_CLASSES];
+    uint16 count[MALLOC_CLASSES];
+} malloc_tcache_t;
+
+//in front of every large allocation, keeps the payload 16 byte aligned
+typedef struct {
+    uint64 magic;
+    handle_t vmo;
+    size mapped;                    //bytes mapped, header included
+    size len;                       //bytes the caller asked for
+} malloc_large_t;
+
+#define LARGE_HEADER_SIZE ((sizeof(malloc_large_t) + MALLOC_ALIGN - 1) & ~(size)(MALLOC_ALIGN - 1))
+
+//serializes span lists, the span table and the large cache across threads
+extern mutex_t _malloc_lock;
+extern malloc_span_t _malloc_spans[MALLOC_SPAN_COUNT];
+
+static inline uint32 _malloc_class_of(size s) {
+    if (s <= 128) return s ? (uint32)((s - 1) >> 4) : 0;
+    uint32 g = 63 - (uint32)__builtin_clzll(s - 1);
+    return 8 + (g - 7) * 4 + (uint32)(((s - 1) >> (g - 2)) & 3);
+}
+
+static inline size _malloc_class_size(uint32 cls) {
+    if (cls < 8) return (size)(cls + 1) << 4;
+    uint32 g = 7 + (cls - 8) / 4;
+    return (size)(5 + (cls - 8) % 4) << (g - 2);
+}
+
+//objects a thread caches per class before half of them go back to the spans
+static inline uint32 _malloc_tcache_limit(uint32 cls) {
+    size n = 16384 / _malloc_class_size(cls);
+    if (n < 2) return 2;
+    return n > 64 ? 64 : (uint32)n;
+}
+
+static inline bool _malloc_is_small(void *ptr) {
+    return _mem_addr && (char *)ptr >= (char *)_mem_addr && (char *)ptr < (char *)_mem_addr + heap_capacity;
+}
+
+static inline malloc_span_t *_malloc_span_of(void *ptr) {
+    return &_malloc_spans[((char *)ptr - (char *)_mem_addr) >> MALLOC_SPAN_SHIFT];
 }
 
-static inline malloc_header_t *_malloc_get_header(void *ptr) {
-    return (malloc_header_t *)((char *)ptr - HEADER_SIZE);
+static inline malloc_large_t *_malloc_large_header(void *ptr) {
+    return (malloc_large_t *)((char *)ptr - LARGE_HEADER_SIZE);
 }
 
-malloc_header_t *_malloc_find_free_block(size desired_len);
-void _malloc_split_block(malloc_header_t *header, size aligned_len);
-void _malloc_coalesce(malloc_header_t *header);
+malloc_tcache_t *_malloc_tcache(void);
+//move up to want objects of a class onto a thread cache, returns how many moved (lock held)
+uint32 _malloc_refill(malloc_tcache_t *tc, uint32 cls, uint32 want);
+//give up to n objects of a class from a thread cache back to their spans (lock held)
+void _malloc_flush(malloc_tcache_t *tc, uint32 cls, uint32 n);
+void *_malloc_small(size len);
+void _malloc_free_small(void *ptr);
+void *_malloc_large(size len, bool *zeroed);
+void _malloc_free_large(malloc_large_t *large);
 
 #endif
@@ -8,28 +8,25 @@ void *realloc(void *ptr, size len) {
         return NULL;
     }
 
-    malloc_header_t *header = _malloc_get_header(ptr);
-    size aligned_len = _malloc_align_up(len);
-
-    if (header->s >= aligned_len) {
-        _malloc_split_block(header, aligned_len);
-        return ptr;
-    }
-
-    if (header->next && header->next->is_free && (header->s + HEADER_SIZE + header->next->s) >= aligned_len) {
-        header->s += HEADER_SIZE + header->next->s;
-        malloc_header_t *old_next = header->next;
-        header->next = old_next->next;
-        if (header->next) header->next->prev = header;
-        
-        _malloc_split_block(header, aligned_len);
-        return ptr;
+    //shrinking or growing within the object's size class or mapping stays in place
+    size old_len;
+    if (_malloc_is_small(ptr)) {
+        old_len = _malloc_class_size(_malloc_span_of(ptr)->cls);
+        if (len <= old_len) return ptr;
+    } else {
+        malloc_large_t *large = _malloc_large_header(ptr);
+        if (large->magic != MALLOC_LARGE_MAGIC) return NULL;
+        if (len <= large->mapped - LARGE_HEADER_SIZE) {
+            large->len = len;
+            return ptr;
+        }
+        old_len = large->len;
     }
 
     void *new_ptr = malloc(len);
     if (!new_ptr) return NULL;
 
-    memcpy(new_ptr, ptr, header->s);
+    memcpy(new_ptr, ptr, old_len < len ? old_len : len);
     free(ptr);
     return new_ptr;
 }
@@ -0,0 +1,39 @@
+#include <sync.h>
+#include <system.h>
+#include <errno.h>
+
+void cond_init(cond_t *c) {
+    c->seq = 0;
+}
+
+//re-take the mutex as contended: other waiters may be queued behind us
+//and the plain fast path would let mutex_unlock skip waking them
+static void cond_relock(mutex_t *m) {
+    while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        futex_wait(&m->state, 2, FUTEX_WAIT_FOREVER);
+    }
+}
+
+int cond_timedwait(cond_t *c, mutex_t *m, uint64 timeout_ns) {
+    //a signal between the unlock and the sleep bumps seq so the wait
+    //returns straight away instead of missing it
+    uint32 seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+    mutex_unlock(m);
+    int rc = futex_wait(&c->seq, seq, timeout_ns);
+    cond_relock(m);
+    return (rc == -ETIMEDOUT) ? -1 : 0;
+}
+
+void cond_wait(cond_t *c, mutex_t *m) {
+    cond_timedwait(c, m, FUTEX_WAIT_FOREVER);
+}
+
+void cond_signal(cond_t *c) {
+    __atomic_add_fetch(&c->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&c->seq, 1);
+}
+
+void cond_broadcast(cond_t *c) {
+    __atomic_add_fetch(&c->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&c->seq, UINT32_MAX);
+}
@@ -0,0 +1,37 @@
+#include <sync.h>
+#include <system.h>
+
+//three-state futex mutex (Drepper, "Futexes Are Tricky")
+//unlock only enters the kernel if a locker marked the word contended
+
+void mutex_init(mutex_t *m) {
+    m->state = 0;
+}
+
+bool mutex_trylock(mutex_t *m) {
+    uint32 expected = 0;
+    return __atomic_compare_exchange_n(&m->state, &expected, 1, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutex_lock(mutex_t *m) {
+    uint32 c = 0;
+    if (__atomic_compare_exchange_n(&m->state, &c, 1, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    //slow path: advertise a sleeper, then sleep until we take it from 0
+    if (c != 2) c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        futex_wait(&m->state, 2, FUTEX_WAIT_FOREVER);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+void mutex_unlock(mutex_t *m) {
+    if (__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+        futex_wake(&m->state, 1);
+    }
+}
@@ -0,0 +1,56 @@
+#include <sync.h>
+#include <system.h>
+#include <errno.h>
+
+void sem_init(sem_t *s, uint32 value) {
+    s->count = value;
+    s->waiters = 0;
+}
+
+bool sem_trywait(sem_t *s) {
+    uint32 c = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+    while (c > 0) {
+        if (__atomic_compare_exchange_n(&s->count, &c, c - 1, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int sem_timedwait(sem_t *s, uint64 timeout_ns) {
+    //fix the deadline once, a wakeup that loses the count to another waiter
+    //must not restart the timeout
+    uint64 deadline = FUTEX_WAIT_FOREVER;
+    if (timeout_ns != FUTEX_WAIT_FOREVER) {
+        uint64 now = clock_ns();
+        deadline = timeout_ns > FUTEX_WAIT_FOREVER - now ? FUTEX_WAIT_FOREVER : now + timeout_ns;
+    }
+
+    while (!sem_trywait(s)) {
+        uint64 wait_ns = FUTEX_WAIT_FOREVER;
+        if (deadline != FUTEX_WAIT_FOREVER) {
+            uint64 now = clock_ns();
+            if (now >= deadline) return -1;
+            wait_ns = deadline - now;
+        }
+
+        //register before sleeping so sem_post knows to enter the kernel
+        __atomic_add_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+        int rc = futex_wait(&s->count, 0, wait_ns);
+        __atomic_sub_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+        if (rc == -ETIMEDOUT) return sem_trywait(s) ? 0 : -1;
+    }
+    return 0;
+}
+
+void sem_wait(sem_t *s) {
+    sem_timedwait(s, FUTEX_WAIT_FOREVER);
+}
+
+void sem_post(sem_t *s) {
+    __atomic_add_fetch(&s->count, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST)) {
+        futex_wake(&s->count, 1);
+    }
+}
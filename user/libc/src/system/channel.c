@@ -17,6 +17,31 @@ int channel_try_recv(int32 ep, void *buf, int buflen) {
     return __syscall3(SYS_CHANNEL_TRY_RECV, ep, (long)buf, buflen);
 }
 
+int channel_send_batch(int32 ep, const channel_batch_msg_t *msgs, uint32 count) {
+    return __syscall3(SYS_CHANNEL_SEND_BATCH, ep, (long)msgs, count);
+}
+
+int channel_recv_batch(int32 ep, channel_batch_msg_t *msgs, uint32 count, uint32 flags) {
+    return __syscall4(SYS_CHANNEL_RECV_BATCH, ep, (long)msgs, count, flags);
+}
+
+int channel_call(int32 ep, const void *req, uint32 req_len,
+                 void *reply, uint32 reply_len, uint64 timeout_ns) {
+    return __syscall6(SYS_CHANNEL_CALL, ep, (long)req, req_len, (long)reply, reply_len, (long)timeout_ns);
+}
+
+int channel_send_reply(int32 ep, uint32 txid, const void *data, uint32 len) {
+    return __syscall4(SYS_CHANNEL_SEND_REPLY, ep, txid, (long)data, len);
+}
+
+int channel_create_ring(int32 *ep0, int32 *ep1, int32 *ring_vmo, uint32 ring_size) {
+    return __syscall4(SYS_CHANNEL_CREATE_RING, (long)ep0, (long)ep1, (long)ring_vmo, ring_size);
+}
+
+int channel_ring_vmo(int32 ep, int32 *ring_vmo) {
+    return __syscall2(SYS_CHANNEL_RING_VMO, ep, (long)ring_vmo);
+}
+
 int channel_recv_msg(int32 ep, void *data_buf, int data_len,
                      int32 *handles_buf, uint32 handles_len,
                      channel_recv_result_t *result) {
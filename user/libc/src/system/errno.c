@@ -1,5 +1,5 @@
-static int _errno = 0;
+#include "../thread/internal.h"
 
 int *__errno_location(void) {
-    return &_errno;
+    return &_thread_tcb()->err;
 }
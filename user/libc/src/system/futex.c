@@ -0,0 +1,10 @@
+#include <system.h>
+#include <sys/syscall.h>
+
+int futex_wait(volatile uint32 *uaddr, uint32 expected, uint64 timeout_ns) {
+    return (int)__syscall3(SYS_FUTEX_WAIT, (long)uaddr, (long)expected, (long)timeout_ns);
+}
+
+int futex_wake(volatile uint32 *uaddr, uint32 count) {
+    return (int)__syscall2(SYS_FUTEX_WAKE, (long)uaddr, (long)count);
+}
@@ -75,3 +75,7 @@ char* handle_getstr(char* buf, int bufsz, int32 f) {
     buf[pos] = '\0';
     return buf;
 }
+
+int object_wait_many(object_wait_item_t *items, uint32 count, uint64 timeout_ns) {
+    return (int)__syscall3(SYS_OBJECT_WAIT_MANY, (long)items, count, (long)timeout_ns);
+}
@@ -0,0 +1,19 @@
+#include <system.h>
+#include <sys/syscall.h>
+
+handle_t thread_spawn(void (*entry)(void *), void *stack, void *arg, void *tls) {
+    return (handle_t)__syscall4(SYS_THREAD_CREATE, (long)entry, (long)stack, (long)arg, (long)tls);
+}
+
+__attribute__((noreturn)) void thread_exit_self(void) {
+    __syscall0(SYS_THREAD_EXIT);
+    __builtin_unreachable();
+}
+
+int thread_wait(handle_t thread_h, uint64 timeout_ns) {
+    return (int)__syscall2(SYS_THREAD_JOIN, (long)thread_h, (long)timeout_ns);
+}
+
+int thread_set_tls(void *tls) {
+    return (int)__syscall1(SYS_THREAD_SET_TLS, (long)tls);
+}
@@ -4,3 +4,15 @@
 uint64 get_ticks(void) {
     return (uint64)__syscall0(SYS_GET_TICKS);
 }
+
+uint64 clock_ns(void) {
+    return (uint64)__syscall0(SYS_CLOCK_NS);
+}
+
+void sleep_ms(uint64 ms) {
+    __syscall1(SYS_SLEEP, (long)ms);
+}
+
+void nanosleep(uint64 ns) {
+    __syscall1(SYS_NANOSLEEP, (long)ns);
+}
@@ -35,3 +35,13 @@ int vmo_unmap(void *vaddr, uint64 len) {
 int vmo_resize(int32 h, uint64 new_size) {
     return __syscall2(SYS_VMO_RESIZE, (long)h, (long)new_size);
 }
+
+//create a copy-on-write child of part of a VMO
+int32 vmo_create_child(int32 h, uint64 offset, uint64 len, uint32 flags, uint32 rights) {
+    return __syscall5(SYS_VMO_CREATE_CHILD, (long)h, (long)offset, (long)len, (long)flags, (long)rights);
+}
+
+//release the committed pages of a VMO range
+int vmo_decommit(int32 h, uint64 offset, uint64 len) {
+    return __syscall3(SYS_VMO_DECOMMIT, (long)h, (long)offset, (long)len);
+}
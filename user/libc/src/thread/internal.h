@@ -0,0 +1,41 @@
+#ifndef _LIBC_THREAD_INTERNAL_H
+#define _LIBC_THREAD_INTERNAL_H
+
+#include <thread.h>
+
+//detach_state transitions (each side CASes exactly once)
+#define TCB_JOINABLE    0
+#define TCB_DETACHED    1
+#define TCB_EXITING     2
+
+//thread control block, FS base points at it so self is at %fs:0
+typedef struct thread_tcb {
+    struct thread_tcb *self;
+    void *(*fn)(void *);
+    void *arg;
+    void *ret;
+    int err;                    //per-thread errno
+    handle_t handle;            //thread object (INVALID_HANDLE for the main thread)
+    handle_t stack_vmo;
+    void *stack_base;
+    size stack_size;
+    volatile uint32 detach_state;
+    struct thread_tcb *next;    //graveyard link once a detached thread exits
+    void *specific[THREAD_KEYS_MAX];
+} thread_tcb_t;
+
+extern thread_tcb_t _thread_main;
+extern volatile uint32 _thread_tls_ready;
+
+void _thread_init(void);
+void _thread_run_destructors(thread_tcb_t *tcb);
+
+static inline thread_tcb_t *_thread_tcb(void) {
+    //anything running before _lib_init has no FS base yet
+    if (!_thread_tls_ready) return &_thread_main;
+    thread_tcb_t *tcb;
+    __asm__ volatile("mov %%fs:0, %0" : "=r"(tcb));
+    return tcb;
+}
+
+#endif
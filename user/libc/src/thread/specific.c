@@ -0,0 +1,66 @@
+#include <thread.h>
+#include <system.h>
+#include <errno.h>
+#include "internal.h"
+
+//thread-specific data slots, each key owns the same slot in every tcb
+static void (*destructors[THREAD_KEYS_MAX])(void *);
+static volatile uint32 key_used[THREAD_KEYS_MAX];
+
+#define DESTRUCTOR_PASSES 4
+
+int thread_key_create(thread_key_t *key, void (*destructor)(void *)) {
+    for (uint32 i = 0; i < THREAD_KEYS_MAX; i++) {
+        uint32 expected = 0;
+        if (__atomic_compare_exchange_n(&key_used[i], &expected, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            destructors[i] = destructor;
+            *key = i;
+            return 0;
+        }
+    }
+    return -EAGAIN;
+}
+
+void *thread_getspecific(thread_key_t key) {
+    if (key >= THREAD_KEYS_MAX) return NULL;
+    return _thread_tcb()->specific[key];
+}
+
+int thread_setspecific(thread_key_t key, const void *value) {
+    if (key >= THREAD_KEYS_MAX || !key_used[key]) return -EINVAL;
+    _thread_tcb()->specific[key] = (void *)value;
+    return 0;
+}
+
+void _thread_run_destructors(thread_tcb_t *tcb) {
+    //a destructor may store new values so repeat a bounded number of times
+    for (int pass = 0; pass < DESTRUCTOR_PASSES; pass++) {
+        bool ran = false;
+        for (uint32 i = 0; i < THREAD_KEYS_MAX; i++) {
+            void *value = tcb->specific[i];
+            if (!value || !destructors[i]) continue;
+            tcb->specific[i] = NULL;
+            destructors[i](value);
+            ran = true;
+        }
+        if (!ran) return;
+    }
+}
+
+void thread_once(thread_once_t *once, void (*fn)(void)) {
+    //0 = not run, 1 = running, 2 = done
+    if (__atomic_load_n(&once->state, __ATOMIC_ACQUIRE) == 2) return;
+
+    uint32 expected = 0;
+    if (__atomic_compare_exchange_n(&once->state, &expected, 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        fn();
+        __atomic_store_n(&once->state, 2, __ATOMIC_RELEASE);
+        futex_wake(&once->state, UINT32_MAX);
+        return;
+    }
+    while (__atomic_load_n(&once->state, __ATOMIC_ACQUIRE) != 2) {
+        futex_wait(&once->state, 1, FUTEX_WAIT_FOREVER);
+    }
+}
@@ -0,0 +1,152 @@
+#include <thread.h>
+#include <sync.h>
+#include <string.h>
+#include <errno.h>
+#include "internal.h"
+
+thread_tcb_t _thread_main;
+volatile uint32 _thread_tls_ready = 0;
+
+//detached threads that exited, their stacks are freed by the next creator
+static thread_tcb_t *graveyard = NULL;
+static mutex_t graveyard_lock = MUTEX_INIT;
+
+void _thread_init(void) {
+    _thread_main.self = &_thread_main;
+    _thread_main.handle = INVALID_HANDLE;
+    _thread_main.stack_vmo = INVALID_HANDLE;
+    if (thread_set_tls(&_thread_main) == 0) _thread_tls_ready = 1;
+}
+
+thread_t thread_self(void) {
+    return _thread_tcb();
+}
+
+static void thread_free(thread_tcb_t *tcb) {
+    handle_t vmo = tcb->stack_vmo;
+    void *base = tcb->stack_base;
+    size len = tcb->stack_size;
+
+    handle_close(tcb->handle);
+    //the tcb lives inside the stack mapping so nothing may touch it past here
+    vmo_unmap(base, len);
+    handle_close(vmo);
+}
+
+static void thread_reap(void) {
+    mutex_lock(&graveyard_lock);
+    thread_tcb_t *list = graveyard;
+    graveyard = NULL;
+    mutex_unlock(&graveyard_lock);
+
+    thread_tcb_t *keep = NULL;
+    while (list) {
+        thread_tcb_t *tcb = list;
+        list = tcb->next;
+        //still on its way out of the kernel, try again next time
+        if (thread_wait(tcb->handle, 0) != 0) {
+            tcb->next = keep;
+            keep = tcb;
+            continue;
+        }
+        thread_free(tcb);
+    }
+
+    if (!keep) return;
+    mutex_lock(&graveyard_lock);
+    thread_tcb_t *tail = keep;
+    while (tail->next) tail = tail->next;
+    tail->next = graveyard;
+    graveyard = keep;
+    mutex_unlock(&graveyard_lock);
+}
+
+__attribute__((noreturn)) void thread_exit(void *ret) {
+    thread_tcb_t *tcb = _thread_tcb();
+    tcb->ret = ret;
+    _thread_run_destructors(tcb);
+
+    //the main thread has no libc-owned stack so there is nothing to hand off
+    if (tcb != &_thread_main) {
+        uint32 state = TCB_JOINABLE;
+        if (!__atomic_compare_exchange_n(&tcb->detach_state, &state, TCB_EXITING, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            //detached: the kernel EXITED signal tells the reaper when the stack is free
+            mutex_lock(&graveyard_lock);
+            tcb->next = graveyard;
+            graveyard = tcb;
+            mutex_unlock(&graveyard_lock);
+        }
+    }
+    thread_exit_self();
+}
+
+__attribute__((noreturn)) static void thread_start(void *arg) {
+    thread_tcb_t *tcb = (thread_tcb_t *)arg;
+    thread_exit(tcb->fn(tcb->arg));
+}
+
+int thread_create(thread_t *out, void *(*fn)(void *), void *arg) {
+    if (!out || !fn) return -EINVAL;
+    thread_reap();
+
+    size len = THREAD_STACK_SIZE;
+    handle_t vmo = vmo_create(len, VMO_FLAG_NONE, RIGHT_READ | RIGHT_WRITE | RIGHT_MAP);
+    if (vmo == INVALID_HANDLE) return -ENOMEM;
+    void *base = vmo_map(vmo, NULL, 0, len, RIGHT_READ | RIGHT_WRITE | RIGHT_MAP);
+    if (!base) {
+        handle_close(vmo);
+        return -ENOMEM;
+    }
+
+    //tcb at the top of the mapping, the stack grows down beneath it
+    uintptr top = ((uintptr)base + len - sizeof(thread_tcb_t)) & ~(uintptr)15;
+    thread_tcb_t *tcb = (thread_tcb_t *)top;
+    memset(tcb, 0, sizeof(*tcb));
+    tcb->self = tcb;
+    tcb->fn = fn;
+    tcb->arg = arg;
+    tcb->stack_vmo = vmo;
+    tcb->stack_base = base;
+    tcb->stack_size = len;
+    tcb->detach_state = TCB_JOINABLE;
+
+    //enter thread_start as if called: rsp + 8 is 16-byte aligned
+    void *sp = (void *)(top - 8);
+    handle_t h = thread_spawn(thread_start, sp, tcb, tcb);
+    if (h < 0) {
+        vmo_unmap(base, len);
+        handle_close(vmo);
+        return h;
+    }
+    tcb->handle = h;
+
+    *out = tcb;
+    return 0;
+}
+
+int thread_join(thread_t t, void **ret) {
+    if (!t || t == &_thread_main || t == _thread_tcb()) return -EINVAL;
+    if (t->detach_state == TCB_DETACHED) return -EINVAL;
+
+    int rc = thread_wait(t->handle, FUTEX_WAIT_FOREVER);
+    if (rc != 0) return rc;
+
+    if (ret) *ret = t->ret;
+    thread_free(t);
+    return 0;
+}
+
+int thread_detach(thread_t t) {
+    if (!t || t == &_thread_main) return -EINVAL;
+
+    uint32 state = TCB_JOINABLE;
+    if (__atomic_compare_exchange_n(&t->detach_state, &state, TCB_DETACHED, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    if (state == TCB_DETACHED) return -EINVAL;
+
+    //already exiting as a joinable thread so reclaim it here
+    return thread_join(t, NULL);
+}
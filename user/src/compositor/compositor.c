@@ -2,6 +2,7 @@
 #include "server.h"
 #include "render.h"
 #include "input.h"
+#include "surface.h"
 
 //global compositor state, declared extern in compositor.h
 struct compositor_state comp;
@@ -11,7 +12,13 @@ void send_msg(handle_t ch, comp_msg_t *msg) {
     channel_send(ch, msg, sizeof(comp_msg_t));
 }
 
-int recv_msg(handle_t ch, comp_msg_t *msg, uint32 *sender_pid) {
+void send_reply(handle_t ch, uint32 txid, comp_msg_t *msg) {
+    if (ch == INVALID_HANDLE) return;
+    if (txid) channel_send_reply(ch, txid, msg, sizeof(comp_msg_t));
+    else channel_send(ch, msg, sizeof(comp_msg_t));
+}
+
+int recv_msg(handle_t ch, comp_msg_t *msg, uint32 *sender_pid, uint32 *txid) {
     channel_recv_result_t res;
     int rc = channel_try_recv_msg(ch, msg, sizeof(comp_msg_t), NULL, 0, &res);
     if (rc == 0) {
@@ -19,10 +26,70 @@ int recv_msg(handle_t ch, comp_msg_t *msg, uint32 *sender_pid) {
             return -1;
         }
         if (sender_pid) *sender_pid = res.sender_pid;
+        if (txid) *txid = res.txid;
     }
     return rc;
 }
 
+int recv_msg_batch(handle_t ch, comp_msg_t *msgs, uint32 *sender_pids, int max) {
+    if (max > CHANNEL_BATCH_MAX) max = CHANNEL_BATCH_MAX;
+    channel_batch_msg_t iov[CHANNEL_BATCH_MAX];
+    for (int i = 0; i < max; i++) {
+        iov[i] = (channel_batch_msg_t){ .data = &msgs[i], .len = sizeof(comp_msg_t) };
+    }
+
+    int n = channel_recv_batch(ch, iov, max, CHANNEL_BATCH_NONBLOCK);
+    if (n <= 0) return n;
+
+    //drop malformed messages by compacting the good ones to the front
+    int good = 0;
+    for (int i = 0; i < n; i++) {
+        if (iov[i].actual != sizeof(comp_msg_t)) continue;
+        if (good != i) msgs[good] = msgs[i];
+        if (sender_pids) sender_pids[good] = iov[i].sender_pid;
+        good++;
+    }
+    return good;
+}
+
+//false if the handle didn't fit, the caller then has to poll for it instead
+static bool wait_add(object_wait_item_t *items, uint32 *count, handle_t h, uint32 signals) {
+    if (h == INVALID_HANDLE) return true;
+    if (*count >= OBJECT_WAIT_MANY_MAX) return false;
+    items[*count].handle = h;
+    items[*count].waitfor = signals;
+    items[*count].pending = 0;
+    (*count)++;
+    return true;
+}
+
+//block until a client, the WM or an input device has something for us
+static void wait_for_events(void) {
+    object_wait_item_t items[OBJECT_WAIT_MANY_MAX];
+    uint32 count = 0;
+    bool all = true;
+
+    //client and WM channels also wake on disconnect so server_listen can reap them
+    const uint32 client_signals = OBJECT_SIGNAL_READABLE | OBJECT_SIGNAL_PEER_CLOSED;
+
+    //input first so it is never the part that doesn't fit
+    all &= wait_add(items, &count, comp.server_handle, OBJECT_SIGNAL_READABLE);
+    if (!comp.wm_present) all &= wait_add(items, &count, kbd_handle(), OBJECT_SIGNAL_READABLE);
+    all &= wait_add(items, &count, comp.mouse_h, OBJECT_SIGNAL_READABLE);
+    if (comp.wm_present && find_surface_by_ch(comp.wm_ch) < 0) {
+        all &= wait_add(items, &count, comp.wm_ch, client_signals);
+    }
+    for (int i = 0; i < comp.num_surfaces; i++) {
+        if (comp.surfaces[i].alive) all &= wait_add(items, &count, comp.surfaces[i].ch, client_signals);
+    }
+
+    //the mouse channel is opened lazily so keep polling for it until it shows up
+    //channels that didn't fit in one wait are polled the same way, the main
+    //loop checks every channel after each wakeup
+    uint64 timeout = (comp.mouse_h == INVALID_HANDLE || !all) ? MOUSE_RETRY_NS : OBJECT_WAIT_FOREVER;
+    if (object_wait_many(items, count, timeout) < 0 && timeout == OBJECT_WAIT_FOREVER) yield();
+}
+
 static void fb_setup(void) {
     comp.fb_handle = get_obj(INVALID_HANDLE, "$devices/fb0", RIGHT_READ | RIGHT_WRITE);
     ASSERT(comp.fb_handle == INVALID_HANDLE, "Failed to get framebuffer\n");
@@ -108,8 +175,11 @@ int main(void) {
             render_mouse(comp.backbuffer);
             handle_seek(comp.fb_handle, 0, HANDLE_SEEK_SET);
             handle_write(comp.fb_handle, comp.backbuffer, comp.fb_size);
+            yield();
+        } else {
+            //nothing changed - sleep until one of our channels has a message
+            wait_for_events();
         }
-        yield();
     }
 
     return 0;
@@ -17,6 +17,9 @@
 #define TITLEBAR_H  22
 #define BORDER_W     2
 
+//how often an idle compositor retries opening a mouse channel that was missing
+#define MOUSE_RETRY_NS 100000000ULL
+
 #define DECO_TB_FOCUSED    FB_RGB( 22,  24,  40)
 #define DECO_TB_UNFOCUSED  FB_RGB( 14,  15,  24)
 #define DECO_BD_FOCUSED    FB_RGB( 96, 104, 224)
@@ -138,6 +141,10 @@ struct compositor_state {
 extern struct compositor_state comp;
 
 void send_msg(handle_t ch, comp_msg_t *msg);
-int recv_msg(handle_t ch, comp_msg_t *msg, uint32 *sender_pid);
+//answer a request, routed to the client's channel_call when txid is set
+void send_reply(handle_t ch, uint32 txid, comp_msg_t *msg);
+int recv_msg(handle_t ch, comp_msg_t *msg, uint32 *sender_pid, uint32 *txid);
+//drain up to max queued messages in one call, returns count, -3 if empty
+int recv_msg_batch(handle_t ch, comp_msg_t *msgs, uint32 *sender_pids, int max);
 
 #endif
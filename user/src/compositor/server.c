@@ -18,17 +18,17 @@ static void send_configure(surface_t *s) {
     send_msg(s->ch, &cfg);
 }
 
-static void handle_client_connect(uint32 pid) {
+static void handle_client_connect(uint32 pid, uint32 txid) {
     INFO("Client connected pid=%u\n", pid);
     comp_msg_t ack = { .type = MSG_ACK, .u.ack.ok = true };
-    send_msg(comp.server_handle, &ack);
+    send_reply(comp.server_handle, txid, &ack);
 }
 
-static void handle_create_surface(uint32 pid, uint16 w, uint16 h) {
+static void handle_create_surface(uint32 pid, uint32 txid, uint16 w, uint16 h) {
     if (comp.num_surfaces >= MAX_SURFACES) {
         WARN("Max surfaces reached from pid=%u\n", pid);
         comp_msg_t ack = { .type = MSG_ACK, .u.ack.ok = false };
-        send_msg(comp.server_handle, &ack);
+        send_reply(comp.server_handle, txid, &ack);
         return;
     }
 
@@ -40,7 +40,7 @@ static void handle_create_surface(uint32 pid, uint16 w, uint16 h) {
         if (wm_end != INVALID_HANDLE) handle_close(wm_end);
         if (client_end != INVALID_HANDLE) handle_close(client_end);
         comp_msg_t ack = { .type = MSG_ACK, .u.ack.ok = false };
-        send_msg(comp.server_handle, &ack);
+        send_reply(comp.server_handle, txid, &ack);
         return;
     }
 
@@ -51,7 +51,7 @@ static void handle_create_surface(uint32 pid, uint16 w, uint16 h) {
         handle_close(wm_end);
         handle_close(client_end);
         comp_msg_t ack = { .type = MSG_ACK, .u.ack.ok = false };
-        send_msg(comp.server_handle, &ack);
+        send_reply(comp.server_handle, txid, &ack);
         return;
     }
 
@@ -63,13 +63,13 @@ static void handle_create_surface(uint32 pid, uint16 w, uint16 h) {
         if (idx >= 0) surface_remove_at(idx);
         handle_close(client_end);
         comp_msg_t ack = { .type = MSG_ACK, .u.ack.ok = false };
-        send_msg(comp.server_handle, &ack);
+        send_reply(comp.server_handle, txid, &ack);
         return;
     }
     handle_close(client_end);
 
     comp_msg_t ack = { .type = MSG_ACK, .u.ack = { .ok = true, .id = s.id } };
-    send_msg(comp.server_handle, &ack);
+    send_reply(comp.server_handle, txid, &ack);
     send_configure(&s);
 
     //notify WM about the new surface
@@ -240,19 +240,21 @@ void handle_wm_message(comp_msg_t *msg) {
 void server_listen(void) {
     comp_msg_t msg;
     uint32 pid = 0;
+    uint32 txid = 0;
 
     //read the server channel for new connections surface creation and WM claims
-    int rc = recv_msg(comp.server_handle, &msg, &pid);
+    //clients ask with channel_call so every ack goes back to the one that asked
+    int rc = recv_msg(comp.server_handle, &msg, &pid, &txid);
     //minus 3 means no data nonblocking and not an error
     if (rc == -3) goto check_clients;
     if (rc < 0) { WARN("Server recv error %d\n", rc); goto check_clients; }
 
     switch (msg.type) {
         case MSG_CLIENT_CONNECT:
-            handle_client_connect(pid);
+            handle_client_connect(pid, txid);
             break;
         case MSG_CREATE_SURFACE:
-            handle_create_surface(pid, msg.u.create_surface.w, msg.u.create_surface.h);
+            handle_create_surface(pid, txid, msg.u.create_surface.w, msg.u.create_surface.h);
             break;
         case MSG_DESTROY_SURFACE:
             handle_destroy(msg.u.destroy_surface.id);
@@ -261,7 +263,7 @@ void server_listen(void) {
             if (comp.wm_present) {
                 WARN("CLAIM_WM rejected - WM already present\n");
                 comp_msg_t ack = { .type = MSG_ACK, .u.ack.ok = false };
-                send_msg(comp.server_handle, &ack);
+                send_reply(comp.server_handle, txid, &ack);
                 break;
             }
             {
@@ -276,7 +278,7 @@ void server_listen(void) {
                     if (ns_register(path, client_end, RIGHT_READ | RIGHT_WRITE) != 0) {
                         handle_close(wm_end);
                         handle_close(client_end);
-                        send_msg(comp.server_handle, &ack);
+                        send_reply(comp.server_handle, txid, &ack);
                         break;
                     }
                     handle_close(client_end);
@@ -310,7 +312,7 @@ void server_listen(void) {
                     if (wm_end != INVALID_HANDLE) handle_close(wm_end);
                     if (client_end != INVALID_HANDLE) handle_close(client_end);
                 }
-                send_msg(comp.server_handle, &ack);
+                send_reply(comp.server_handle, txid, &ack);
             }
             break;
         default:
@@ -324,7 +326,7 @@ check_clients:
         surface_t *s = &comp.surfaces[i];
         if (!s->alive || s->ch == INVALID_HANDLE) continue;
 
-        rc = recv_msg(s->ch, &msg, &pid);
+        rc = recv_msg(s->ch, &msg, &pid, NULL);
         if (rc == -3) continue;
         if (rc < 0) {
             WARN("Client pid=%u surface id=%u disconnected (rc=%d)\n", s->owner_pid, s->id, rc);
@@ -343,10 +345,14 @@ check_clients:
     if (comp.wm_present && comp.wm_ch != INVALID_HANDLE) {
         int wm_surf_idx = find_surface_by_ch(comp.wm_ch);
         if (wm_surf_idx < 0) {
-            rc = recv_msg(comp.wm_ch, &msg, &pid);
-            if (rc == 0) {
-                handle_wm_message(&msg);
-            } else if (rc < 0 && rc != -3) {
+            //the WM sends its layout updates in batches so drain them the same way
+            comp_msg_t wm_msgs[CHANNEL_BATCH_MAX];
+            rc = recv_msg_batch(comp.wm_ch, wm_msgs, NULL, CHANNEL_BATCH_MAX);
+            if (rc >= 0) {
+                for (int i = 0; i < rc && comp.wm_ch != INVALID_HANDLE; i++) {
+                    handle_wm_message(&wm_msgs[i]);
+                }
+            } else if (rc != -3) {
                 WARN("WM channel error rc=%d\n", rc);
                 handle_close(comp.wm_ch);
                 comp.wm_present = false;
@@ -167,6 +167,9 @@ int main(void) {
     INFO("WM ready\n");
 
     while (1) {
+        //everything we tell the compositor this round goes out in one batch
+        comp_batch_begin(wm_ch);
+
         //read raw keyboard events and dispatch them
         kbd_event_t kev;
         while (kbd_try_read(&kev) == 0) {
@@ -174,7 +177,20 @@ int main(void) {
             handle_key_event(&kmsg);
         }
         server_listen();
-        yield();
+        comp_batch_end();
+
+        //sleep until the keyboard or the compositor has something for us
+        object_wait_item_t items[2];
+        uint32 count = 0;
+        if (kbd_handle() != INVALID_HANDLE) {
+            items[count++] = (object_wait_item_t){ .handle = kbd_handle(), .waitfor = OBJECT_SIGNAL_READABLE };
+        }
+        if (wm_ch != INVALID_HANDLE) {
+            items[count++] = (object_wait_item_t){ .handle = wm_ch, .waitfor = OBJECT_SIGNAL_READABLE };
+        }
+        if (count == 0 || object_wait_many(items, count, OBJECT_WAIT_FOREVER) < 0) {
+            yield();
+        }
     }
 
     return 0;